@@ -0,0 +1,88 @@
+/**
+ * @file Arena.cpp
+ *
+ * implements Arena class
+ */
+
+#include <string.h>
+#include <CF/Arena.h>
+
+using namespace CF;
+
+Arena::Arena(UInt32 inBlockSize)
+    : fFirst(nullptr),
+      fCurrent(nullptr),
+      fPos(nullptr),
+      fEnd(nullptr),
+      fBlockSize(inBlockSize),
+      fNumBlocks(0) {}
+
+Arena::~Arena() {
+  while (fFirst != nullptr) {
+    Block *theNext = fFirst->fNext;
+    delete[] (char *) fFirst;
+    fFirst = theNext;
+  }
+}
+
+void *Arena::Allocate(UInt32 inLen) {
+  UInt32 theLen = (inLen + kAlignment - 1) & ~((UInt32) kAlignment - 1);
+  if (theLen == 0)
+    theLen = kAlignment;
+
+  if ((UInt32) (fEnd - fPos) < theLen)
+    return this->nextBlock(theLen);
+
+  void *thePtr = fPos;
+  fPos += theLen;
+  return thePtr;
+}
+
+void *Arena::nextBlock(UInt32 inLen) {
+  Block *theNext = fCurrent != nullptr ? fCurrent->fNext : fFirst;
+
+  if (theNext == nullptr || theNext->fSize < inLen) {
+    // kept blocks are all fBlockSize, a larger one is made for inLen alone
+    UInt32 theSize = inLen > fBlockSize ? inLen : fBlockSize;
+    Block *theBlock = (Block *) new char[sizeof(Block) + theSize];
+    theBlock->fSize = theSize;
+    theBlock->fNext = theNext;
+    if (fCurrent != nullptr)
+      fCurrent->fNext = theBlock;
+    else
+      fFirst = theBlock;
+    fNumBlocks++;
+    theNext = theBlock;
+  }
+
+  fCurrent = theNext;
+  char *theData = (char *) (fCurrent + 1);
+  fPos = theData + inLen;
+  fEnd = theData + fCurrent->fSize;
+  return theData;
+}
+
+char *Arena::Copy(const StrPtrLen &inString) {
+  char *theCopy = (char *) this->Allocate(inString.Len + 1);
+  if (inString.Len > 0)
+    ::memcpy(theCopy, inString.Ptr, inString.Len);
+  theCopy[inString.Len] = '\0';
+  return theCopy;
+}
+
+void Arena::Reset() {
+  Block **theLink = &fFirst;
+  while (*theLink != nullptr) {
+    Block *theBlock = *theLink;
+    if (theBlock->fSize > fBlockSize) {
+      *theLink = theBlock->fNext;
+      delete[] (char *) theBlock;
+      fNumBlocks--;
+    } else {
+      theLink = &theBlock->fNext;
+    }
+  }
+
+  fCurrent = nullptr;
+  fPos = fEnd = nullptr;
+}
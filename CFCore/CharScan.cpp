@@ -0,0 +1,491 @@
+/**
+ * @file CharScan.cpp
+ *
+ * implements the CharScan kernels and their dispatch
+ */
+
+#include <string.h>
+#include <CF/CharScan.h>
+
+#if defined(__GNUC__) && (defined(__x86_64__) || (defined(__i386__) && defined(__SSE2__)))
+#define CHARSCAN_X86 1
+#include <immintrin.h>
+#define CHARSCAN_AVX2 __attribute__((target("avx2")))
+#else
+#define CHARSCAN_X86 0
+#endif
+
+#if CHARSCAN_TESTING
+#include <stdlib.h>
+#include <CF/sstdlib.h>
+#include <CF/Core/Time.h>
+#endif
+
+using namespace CF;
+
+//
+// Scalar, also the tail of the vector kernels
+
+static inline bool isWhitespace(char inChar) {
+  // '\t' '\n' '\v' '\f' '\r' and ' '
+  return (UInt8) (inChar - '\t') <= '\r' - '\t' || inChar == ' ';
+}
+
+static inline char toLower(char inChar) {
+  return (inChar >= 'A' && inChar <= 'Z') ? (char) (inChar + ('a' - 'A')) : inChar;
+}
+
+static inline bool isLetter(char inChar) {
+  return toLower(inChar) >= 'a' && toLower(inChar) <= 'z';
+}
+
+static bool equalTail(char const *inStr, char const *inQuery, UInt32 inLen,
+                      bool inIgnoreCase) {
+  if (!inIgnoreCase)
+    return ::memcmp(inStr, inQuery, inLen) == 0;
+  for (UInt32 i = 0; i < inLen; i++)
+    if (toLower(inStr[i]) != toLower(inQuery[i]))
+      return false;
+  return true;
+}
+
+static char *findEOLOrScalar(char *inStart, char *inEnd, char inChar1, char inChar2) {
+  for (; inStart < inEnd; inStart++) {
+    char theChar = *inStart;
+    if (theChar == '\r' || theChar == '\n' || theChar == inChar1 || theChar == inChar2)
+      break;
+  }
+  return inStart;
+}
+
+static char *findWhitespaceOrScalar(char *inStart, char *inEnd, char inChar) {
+  while (inStart < inEnd && !isWhitespace(*inStart) && *inStart != inChar)
+    inStart++;
+  return inStart;
+}
+
+static char *skipWhitespaceScalar(char *inStart, char *inEnd) {
+  while (inStart < inEnd && isWhitespace(*inStart))
+    inStart++;
+  return inStart;
+}
+
+static char *findStringScalar(char *inStart, char *inEnd,
+                              char const *inQuery, UInt32 inQueryLen,
+                              bool inIgnoreCase) {
+  if (inEnd - inStart < (SInt64) inQueryLen)
+    return nullptr;
+  for (char *theLast = inEnd - inQueryLen; inStart <= theLast; inStart++)
+    if (equalTail(inStart, inQuery, inQueryLen, inIgnoreCase))
+      return inStart;
+  return nullptr;
+}
+
+#if CHARSCAN_X86
+
+//
+// SSE2, 16 bytes a step. Part of x86_64, no runtime check needed.
+
+static char *findEOLOrSSE2(char *inStart, char *inEnd, char inChar1, char inChar2) {
+  __m128i const theCR = _mm_set1_epi8('\r');
+  __m128i const theLF = _mm_set1_epi8('\n');
+  __m128i const theChar1 = _mm_set1_epi8(inChar1);
+  __m128i const theChar2 = _mm_set1_epi8(inChar2);
+
+  while (inEnd - inStart >= 16) {
+    __m128i theData = _mm_loadu_si128((__m128i const *) inStart);
+    __m128i theHits = _mm_or_si128(
+        _mm_or_si128(_mm_cmpeq_epi8(theData, theCR), _mm_cmpeq_epi8(theData, theLF)),
+        _mm_or_si128(_mm_cmpeq_epi8(theData, theChar1), _mm_cmpeq_epi8(theData, theChar2)));
+    int theBits = _mm_movemask_epi8(theHits);
+    if (theBits != 0)
+      return inStart + __builtin_ctz(theBits);
+    inStart += 16;
+  }
+  return findEOLOrScalar(inStart, inEnd, inChar1, inChar2);
+}
+
+// 0xFF where the byte is '\t'..'\r' or ' '
+static inline __m128i whitespaceSSE2(__m128i inData) {
+  // inData - '\t' <= 4 unsigned, as a saturating subtract that leaves 0
+  __m128i theRange = _mm_subs_epu8(_mm_sub_epi8(inData, _mm_set1_epi8('\t')),
+                                   _mm_set1_epi8('\r' - '\t'));
+  return _mm_or_si128(_mm_cmpeq_epi8(theRange, _mm_setzero_si128()),
+                      _mm_cmpeq_epi8(inData, _mm_set1_epi8(' ')));
+}
+
+static char *findWhitespaceOrSSE2(char *inStart, char *inEnd, char inChar) {
+  __m128i const theChar = _mm_set1_epi8(inChar);
+
+  while (inEnd - inStart >= 16) {
+    __m128i theData = _mm_loadu_si128((__m128i const *) inStart);
+    __m128i theHits = _mm_or_si128(whitespaceSSE2(theData),
+                                   _mm_cmpeq_epi8(theData, theChar));
+    int theBits = _mm_movemask_epi8(theHits);
+    if (theBits != 0)
+      return inStart + __builtin_ctz(theBits);
+    inStart += 16;
+  }
+  return findWhitespaceOrScalar(inStart, inEnd, inChar);
+}
+
+static char *skipWhitespaceSSE2(char *inStart, char *inEnd) {
+  while (inEnd - inStart >= 16) {
+    __m128i theData = _mm_loadu_si128((__m128i const *) inStart);
+    int theBits = ~_mm_movemask_epi8(whitespaceSSE2(theData)) & 0xFFFF;
+    if (theBits != 0)
+      return inStart + __builtin_ctz(theBits);
+    inStart += 16;
+  }
+  return skipWhitespaceScalar(inStart, inEnd);
+}
+
+/*
+ * Candidates are positions where the first and the last char of the query
+ * both match, 16 at a time; only those are compared in full. Ignoring case,
+ * a letter is compared with 0x20 or'ed in on both sides.
+ */
+static char *findStringSSE2(char *inStart, char *inEnd,
+                            char const *inQuery, UInt32 inQueryLen,
+                            bool inIgnoreCase) {
+  if (inQueryLen == 0)
+    return inStart;
+  if (inEnd - inStart < (SInt64) inQueryLen)
+    return nullptr;
+
+  char theFirst = inQuery[0], theLast = inQuery[inQueryLen - 1];
+  char theFirstFold = (inIgnoreCase && isLetter(theFirst)) ? 0x20 : 0;
+  char theLastFold = (inIgnoreCase && isLetter(theLast)) ? 0x20 : 0;
+  __m128i const theFirstMask = _mm_set1_epi8(theFirstFold);
+  __m128i const theLastMask = _mm_set1_epi8(theLastFold);
+  __m128i const theFirstChar = _mm_set1_epi8((char) (theFirst | theFirstFold));
+  __m128i const theLastChar = _mm_set1_epi8((char) (theLast | theLastFold));
+
+  // the last char of the window is read 16 bytes at a time too
+  while (inEnd - inStart >= (SInt64) inQueryLen - 1 + 16) {
+    __m128i theFirstData = _mm_or_si128(
+        _mm_loadu_si128((__m128i const *) inStart), theFirstMask);
+    __m128i theLastData = _mm_or_si128(
+        _mm_loadu_si128((__m128i const *) (inStart + inQueryLen - 1)), theLastMask);
+    int theBits = _mm_movemask_epi8(
+        _mm_and_si128(_mm_cmpeq_epi8(theFirstData, theFirstChar),
+                      _mm_cmpeq_epi8(theLastData, theLastChar)));
+    while (theBits != 0) {
+      char *theCandidate = inStart + __builtin_ctz(theBits);
+      if (equalTail(theCandidate, inQuery, inQueryLen, inIgnoreCase))
+        return theCandidate;
+      theBits &= theBits - 1;
+    }
+    inStart += 16;
+  }
+  return findStringScalar(inStart, inEnd, inQuery, inQueryLen, inIgnoreCase);
+}
+
+//
+// AVX2, 32 bytes a step, the SSE2 kernels finish the tail. The upper
+// halves are cleared before, or every SSE instruction after pays for them.
+
+CHARSCAN_AVX2
+static char *findEOLOrAVX2(char *inStart, char *inEnd, char inChar1, char inChar2) {
+  __m256i const theCR = _mm256_set1_epi8('\r');
+  __m256i const theLF = _mm256_set1_epi8('\n');
+  __m256i const theChar1 = _mm256_set1_epi8(inChar1);
+  __m256i const theChar2 = _mm256_set1_epi8(inChar2);
+
+  while (inEnd - inStart >= 32) {
+    __m256i theData = _mm256_loadu_si256((__m256i const *) inStart);
+    __m256i theHits = _mm256_or_si256(
+        _mm256_or_si256(_mm256_cmpeq_epi8(theData, theCR),
+                        _mm256_cmpeq_epi8(theData, theLF)),
+        _mm256_or_si256(_mm256_cmpeq_epi8(theData, theChar1),
+                        _mm256_cmpeq_epi8(theData, theChar2)));
+    UInt32 theBits = (UInt32) _mm256_movemask_epi8(theHits);
+    if (theBits != 0)
+      return inStart + __builtin_ctz(theBits);
+    inStart += 32;
+  }
+  _mm256_zeroupper();
+  return findEOLOrSSE2(inStart, inEnd, inChar1, inChar2);
+}
+
+CHARSCAN_AVX2
+static inline __m256i whitespaceAVX2(__m256i inData) {
+  __m256i theRange = _mm256_subs_epu8(_mm256_sub_epi8(inData, _mm256_set1_epi8('\t')),
+                                      _mm256_set1_epi8('\r' - '\t'));
+  return _mm256_or_si256(_mm256_cmpeq_epi8(theRange, _mm256_setzero_si256()),
+                         _mm256_cmpeq_epi8(inData, _mm256_set1_epi8(' ')));
+}
+
+CHARSCAN_AVX2
+static char *findWhitespaceOrAVX2(char *inStart, char *inEnd, char inChar) {
+  __m256i const theChar = _mm256_set1_epi8(inChar);
+
+  while (inEnd - inStart >= 32) {
+    __m256i theData = _mm256_loadu_si256((__m256i const *) inStart);
+    __m256i theHits = _mm256_or_si256(whitespaceAVX2(theData),
+                                      _mm256_cmpeq_epi8(theData, theChar));
+    UInt32 theBits = (UInt32) _mm256_movemask_epi8(theHits);
+    if (theBits != 0)
+      return inStart + __builtin_ctz(theBits);
+    inStart += 32;
+  }
+  _mm256_zeroupper();
+  return findWhitespaceOrSSE2(inStart, inEnd, inChar);
+}
+
+CHARSCAN_AVX2
+static char *skipWhitespaceAVX2(char *inStart, char *inEnd) {
+  while (inEnd - inStart >= 32) {
+    __m256i theData = _mm256_loadu_si256((__m256i const *) inStart);
+    UInt32 theBits = ~(UInt32) _mm256_movemask_epi8(whitespaceAVX2(theData));
+    if (theBits != 0)
+      return inStart + __builtin_ctz(theBits);
+    inStart += 32;
+  }
+  _mm256_zeroupper();
+  return skipWhitespaceSSE2(inStart, inEnd);
+}
+
+CHARSCAN_AVX2
+static char *findStringAVX2(char *inStart, char *inEnd,
+                            char const *inQuery, UInt32 inQueryLen,
+                            bool inIgnoreCase) {
+  if (inQueryLen == 0)
+    return inStart;
+  if (inEnd - inStart < (SInt64) inQueryLen)
+    return nullptr;
+
+  char theFirst = inQuery[0], theLast = inQuery[inQueryLen - 1];
+  char theFirstFold = (inIgnoreCase && isLetter(theFirst)) ? 0x20 : 0;
+  char theLastFold = (inIgnoreCase && isLetter(theLast)) ? 0x20 : 0;
+  __m256i const theFirstMask = _mm256_set1_epi8(theFirstFold);
+  __m256i const theLastMask = _mm256_set1_epi8(theLastFold);
+  __m256i const theFirstChar = _mm256_set1_epi8((char) (theFirst | theFirstFold));
+  __m256i const theLastChar = _mm256_set1_epi8((char) (theLast | theLastFold));
+
+  while (inEnd - inStart >= (SInt64) inQueryLen - 1 + 32) {
+    __m256i theFirstData = _mm256_or_si256(
+        _mm256_loadu_si256((__m256i const *) inStart), theFirstMask);
+    __m256i theLastData = _mm256_or_si256(
+        _mm256_loadu_si256((__m256i const *) (inStart + inQueryLen - 1)), theLastMask);
+    UInt32 theBits = (UInt32) _mm256_movemask_epi8(
+        _mm256_and_si256(_mm256_cmpeq_epi8(theFirstData, theFirstChar),
+                         _mm256_cmpeq_epi8(theLastData, theLastChar)));
+    while (theBits != 0) {
+      char *theCandidate = inStart + __builtin_ctz(theBits);
+      if (equalTail(theCandidate, inQuery, inQueryLen, inIgnoreCase))
+        return theCandidate;
+      theBits &= theBits - 1;
+    }
+    inStart += 32;
+  }
+  _mm256_zeroupper();
+  return findStringSSE2(inStart, inEnd, inQuery, inQueryLen, inIgnoreCase);
+}
+
+#endif // CHARSCAN_X86
+
+//
+// Case folding compare
+
+// 'A'..'Z' to lower case in all 8 bytes, nothing else changes
+static inline UInt64 lowerWord(UInt64 inWord) {
+  UInt64 theHeptets = inWord & 0x7F7F7F7F7F7F7F7FULL;
+  UInt64 theAboveZ = theHeptets + 0x2525252525252525ULL;   // top bit: > 'Z'
+  UInt64 theAtLeastA = theHeptets + 0x3F3F3F3F3F3F3F3FULL; // top bit: >= 'A'
+  UInt64 theUpper = (theAtLeastA ^ theAboveZ) & ~inWord & 0x8080808080808080ULL;
+  return inWord | (theUpper >> 2);
+}
+
+static inline UInt64 loadWord(char const *inStr) {
+  UInt64 theWord;
+  ::memcpy(&theWord, inStr, sizeof(theWord));
+  return theWord;
+}
+
+static inline UInt64 loadHalfWord(char const *inStr) {
+  UInt32 theWord;
+  ::memcpy(&theWord, inStr, sizeof(theWord));
+  return theWord;
+}
+
+#if CHARSCAN_X86
+static inline __m128i lowerSSE2(__m128i inData) {
+  // signed compares, bytes from 0x80 up are below 'A'
+  __m128i theUpper = _mm_and_si128(_mm_cmpgt_epi8(inData, _mm_set1_epi8('A' - 1)),
+                                   _mm_cmplt_epi8(inData, _mm_set1_epi8('Z' + 1)));
+  return _mm_or_si128(inData, _mm_and_si128(theUpper, _mm_set1_epi8(0x20)));
+}
+#endif
+
+bool CharScan::EqualIgnoreCase(char const *inStr1, char const *inStr2, UInt32 inLen) {
+  if (inLen < 4) {
+    for (UInt32 i = 0; i < inLen; i++)
+      if (toLower(inStr1[i]) != toLower(inStr2[i]))
+        return false;
+    return true;
+  }
+
+  if (inLen < 8) {
+    // the first and the last 4 bytes, overlapping
+    UInt64 theWord1 = loadHalfWord(inStr1) | loadHalfWord(inStr1 + inLen - 4) << 32;
+    UInt64 theWord2 = loadHalfWord(inStr2) | loadHalfWord(inStr2 + inLen - 4) << 32;
+    return lowerWord(theWord1) == lowerWord(theWord2);
+  }
+
+  UInt32 theOffset = 0;
+#if CHARSCAN_X86
+  for (; theOffset + 16 <= inLen; theOffset += 16) {
+    __m128i theData1 = lowerSSE2(_mm_loadu_si128((__m128i const *) (inStr1 + theOffset)));
+    __m128i theData2 = lowerSSE2(_mm_loadu_si128((__m128i const *) (inStr2 + theOffset)));
+    if (_mm_movemask_epi8(_mm_cmpeq_epi8(theData1, theData2)) != 0xFFFF)
+      return false;
+  }
+#endif
+  for (; theOffset + 8 <= inLen; theOffset += 8)
+    if (lowerWord(loadWord(inStr1 + theOffset)) != lowerWord(loadWord(inStr2 + theOffset)))
+      return false;
+
+  // the last 8 bytes, overlapping what was compared
+  return theOffset == inLen
+      || lowerWord(loadWord(inStr1 + inLen - 8)) == lowerWord(loadWord(inStr2 + inLen - 8));
+}
+
+CharScan::Kernels const CharScan::sKernelSets[] = {
+    {"scalar", findEOLOrScalar, findWhitespaceOrScalar,
+     skipWhitespaceScalar, findStringScalar},
+#if CHARSCAN_X86
+    {"sse2", findEOLOrSSE2, findWhitespaceOrSSE2,
+     skipWhitespaceSSE2, findStringSSE2},
+    {"avx2", findEOLOrAVX2, findWhitespaceOrAVX2,
+     skipWhitespaceAVX2, findStringAVX2}
+#endif
+};
+
+// scalar until the selector below has run, so static initializers may scan too
+CharScan::Kernels const *CharScan::sKernels = &CharScan::sKernelSets[kScalar];
+
+namespace {
+
+struct KernelSelector {
+  KernelSelector() { CharScan::Select(CharScan::GetBestSupported()); }
+} sKernelSelector;
+
+}
+
+UInt32 CharScan::GetBestSupported() {
+#if CHARSCAN_X86
+  __builtin_cpu_init();  // may run before libgcc's own constructor
+  if (__builtin_cpu_supports("avx2"))
+    return kAVX2;
+  return kSSE2;
+#else
+  return kScalar;
+#endif
+}
+
+bool CharScan::Select(UInt32 inKernel) {
+  if (inKernel > GetBestSupported())
+    return false;
+  sKernels = &sKernelSets[inKernel];
+  return true;
+}
+
+#if CHARSCAN_TESTING
+bool CharScan::Test() {
+  UInt32 theBest = GetBestSupported();
+
+  // every kernel against the scalar one, at every offset and length
+  char theBuffer[200];
+  ::srand(1);
+  for (UInt32 theRound = 0; theRound < 2000; theRound++) {
+    static char const sAlphabet[] = "aZ: \t\r\n?\v/-xX";
+    for (UInt32 i = 0; i < sizeof(theBuffer); i++)
+      theBuffer[i] = (::rand() % 8 == 0) ? sAlphabet[::rand() % (sizeof(sAlphabet) - 1)]
+                                         : (char) ('a' + ::rand() % 4);
+    char *theStart = theBuffer + ::rand() % 40;
+    char *theEnd = theStart + ::rand() % (theBuffer + sizeof(theBuffer) - theStart);
+    char const *theQuery = theBuffer + ::rand() % 100;
+    UInt32 theQueryLen = 1 + ::rand() % 6;
+    bool theIgnoreCase = (theRound & 1) != 0;
+
+    for (UInt32 k = kSSE2; k <= theBest; k++) {
+      Kernels const &theScalar = sKernelSets[kScalar];
+      Kernels const &theKernel = sKernelSets[k];
+      if (theKernel.fFindEOLOr(theStart, theEnd, ':', ' ')
+          != theScalar.fFindEOLOr(theStart, theEnd, ':', ' '))
+        return false;
+      if (theKernel.fFindWhitespaceOr(theStart, theEnd, '?')
+          != theScalar.fFindWhitespaceOr(theStart, theEnd, '?'))
+        return false;
+      if (theKernel.fSkipWhitespace(theStart, theEnd)
+          != theScalar.fSkipWhitespace(theStart, theEnd))
+        return false;
+      if (theKernel.fFindString(theStart, theEnd, theQuery, theQueryLen, theIgnoreCase)
+          != theScalar.fFindString(theStart, theEnd, theQuery, theQueryLen, theIgnoreCase))
+        return false;
+    }
+  }
+
+  // a browser GET, scanned the way HTTPRequestStream and HTTPPacket do
+  static char const sHeader[] =
+      "GET /live/stream.m3u8?token=3f9a2c7e&session=88213 HTTP/1.1\r\n"
+      "Host: media.example.com:8080\r\n"
+      "Connection: keep-alive\r\n"
+      "User-Agent: Mozilla/5.0 (Windows NT 10.0; Win64; x64) AppleWebKit/537.36 "
+      "(KHTML, like Gecko) Chrome/120.0.0.0 Safari/537.36\r\n"
+      "Accept: text/html,application/xhtml+xml,application/xml;q=0.9,"
+      "image/avif,image/webp,*/*;q=0.8\r\n"
+      "Accept-Encoding: gzip, deflate, br\r\n"
+      "Accept-Language: en-US,en;q=0.9,zh-CN;q=0.8,zh;q=0.7\r\n"
+      "Cookie: _ga=GA1.2.1234567890.1700000000; sid=a8f5f167f44f4964e6c998dee827110c; "
+      "theme=dark; consent=1\r\n"
+      "Referer: https://media.example.com/live/index.html\r\n"
+      "\r\n";
+  char *theHeader = const_cast<char *>(sHeader);
+  char *theHeaderEnd = theHeader + sizeof(sHeader) - 1;
+  enum { kIterations = 200000 };
+
+  for (UInt32 k = kScalar; k <= theBest; k++) {
+    Select(k);
+    UInt64 theCount = 0;
+
+    SInt64 theStart = Core::Time::Microseconds();
+    for (UInt32 i = 0; i < kIterations; i++) {
+      for (char *p = theHeader; p < theHeaderEnd;) {
+        p = FindEOLOr(p, theHeaderEnd, ':', ':');
+        theCount += p - theHeader;
+        p++;
+      }
+    }
+    SInt64 theLines = Core::Time::Microseconds() - theStart;
+
+    theStart = Core::Time::Microseconds();
+    for (UInt32 i = 0; i < kIterations; i++) {
+      for (char *p = theHeader; p < theHeaderEnd;) {
+        p = SkipWhitespace(FindEOLOrWhitespace(p, theHeaderEnd), theHeaderEnd);
+        theCount += p - theHeader;
+      }
+    }
+    SInt64 theWords = Core::Time::Microseconds() - theStart;
+
+    theStart = Core::Time::Microseconds();
+    for (UInt32 i = 0; i < kIterations; i++) {
+      char *theFound = FindString(theHeader, theHeaderEnd, "consent=", 8, false);
+      theFound = FindString(theHeader, theHeaderEnd, "REFERER", 7, true);
+      theCount += theFound != nullptr ? theFound - theHeader : 0;
+    }
+    SInt64 theFind = Core::Time::Microseconds() - theStart;
+
+    UInt64 theBytes = (UInt64) kIterations * (theHeaderEnd - theHeader);
+    s_printf("CharScan::Test %s: fields %" _U64BITARG_ " MB/s, words %" _U64BITARG_
+             " MB/s, find %" _U64BITARG_ " MB/s (%" _U64BITARG_ ")\n",
+             GetKernelName(), theBytes / (theLines > 0 ? theLines : 1),
+             theBytes / (theWords > 0 ? theWords : 1),
+             theBytes * 2 / (theFind > 0 ? theFind : 1), theCount);
+  }
+
+  Select(theBest);
+  return true;
+}
+#endif
@@ -152,3 +152,35 @@ void DateBuffer::InexactUpdate() {
     this->Update(0);
   }
 }
+
+char DateCache::sSlots[kNumSlots][DateBuffer::kDateBufferLen + 2];
+std::atomic<UInt32> DateCache::sCurrentSlot(0);
+std::atomic<SInt64> DateCache::sCurrentSecond(0);
+
+char const *DateCache::Get() {
+  char const *theDate = sSlots[sCurrentSlot.load(std::memory_order_acquire)];
+  while (theDate[0] == '\0') {
+    // not updated yet, or another thread is formatting the first date
+    Update();
+    theDate = sSlots[sCurrentSlot.load(std::memory_order_acquire)];
+  }
+  return theDate;
+}
+
+void DateCache::Update() {
+  SInt64 theSecond = (SInt64) ::time(NULL);
+  SInt64 theLastSecond = sCurrentSecond.load(std::memory_order_relaxed);
+  if (theSecond == theLastSecond)
+    return;
+
+  // only one thread formats a given second
+  if (!sCurrentSecond.compare_exchange_strong(theLastSecond, theSecond))
+    return;
+
+  DateBuffer theDate;
+  theDate.Update(theSecond * 1000);
+
+  UInt32 theSlot = (sCurrentSlot.load(std::memory_order_relaxed) + 1) % kNumSlots;
+  ::memcpy(sSlots[theSlot], theDate.GetDateBuffer(), DateBuffer::kDateBufferLen + 1);
+  sCurrentSlot.store(theSlot, std::memory_order_release);
+}
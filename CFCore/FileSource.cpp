@@ -335,8 +335,10 @@ void FileSource::Set(char const *inPath) {
         fModDate = 0;
 #ifdef __Win32__
       fIsDir = buf.st_mode & _S_IFDIR;
+      fIsRegular = (buf.st_mode & _S_IFREG) != 0;
 #else
       fIsDir = S_ISDIR(buf.st_mode);
+      fIsRegular = S_ISREG(buf.st_mode);
 #endif
       this->SetLog(inPath);
     } else
@@ -344,6 +346,17 @@ void FileSource::Set(char const *inPath) {
   }
 }
 
+void FileSource::Set(int inFD, UInt64 inLength, time_t inModDate, bool inIsRegular) {
+  Close();
+
+  fFile = inFD;
+  fShouldClose = false;
+  fLength = inLength;
+  fModDate = inModDate;
+  fIsDir = false;
+  fIsRegular = inIsRegular;
+}
+
 void FileSource::Advise(UInt64, UInt32) {
   // does nothing on platforms other than MacOSXServer
 }
@@ -581,6 +594,7 @@ void FileSource::Close() {
 
   fFile = -1;
   fModDate = 0;
+  fIsRegular = false;
   fLength = 0;
   fPosition = 0;
   fReadPos = 0;
@@ -31,6 +31,7 @@
 
 
 #include <CF/StrPtrLen.h>
+#include <CF/CharScan.h>
 
 using namespace CF;
 
@@ -147,10 +148,6 @@ bool StrPtrLen::NumEqualIgnoreCase(char const *compare, const UInt32 len) const
 }
 
 char *StrPtrLen::FindStringCase(char *queryCharStr, StrPtrLen *resultStr, bool caseSensitive) const {
-  // Be careful about exiting this method from the middle. This routine deletes
-  // allocated memory at the end.
-  //
-
   if (resultStr)
     resultStr->Set(nullptr, 0);
 
@@ -159,49 +156,14 @@ char *StrPtrLen::FindStringCase(char *queryCharStr, StrPtrLen *resultStr, bool c
   if (nullptr == Ptr) return nullptr;
   if (0 == Len) return nullptr;
 
-  StrPtrLen queryStr(queryCharStr);
-  char *editSource = nullptr;
-  char *resultChar = nullptr;
-  char lastSourceChar = Ptr[Len - 1];
-
-  if (lastSourceChar != 0) { // need to modify for termination.
-    editSource = new char[Len + 1]; // Ptr could be a static string so make a copy
-    ::memcpy(editSource, Ptr, Len);
-    editSource[Len] = 0; // this won't work on static strings so we are modifing a new string here
-  }
+  // searched as a C string used to be: a 0 in the source ends it
+  char *sourceEnd = static_cast<char *>(::memchr(Ptr, 0, Len));
+  if (sourceEnd == nullptr)
+    sourceEnd = Ptr + Len;
 
-  char *queryString = queryCharStr;
-  char *dupSourceString = nullptr;
-  char *dupQueryString = nullptr;
-  char *sourceString = Ptr;
-  UInt32 foundLen = 0;
-
-  if (editSource != nullptr) // a copy of the source ptr and len 0 terminated
-    sourceString = editSource;
-
-  if (!caseSensitive) {
-    dupSourceString = ::strdup(sourceString);
-    dupQueryString = ::strdup(queryCharStr);
-    if (dupSourceString && dupQueryString) {
-      sourceString = StrPtrLen(dupSourceString).ToUpper();
-      queryString = StrPtrLen(dupQueryString).ToUpper();
-      resultChar = ::strstr(sourceString, queryString);
-
-      ::free(dupSourceString);
-      ::free(dupQueryString);
-    }
-  } else {
-    resultChar = ::strstr(sourceString, queryString);
-  }
-
-  if (resultChar != nullptr) { // get the start offset
-    foundLen = resultChar - sourceString;
-    resultChar = Ptr + foundLen;  // return a pointer in the source buffer
-    if (resultChar > (Ptr + Len)) // make sure it is in the buffer
-      resultChar = nullptr;
-  }
-
-  delete[] editSource;
+  StrPtrLen queryStr(queryCharStr);
+  char *resultChar = CharScan::FindString(Ptr, sourceEnd, queryStr.Ptr,
+                                          queryStr.Len, !caseSensitive);
 
   if (resultStr != nullptr && resultChar != nullptr)
     resultStr->Set(resultChar, queryStr.Len);
@@ -301,20 +263,13 @@ UInt32 StrPtrLen::TrimTrailingWhitespace() {
 }
 
 void StrPtrLen::PrintStr() {
-  char *thestr = GetAsCString();
-
+  // up to the first character that can't be printed, from Ptr: no copy
   UInt32 i = 0;
-  for (; i < Len; i++) {
-    if (StrPtrLen::sNonPrintChars[(UInt8) Ptr[i]]) {
-      thestr[i] = 0;
-      break;
-    }
-  }
+  while (i < Len && !StrPtrLen::sNonPrintChars[(UInt8) Ptr[i]])
+    i++;
 
-  if (thestr != nullptr) {
-    s_printf(thestr);
-    delete[]thestr;
-  }
+  if (i > 0)
+    s_printf("%.*s", (int) i, Ptr);
 }
 
 void StrPtrLen::PrintStr(char *appendStr) {
@@ -334,69 +289,39 @@ void StrPtrLen::PrintStr(char *prependStr, char *appendStr) {
 }
 
 void StrPtrLen::PrintStrEOL(char *stopStr, char *appendStr) {
+  // the printable part, through stopStr if it is there; printed from Ptr
+  // a line at a time, without a copy
+  UInt32 theLen = 0;
+  while (theLen < Len && !StrPtrLen::sNonPrintChars[(UInt8) Ptr[theLen]])
+    theLen++;
 
-  char *thestr = GetAsCString();
-
-  SInt32 i = 0;
-  for (; i < (SInt32) Len; i++) {
-    if (StrPtrLen::sNonPrintChars[(UInt8) Ptr[i]]) {
-      thestr[i] = 0;
-      break;
-    }
-  }
-
-  for (i = 0; thestr[i] != 0; i++) {
-    if (thestr[i] == '%' && thestr[i + 1] != '%') {
-      thestr[i] = '$';
-    }
-  }
-
-  SInt32 stopLen = 0;
+  UInt32 stopLen = 0;
   if (stopStr != nullptr)
-    stopLen = ::strlen(stopStr);
-
-  if (stopLen > 0 && stopLen <= i) {
-    char *stopPtr = ::strstr(thestr, stopStr);
-    if (stopPtr != nullptr) {
-      stopPtr += stopLen;
-      *stopPtr = 0;
-      i = stopPtr - thestr;
+    stopLen = (UInt32) ::strlen(stopStr);
+
+  if (stopLen > 0 && stopLen <= theLen) {
+    for (UInt32 i = 0; i + stopLen <= theLen; i++) {
+      if (::memcmp(Ptr + i, stopStr, stopLen) == 0) {
+        theLen = i + stopLen;
+        break;
+      }
     }
   }
 
-  char *theStrLine = thestr;
-  char *nextLine = nullptr;
-  char *theChar = nullptr;
-  static char *cr = "\\r";
-  static char *lf = "\\n\n";
-  SInt32 tempLen = i;
-  for (i = 0; i < tempLen; i++) {
-    if (theStrLine[i] == '\r') {
-      theChar = cr;
-      theStrLine[i] = 0;
-      nextLine = &theStrLine[i + 1];
-    } else if (theStrLine[i] == '\n') {
-      theChar = lf;
-      theStrLine[i] = 0;
-      nextLine = &theStrLine[i + 1];
-    }
-
-    if (nextLine != nullptr) {
-      s_printf(theStrLine);
-      s_printf(theChar);
-
-      theStrLine = nextLine;
-      nextLine = nullptr;
-      tempLen -= (i + 1);
-      i = -1;
+  // CR and LF are shown as "\r" and "\n"
+  char *theStrLine = Ptr;
+  for (UInt32 i = 0; i < theLen; i++) {
+    if (Ptr[i] == '\r' || Ptr[i] == '\n') {
+      s_printf("%.*s%s", (int) (Ptr + i - theStrLine), theStrLine,
+               Ptr[i] == '\r' ? "\\r" : "\\n\n");
+      theStrLine = Ptr + i + 1;
     }
   }
-  s_printf(theStrLine);
-  delete[]thestr;
+  if (theStrLine < Ptr + theLen)
+    s_printf("%.*s", (int) (Ptr + theLen - theStrLine), theStrLine);
 
   if (appendStr != nullptr)
     s_printf(appendStr);
-
 }
 
 #if STRPTRLEN_TESTING
@@ -30,6 +30,7 @@
 */
 
 #include <CF/StringParser.h>
+#include <CF/CharScan.h>
 
 using namespace CF;
 
@@ -272,8 +273,8 @@ void StringParser::ConsumeUntil(StrPtrLen *outString, char inStop) {
 
   char *originalStartGet = fStartGet;
 
-  while ((fStartGet < fEndGet) && (*fStartGet != inStop))
-    advanceMark();
+  auto *theStop = static_cast<char *>(::memchr(fStartGet, inStop, fEndGet - fStartGet));
+  this->advanceMarkTo(theStop != nullptr ? theStop : fEndGet);
 
   if (outString != nullptr) {
     outString->Ptr = originalStartGet;
@@ -287,8 +288,19 @@ void StringParser::ConsumeUntil(StrPtrLen *outString, UInt8 *inMask) {
 
   char *originalStartGet = fStartGet;
 
-  while ((fStartGet < fEndGet) && (!inMask[(unsigned char) (*fStartGet)])) //make sure inMask is indexed with an unsigned char
-    advanceMark();
+  // the common masks have vector kernels, they stop before or at an EOL
+  // so the line count can't change, except for whitespace
+  if (inMask == sEOLMask)
+    fStartGet = CharScan::FindEOL(fStartGet, fEndGet);
+  else if (inMask == sEOLWhitespaceMask)
+    fStartGet = CharScan::FindEOLOrWhitespace(fStartGet, fEndGet);
+  else if (inMask == sEOLWhitespaceQueryMask)
+    fStartGet = CharScan::FindEOLWhitespaceOr(fStartGet, fEndGet, '?');
+  else if (inMask == sNonWhitespaceMask)
+    this->advanceMarkTo(CharScan::SkipWhitespace(fStartGet, fEndGet));
+  else
+    while ((fStartGet < fEndGet) && (!inMask[(unsigned char) (*fStartGet)])) //make sure inMask is indexed with an unsigned char
+      advanceMark();
 
   if (outString != nullptr) {
     outString->Ptr = originalStartGet;
@@ -513,6 +525,17 @@ void StringParser::advanceMark() {
   fStartGet++;
 }
 
+void StringParser::advanceMarkTo(char *inStop) {
+  // count the line boundaries in between, as advanceMark would
+  char *theEOL = CharScan::FindEOL(fStartGet, inStop);
+  while (theEOL < inStop) {
+    if (*theEOL == '\n' || theEOL + 1 >= fEndGet || theEOL[1] != '\n')
+      fCurLineNumber++;
+    theEOL = CharScan::FindEOL(theEOL + 1, inStop);
+  }
+  fStartGet = inStop;
+}
+
 #if STRING_PARSER_TESTING
 bool StringParser::Test() {
   static char *string1 = "RTSP 200 OK\r\nContent-Type: MeowMix\r\n\t   \n3450";
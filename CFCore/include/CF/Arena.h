@@ -0,0 +1,67 @@
+/**
+ * @file Arena.h
+ *
+ * Bump allocator for memory that lives as long as one message: Allocate
+ * moves a pointer through a block, and Reset gives everything back at once.
+ * The blocks are kept for the next message, so an arena that is reset and
+ * reused stops allocating once it has seen its largest message. Nothing is
+ * freed one by one, and no destructor is run.
+ */
+
+#ifndef __CF_ARENA_H__
+#define __CF_ARENA_H__
+
+#include <CF/Types.h>
+#include <CF/StrPtrLen.h>
+
+namespace CF {
+
+class Arena {
+ public:
+
+  enum {
+    kDefaultBlockSize = 1024,  // UInt32
+    kAlignment = 8             // UInt32
+  };
+
+  // no memory is taken until the first Allocate
+  explicit Arena(UInt32 inBlockSize = kDefaultBlockSize);
+  ~Arena();
+
+  // inLen bytes, aligned to kAlignment, valid until Reset
+  void *Allocate(UInt32 inLen);
+
+  // a copy of inString, '\0' terminated
+  char *Copy(const StrPtrLen &inString);
+
+  /**
+   * @brief forget everything allocated.
+   *
+   * The blocks of kDefaultBlockSize are kept, a block made for one large
+   * allocation is freed.
+   */
+  void Reset();
+
+  UInt32 GetNumBlocks() { return fNumBlocks; }
+
+ private:
+
+  struct Block {
+    Block *fNext;
+    UInt32 fSize;  // of the data after the Block
+  };
+
+  // the next kept block, or a new one of at least inLen bytes
+  void *nextBlock(UInt32 inLen);
+
+  Block *fFirst;
+  Block *fCurrent;
+  char *fPos;    // in fCurrent
+  char *fEnd;
+  UInt32 fBlockSize;
+  UInt32 fNumBlocks;
+};
+
+}
+
+#endif // __CF_ARENA_H__
@@ -52,6 +52,7 @@ class BufferPool {
 
   //
   // ACCESSORS
+  UInt32 GetBufferSize() { return fBufSize; }
   UInt32 GetTotalNumBuffers() { return fTotNumBuffers; }
   UInt32 GetNumAvailableBuffers() { return fQueue.GetLength(); }
 
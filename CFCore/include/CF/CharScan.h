@@ -0,0 +1,107 @@
+/**
+ * @file CharScan.h
+ *
+ * Vectorized byte scanning for the parsers: find the next EOL, the next
+ * EOL or whitespace, skip whitespace, find a substring. Each has a scalar,
+ * an SSE2 and an AVX2 version; the best one the CPU supports is picked
+ * once at startup, the scalar one is used before that and on other
+ * architectures or compilers.
+ *
+ * Every function looks at [inStart, inEnd) only, never reads past inEnd,
+ * and returns inEnd when nothing was found.
+ */
+
+#ifndef __CF_CHAR_SCAN_H__
+#define __CF_CHAR_SCAN_H__
+
+#include <CF/Types.h>
+
+#define CHARSCAN_TESTING 0
+
+namespace CF {
+
+class CharScan {
+ public:
+
+  enum {
+    kScalar = 0,  // UInt32
+    kSSE2 = 1,    // UInt32
+    kAVX2 = 2     // UInt32
+  };
+
+  // '\r' or '\n'
+  static char *FindEOL(char *inStart, char *inEnd) {
+    return sKernels->fFindEOLOr(inStart, inEnd, '\r', '\r');
+  }
+
+  // '\r', '\n' or one of the two chars (pass inChar twice for one)
+  static char *FindEOLOr(char *inStart, char *inEnd, char inChar1, char inChar2) {
+    return sKernels->fFindEOLOr(inStart, inEnd, inChar1, inChar2);
+  }
+
+  // '\t', '\n', '\v', '\f', '\r' or ' ', what StringParser::sEOLWhitespaceMask stops at
+  static char *FindEOLOrWhitespace(char *inStart, char *inEnd) {
+    return sKernels->fFindWhitespaceOr(inStart, inEnd, ' ');
+  }
+
+  // same, and inChar ('?' for StringParser::sEOLWhitespaceQueryMask)
+  static char *FindEOLWhitespaceOr(char *inStart, char *inEnd, char inChar) {
+    return sKernels->fFindWhitespaceOr(inStart, inEnd, inChar);
+  }
+
+  // first byte that is not whitespace, as in StringParser::sNonWhitespaceMask
+  static char *SkipWhitespace(char *inStart, char *inEnd) {
+    return sKernels->fSkipWhitespace(inStart, inEnd);
+  }
+
+  /**
+   * @brief first occurrence of inQuery in [inStart, inEnd).
+   *
+   * @param inIgnoreCase - ASCII letters match either case
+   * @return the match, or nullptr
+   */
+  static char *FindString(char *inStart, char *inEnd,
+                          char const *inQuery, UInt32 inQueryLen,
+                          bool inIgnoreCase) {
+    return sKernels->fFindString(inStart, inEnd, inQuery, inQueryLen, inIgnoreCase);
+  }
+
+  /**
+   * @brief inLen bytes equal, ASCII letters in either case.
+   *
+   * 16 bytes at a time with SSE2, 8 with a word compare, no per-byte
+   * branches above 4 bytes. Not dispatched, names are too short for AVX2.
+   */
+  static bool EqualIgnoreCase(char const *inStr1, char const *inStr2, UInt32 inLen);
+
+  /**
+   * @brief use a given kernel set, for benchmarks.
+   *
+   * @return false when the CPU or the build does not have it.
+   */
+  static bool Select(UInt32 inKernel);
+  static UInt32 GetBestSupported();
+  static char const *GetKernelName() { return sKernels->fName; }
+
+#if CHARSCAN_TESTING
+  // kernels against the scalar ones, then bytes/sec of each on HTTP headers
+  static bool Test();
+#endif
+
+ private:
+
+  struct Kernels {
+    char const *fName;
+    char *(*fFindEOLOr)(char *, char *, char, char);
+    char *(*fFindWhitespaceOr)(char *, char *, char);
+    char *(*fSkipWhitespace)(char *, char *);
+    char *(*fFindString)(char *, char *, char const *, UInt32, bool);
+  };
+
+  static Kernels const sKernelSets[];
+  static Kernels const *sKernels;
+};
+
+}
+
+#endif // __CF_CHAR_SCAN_H__
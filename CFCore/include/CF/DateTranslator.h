@@ -34,6 +34,7 @@
 #ifndef __CF_DATE_TRANSLATOR_H__
 #define __CF_DATE_TRANSLATOR_H__
 
+#include <atomic>
 #include <CF/Types.h>
 #include <CF/StrPtrLen.h>
 
@@ -107,6 +108,30 @@ class DateBuffer {
   friend class DateTranslator;
 };
 
+// The current date, shared by all threads. Update rewrites it at most once a
+// second (the HTTP service calls it every second); Get reads it without a
+// lock. A string returned by Get stays valid for kNumSlots - 1 seconds:
+// each update writes the next slot, then publishes it.
+class DateCache {
+ public:
+
+  // returns a NULL terminated C-string always of DateBuffer::kDateBufferLen length.
+  static char const *Get();
+
+  // formats the date if the second has changed. Thread safe.
+  static void Update();
+
+ private:
+
+  enum {
+    kNumSlots = 4 // UInt32
+  };
+
+  static char sSlots[kNumSlots][DateBuffer::kDateBufferLen + 2];
+  static std::atomic<UInt32> sCurrentSlot;
+  static std::atomic<SInt64> sCurrentSecond;
+};
+
 } // namespace CF
 
 #endif
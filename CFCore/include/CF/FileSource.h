@@ -189,6 +189,7 @@ class FileSource {
         fReadPos(0),
         fShouldClose(true),
         fIsDir(false),
+        fIsRegular(false),
         fModDate(0),
         fCacheEnabled(false) {
 
@@ -207,6 +208,7 @@ class FileSource {
         fReadPos(0),
         fShouldClose(true),
         fIsDir(false),
+        fIsRegular(false),
         fCacheEnabled(false) {
     Set(inPath);
 
@@ -226,6 +228,10 @@ class FileSource {
   //Sets this object to reference this file
   void Set(char const *inPath);
 
+  //Sets this object to reference an fd opened and stat'ed elsewhere, which
+  //stays open when this object is closed
+  void Set(int inFD, UInt64 inLength, time_t inModDate, bool inIsRegular);
+
   // Call this if you don't want Close or the destructor to close the fd
   void DontCloseFD() { fShouldClose = false; }
 
@@ -287,6 +293,8 @@ class FileSource {
   void Seek(SInt64 newPosition) { fPosition = newPosition; }
   bool IsValid() const { return fFile != -1; }
   bool IsDir() const { return fIsDir; }
+  // false for pipes, fifos and devices, which can't be seeked or sendfile'd
+  bool IsRegular() const { return fIsRegular; }
 
   // For async I/O purposes
   int GetFD() const { return fFile; }
@@ -304,6 +312,7 @@ class FileSource {
   UInt64 fReadPos;
   bool fShouldClose;
   bool fIsDir;
+  bool fIsRegular;
   time_t fModDate;
 
   Core::Mutex fMutex;
@@ -148,6 +148,8 @@ class StringParser {
  private:
 
   void advanceMark();
+  // to inStop, which is at most fEndGet
+  void advanceMarkTo(char *inStop);
 
   //built in masks for some common stop conditions
   static UInt8 sNonWordMask[];
@@ -0,0 +1,78 @@
+/**
+ * @file HTTPDeferred.cpp
+ *
+ * implements HTTPDeferred class
+ */
+
+#include <CF/Net/Http/HTTPDeferred.h>
+
+using namespace CF::Net;
+
+HTTPDeferred::HTTPDeferred()
+    : fMutex(),
+      fResponse(new HTTPPacket(httpResponseType)),
+      fTask(nullptr),
+      fResult(CF_NoErr),
+      fRefCount(2),
+      fComplete(false),
+      fCancelled(false) {}
+
+HTTPDeferred::~HTTPDeferred() {
+  delete fResponse;
+}
+
+bool HTTPDeferred::release() {
+  Assert(fRefCount > 0);
+  return --fRefCount == 0;
+}
+
+void HTTPDeferred::Complete(CF_Error inResult) {
+  fMutex.Lock();
+  Assert(!fComplete);
+  fResult = inResult;
+  fComplete = true;
+  // under fMutex: Detach can't let the task go in between
+  if (fTask != nullptr)
+    fTask->Signal(Thread::Task::kUpdateEvent);
+  bool isLast = this->release();
+  fMutex.Unlock();
+
+  if (isLast)
+    delete this;
+}
+
+bool HTTPDeferred::IsCancelled() {
+  Core::MutexLocker theLocker(&fMutex);
+  return fCancelled;
+}
+
+bool HTTPDeferred::Park(Thread::Task *inTask) {
+  Core::MutexLocker theLocker(&fMutex);
+  if (fComplete)
+    return false;
+  fTask = inTask;
+  return true;
+}
+
+bool HTTPDeferred::IsComplete() {
+  Core::MutexLocker theLocker(&fMutex);
+  return fComplete;
+}
+
+HTTPPacket *HTTPDeferred::TakeResponse() {
+  Assert(this->IsComplete());
+  HTTPPacket *theResponse = fResponse;
+  fResponse = nullptr;
+  return theResponse;
+}
+
+void HTTPDeferred::Detach() {
+  fMutex.Lock();
+  fTask = nullptr;
+  fCancelled = true;
+  bool isLast = this->release();
+  fMutex.Unlock();
+
+  if (isLast)
+    delete this;
+}
@@ -2,83 +2,503 @@
 // Created by james on 8/26/17.
 //
 
+#include <string.h>
 #include <CF/Net/Http/HTTPDispatcher.h>
+#include <CF/Net/Http/HTTPResponseCache.h>
+
+#if HTTPDISPATCHER_TESTING
+#include <stdio.h>
+#include <CF/Core/Time.h>
+#endif
 
 namespace CF {
 namespace Net {
 
-StrPtrLen HTTPPathMapper::sAllSuffix("/*", 2);
-StrPtrLen HTTPPathMapper::sTypePrefix("*.", 2);
-StrPtrLen HTTPPathMapper::sRootPath("/", 1);
+StrPtrLen HTTPDispatcher::sAllSuffix("/*", 2);
+StrPtrLen HTTPDispatcher::sTypePrefix("*.", 2);
+StrPtrLen HTTPDispatcher::sRootPath("/", 1);
 
-int cmp_mapper(const void *a, const void *b) {
-  return HTTPPathMapper::ComparePriority(*(HTTPPathMapper **) a,
-                                         *(HTTPPathMapper **) b);
-}
+/**
+ * An edge of the tree and the node below it. Static children are found by
+ * their first byte, a parameter child matches one whole segment.
+ */
+struct HTTPDispatcher::Node {
+  Node(char const *inLabel, UInt32 inLen)
+      : fLabel(new char[inLen + 1]), fLabelLen(inLen),
+        fFirstBytes(nullptr), fChildren(nullptr),
+        fNumChildren(0), fMaxChildren(0),
+        fParamChild(nullptr), fExact(nullptr), fWildcard(nullptr) {
+    ::memcpy(fLabel, inLabel, inLen);
+    fLabel[inLen] = '\0';
+  }
 
-HTTPDispatcher::HTTPDispatcher(HTTPMapping *mapping) {
-  int count;
-  for (count = 0; true; count++) {
-    if (mapping[count].path == nullptr || mapping[count].func == nullptr) break;
+  ~Node() {
+    for (UInt32 i = 0; i < fNumChildren; i++)
+      delete fChildren[i];
+    delete fParamChild;
+    delete[] fChildren;
+    delete[] fFirstBytes;
+    delete[] fLabel;
   }
 
-  fMappers = new HTTPPathMapper *[count];
-  Assert(fMappers != nullptr);
+  Node *getChild(char inFirst) {
+    if (fNumChildren == 0)
+      return nullptr;
+    char *theFound = (char *) ::memchr(fFirstBytes, inFirst, fNumChildren);
+    return theFound != nullptr ? fChildren[theFound - fFirstBytes] : nullptr;
+  }
 
-  UInt32 index = 0;
-  for (int i = 0; i < count; i++) {
-    HTTPPathMapper *mapper = HTTPPathMapper::BuildPathMatcher(mapping[i]);
-    if (mapper != nullptr)
-      fMappers[index++] = mapper;
-    else
-      s_printf("error: construct path matcher failed, path: %s",
-               mapping->path);
+  void setChild(Node *inChild) {
+    char *theFound = fNumChildren > 0
+                     ? (char *) ::memchr(fFirstBytes, inChild->fLabel[0], fNumChildren)
+                     : nullptr;
+    if (theFound != nullptr) {
+      fChildren[theFound - fFirstBytes] = inChild;
+      return;
+    }
+
+    if (fNumChildren == fMaxChildren) {
+      fMaxChildren = fMaxChildren == 0 ? 2 : fMaxChildren * 2;
+      char *theFirstBytes = new char[fMaxChildren];
+      Node **theChildren = new Node *[fMaxChildren];
+      if (fNumChildren > 0) {
+        ::memcpy(theFirstBytes, fFirstBytes, fNumChildren);
+        ::memcpy(theChildren, fChildren, fNumChildren * sizeof(Node *));
+      }
+      delete[] fFirstBytes;
+      delete[] fChildren;
+      fFirstBytes = theFirstBytes;
+      fChildren = theChildren;
+    }
+    fFirstBytes[fNumChildren] = inChild->fLabel[0];
+    fChildren[fNumChildren++] = inChild;
   }
-  fMapperNum = index;
 
-  // sort
-  qsort(fMappers, fMapperNum, sizeof(HTTPPathMapper *), cmp_mapper);
-}
+  char *fLabel;          // a parameter node keeps its name here
+  UInt32 fLabelLen;
 
-CF_Error HTTPDispatcher::Dispatch(HTTPPacket &request, HTTPPacket &response) {
+  char *fFirstBytes;     // fLabel[0] of each child, for memchr
+  Node **fChildren;
+  UInt32 fNumChildren;
+  UInt32 fMaxChildren;
 
-  StrPtrLen *requestPath = request.GetRequestRelativeURI();
+  Node *fParamChild;
+
+  HTTPMapping *fExact;     // the path ends here
+  HTTPMapping *fWildcard;  // the path starts with this
+};
+
+// plain data, so that a Search costs nothing to set up
+struct HTTPDispatcher::Search {
+  struct Capture {
+    Node *fParam;
+    char *fValue;
+    UInt32 fLen;
+  };
 
-  for (UInt32 i = 0; i < fMapperNum; i++) {
-    if (fMappers[i]->Match(*requestPath))
-      return fMappers[i]->Mapping(request, response);
+  char *fStart;
+
+  HTTPMapping *fExact;
+
+  // the longest wildcard seen, and the parameters on the way to it
+  HTTPMapping *fWildcard;
+  UInt32 fWildcardLen;
+  UInt32 fNumWildcardParams;
+  Capture fWildcardParams[HTTPPacket::kMaxPathParams];
+
+  // the parameters on the current path
+  UInt32 fNumParams;
+  Capture fParams[HTTPPacket::kMaxPathParams];
+
+  void copyTo(Capture *inParams, UInt32 inNumParams, HTTPPacket *outPacket) {
+    for (UInt32 i = 0; i < inNumParams; i++) {
+      StrPtrLen theName(inParams[i].fParam->fLabel, inParams[i].fParam->fLabelLen);
+      StrPtrLen theValue(inParams[i].fValue, inParams[i].fLen);
+      outPacket->AddPathParam(theName, theValue);
+    }
   }
+};
+
+HTTPDispatcher::HTTPDispatcher(HTTPMapping *mapping)
+    : fRoot(new Node("", 0)),
+      fSuffixRoot(new Node("", 0)),
+      fDefault(nullptr),
+      fMappings(nullptr),
+      fNumRoutes(0) {
+  UInt32 count;
+  for (count = 0; mapping[count].path != nullptr && mapping[count].func != nullptr; count++) {}
 
-  return CF_FileNotFound;
+  // the tree points at our copy, the caller's table may go away
+  fMappings = new HTTPMapping[count > 0 ? count : 1];
+  for (UInt32 i = 0; i < count; i++) {
+    fMappings[i] = mapping[i];
+    if (this->addRoute(fMappings[i]))
+      fNumRoutes++;
+    else
+      s_printf("error: construct path matcher failed, path: %s\n",
+               mapping[i].path);
+  }
 }
 
-HTTPPathMapper *HTTPPathMapper::BuildPathMatcher(HTTPMapping &mapping) {
-  size_t len = strlen(mapping.path);
+HTTPDispatcher::~HTTPDispatcher() {
+  delete fRoot;
+  delete fSuffixRoot;
+  delete[] fMappings;
+}
+
+bool HTTPDispatcher::addRoute(HTTPMapping &mapping) {
+  UInt32 len = (UInt32) ::strlen(mapping.path);
+  bool isWildcard = false;
+  Node *theNode = nullptr;
 
   if (len >= 2) {
     StrPtrLen lastTwoLetter(mapping.path + (len - 2), 2);
+    StrPtrLen firstTwoLetter(mapping.path, 2);
     if (sAllSuffix.Equal(lastTwoLetter)) { // 以 /* 结尾，wildcard
-      return new WildcardPathMapper(mapping);
+      len -= 2;
+      isWildcard = true;
+    } else if (sTypePrefix.Equal(firstTwoLetter)) { // 以 *. 开头，extension
+      // 反转后放入后缀树: "*.m3u8" -> "8u3m."
+      UInt32 theLen = len - 1;
+      char *theReversed = new char[theLen];
+      for (UInt32 i = 0; i < theLen; i++)
+        theReversed[i] = mapping.path[len - 1 - i];
+      theNode = insert(fSuffixRoot, theReversed, theLen);
+      delete[] theReversed;
+      if (theNode->fExact != nullptr)
+        return false;
+      theNode->fExact = &mapping;
+      return true;
     }
+  }
 
-    StrPtrLen firstTwoLetter(mapping.path, 2);
-    if (sTypePrefix.Equal(firstTwoLetter)) { // 以 *. 开头，extension
-      return new ExtensionPathMapper(mapping);
+  if (sRootPath.Equal(mapping.path)) { // 只有 /，default
+    if (fDefault != nullptr)
+      return false;
+    fDefault = &mapping;
+    return true;
+  }
+
+  // 其它，exact; ':' 开头的段是参数
+  theNode = fRoot;
+  char const *theKey = mapping.path;
+  char const *theEnd = mapping.path + len;
+  while (theKey < theEnd) {
+    char const *theStatic = theKey;
+    while (theKey < theEnd
+        && !(theKey[0] == ':' && theKey > mapping.path && theKey[-1] == '/'))
+      theKey++;
+    if (theKey > theStatic)
+      theNode = insert(theNode, theStatic, (UInt32) (theKey - theStatic));
+    if (theKey == theEnd)
+      break;
+
+    char const *theName = ++theKey;
+    while (theKey < theEnd && *theKey != '/')
+      theKey++;
+    if (theKey == theName)
+      return false;
+    theNode = insertParam(theNode, theName, (UInt32) (theKey - theName));
+    if (theNode == nullptr)
+      return false;
+  }
+
+  HTTPMapping **theSlot = isWildcard ? &theNode->fWildcard : &theNode->fExact;
+  if (*theSlot != nullptr)
+    return false;
+  *theSlot = &mapping;
+  return true;
+}
+
+HTTPDispatcher::Node *HTTPDispatcher::insert(Node *inNode, char const *inKey, UInt32 inLen) {
+  while (inLen > 0) {
+    Node *theChild = inNode->getChild(inKey[0]);
+    if (theChild == nullptr) {
+      theChild = new Node(inKey, inLen);
+      inNode->setChild(theChild);
+      return theChild;
+    }
+
+    UInt32 theCommon = 1;
+    while (theCommon < inLen && theCommon < theChild->fLabelLen
+        && inKey[theCommon] == theChild->fLabel[theCommon])
+      theCommon++;
+
+    if (theCommon < theChild->fLabelLen) {
+      // 分裂: the common part above, the rest of the old edge below
+      Node *theSplit = new Node(theChild->fLabel, theCommon);
+      Node *theRest = new Node(theChild->fLabel + theCommon, theChild->fLabelLen - theCommon);
+      theRest->fFirstBytes = theChild->fFirstBytes;
+      theRest->fChildren = theChild->fChildren;
+      theRest->fNumChildren = theChild->fNumChildren;
+      theRest->fMaxChildren = theChild->fMaxChildren;
+      theRest->fParamChild = theChild->fParamChild;
+      theRest->fExact = theChild->fExact;
+      theRest->fWildcard = theChild->fWildcard;
+      theChild->fFirstBytes = nullptr;
+      theChild->fChildren = nullptr;
+      theChild->fNumChildren = theChild->fMaxChildren = 0;
+      theChild->fParamChild = nullptr;
+      delete theChild;
+
+      theSplit->setChild(theRest);
+      inNode->setChild(theSplit);
+      theChild = theSplit;
     }
+
+    inNode = theChild;
+    inKey += theCommon;
+    inLen -= theCommon;
   }
+  return inNode;
+}
 
-  if (sRootPath.Equal(mapping.path)) { // 只有 /，default
-    return new DefaultPathMapper(mapping);
+HTTPDispatcher::Node *HTTPDispatcher::insertParam(Node *inNode, char const *inName, UInt32 inLen) {
+  Node *theParam = inNode->fParamChild;
+  if (theParam == nullptr) {
+    theParam = inNode->fParamChild = new Node(inName, inLen);
+    return theParam;
+  }
+  // "/a/:id" and "/a/:name/b" would give one segment two names
+  if (theParam->fLabelLen != inLen || ::memcmp(theParam->fLabel, inName, inLen) != 0)
+    return nullptr;
+  return theParam;
+}
+
+bool HTTPDispatcher::find(Node *inNode, char *inPath, UInt32 inRemaining, Search *ioSearch) {
+  if (inNode->fWildcard != nullptr) {
+    UInt32 theLen = (UInt32) (inPath - ioSearch->fStart);
+    if (ioSearch->fWildcard == nullptr || theLen > ioSearch->fWildcardLen) {
+      ioSearch->fWildcard = inNode->fWildcard;
+      ioSearch->fWildcardLen = theLen;
+      ioSearch->fNumWildcardParams = ioSearch->fNumParams;
+      for (UInt32 i = 0; i < ioSearch->fNumParams; i++)
+        ioSearch->fWildcardParams[i] = ioSearch->fParams[i];
+    }
+  }
+
+  if (inRemaining == 0) {
+    if (inNode->fExact == nullptr)
+      return false;
+    ioSearch->fExact = inNode->fExact;
+    return true;
+  }
+
+  // static before parameter: "/users/me" wins over "/users/:id"
+  Node *theChild = inNode->getChild(inPath[0]);
+  if (theChild != nullptr && theChild->fLabelLen <= inRemaining
+      && ::memcmp(theChild->fLabel, inPath, theChild->fLabelLen) == 0
+      && find(theChild, inPath + theChild->fLabelLen,
+              inRemaining - theChild->fLabelLen, ioSearch))
+    return true;
+
+  Node *theParam = inNode->fParamChild;
+  if (theParam == nullptr || inPath[0] == '/')
+    return false;
+
+  char *theEnd = (char *) ::memchr(inPath, '/', inRemaining);
+  UInt32 theLen = theEnd != nullptr ? (UInt32) (theEnd - inPath) : inRemaining;
+
+  UInt32 theIndex = ioSearch->fNumParams;
+  if (theIndex < HTTPPacket::kMaxPathParams) {
+    ioSearch->fParams[theIndex].fParam = theParam;
+    ioSearch->fParams[theIndex].fValue = inPath;
+    ioSearch->fParams[theIndex].fLen = theLen;
+    ioSearch->fNumParams++;
   }
+  if (find(theParam, inPath + theLen, inRemaining - theLen, ioSearch))
+    return true;
+  ioSearch->fNumParams = theIndex;
+  return false;
+}
+
+HTTPMapping *HTTPDispatcher::findExtension(const StrPtrLen &inPath) {
+  // 从后往前走后缀树，最长的后缀优先
+  HTTPMapping *theFound = nullptr;
+  Node *theNode = fSuffixRoot;
+  char *theStart = inPath.Ptr;
+  char *thePos = inPath.Ptr + inPath.Len;
+
+  while (thePos > theStart) {
+    Node *theChild = theNode->getChild(thePos[-1]);
+    if (theChild == nullptr || theChild->fLabelLen > (UInt32) (thePos - theStart))
+      break;
+    UInt32 i = 1;
+    while (i < theChild->fLabelLen && theChild->fLabel[i] == thePos[-1 - (SInt32) i])
+      i++;
+    if (i < theChild->fLabelLen)
+      break;
+    thePos -= theChild->fLabelLen;
+    theNode = theChild;
+    if (theNode->fExact != nullptr)
+      theFound = theNode->fExact;
+  }
+  return theFound;
+}
 
-  // 其它，exact
-  return new ExactPathMapper(mapping);
+CF_CGIFunction HTTPDispatcher::Route(const StrPtrLen &inPath, HTTPPacket *outParams) {
+  HTTPMapping *theMapping = this->Find(inPath, outParams);
+  return theMapping != nullptr ? theMapping->func : nullptr;
 }
 
-int HTTPPathMapper::ComparePriority(HTTPPathMapper *aMapper,
-                                    HTTPPathMapper *bMapper) {
-  return aMapper->ItsType() - bMapper->ItsType();
+HTTPMapping *HTTPDispatcher::Find(const StrPtrLen &inPath, HTTPPacket *outParams) {
+  if (outParams != nullptr)
+    outParams->ClearPathParams();
+
+  Search theSearch;
+  theSearch.fStart = inPath.Ptr;
+  theSearch.fExact = nullptr;
+  theSearch.fWildcard = nullptr;
+  theSearch.fWildcardLen = 0;
+  theSearch.fNumWildcardParams = 0;
+  theSearch.fNumParams = 0;
+
+  if (find(fRoot, inPath.Ptr, inPath.Len, &theSearch)) {
+    if (outParams != nullptr)
+      theSearch.copyTo(theSearch.fParams, theSearch.fNumParams, outParams);
+    return theSearch.fExact;
+  }
+
+  if (theSearch.fWildcard != nullptr) {
+    if (outParams != nullptr)
+      theSearch.copyTo(theSearch.fWildcardParams, theSearch.fNumWildcardParams, outParams);
+    return theSearch.fWildcard;
+  }
+
+  HTTPMapping *theMapping = this->findExtension(inPath);
+  return theMapping != nullptr ? theMapping : fDefault;
+}
+
+CF_Error HTTPDispatcher::Dispatch(HTTPPacket &request, HTTPPacket &response,
+                                  Thread::Task *inTask) {
+  StrPtrLen *requestPath = request.GetRequestRelativeURI();
+
+  HTTPMapping *theMapping = this->Find(*requestPath, &request);
+  if (theMapping == nullptr || theMapping->func == nullptr)
+    return CF_FileNotFound;
+
+  // opt-in response cache, the function runs on a miss only
+  HTTPCachePolicy *thePolicy = theMapping->cache;
+  if (thePolicy != nullptr) {
+    CF_Error theErr = HTTPResponseCache::Lookup(thePolicy, request, response, inTask);
+    if (theErr != CF_ValueNotFound)
+      return theErr;
+  }
+
+  CF_Error theErr = theMapping->func(request, response);
+  if (theErr == CF_WouldBlock) {
+    // deferred: stored by Finish, the waiters wait until then
+    if (response.GetDeferred() != nullptr)
+      return theErr;
+    // nothing would ever wake the session, answer 500 now
+    theErr = CF_RequestFailed;
+  }
+
+  if (thePolicy != nullptr)
+    HTTPResponseCache::Store(thePolicy, request, response, theErr, inTask);
+  return theErr;
+}
+
+void HTTPDispatcher::Finish(HTTPPacket &request, HTTPPacket &response,
+                            CF_Error inResult, Thread::Task *inTask) {
+  HTTPMapping *theMapping = this->Find(*request.GetRequestRelativeURI(), nullptr);
+  if (theMapping != nullptr && theMapping->cache != nullptr)
+    HTTPResponseCache::Store(theMapping->cache, request, response, inResult, inTask);
+}
+
+void HTTPDispatcher::Cancel(Thread::Task *inTask) {
+  HTTPResponseCache::Cancel(inTask);
+}
+
+#if HTTPDISPATCHER_TESTING
+
+static CF_Error testHandler(HTTPPacket &, HTTPPacket &) { return CF_NoErr; }
+
+bool HTTPDispatcher::Test() {
+  // precedence and parameters; the handlers are told apart by address
+  static CF_CGIFunction const sFuncs[] = {
+      (CF_CGIFunction) 1, (CF_CGIFunction) 2, (CF_CGIFunction) 3,
+      (CF_CGIFunction) 4, (CF_CGIFunction) 5, (CF_CGIFunction) 6,
+      (CF_CGIFunction) 7, (CF_CGIFunction) 8, (CF_CGIFunction) 9};
+  HTTPMapping theMapping[] = {
+      {(char *) "/live/list", sFuncs[0]},
+      {(char *) "/live/*", sFuncs[1]},
+      {(char *) "/live/hls/*", sFuncs[2]},
+      {(char *) "*.m3u8", sFuncs[3]},
+      {(char *) "*.index.m3u8", sFuncs[4]},
+      {(char *) "/users/:id", sFuncs[5]},
+      {(char *) "/users/me", sFuncs[6]},
+      {(char *) "/users/:id/posts/:post", sFuncs[7]},
+      {(char *) "/", sFuncs[8]},
+      {nullptr, nullptr}};
+  HTTPDispatcher theDispatcher(theMapping);
+  HTTPPacket theParams(httpRequestType);
+
+  struct {
+    char const *fPath;
+    UInt32 fFunc;
+  } const sCases[] = {
+      {"/live/list", 0}, {"/live/list2", 1}, {"/livestream", 1}, {"/live/hls/a", 2},
+      {"/vod/a.m3u8", 3}, {"/vod/a.index.m3u8", 4}, {"/live/a.m3u8", 1},
+      {"/users/42", 5}, {"/users/me", 6}, {"/users/me/posts/7", 7},
+      {"/users/", 8}, {"/users/42/x", 8}, {"", 8}, {"/", 8}};
+  for (auto const &theCase : sCases) {
+    StrPtrLen thePath((char *) theCase.fPath);
+    if (theDispatcher.Route(thePath, &theParams) != sFuncs[theCase.fFunc])
+      return false;
+  }
+  StrPtrLen thePath((char *) "/users/me/posts/7");
+  theDispatcher.Route(thePath, &theParams);
+  if (theParams.GetNumPathParams() != 2
+      || !theParams.GetPathParam("id")->Equal("me")
+      || !theParams.GetPathParam("post")->Equal("7"))
+    return false;
+
+  // lookup time, against trying every route in turn as the mappers did
+  for (UInt32 theNumRoutes : {10, 1000, 10000}) {
+    char (*thePaths)[64] = new char[theNumRoutes][64];
+    HTTPMapping *theRoutes = new HTTPMapping[theNumRoutes + 1];
+    for (UInt32 i = 0; i < theNumRoutes; i++) {
+      ::snprintf(thePaths[i], 64, "/api/v%u/resource%u/items", i % 3, i);
+      theRoutes[i].path = thePaths[i];
+      theRoutes[i].func = testHandler;
+    }
+    theRoutes[theNumRoutes].path = nullptr;
+    theRoutes[theNumRoutes].func = nullptr;
+    HTTPDispatcher theRouter(theRoutes);
+
+    enum { kLookups = 200000 };
+    UInt64 theHits = 0;
+    SInt64 theStart = Core::Time::Microseconds();
+    for (UInt32 i = 0; i < kLookups; i++) {
+      StrPtrLen theRequest(thePaths[(i * 7919) % theNumRoutes]);
+      theHits += theRouter.Route(theRequest, &theParams) != nullptr;
+    }
+    SInt64 theTree = Core::Time::Microseconds() - theStart;
+
+    theStart = Core::Time::Microseconds();
+    for (UInt32 i = 0; i < kLookups; i++) {
+      StrPtrLen theRequest(thePaths[(i * 7919) % theNumRoutes]);
+      for (UInt32 j = 0; j < theNumRoutes; j++) {
+        if (theRequest.Equal(theRoutes[j].path)) {
+          theHits++;
+          break;
+        }
+      }
+    }
+    SInt64 theLinear = Core::Time::Microseconds() - theStart;
+
+    s_printf("HTTPDispatcher::Test %u routes: tree %" _U64BITARG_ " ns, linear %"
+             _U64BITARG_ " ns per lookup (%" _U64BITARG_ ")\n", theNumRoutes,
+             (UInt64) theTree * 1000 / kLookups, (UInt64) theLinear * 1000 / kLookups,
+             theHits);
+
+    delete[] theRoutes;
+    delete[] thePaths;
+  }
+  return true;
 }
+#endif
 
 } // namespace Net
 } // namespace CF
@@ -0,0 +1,166 @@
+/**
+ * @file HTTPFileBody.cpp
+ *
+ * implements HTTPFileBody class
+ */
+
+#include <CF/Net/Http/HTTPFileBody.h>
+
+#if !__Win32__
+
+#include <unistd.h>
+#include <fcntl.h>
+
+#endif
+
+using namespace CF::Net;
+
+HTTPFileBody::HTTPFileBody(FileSource *inSource,
+                           UInt64 inOffset,
+                           UInt64 inLength)
+    : fSource(inSource),
+      fOffset(inOffset),
+      fLength(inLength),
+      fSent(0),
+      fUseCopy(false),
+      fPipeBytes(0),
+      fCopyBuffer(nullptr),
+      fCopyBufferLen(0),
+      fCopyBufferPos(0) {
+  fPipe[0] = fPipe[1] = -1;
+
+#if !__Win32__
+  // a pipe or socket without data must not stall the task thread
+  if (this->IsValid() && !fSource->IsRegular()) {
+    int theFlags = ::fcntl(fSource->GetFD(), F_GETFL, 0);
+    if (theFlags != -1 && (theFlags & O_NONBLOCK) == 0)
+      (void) ::fcntl(fSource->GetFD(), F_SETFL, theFlags | O_NONBLOCK);
+  }
+#endif
+}
+
+HTTPFileBody::HTTPFileBody(char const *inPath)
+    : HTTPFileBody(new FileSource(inPath), 0, 0) {
+  fLength = fSource->GetLength();
+}
+
+HTTPFileBody::~HTTPFileBody() {
+#if !__Win32__
+  if (fPipe[0] != -1) ::close(fPipe[0]);
+  if (fPipe[1] != -1) ::close(fPipe[1]);
+#endif
+  delete[] fCopyBuffer;
+  delete fSource;
+}
+
+CF_Error HTTPFileBody::Send(Socket *inSocket, UInt32 *outLengthSent) {
+  Assert(inSocket != nullptr);
+
+  UInt32 theTotalSent = 0;
+  CF_Error theErr = CF_NoErr;
+
+  if (!this->IsValid())
+    theErr = CF_FileNotFound;
+
+  while (theErr == CF_NoErr && !this->IsDone()) {
+    UInt32 theLength = kMaxSendSizeInBytes;
+    if (this->GetRemaining() < theLength)
+      theLength = (UInt32) this->GetRemaining();
+
+    UInt32 theLengthSent = 0;
+    if (fUseCopy) {
+      theErr = this->sendByCopy(inSocket, theLength, &theLengthSent);
+    } else if (fSource->IsRegular()) {
+      theErr = inSocket->SendFile(fSource->GetFD(), &fOffset,
+                                  theLength, &theLengthSent);
+      if (theErr == CF_NoErr && theLengthSent == 0)
+        theErr = CF_NoMoreData; // file got shorter under us
+    } else {
+#if __linux__
+      if (fPipe[0] == -1 && ::pipe(fPipe) != 0)
+        fPipe[0] = fPipe[1] = -1;
+      if (fPipe[0] != -1)
+        theErr = inSocket->Splice(fSource->GetFD(), fPipe, &fPipeBytes,
+                                  theLength, &theLengthSent);
+      else
+        theErr = ENOTSUP;
+#else
+      theErr = ENOTSUP;
+#endif
+    }
+
+    if (theErr == ENOTSUP) {
+      // this fd (or platform) can't do it inside the kernel
+      fUseCopy = true;
+      theErr = CF_NoErr;
+      continue;
+    }
+
+    fSent += theLengthSent;
+    theTotalSent += theLengthSent;
+
+    if (theErr == CF_NoErr && theLengthSent == 0)
+      theErr = EAGAIN; // nothing moved, wait for the Socket
+  }
+
+  if (outLengthSent != nullptr)
+    *outLengthSent = theTotalSent;
+
+  return theErr;
+}
+
+CF_Error HTTPFileBody::sendByCopy(Socket *inSocket,
+                                  UInt32 inLength,
+                                  UInt32 *outLengthSent) {
+  *outLengthSent = 0;
+
+  if (fCopyBuffer == nullptr)
+    fCopyBuffer = new char[kCopyBufferSizeInBytes];
+
+  // refill only when everything read before has been sent
+  if (fCopyBufferPos == fCopyBufferLen) {
+    UInt32 theReadLen = 0;
+    if (inLength > kCopyBufferSizeInBytes)
+      inLength = kCopyBufferSizeInBytes;
+
+    if (fSource->IsRegular()) {
+#if __Win32__
+      OS_Error theErr = fSource->ReadFromPos(fOffset, fCopyBuffer, inLength,
+                                             &theReadLen);
+      if (theErr != OS_NoErr)
+        return theErr;
+#else
+      // positional, the fd may be shared with other bodies (HTTPFileMapper)
+      ssize_t theLen = ::pread(fSource->GetFD(), fCopyBuffer, inLength, (off_t) fOffset);
+      if (theLen == -1)
+        return (CF_Error) Core::Thread::GetErrno();
+      theReadLen = (UInt32) theLen;
+#endif
+    } else {
+      int theLen = ::read(fSource->GetFD(), fCopyBuffer, inLength);
+      if (theLen == -1) {
+        int theErr = Core::Thread::GetErrno();
+        // the source has no data yet, not the Socket being full
+        if (theErr == EAGAIN || theErr == EINTR)
+          return CF_WouldBlock;
+        return (CF_Error) theErr;
+      }
+      theReadLen = (UInt32) theLen;
+    }
+
+    if (theReadLen == 0)
+      return CF_NoMoreData;
+
+    fOffset += theReadLen;
+    fCopyBufferPos = 0;
+    fCopyBufferLen = theReadLen;
+  }
+
+  UInt32 theLengthSent = 0;
+  OS_Error theErr = inSocket->Send(fCopyBuffer + fCopyBufferPos,
+                                   fCopyBufferLen - fCopyBufferPos,
+                                   &theLengthSent);
+  fCopyBufferPos += theLengthSent;
+  *outLengthSent = theLengthSent;
+  return theErr;
+}
@@ -0,0 +1,583 @@
+/**
+ * @file HTTPFileMapper.cpp
+ *
+ * implements HTTPFileMapper class
+ */
+
+#include <fcntl.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <CF/Core/Mutex.h>
+#include <CF/Core/Time.h>
+#include <CF/DateTranslator.h>
+#include <CF/HashTable.h>
+#include <CF/Queue.h>
+#include <CF/Net/Http/HTTPFileBody.h>
+#include <CF/Net/Http/HTTPFileMapper.h>
+
+using namespace CF;
+using namespace CF::Net;
+
+namespace {
+
+enum {
+  kMaxPathLength = 1024,  // UInt32, file system path
+  kTableSize = 2048,      // UInt32, hash buckets
+  kMaxETagLength = 40     // UInt32
+};
+
+/*
+ * One open file and what fstat said about it. The cache holds a reference
+ * while the entry is in the table, each body sending the file holds one
+ * more; the fd is closed with the last.
+ */
+struct FileEntry {
+  FileEntry()
+      : fHash(0),
+        fFD(-1),
+        fLength(0),
+        fModDate(0),
+        fDevice(0),
+        fInode(0),
+        fCheckedAt(0),
+        fRefCount(1),
+        fCached(false),
+        fETagLen(0),
+        fNextHashEntry(nullptr),
+        fLRUElem(this) {
+    fLastModified[0] = '\0';
+  }
+
+  ~FileEntry() {
+    if (fFD != -1) ::close(fFD);
+    delete[] fPath.Ptr;
+  }
+
+  StrPtrLen fPath;  // owned
+  UInt32 fHash;
+  int fFD;
+  UInt64 fLength;
+  time_t fModDate;
+  dev_t fDevice;
+  ino_t fInode;
+  SInt64 fCheckedAt;  // last stat, Core::Time::Milliseconds
+  UInt32 fRefCount;
+  bool fCached;
+
+  char fLastModified[DateBuffer::kDateBufferLen + 1];
+  char fETag[kMaxETagLength];
+  UInt32 fETagLen;
+
+  FileEntry *fNextHashEntry;
+  QueueElem fLRUElem;
+};
+
+UInt32 hashPath(const StrPtrLen &inPath) {
+  UInt32 theHash = 2166136261U; // FNV-1a
+  for (UInt32 i = 0; i < inPath.Len; i++)
+    theHash = (theHash ^ (UInt8) inPath.Ptr[i]) * 16777619U;
+  return theHash;
+}
+
+class FileEntryKey {
+ public:
+  explicit FileEntryKey(StrPtrLen *inPath)
+      : fPath(inPath), fHash(hashPath(*inPath)) {}
+  explicit FileEntryKey(FileEntry *inEntry)
+      : fPath(&inEntry->fPath), fHash(inEntry->fHash) {}
+
+  UInt32 GetHashKey() { return fHash; }
+
+  friend int operator==(const FileEntryKey &key1, const FileEntryKey &key2) {
+    return key1.fHash == key2.fHash && key1.fPath->Equal(*key2.fPath);
+  }
+
+ private:
+  StrPtrLen *fPath;
+  UInt32 fHash;
+};
+
+Core::Mutex sMutex;  // the table, the LRU queue and the reference counts
+HashTable<FileEntry, FileEntryKey> sTable(kTableSize);
+Queue sLRU;          // least recently used at the head
+UInt32 sMaxCachedFiles = HTTPFileMapper::kDefaultMaxCachedFiles;
+UInt32 sRevalidateInterval = HTTPFileMapper::kDefaultRevalidateIntervalInMSecs;
+
+struct Root {
+  StrPtrLen fPrefix;     // without the slashes around it
+  StrPtrLen fDirectory;  // without the trailing slash
+};
+
+Root sRoots[HTTPFileMapper::kMaxRoots];
+UInt32 sNumRoots = 0;
+
+// a cache reference is dropped, true if it was the last. sMutex is held.
+bool unref(FileEntry *inEntry) {
+  Assert(inEntry->fRefCount > 0);
+  return --inEntry->fRefCount == 0;
+}
+
+// out of the table, the cache's reference with it. sMutex is held.
+bool uncache(FileEntry *inEntry) {
+  if (!inEntry->fCached)
+    return false;
+  sTable.Remove(inEntry);
+  sLRU.Remove(&inEntry->fLRUElem);
+  inEntry->fCached = false;
+  return unref(inEntry);
+}
+
+void release(FileEntry *inEntry) {
+  bool theLast;
+  {
+    Core::MutexLocker locker(&sMutex);
+    theLast = unref(inEntry);
+  }
+  if (theLast)
+    delete inEntry;
+}
+
+void evictOverLimit() {
+  while (true) {
+    FileEntry *theEntry = nullptr;
+    {
+      Core::MutexLocker locker(&sMutex);
+      if (sLRU.GetLength() <= sMaxCachedFiles)
+        return;
+      theEntry = (FileEntry *) sLRU.GetHead()->GetEnclosingObject();
+      if (!uncache(theEntry))
+        continue;
+    }
+    delete theEntry;
+  }
+}
+
+bool isSameFile(const FileEntry *inEntry, const struct stat &inStat) {
+  return inEntry->fModDate == inStat.st_mtime
+      && inEntry->fLength == (UInt64) inStat.st_size
+      && inEntry->fInode == inStat.st_ino
+      && inEntry->fDevice == inStat.st_dev;
+}
+
+// regular files only, a fifo or device under the root is not served
+FileEntry *openEntry(const StrPtrLen &inPath, SInt64 inNow) {
+  int theFD = ::open(inPath.Ptr, O_RDONLY | O_NONBLOCK);
+  if (theFD == -1)
+    return nullptr;
+
+  struct stat theStat;
+  if (::fstat(theFD, &theStat) != 0 || !S_ISREG(theStat.st_mode)) {
+    ::close(theFD);
+    return nullptr;
+  }
+
+  auto *theEntry = new FileEntry();
+  theEntry->fPath.Ptr = new char[inPath.Len + 1];
+  theEntry->fPath.Len = inPath.Len;
+  ::memcpy(theEntry->fPath.Ptr, inPath.Ptr, inPath.Len + 1);
+  theEntry->fHash = hashPath(inPath);
+  theEntry->fFD = theFD;
+  theEntry->fLength = (UInt64) theStat.st_size;
+  theEntry->fModDate = theStat.st_mtime;
+  theEntry->fDevice = theStat.st_dev;
+  theEntry->fInode = theStat.st_ino;
+  theEntry->fCheckedAt = inNow;
+
+  // the validators are made once per open, not per request
+  DateBuffer theDate;
+  theDate.Update((SInt64) theEntry->fModDate * 1000);
+  ::memcpy(theEntry->fLastModified, theDate.GetDateBuffer(), DateBuffer::kDateBufferLen + 1);
+  theEntry->fETagLen = (UInt32) s_sprintf(theEntry->fETag,
+                                          "\"%" _64BITARG_ "x-%" _64BITARG_ "x\"",
+                                          (UInt64) theEntry->fModDate,
+                                          theEntry->fLength);
+  return theEntry;
+}
+
+// the entry for inPath, with a reference for the caller; nullptr if there
+// is no such regular file
+FileEntry *acquire(char const *inPath) {
+  StrPtrLen thePath((char *) inPath);
+  FileEntryKey theKey(&thePath);
+  SInt64 theNow = Core::Time::Milliseconds();
+
+  FileEntry *theEntry;
+  {
+    Core::MutexLocker locker(&sMutex);
+    theEntry = sTable.Map(&theKey);
+    if (theEntry != nullptr) {
+      theEntry->fRefCount++;
+      sLRU.Remove(&theEntry->fLRUElem);
+      sLRU.EnQueue(&theEntry->fLRUElem);
+      if (theNow - theEntry->fCheckedAt < sRevalidateInterval)
+        return theEntry;
+    }
+  }
+
+  if (theEntry != nullptr) {
+    struct stat theStat;
+    if (::stat(inPath, &theStat) == 0 && isSameFile(theEntry, theStat)) {
+      Core::MutexLocker locker(&sMutex);
+      theEntry->fCheckedAt = theNow;
+      return theEntry;
+    }
+
+    // changed or gone: bodies still sending it keep the old fd
+    bool theLast;
+    {
+      Core::MutexLocker locker(&sMutex);
+      uncache(theEntry);
+      theLast = unref(theEntry);
+    }
+    if (theLast)
+      delete theEntry;
+  }
+
+  theEntry = openEntry(thePath, theNow);
+  if (theEntry == nullptr || sMaxCachedFiles == 0)
+    return theEntry;
+
+  FileEntry *theOther;
+  {
+    Core::MutexLocker locker(&sMutex);
+    theOther = sTable.Map(&theKey);
+    if (theOther != nullptr) {
+      // opened by another session meanwhile
+      theOther->fRefCount++;
+    } else {
+      sTable.Add(theEntry);
+      sLRU.EnQueue(&theEntry->fLRUElem);
+      theEntry->fCached = true;
+      theEntry->fRefCount++;
+    }
+  }
+  if (theOther != nullptr) {
+    delete theEntry;
+    return theOther;
+  }
+
+  evictOverLimit();
+  return theEntry;
+}
+
+// keeps its entry, so the fd stays open while the body is sent
+class CachedFileBody : public HTTPFileBody {
+ public:
+  CachedFileBody(FileEntry *inEntry, UInt64 inOffset, UInt64 inLength)
+      : HTTPFileBody(newSource(inEntry), inOffset, inLength), fEntry(inEntry) {}
+
+  ~CachedFileBody() override { release(fEntry); }
+
+ private:
+  static FileSource *newSource(FileEntry *inEntry) {
+    auto *theSource = new FileSource();
+    theSource->Set(inEntry->fFD, inEntry->fLength, inEntry->fModDate, true);
+    return theSource;
+  }
+
+  FileEntry *fEntry;
+};
+
+// inRequestPath has no leading slash
+bool mapPath(char const *inRequestPath, char *outPath, UInt32 inPathSize) {
+  if (inRequestPath == nullptr)
+    return false;
+
+  UInt32 theRequestLen = (UInt32) ::strlen(inRequestPath);
+  Root *theRoot = nullptr;
+  for (UInt32 i = 0; i < sNumRoots; i++) {
+    StrPtrLen &thePrefix = sRoots[i].fPrefix;
+    if (thePrefix.Len > theRequestLen
+        || ::memcmp(thePrefix.Ptr, inRequestPath, thePrefix.Len) != 0)
+      continue;
+    if (thePrefix.Len > 0 && thePrefix.Len < theRequestLen
+        && inRequestPath[thePrefix.Len] != '/')
+      continue; // "/static" does not serve "/statics"
+    if (theRoot == nullptr || thePrefix.Len > theRoot->fPrefix.Len)
+      theRoot = &sRoots[i];
+  }
+  if (theRoot == nullptr)
+    return false;
+
+  char const *theRest = inRequestPath + theRoot->fPrefix.Len;
+  while (*theRest == '/')
+    theRest++;
+
+  // no way out of the directory
+  for (char const *theSegment = theRest; *theSegment != '\0';) {
+    char const *theEnd = ::strchr(theSegment, '/');
+    UInt32 theLen = theEnd != nullptr ? (UInt32) (theEnd - theSegment)
+                                      : (UInt32) ::strlen(theSegment);
+    if (theLen == 2 && theSegment[0] == '.' && theSegment[1] == '.')
+      return false;
+    if (theEnd == nullptr)
+      break;
+    theSegment = theEnd + 1;
+  }
+
+  UInt32 theRestLen = (UInt32) ::strlen(theRest);
+  bool theIsDir = theRestLen == 0 || theRest[theRestLen - 1] == '/';
+  static StrPtrLen sIndex((char *) "index.html", 10);
+
+  UInt32 theLen = theRoot->fDirectory.Len + 1 + theRestLen
+      + (theIsDir ? sIndex.Len : 0);
+  if (theLen + 1 > inPathSize)
+    return false;
+
+  char *thePut = outPath;
+  ::memcpy(thePut, theRoot->fDirectory.Ptr, theRoot->fDirectory.Len);
+  thePut += theRoot->fDirectory.Len;
+  *thePut++ = '/';
+  ::memcpy(thePut, theRest, theRestLen);
+  thePut += theRestLen;
+  if (theIsDir) {
+    ::memcpy(thePut, sIndex.Ptr, sIndex.Len);
+    thePut += sIndex.Len;
+  }
+  *thePut = '\0';
+  return true;
+}
+
+struct ContentType {
+  char const *fExtension;
+  char const *fType;
+};
+
+const ContentType sContentTypes[] = {
+    {"html", "text/html; charset=utf-8"},
+    {"htm", "text/html; charset=utf-8"},
+    {"css", "text/css; charset=utf-8"},
+    {"js", "application/javascript"},
+    {"json", "application/json"},
+    {"txt", "text/plain; charset=utf-8"},
+    {"xml", "text/xml"},
+    {"png", "image/png"},
+    {"jpg", "image/jpeg"},
+    {"jpeg", "image/jpeg"},
+    {"gif", "image/gif"},
+    {"svg", "image/svg+xml"},
+    {"ico", "image/x-icon"},
+    {"webp", "image/webp"},
+    {"wasm", "application/wasm"},
+    {"pdf", "application/pdf"},
+    {"mp4", "video/mp4"},
+    {"m3u8", "application/vnd.apple.mpegurl"},
+    {"ts", "video/mp2t"},
+    {"flv", "video/x-flv"}
+};
+
+StrPtrLen contentTypeOf(char const *inPath) {
+  char const *theDot = ::strrchr(inPath, '.');
+  if (theDot != nullptr && ::strchr(theDot, '/') == nullptr) {
+    for (const ContentType &theType : sContentTypes)
+      if (::strcasecmp(theDot + 1, theType.fExtension) == 0)
+        return StrPtrLen((char *) theType.fType);
+  }
+  return StrPtrLen((char *) "application/octet-stream");
+}
+
+bool isNotModified(HTTPPacket &inRequest, FileEntry *inEntry) {
+  StrPtrLen *theNoneMatch = inRequest.GetHeaderValue(httpIfNoneMatchHeader);
+  if (theNoneMatch->Len > 0)
+    return inRequest.IfNoneMatch(StrPtrLen(inEntry->fETag, inEntry->fETagLen));
+
+  StrPtrLen *theSince = inRequest.GetHeaderValue(httpIfModifiedSinceHeader);
+  if (theSince->Len == 0)
+    return false;
+  // usually our own Last-Modified sent back
+  if (theSince->Equal(StrPtrLen(inEntry->fLastModified, DateBuffer::kDateBufferLen)))
+    return true;
+  time_t theDate = inRequest.ParseIfModSinceHeader();
+  return theDate > 0 && inEntry->fModDate <= theDate;
+}
+
+// If-Range: the range is for this version of the file only
+bool rangeApplies(HTTPPacket &inRequest, FileEntry *inEntry) {
+  StrPtrLen *theIfRange = inRequest.GetHeaderValue(httpIfRangeHeader);
+  if (theIfRange->Len == 0)
+    return true;
+  if (theIfRange->Ptr[0] == '"')
+    return theIfRange->Equal(StrPtrLen(inEntry->fETag, inEntry->fETagLen));
+  return theIfRange->Equal(StrPtrLen(inEntry->fLastModified, DateBuffer::kDateBufferLen));
+}
+
+enum RangeResult {
+  kWholeFile,       // no Range, or one we don't do (several, bad syntax)
+  kPartial,
+  kNotSatisfiable
+};
+
+RangeResult parseRange(const StrPtrLen &inRange, UInt64 inLength,
+                       UInt64 *outOffset, UInt64 *outLength) {
+  static StrPtrLen sBytes((char *) "bytes=", 6);
+  if (inRange.Len <= sBytes.Len
+      || !StrPtrLen(inRange.Ptr, sBytes.Len).EqualIgnoreCase(sBytes))
+    return kWholeFile;
+
+  StringParser theParser(&const_cast<StrPtrLen &>(inRange));
+  theParser.ConsumeLength(nullptr, sBytes.Len);
+  theParser.ConsumeWhitespace();
+
+  bool theHasFirst = theParser.GetDataRemaining() > 0
+      && StringParser::sDigitMask[(UInt8) theParser.PeekFast()];
+  UInt64 theFirst = 0;
+  while (theParser.GetDataRemaining() > 0
+      && StringParser::sDigitMask[(UInt8) theParser.PeekFast()]) {
+    theFirst = theFirst * 10 + (theParser.PeekFast() - '0');
+    theParser.ConsumeLength(nullptr, 1);
+  }
+  if (!theParser.Expect('-'))
+    return kWholeFile;
+
+  bool theHasLast = theParser.GetDataRemaining() > 0
+      && StringParser::sDigitMask[(UInt8) theParser.PeekFast()];
+  UInt64 theLast = 0;
+  while (theParser.GetDataRemaining() > 0
+      && StringParser::sDigitMask[(UInt8) theParser.PeekFast()]) {
+    theLast = theLast * 10 + (theParser.PeekFast() - '0');
+    theParser.ConsumeLength(nullptr, 1);
+  }
+  theParser.ConsumeWhitespace();
+  if (theParser.GetDataRemaining() > 0 || (!theHasFirst && !theHasLast))
+    return kWholeFile; // several ranges, or garbage
+
+  if (!theHasFirst) {
+    // "-n": the last n bytes
+    if (theLast == 0 || inLength == 0)
+      return kNotSatisfiable;
+    if (theLast > inLength)
+      theLast = inLength;
+    *outOffset = inLength - theLast;
+    *outLength = theLast;
+    return kPartial;
+  }
+
+  if (theHasLast && theLast < theFirst)
+    return kWholeFile;
+  if (theFirst >= inLength)
+    return kNotSatisfiable;
+  if (!theHasLast || theLast >= inLength)
+    theLast = inLength - 1;
+  *outOffset = theFirst;
+  *outLength = theLast - theFirst + 1;
+  return kPartial;
+}
+
+} // namespace
+
+bool HTTPFileMapper::AddRoot(char const *inURLPrefix, char const *inDirectory) {
+  if (sNumRoots == kMaxRoots)
+    return false;
+
+  while (*inURLPrefix == '/')
+    inURLPrefix++;
+  UInt32 thePrefixLen = (UInt32) ::strlen(inURLPrefix);
+  while (thePrefixLen > 0 && inURLPrefix[thePrefixLen - 1] == '/')
+    thePrefixLen--;
+
+  UInt32 theDirectoryLen = (UInt32) ::strlen(inDirectory);
+  while (theDirectoryLen > 0 && inDirectory[theDirectoryLen - 1] == '/')
+    theDirectoryLen--;
+
+  Root &theRoot = sRoots[sNumRoots++];
+  theRoot.fPrefix.Set(StrPtrLen((char *) inURLPrefix, thePrefixLen).GetAsCString(),
+                      thePrefixLen);
+  theRoot.fDirectory.Set(StrPtrLen((char *) inDirectory, theDirectoryLen).GetAsCString(),
+                         theDirectoryLen);
+  return true;
+}
+
+CF_Error HTTPFileMapper::Serve(HTTPPacket &request, HTTPPacket &response) {
+  HTTPMethod theMethod = request.GetMethod();
+  if (theMethod != httpGetMethod && theMethod != httpHeadMethod) {
+    static StrPtrLen sAllowed((char *) "GET, HEAD", 9);
+    response.SetStatusCode(httpMethodNotAllowed);
+    response.AddResponseHeader(httpAllowHeader, sAllowed);
+    return CF_NoErr;
+  }
+
+  char thePath[kMaxPathLength];
+  if (!mapPath(request.GetRequestPath(), thePath, sizeof(thePath)))
+    return CF_FileNotFound;
+
+  FileEntry *theEntry = acquire(thePath);
+  if (theEntry == nullptr)
+    return CF_FileNotFound;
+
+  static StrPtrLen sBytes((char *) "bytes", 5);
+  StrPtrLen theETag(theEntry->fETag, theEntry->fETagLen);
+  response.AddResponseHeader(httpLastModifiedHeader,
+                             StrPtrLen(theEntry->fLastModified, DateBuffer::kDateBufferLen));
+  response.AddResponseHeader(httpETagHeader, theETag);
+  response.AddResponseHeader(httpAcceptRangesHeader, sBytes);
+  response.AddResponseHeader(httpContentTypeHeader, contentTypeOf(thePath));
+
+  if (isNotModified(request, theEntry)) {
+    response.SetStatusCode(httpNotModified);
+    release(theEntry);
+    return CF_NoErr;
+  }
+
+  UInt64 theOffset = 0;
+  UInt64 theLength = theEntry->fLength;
+  StrPtrLen *theRange = request.GetHeaderValue(httpRangeHeader);
+  if (theRange->Len > 0 && rangeApplies(request, theEntry)) {
+    char theContentRange[64];
+    RangeResult theResult = parseRange(*theRange, theEntry->fLength,
+                                       &theOffset, &theLength);
+    if (theResult == kNotSatisfiable) {
+      s_sprintf(theContentRange, "bytes */%" _U64BITARG_, theEntry->fLength);
+      response.SetStatusCode(httpRequestRangeNotSatisfiable);
+      response.AddResponseHeader(httpContentRangeHeader, StrPtrLen(theContentRange));
+      release(theEntry);
+      return CF_NoErr;
+    }
+    if (theResult == kPartial) {
+      s_sprintf(theContentRange, "bytes %" _U64BITARG_ "-%" _U64BITARG_ "/%" _U64BITARG_,
+                theOffset, theOffset + theLength - 1, theEntry->fLength);
+      response.SetStatusCode(httpPartialContent);
+      response.AddResponseHeader(httpContentRangeHeader, StrPtrLen(theContentRange));
+    }
+  }
+
+  // the body takes the reference
+  response.SetFileBody(new CachedFileBody(theEntry, theOffset, theLength));
+  return CF_NoErr;
+}
+
+void HTTPFileMapper::SetMaxCachedFiles(UInt32 inMaxFiles) {
+  {
+    Core::MutexLocker locker(&sMutex);
+    sMaxCachedFiles = inMaxFiles;
+  }
+  evictOverLimit();
+}
+
+void HTTPFileMapper::SetRevalidateInterval(UInt32 inMilliseconds) {
+  sRevalidateInterval = inMilliseconds;
+}
+
+void HTTPFileMapper::Invalidate(char const *inPath) {
+  StrPtrLen thePath((char *) inPath);
+  FileEntryKey theKey(&thePath);
+  FileEntry *theEntry;
+  {
+    Core::MutexLocker locker(&sMutex);
+    theEntry = sTable.Map(&theKey);
+    if (theEntry == nullptr || !uncache(theEntry))
+      return;
+  }
+  delete theEntry;
+}
+
+void HTTPFileMapper::InvalidateAll() {
+  UInt32 theMaxFiles = sMaxCachedFiles;
+  SetMaxCachedFiles(0);
+  SetMaxCachedFiles(theMaxFiles);
+}
+
+UInt32 HTTPFileMapper::GetNumCachedFiles() {
+  Core::MutexLocker locker(&sMutex);
+  return sLRU.GetLength();
+}
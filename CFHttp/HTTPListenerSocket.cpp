@@ -23,7 +23,9 @@ Thread::Task *HTTPListenerSocket::GetSessionTask(TCPSocket **outSocket) {
 }
 
 bool HTTPListenerSocket::OverMaxConnections(UInt32 buffer) {
-  return false;
+  // every HTTPSession registers itself with the governor, so the session,
+  // task queue and memory limits configured in HTTPConfigure apply here.
+  return ConnectionGovernor::IsOverloaded(buffer);
 }
 
 } // namespace Net
@@ -24,11 +24,35 @@
  */
 
 #include <CF/Net/Http/HTTPPacket.h>
+#include <CF/Net/Http/HTTPFileBody.h>
+#include <CF/Net/Http/HTTPStreamBody.h>
+#include <CF/Net/Http/HTTPBodySink.h>
+#include <CF/Net/Http/HTTPDeferred.h>
 #include <CF/StringTranslator.h>
 #include <CF/DateTranslator.h>
-#include <CF/Core/Thread.h>
 #include <CF/CFEnv.h>
 
+#if HTTPPACKET_TESTING
+#include <stdlib.h>
+#include <new>
+#include <CF/Core/Time.h>
+
+// every new and new[] of the program is counted
+static UInt64 sNumAllocations = 0;
+
+void *operator new(size_t inSize) {
+  sNumAllocations++;
+  void *thePtr = ::malloc(inSize > 0 ? inSize : 1);
+  if (thePtr == nullptr)
+    throw std::bad_alloc();
+  return thePtr;
+}
+
+void operator delete(void *inPtr) noexcept {
+  ::free(inPtr);
+}
+#endif
+
 namespace CF {
 namespace Net {
 
@@ -36,10 +60,29 @@ StrPtrLen HTTPPacket::sColonSpace(": ", 2);
 static bool sFalse = false;
 static bool sTrue = true;
 static StrPtrLen sCloseString("close", 5);
-static StrPtrLen sAllString("*", 1);
 static StrPtrLen sKeepAliveString("keep-alive", 10);
 static StrPtrLen sDefaultRealm("CxxFramework Server", 19);
 
+// Complete header lines, copied as they are into responses
+static StrPtrLen sConnectionCloseLine("Connection: close\r\n");
+static StrPtrLen sAllowAllOriginLine("Access-Control-Allow-Origin: *\r\n");
+
+// "Server: <CFEnv server header>\r\n", made once CFEnv has its header
+static StrPtrLen const &serverHeaderLine() {
+  static StrPtrLen sLine = [] {
+    StrPtrLen &theServer = CFEnv::GetServerHeader();
+    StrPtrLen theName = HTTPProtocol::GetHeaderString(httpServerHeader);
+    UInt32 theLen = theName.Len + 2 + theServer.Len + 2;
+    char *theLine = new char[theLen];
+    ::memcpy(theLine, theName.Ptr, theName.Len);
+    ::memcpy(theLine + theName.Len, ": ", 2);
+    ::memcpy(theLine + theName.Len + 2, theServer.Ptr, theServer.Len);
+    ::memcpy(theLine + theLen - 2, "\r\n", 2);
+    return StrPtrLen(theLine, theLen);
+  }();
+  return sLine;
+}
+
 UInt8 HTTPPacket::sURLStopConditions[] =
     {
         0, 0, 0, 0, 0, 0, 0, 0, 0, 1, //0-9      '\t' is a stop condition
@@ -71,11 +114,21 @@ UInt8 HTTPPacket::sURLStopConditions[] =
     };
 
 // Constructor for parse a packet header
-HTTPPacket::HTTPPacket(StrPtrLen *packetPtr)
-    : fSvrHeader(CFEnv::GetServerHeader()),
-      fPacketHeader(*packetPtr), // 浅拷贝
-      fMethod(httpIllegalMethod),
+HTTPPacket::HTTPPacket(StrPtrLen *packetPtr, HTTPHeaderIndex *index)
+    : fPacketHeader(*packetPtr), // 浅拷贝
+      fHeaderIndex(index),
+      fHTTPHeaderFormatter(nullptr),
+      fExtraHeaders(nullptr),
+      fHTTPHeader(),
+      fHTTPBody(nullptr),
+      fHTTPFileBody(nullptr),
+      fHTTPStreamBody(nullptr),
+      fBodySink(nullptr),
+      fDeferred(nullptr),
+      fHTTPType(httpIllegalType), // 未解析情况下为httpIllegalType
       fVersion(httpIllegalVersion),
+      fMethod(httpIllegalMethod),
+      fStatusCode(httpOK),
       fRequestLine(),
       fAbsoluteURI(),
       fRelativeURI(),
@@ -83,22 +136,33 @@ HTTPPacket::HTTPPacket(StrPtrLen *packetPtr)
       fHostHeader(),
       fRequestPath(nullptr),
       fQueryString(nullptr),
-      fQueryValues(nullptr),
-      fStatusCode(httpOK),
+      fQueryParams(nullptr),
+      fNumQueryParams(0),
+      fQueryParsed(false),
+      fArena(),
+      fBodyRef(),
+      fNumPathParams(0),
       fRequestKeepAlive(false), // Default value when there is no version string
-      fHTTPHeader(nullptr),
-      fHTTPHeaderFormatter(nullptr),
-      fHTTPBody(nullptr),
-      fHTTPType(httpIllegalType) { // 未解析情况下为httpIllegalType
+      fSvrHeader(CFEnv::GetServerHeader()) {
 
 }
 
 // Constructor for creating a new packet
 HTTPPacket::HTTPPacket(HTTPType httpType)
-    : fSvrHeader(CFEnv::GetServerHeader()),
-      fPacketHeader(),
-      fMethod(httpIllegalMethod),
+    : fPacketHeader(),
+      fHeaderIndex(nullptr),
+      fHTTPHeaderFormatter(nullptr),
+      fExtraHeaders(nullptr),
+      fHTTPHeader(),
+      fHTTPBody(nullptr),
+      fHTTPFileBody(nullptr),
+      fHTTPStreamBody(nullptr),
+      fBodySink(nullptr),
+      fDeferred(nullptr),
+      fHTTPType(httpType),
       fVersion(httpIllegalVersion),
+      fMethod(httpIllegalMethod),
+      fStatusCode(httpOK),
       fRequestLine(),
       fAbsoluteURI(),
       fRelativeURI(),
@@ -106,13 +170,14 @@ HTTPPacket::HTTPPacket(HTTPType httpType)
       fHostHeader(),
       fRequestPath(nullptr),
       fQueryString(nullptr),
-      fQueryValues(nullptr),
-      fStatusCode(httpOK),
+      fQueryParams(nullptr),
+      fNumQueryParams(0),
+      fQueryParsed(false),
+      fArena(),
+      fBodyRef(),
+      fNumPathParams(0),
       fRequestKeepAlive(false), // Default value when there is no version string
-      fHTTPHeader(nullptr),
-      fHTTPHeaderFormatter(nullptr),
-      fHTTPBody(nullptr),
-      fHTTPType(httpType) {
+      fSvrHeader(CFEnv::GetServerHeader()) {
 
   // We require the response but we allocate memory only when we call
   // CreateResponseHeader
@@ -122,17 +187,100 @@ HTTPPacket::HTTPPacket(HTTPType httpType)
 HTTPPacket::~HTTPPacket() {
   // delete nullptr is no effect.
 
-  delete fHTTPHeader;
   delete fHTTPHeaderFormatter;
-  delete[] fRequestPath;
-  delete[] fQueryString;
-  delete fQueryValues;
-  delete fHTTPBody;
+  delete fExtraHeaders;
+  SetBody(nullptr);
+  delete fHTTPFileBody;
+  delete fHTTPStreamBody;
+  delete fBodySink;
+  if (fDeferred != nullptr)
+    fDeferred->Detach();
+}
+
+void HTTPPacket::Reset(HTTPType httpType) {
+  SetFileBody(nullptr); // and the other bodies
+  SetBodySink(nullptr);
+  if (fDeferred != nullptr) {
+    fDeferred->Detach();
+    fDeferred = nullptr;
+  }
+
+  if (fHTTPHeaderFormatter != nullptr)
+    fHTTPHeaderFormatter->Reset();
+  if (fExtraHeaders != nullptr)
+    fExtraHeaders->Reset();
+  fHTTPHeader.Set(nullptr, 0);
+  fArena.Reset();
+
+  fPacketHeader.Set(nullptr, 0);
+  fHeaderIndex = nullptr;
+  fHTTPType = httpType;
+  fMethod = httpIllegalMethod;
+  fVersion = httpIllegalVersion;
+  fStatusCode = httpOK;
+  fRequestKeepAlive = false;
+
+  fRequestLine.Set(nullptr, 0);
+  fAbsoluteURI.Set(nullptr, 0);
+  fRelativeURI.Set(nullptr, 0);
+  fAbsoluteURIScheme.Set(nullptr, 0);
+  fHostHeader.Set(nullptr, 0);
+  fRequestPath = nullptr;
+  fQueryString = nullptr;
+  fQueryParams = nullptr;
+  fNumQueryParams = 0;
+  fQueryParsed = false;
+  fNumPathParams = 0;
+  for (StrPtrLen &theValue : fFieldValues)
+    theValue.Set(nullptr, 0);
+  fSvrHeader = CFEnv::GetServerHeader();
+}
+
+void HTTPPacket::Reset(StrPtrLen *packetPtr, HTTPHeaderIndex *index) {
+  this->Reset(httpIllegalType); // 未解析情况下为httpIllegalType
+  fPacketHeader = *packetPtr;
+  fHeaderIndex = index;
+}
+
+void HTTPPacket::SetFileBody(HTTPFileBody *body) {
+  SetBody(nullptr);
+  delete fHTTPStreamBody;
+  fHTTPStreamBody = nullptr;
+  delete fHTTPFileBody;
+  fHTTPFileBody = body;
+}
+
+void HTTPPacket::SetBodySink(HTTPBodySink *sink) {
+  delete fBodySink;
+  fBodySink = sink;
+}
+
+HTTPDeferred *HTTPPacket::Defer() {
+  if (fDeferred == nullptr)
+    fDeferred = new HTTPDeferred();
+  return fDeferred;
+}
+
+void HTTPPacket::SetStreamBody(HTTPStreamBody *body) {
+  SetBody(nullptr);
+  delete fHTTPFileBody;
+  fHTTPFileBody = nullptr;
+  delete fHTTPStreamBody;
+  fHTTPStreamBody = body;
 }
 
 // Parses the request
 CF_Error HTTPPacket::Parse() {
   Assert(fPacketHeader.Ptr != NULL);
+
+  // The stream already found the lines, no need to look at the bytes again
+  if (fHeaderIndex != nullptr && fHeaderIndex->IsUsable()) {
+    CF_Error err = parseIndexed();
+    if (err != CF_NoErr || fHTTPType != httpIllegalType)
+      return err;
+    // not a request line, skip it the way the parser below does
+  }
+
   StringParser parser(&fPacketHeader);
 
   // Store the request line (used for logging)
@@ -213,6 +361,9 @@ CF_Error HTTPPacket::parseRequestLine(StringParser *parser) {
   if (versionStr.Len > 0)
     fVersion = HTTPProtocol::GetVersion(&versionStr);
 
+  // HTTP/1.1 connections persist unless the header says "Connection: close"
+  fRequestKeepAlive = fVersion == http11Version;
+
   // Go past the end of line
   if (!parser->ExpectEOL()) {
     fStatusCode = httpBadRequest;
@@ -247,22 +398,11 @@ CF_Error HTTPPacket::parseURI(StringParser *parser) {
       // consume the rest of the line..
       parser->ConsumeUntilWhitespace(&queryString);
 
-      if (queryString.Len) {
-        if (fQueryString != NULL) {
-          delete[] fQueryString;
-          fQueryString = NULL;
-        }
-
-        fQueryString = new char[queryString.Len + 1];
-        ::memcpy(fQueryString, queryString.Ptr, queryString.Len);
-        fQueryString[queryString.Len] = '\0';
-      }
+      if (queryString.Len)
+        fQueryString = fArena.Copy(queryString);
     }
   }
 
-  delete fQueryValues;
-  fQueryValues = new QueryParamList(fQueryString);
-
   // whatever is in this position is the relative URI
   StrPtrLen relativeURI(urlParser.GetCurrentPosition(),
                         urlParser.GetDataReceivedLen()
@@ -270,11 +410,10 @@ CF_Error HTTPPacket::parseURI(StringParser *parser) {
   // read this URI into fRequestRelURI
   fRelativeURI = relativeURI;
 
-  // Allocate memory for fRequestPath
+  // Allocate memory for fRequestPath, with room for the terminator
   UInt32 len = fRelativeURI.Len;
   len++;
-  //char* relativeURIDecoded = new char[len];
-  char relativeURIDecoded[512] = {0};
+  char *relativeURIDecoded = (char *) fArena.Allocate(len);
 
   SInt32 theBytesWritten =
       StringTranslator::DecodeURL(fRelativeURI.Ptr, fRelativeURI.Len,
@@ -287,19 +426,106 @@ CF_Error HTTPPacket::parseURI(StringParser *parser) {
     return CF_BadArgument;
   }
 
-  if (fRequestPath != NULL)
-    delete[] fRequestPath;
+  // without the leading '/'
+  relativeURIDecoded[theBytesWritten] = '\0';
+  fRequestPath = theBytesWritten > 0 ? relativeURIDecoded + 1 : relativeURIDecoded;
 
-  fRequestPath = NULL;
+  return CF_NoErr;
+}
+
+void HTTPPacket::parseQuery() {
+  fQueryParsed = true;
+  if (fQueryString == nullptr)
+    return;
+
+  // a pair ends at each '&'
+  UInt32 theMaxParams = 1;
+  for (char *theChar = fQueryString; *theChar != '\0'; theChar++)
+    if (*theChar == '&')
+      theMaxParams++;
+  fQueryParams = (QueryParam *) fArena.Allocate(theMaxParams * sizeof(QueryParam));
+
+  // 'form' encoded, as QueryParamList reads it
+  StrPtrLen theQuery(fQueryString);
+  StringParser queryParser(&theQuery);
+  while (queryParser.GetDataRemaining() > 0) {
+    StrPtrLen theName;
+    StrPtrLen theValue;
+
+    queryParser.ConsumeUntil(&theName, '=');
+    if (queryParser.GetDataRemaining() < 1)
+      break;
+
+    queryParser.ConsumeLength(nullptr, 1);   // the '='
+    if (*queryParser.GetCurrentPosition() == '"') { // if quote read to next quote
+      queryParser.ConsumeLength(nullptr, 1);
+      queryParser.ConsumeUntil(&theValue, '"');
+      queryParser.ConsumeLength(nullptr, 1);
+      queryParser.ConsumeUntil(nullptr, '&');
+    } else {
+      queryParser.ConsumeUntil(&theValue, '&');
+    }
+
+    Assert(fNumQueryParams < theMaxParams);
+    QueryParam &theParam = fQueryParams[fNumQueryParams++];
+    theParam.fName = fArena.Copy(theName);
+    theParam.fValue = fArena.Copy(theValue);
+    QueryParamList::DecodeArg(theParam.fName);
+    QueryParamList::DecodeArg(theParam.fValue);
+
+    queryParser.ConsumeLength(nullptr, 1);   // the '&'
+  }
+}
 
-  fRequestPath = new char[theBytesWritten + 1];
-  ::memcpy(fRequestPath, relativeURIDecoded + 1, theBytesWritten);
-  //delete relativeURIDecoded;
-  fRequestPath[theBytesWritten] = '\0';
+CF_Error HTTPPacket::parseIndexed() {
+  HTTPHeaderIndex *theIndex = fHeaderIndex;
+  UInt32 theLineOffset = theIndex->GetRequestLineOffset();
+
+  // Store the request line (used for logging)
+  fRequestLine.Set(fPacketHeader.Ptr + theLineOffset,
+                   theIndex->GetRequestLineLen());
+
+  // the request line with its EOL
+  StrPtrLen theLine(fPacketHeader.Ptr + theLineOffset,
+                    theIndex->GetHeadersOffset() - theLineOffset);
+  StringParser parser(&theLine);
+  CF_Error err = parseRequestLine(&parser);
+  if (err != CF_NoErr || fHTTPType == httpIllegalType)
+    return err;
+
+  if (theIndex->IsMalformed()) { // No colon after header!
+    fStatusCode = httpBadRequest;
+    return CF_BadArgument;
+  }
+
+  for (UInt32 i = 0; i < theIndex->GetNumFields(); i++) {
+    HTTPHeaderIndex::Field *theField = theIndex->GetField(i);
+    StrPtrLen theKeyWord(fPacketHeader.Ptr + theField->fNameOffset,
+                         theField->fNameLen);
+    StrPtrLen theHeaderVal(fPacketHeader.Ptr + theField->fValueOffset,
+                           theField->fValueLen);
+    setHeaderValue(&theKeyWord, &theHeaderVal);
+  }
 
   return CF_NoErr;
 }
 
+void HTTPPacket::setHeaderValue(StrPtrLen *inKeyWord, StrPtrLen *inValue) {
+  //Look up the proper header enumeration based on the header string.
+  HTTPHeader theHeader = HTTPProtocol::GetHeader(inKeyWord);
+
+  // If this is the connection header
+  if (theHeader == httpConnectionHeader) {
+    // Set the keep alive boolean based on the connection header value
+    setKeepAlive(inValue);
+  }
+
+  // Have the header field and the value; Add value to the array
+  // If the field is invalid (or unrecognized) just skip over gracefully
+  if (theHeader != httpIllegalHeader)
+    fFieldValues[theHeader] = *inValue;
+}
+
 // Parses the Connection header and makes sure that request is properly terminated
 CF_Error HTTPPacket::parseHeaders(StringParser *parser) {
   StrPtrLen theKeyWord;
@@ -320,9 +546,6 @@ CF_Error HTTPPacket::parseHeaders(StringParser *parser) {
       Assert(isStreamOK);
     }
 
-    //Look up the proper header enumeration based on the header string.
-    HTTPHeader theHeader = HTTPProtocol::GetHeader(&theKeyWord);
-
     StrPtrLen theHeaderVal;
     isStreamOK = parser->GetThruEOL(&theHeaderVal);
 
@@ -331,17 +554,7 @@ CF_Error HTTPPacket::parseHeaders(StringParser *parser) {
       return CF_BadArgument;
     }
 
-    // If this is the connection header
-    if (theHeader == httpConnectionHeader) {
-      // Set the keep alive boolean based on the connection header value
-      setKeepAlive(&theHeaderVal);
-    }
-
-    // Have the header field and the value; Add value to the array
-    // If the field is invalid (or unrecognized) just skip over gracefully
-    if (theHeader != httpIllegalHeader)
-      fFieldValues[theHeader] = theHeaderVal;
-
+    setHeaderValue(&theKeyWord, &theHeaderVal);
   }
 
   isStreamOK = parser->ExpectEOL();
@@ -361,7 +574,32 @@ void HTTPPacket::setKeepAlive(StrPtrLen *keepAliveValue) {
 }
 
 char const *HTTPPacket::GetQueryValues(char *inParam) {
-  return fQueryValues->DoFindCGIValueForParam(inParam);
+  if (!fQueryParsed)
+    this->parseQuery();
+
+  UInt32 theLen = (UInt32) ::strlen(inParam);
+  for (UInt32 i = 0; i < fNumQueryParams; i++) {
+    StrPtrLen theName(fQueryParams[i].fName);
+    if (theName.EqualIgnoreCase(inParam, theLen))
+      return fQueryParams[i].fValue;
+  }
+  return nullptr;
+}
+
+StrPtrLen *HTTPPacket::GetPathParam(char const *inName) {
+  for (UInt32 i = 0; i < fNumPathParams; i++)
+    if (fPathParamNames[i].Equal(inName))
+      return &fPathParamValues[i];
+  return nullptr;
+}
+
+bool HTTPPacket::AddPathParam(const StrPtrLen &inName, const StrPtrLen &inValue) {
+  if (fNumPathParams == kMaxPathParams)
+    return false;
+  fPathParamNames[fNumPathParams] = inName;
+  fPathParamValues[fNumPathParams] = inValue;
+  fNumPathParams++;
+  return true;
 }
 
 StrPtrLen *HTTPPacket::GetHeaderValue(HTTPHeader inHeader) {
@@ -373,12 +611,7 @@ StrPtrLen *HTTPPacket::GetHeaderValue(HTTPHeader inHeader) {
 void HTTPPacket::putStatusLine(StringFormatter *putStream,
                                HTTPStatusCode status,
                                HTTPVersion version) {
-  putStream->Put(HTTPProtocol::GetVersionString(version));
-  putStream->PutSpace();
-  putStream->Put(HTTPProtocol::GetStatusCodeAsString(status));
-  putStream->PutSpace();
-  putStream->Put(HTTPProtocol::GetStatusCodeString(status));
-  putStream->PutEOL();
+  putStream->Put(HTTPProtocol::GetStatusLine(status, version));
 }
 
 void HTTPPacket::putMethedLine(StringFormatter *putStream,
@@ -395,44 +628,46 @@ void HTTPPacket::putMethedLine(StringFormatter *putStream,
 bool HTTPPacket::CreateResponseHeader() {
   if (fHTTPType != httpResponseType) return false;
 
-  // If we are creating a second response for the same request, make sure and
-  // deallocate memory for old response and allocate fresh memory
-  delete fHTTPHeader;
-  delete fHTTPHeaderFormatter;
-
-  // Allocate memory for the response when you first create it
-  char *responseString = new char[kMinHeaderSizeInBytes];
-  fHTTPHeader = new StrPtrLenDel(responseString, kMinHeaderSizeInBytes);
-  fHTTPHeaderFormatter =
-      new ResizeableStringFormatter(fHTTPHeader->Ptr, fHTTPHeader->Len);
+  // Start in the packet's own buffer, only a long header allocates. A second
+  // header for the same packet, or one after Reset, reuses the formatter.
+  if (fHTTPHeaderFormatter == nullptr)
+    fHTTPHeaderFormatter =
+        new ResizeableStringFormatter(fHTTPHeaderBuffer, kMinHeaderSizeInBytes);
+  else
+    fHTTPHeaderFormatter->Reset();
 
   // make a partial header for the given version and status code
   putStatusLine(fHTTPHeaderFormatter, fStatusCode, fVersion);
 
   Assert(fSvrHeader.Ptr != NULL);
-  AppendResponseHeader(httpServerHeader, &fSvrHeader);
+  if (fSvrHeader.Ptr == CFEnv::GetServerHeader().Ptr)
+    fHTTPHeaderFormatter->Put(serverHeaderLine());
+  else
+    AppendResponseHeader(httpServerHeader, &fSvrHeader);
   AppendDateField();
 
   // Access-Control-Allow-Origin: *
-  AppendResponseHeader(httpAccessControlAllowOriginHeader, &sAllString);
+  fHTTPHeaderFormatter->Put(sAllowAllOriginLine);
+
+  if (fExtraHeaders != nullptr)
+    fHTTPHeaderFormatter->Put(fExtraHeaders->GetBufPtr(),
+                              fExtraHeaders->GetCurrentOffset());
 
-  fHTTPHeader->Len = fHTTPHeaderFormatter->GetCurrentOffset();
+  fHTTPHeader.Set(fHTTPHeaderFormatter->GetBufPtr(),
+                  fHTTPHeaderFormatter->GetCurrentOffset());
   return true;
 }
 
 bool HTTPPacket::CreateRequestHeader() {
   if (fHTTPType != httpRequestType) return false;
 
-  // If we are creating a second response for the same request, make sure and
-  // deallocate memory for old response and allocate fresh memory
-  delete fHTTPHeader;
-  delete fHTTPHeaderFormatter;
-
-  // Allocate memory for the response when you first create it
-  char *responseString = new char[kMinHeaderSizeInBytes];
-  fHTTPHeader = new StrPtrLenDel(responseString, kMinHeaderSizeInBytes);
-  fHTTPHeaderFormatter =
-      new ResizeableStringFormatter(fHTTPHeader->Ptr, fHTTPHeader->Len);
+  // Start in the packet's own buffer, only a long header allocates. A second
+  // header for the same packet, or one after Reset, reuses the formatter.
+  if (fHTTPHeaderFormatter == nullptr)
+    fHTTPHeaderFormatter =
+        new ResizeableStringFormatter(fHTTPHeaderBuffer, kMinHeaderSizeInBytes);
+  else
+    fHTTPHeaderFormatter->Reset();
 
   //make a partial header for the given version and status code
   putMethedLine(fHTTPHeaderFormatter, fMethod, fVersion);
@@ -440,14 +675,39 @@ bool HTTPPacket::CreateRequestHeader() {
   Assert(fSvrHeader.Ptr != NULL);
   AppendResponseHeader(httpUserAgentHeader, &fSvrHeader);
 
-  fHTTPHeader->Len = fHTTPHeaderFormatter->GetCurrentOffset();
+  fHTTPHeader.Set(fHTTPHeaderFormatter->GetBufPtr(),
+                  fHTTPHeaderFormatter->GetCurrentOffset());
   return true;
 }
 
 StrPtrLen *HTTPPacket::GetCompleteHTTPHeader() const {
   fHTTPHeaderFormatter->PutEOL();
-  fHTTPHeader->Len = fHTTPHeaderFormatter->GetCurrentOffset();
-  return fHTTPHeader;
+  fHTTPHeader.Set(fHTTPHeaderFormatter->GetBufPtr(),
+                  fHTTPHeaderFormatter->GetCurrentOffset());
+  return &fHTTPHeader;
+}
+
+void HTTPPacket::AddResponseHeader(HTTPHeader inHeader, const StrPtrLen &inValue) {
+  if (fExtraHeaders == nullptr)
+    fExtraHeaders = new ResizeableStringFormatter(nullptr, 0);
+
+  fExtraHeaders->Put(HTTPProtocol::GetHeaderString(inHeader));
+  fExtraHeaders->Put(sColonSpace);
+  fExtraHeaders->Put(inValue);
+  fExtraHeaders->PutEOL();
+}
+
+void HTTPPacket::AddResponseHeaderLines(const StrPtrLen &inLines) {
+  if (fExtraHeaders == nullptr)
+    fExtraHeaders = new ResizeableStringFormatter(nullptr, 0);
+
+  fExtraHeaders->Put(inLines);
+}
+
+StrPtrLen HTTPPacket::GetAddedResponseHeaders() {
+  if (fExtraHeaders == nullptr)
+    return StrPtrLen();
+  return StrPtrLen(fExtraHeaders->GetBufPtr(), fExtraHeaders->GetCurrentOffset());
 }
 
 void HTTPPacket::AppendResponseHeader(HTTPHeader inHeader,
@@ -456,27 +716,30 @@ void HTTPPacket::AppendResponseHeader(HTTPHeader inHeader,
   fHTTPHeaderFormatter->Put(sColonSpace);
   fHTTPHeaderFormatter->Put(*inValue);
   fHTTPHeaderFormatter->PutEOL();
-  fHTTPHeader->Len = fHTTPHeaderFormatter->GetCurrentOffset();
+  fHTTPHeader.Set(fHTTPHeaderFormatter->GetBufPtr(),
+                  fHTTPHeaderFormatter->GetCurrentOffset());
 }
 
 void HTTPPacket::AppendContentLengthHeader(UInt64 length_64bit) const {
-  //char* contentLength = new char[256];
-  char contentLength[256] = {0};
-  s_sprintf(contentLength, "%" _U64BITARG_ "", length_64bit);
-  StrPtrLen contentLengthPtr(contentLength);
+  // digits from the end of the buffer, no sprintf
+  char contentLength[20];
+  char *theDigit = contentLength + sizeof(contentLength);
+  do {
+    *--theDigit = (char) ('0' + length_64bit % 10);
+    length_64bit /= 10;
+  } while (length_64bit != 0);
+  StrPtrLen contentLengthPtr(theDigit, (UInt32) (contentLength + sizeof(contentLength) - theDigit));
   AppendResponseHeader(httpContentLengthHeader, &contentLengthPtr);
 }
 
 void HTTPPacket::AppendContentLengthHeader(UInt32 length_32bit) const {
-  //char* contentLength = new char[256];
-  char contentLength[256] = {0};
-  s_sprintf(contentLength, "%"   _U32BITARG_   "", length_32bit);
-  StrPtrLen contentLengthPtr(contentLength);
-  AppendResponseHeader(httpContentLengthHeader, &contentLengthPtr);
+  this->AppendContentLengthHeader((UInt64) length_32bit);
 }
 
 void HTTPPacket::AppendConnectionCloseHeader() const {
-  AppendResponseHeader(httpConnectionHeader, &sCloseString);
+  fHTTPHeaderFormatter->Put(sConnectionCloseLine);
+  fHTTPHeader.Set(fHTTPHeaderFormatter->GetBufPtr(),
+                  fHTTPHeaderFormatter->GetCurrentOffset());
 }
 
 void HTTPPacket::AppendConnectionKeepAliveHeader() const {
@@ -484,11 +747,7 @@ void HTTPPacket::AppendConnectionKeepAliveHeader() const {
 }
 
 void HTTPPacket::AppendDateAndExpiresFields() const {
-  Assert(Core::Thread::GetCurrent() != NULL);
-  DateBuffer *theDateBuffer = Core::Thread::GetCurrent()->GetDateBuffer();
-  theDateBuffer
-      ->InexactUpdate(); // Update the date buffer to the current date & Time
-  StrPtrLen theDate(theDateBuffer->GetDateBuffer(), DateBuffer::kDateBufferLen);
+  StrPtrLen theDate((char *) DateCache::Get(), DateBuffer::kDateBufferLen);
 
   // Append dates, and have this response expire immediately
   this->AppendResponseHeader(httpDateHeader, &theDate);
@@ -496,20 +755,106 @@ void HTTPPacket::AppendDateAndExpiresFields() const {
 }
 
 void HTTPPacket::AppendDateField() const {
-  Assert(Core::Thread::GetCurrent() != NULL);
-  DateBuffer *theDateBuffer = Core::Thread::GetCurrent()->GetDateBuffer();
-  theDateBuffer->InexactUpdate(); // Update the date buffer to the current date & Time
-  StrPtrLen theDate(theDateBuffer->GetDateBuffer(), DateBuffer::kDateBufferLen);
+  // shared by all threads, formatted once a second
+  StrPtrLen theDate((char *) DateCache::Get(), DateBuffer::kDateBufferLen);
 
   // Append date
   this->AppendResponseHeader(httpDateHeader, &theDate);
 }
 
 time_t HTTPPacket::ParseIfModSinceHeader() {
+  // ParseDate returns milliseconds
   time_t theIfModSinceDate = static_cast<time_t>(
-      DateTranslator::ParseDate(&fFieldValues[httpIfModifiedSinceHeader]));
+      DateTranslator::ParseDate(&fFieldValues[httpIfModifiedSinceHeader]) / 1000);
   return theIfModSinceDate;
 }
 
+bool HTTPPacket::IfNoneMatch(const StrPtrLen &inETag) {
+  StringParser theParser(&fFieldValues[httpIfNoneMatchHeader]);
+  while (theParser.GetDataRemaining() > 0) {
+    theParser.ConsumeWhitespace();
+    StrPtrLen theTag;
+    theParser.ConsumeUntil(&theTag, ',');
+    theParser.Expect(',');
+    theTag.TrimTrailingWhitespace();
+    if (theTag.Len == 1 && theTag.Ptr[0] == '*')
+      return true;
+    if (theTag.Len > 2 && theTag.Ptr[0] == 'W' && theTag.Ptr[1] == '/') {
+      theTag.Ptr += 2;
+      theTag.Len -= 2;
+    }
+    if (theTag.Equal(inETag))
+      return true;
+  }
+  return false;
+}
+
+#if HTTPPACKET_TESTING
+
+// what the session does with the packets of one request
+static bool exercise(HTTPPacket &request, HTTPPacket &response) {
+  if (request.Parse() != CF_NoErr)
+    return false;
+  char const *theName = request.GetQueryValues((char *) "name");
+  if (theName == nullptr || ::strcmp(theName, "a b") != 0
+      || ::strcmp(request.GetRequestPath(), "live/list all") != 0)
+    return false;
+
+  char *theBody = response.Allocate(13);
+  ::memcpy(theBody, "test content\n", 13);
+  response.SetBody(theBody, 13);
+  response.SetVersion(http11Version);
+  response.AddResponseHeader(httpCacheControlHeader, StrPtrLen((char *) "no-cache", 8));
+  response.CreateResponseHeader();
+  response.AppendContentLengthHeader((UInt32) response.GetBody()->Len);
+  return response.GetCompleteHTTPHeader()->Len > 0;
+}
+
+bool HTTPPacket::Test() {
+  char theRequest[] = "GET /live/list%20all?id=42&name=a+b HTTP/1.1\r\n"
+                      "Host: localhost\r\nConnection: keep-alive\r\n\r\n";
+  StrPtrLen theBuffer(theRequest, sizeof(theRequest) - 1);
+  enum { kRequests = 100000 };
+
+  // as the session did: two new packets for each request
+  UInt64 theStart = sNumAllocations;
+  SInt64 theTime = Core::Time::Microseconds();
+  for (UInt32 i = 0; i < kRequests; i++) {
+    HTTPPacket *theRequestPacket = new HTTPPacket(&theBuffer);
+    HTTPPacket *theResponsePacket = new HTTPPacket(httpResponseType);
+    bool isOK = exercise(*theRequestPacket, *theResponsePacket);
+    delete theRequestPacket;
+    delete theResponsePacket;
+    if (!isOK)
+      return false;
+  }
+  UInt64 theNew = sNumAllocations - theStart;
+  SInt64 theNewTime = Core::Time::Microseconds() - theTime;
+
+  // the packets of a session, reset for each request; the first one
+  // allocates what is kept
+  HTTPPacket theRequestPacket(httpIllegalType);
+  HTTPPacket theResponsePacket(httpResponseType);
+  theStart = sNumAllocations;
+  theTime = Core::Time::Microseconds();
+  for (UInt32 i = 0; i < kRequests; i++) {
+    theRequestPacket.Reset(&theBuffer);
+    theResponsePacket.Reset();
+    if (!exercise(theRequestPacket, theResponsePacket))
+      return false;
+    if (i == 0)
+      theStart = sNumAllocations;
+  }
+  UInt64 theReused = sNumAllocations - theStart;
+  SInt64 theReusedTime = Core::Time::Microseconds() - theTime;
+
+  s_printf("HTTPPacket::Test per request: new packets %" _U64BITARG_ " allocations, %"
+           _U64BITARG_ " ns; reset packets %" _U64BITARG_ " allocations in %u requests, %"
+           _U64BITARG_ " ns\n", theNew / kRequests, (UInt64) theNewTime * 1000 / kRequests,
+           theReused, (UInt32) kRequests, (UInt64) theReusedTime * 1000 / kRequests);
+  return theReused == 0;
+}
+#endif
+
 } // namespace Net
 } // namespace CF
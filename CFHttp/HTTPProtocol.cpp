@@ -23,20 +23,257 @@
  *
  */
 
+#include <CF/CharScan.h>
 #include <CF/Net/Http/HTTPProtocol.h>
 
+// In HTTPMethod order
+#define HTTP_METHOD_NAMES(X) \
+    X("GET")                 \
+    X("HEAD")                \
+    X("POST")                \
+    X("OPTIONS")             \
+    X("PUT")                 \
+    X("DELETE")              \
+    X("TRACE")               \
+    X("CONNECT")
+
+// In HTTPHeader order
+#define HTTP_HEADER_NAMES(X)             \
+    /* VIP headers */                    \
+    X("Connection")                      \
+    X("Date")                            \
+    X("Authorization")                   \
+    X("If-Modified-Since")               \
+    X("Server")                          \
+    X("WWW-Authenticate")                \
+    X("Expires")                         \
+    X("Last-Modified")                   \
+    /* Other general http headers */     \
+    X("Cache-Control")                   \
+    X("Pragma")                          \
+    X("Trailer")                         \
+    X("Transfer-Encoding")               \
+    X("Upgrade")                         \
+    X("Via")                             \
+    X("Warning")                         \
+    /* Other request headers */          \
+    X("Accept")                          \
+    X("Accept-Charset")                  \
+    X("Accept-Encoding")                 \
+    X("Accept-Language")                 \
+    X("Expect")                          \
+    X("From")                            \
+    X("Host")                            \
+    X("If-Match")                        \
+    X("If-None-Match")                   \
+    X("If-Range")                        \
+    X("If-Unmodified-Since")             \
+    X("Max-Forwards")                    \
+    X("Proxy-Authorization")             \
+    X("Range")                           \
+    X("Referer")                         \
+    X("TE")                              \
+    X("User-Agent")                      \
+    /* Other response headers */         \
+    X("Accept-Ranges")                   \
+    X("Age")                             \
+    X("ETag")                            \
+    X("Location")                        \
+    X("Proxy-Authenticate")              \
+    X("Retry-After")                     \
+    X("Vary")                            \
+    /* Other entity headers */           \
+    X("Allow")                           \
+    X("Content-Encoding")                \
+    X("Content-Language")                \
+    X("Content-Length")                  \
+    X("Content-Location")                \
+    X("Content-MD5")                     \
+    X("Content-Range")                   \
+    X("Content-Type")                    \
+    /* QTSS Specific headers */          \
+    X("X-SessionCookie")                 \
+    X("X-Server-IP-Address")             \
+    /* CORS headers */                   \
+    X("Access-Control-Allow-Origin")     \
+    /* Cookie */                         \
+    X("Cookie")
+
+// In HTTPVersion order
+#define HTTP_VERSION_NAMES(X) \
+    X("HTTP/0.9")             \
+    X("HTTP/1.0")             \
+    X("HTTP/1.1")
+
+// In HTTPStatusCode order
+#define HTTP_STATUS_CODES(X)                      \
+    X(100, "Continue")                         \
+    X(101, "Switching Protocols")              \
+    X(200, "OK")                               \
+    X(201, "Created")                          \
+    X(202, "Accepted")                         \
+    X(203, "Non Authoritative Information")    \
+    X(204, "No Content")                       \
+    X(205, "Reset Content")                    \
+    X(206, "Partial Content")                  \
+    X(300, "Multiple Choices")                 \
+    X(301, "Moved Permanently")                \
+    X(302, "Found")                            \
+    X(303, "See Other")                        \
+    X(304, "Not Modified")                     \
+    X(305, "Use Proxy")                        \
+    X(307, "Temporary Redirect")               \
+    X(400, "Bad Request")                      \
+    X(401, "Unauthorized")                     \
+    X(402, "Payment Required")                 \
+    X(403, "Forbidden")                        \
+    X(404, "Not Found")                        \
+    X(405, "Method Not Allowed")               \
+    X(406, "Not Acceptable")                   \
+    X(407, "Proxy Authentication Required")    \
+    X(408, "Request Time-out")                 \
+    X(409, "Conflict")                         \
+    X(410, "Gone")                             \
+    X(411, "Length Required")                  \
+    X(412, "Precondition Failed")              \
+    X(413, "Request Entity Too Large")         \
+    X(414, "Request-URI Too Large")            \
+    X(415, "Unsupported Media Type")           \
+    X(416, "Request Range Not Satisfiable")    \
+    X(417, "Expectation Failed")               \
+    X(431, "Request Header Fields Too Large")  \
+    X(500, "Internal Server Error")            \
+    X(501, "Not Implemented")                  \
+    X(502, "Bad Gateway")                      \
+    X(503, "Service Unavailable")              \
+    X(504, "Gateway Timeout")                  \
+    X(505, "HTTP Version not supported")
+
+#define HTTP_NAME_AS_STRPTRLEN(name) StrPtrLen(name),
+#define HTTP_NAME_AS_CSTRING(name) name,
+#define HTTP_STATUS_AS_REASON(code, reason) StrPtrLen(reason),
+#define HTTP_STATUS_AS_CODE(code, reason) code,
+#define HTTP_STATUS_AS_STRING(code, reason) StrPtrLen(#code),
+#define HTTP_STATUS_AS_LINE_09(code, reason) StrPtrLen("HTTP/0.9 " #code " " reason "\r\n"),
+#define HTTP_STATUS_AS_LINE_10(code, reason) StrPtrLen("HTTP/1.0 " #code " " reason "\r\n"),
+#define HTTP_STATUS_AS_LINE_11(code, reason) StrPtrLen("HTTP/1.1 " #code " " reason "\r\n"),
+
 namespace CF {
 namespace Net {
 
+namespace {
+
+/*
+ * Names are looked up with a perfect hash of their length and their first
+ * and last char, case folded. Each table picks the multipliers and the
+ * number of slots; the compiler fills the slot tables from the name lists
+ * and the static_asserts fail the build if two names share a slot. A
+ * lookup is one hash, one table load and one compare.
+ */
+
+constexpr UInt32 cStrLen(char const *inStr) {
+  return *inStr == '\0' ? 0 : 1 + cStrLen(inStr + 1);
+}
+
+// inLen must not be 0
+template<typename Table>
+constexpr UInt32 nameHash(char const *inName, UInt32 inLen) {
+  return (inLen * Table::kLenMul
+      + ((UInt8) inName[0] | 0x20) * Table::kFirstMul
+      + ((UInt8) inName[inLen - 1] | 0x20)) & (Table::kNumSlots - 1);
+}
+
+template<typename Table>
+constexpr UInt32 nameHash(UInt32 inIndex) {
+  return nameHash<Table>(Table::Name(inIndex), cStrLen(Table::Name(inIndex)));
+}
+
+// the name in inSlot, or kNumNames for none
+template<typename Table>
+constexpr UInt8 slotOwner(UInt32 inSlot, UInt32 inIndex = 0) {
+  return inIndex == Table::kNumNames ? (UInt8) Table::kNumNames
+      : nameHash<Table>(inIndex) == inSlot ? (UInt8) inIndex
+      : slotOwner<Table>(inSlot, inIndex + 1);
+}
+
+template<typename Table>
+constexpr bool sharesSlot(UInt32 inIndex, UInt32 inOther) {
+  return inOther != Table::kNumNames
+      && (nameHash<Table>(inIndex) == nameHash<Table>(inOther)
+          || sharesSlot<Table>(inIndex, inOther + 1));
+}
+
+template<typename Table>
+constexpr bool isPerfect(UInt32 inIndex = 0) {
+  return inIndex == Table::kNumNames
+      || (!sharesSlot<Table>(inIndex, inIndex + 1) && isPerfect<Table>(inIndex + 1));
+}
+
+template<UInt32... I>
+struct IndexList {};
+
+template<UInt32 N, UInt32... I>
+struct MakeIndexList : MakeIndexList<N - 1, N - 1, I...> {};
+
+template<UInt32... I>
+struct MakeIndexList<0, I...> {
+  typedef IndexList<I...> Type;
+};
+
+template<typename Table, typename Slots = typename MakeIndexList<Table::kNumSlots>::Type>
+struct SlotTable;
+
+template<typename Table, UInt32... I>
+struct SlotTable<Table, IndexList<I...> > {
+  static constexpr UInt8 sSlots[sizeof...(I)] = {slotOwner<Table>(I)...};
+};
+
+template<typename Table, UInt32... I>
+constexpr UInt8 SlotTable<Table, IndexList<I...> >::sSlots[sizeof...(I)];
+
+template<typename Table>
+UInt32 lookup(const StrPtrLen *inName) {
+  if (inName->Len == 0)
+    return Table::kNumNames;
+  return SlotTable<Table>::sSlots[nameHash<Table>(inName->Ptr, inName->Len)];
+}
+
+constexpr char const *kMethodNames[] = {HTTP_METHOD_NAMES(HTTP_NAME_AS_CSTRING)};
+constexpr char const *kHeaderNames[] = {HTTP_HEADER_NAMES(HTTP_NAME_AS_CSTRING)};
+constexpr char const *kVersionNames[] = {HTTP_VERSION_NAMES(HTTP_NAME_AS_CSTRING)};
+constexpr SInt32 kStatusCodes[] = {HTTP_STATUS_CODES(HTTP_STATUS_AS_CODE)};
+
+struct MethodTable {
+  enum { kNumNames = httpNumMethods, kNumSlots = 16, kLenMul = 2, kFirstMul = 9 };
+  static constexpr char const *Name(UInt32 inIndex) { return kMethodNames[inIndex]; }
+};
+
+struct HeaderTable {
+  enum { kNumNames = httpNumHeaders, kNumSlots = 256, kLenMul = 12, kFirstMul = 15 };
+  static constexpr char const *Name(UInt32 inIndex) { return kHeaderNames[inIndex]; }
+};
+
+struct VersionTable {
+  enum { kNumNames = httpNumVersions, kNumSlots = 16, kLenMul = 0, kFirstMul = 0 };
+  static constexpr char const *Name(UInt32 inIndex) { return kVersionNames[inIndex]; }
+};
+
+static_assert(sizeof(kMethodNames) / sizeof(kMethodNames[0]) == httpNumMethods,
+              "HTTP_METHOD_NAMES and HTTPMethod differ");
+static_assert(sizeof(kHeaderNames) / sizeof(kHeaderNames[0]) == httpNumHeaders,
+              "HTTP_HEADER_NAMES and HTTPHeader differ");
+static_assert(sizeof(kVersionNames) / sizeof(kVersionNames[0]) == httpNumVersions,
+              "HTTP_VERSION_NAMES and HTTPVersion differ");
+static_assert(sizeof(kStatusCodes) / sizeof(kStatusCodes[0]) == httpNumStatusCodes,
+              "HTTP_STATUS_CODES and HTTPStatusCode differ");
+static_assert(isPerfect<MethodTable>(), "two methods share a slot, change MethodTable");
+static_assert(isPerfect<HeaderTable>(), "two headers share a slot, change HeaderTable");
+static_assert(isPerfect<VersionTable>(), "two versions share a slot, change VersionTable");
+
+}
+
 const StrPtrLen HTTPProtocol::sMethods[] = {
-    StrPtrLen("GET"),
-    StrPtrLen("HEAD"),
-    StrPtrLen("POST"),
-    StrPtrLen("OPTIONS"),
-    StrPtrLen("PUT"),
-    StrPtrLen("DELETE"),
-    StrPtrLen("TRACE"),
-    StrPtrLen("CONNECT"),
+    HTTP_METHOD_NAMES(HTTP_NAME_AS_STRPTRLEN)
 };
 
 const StrPtrLen HTTPProtocol::sStreamTypes[] = {
@@ -46,302 +283,61 @@ const StrPtrLen HTTPProtocol::sStreamTypes[] = {
 };
 
 HTTPMethod HTTPProtocol::GetMethod(const StrPtrLen *inMethodStr) {
-  HTTPMethod theMethod = httpIllegalMethod;
-
-  if (inMethodStr->Len == 0)
-    return httpIllegalMethod;
-
-  /* 快速预测 */
-  switch ((inMethodStr->Ptr)[0]) {
-    case 'G': theMethod = httpGetMethod;
-      break;
-    case 'H': theMethod = httpHeadMethod;
-      break;
-    case 'P': theMethod = httpPostMethod;
-      break;  // Most likely POST and not PUT
-    case 'O': theMethod = httpOptionsMethod;
-      break;
-    case 'D': theMethod = httpDeleteMethod;
-      break;
-    case 'T': theMethod = httpTraceMethod;
-      break;
-    case 'C': theMethod = httpConnectMethod;
-      break;
-    default: break;
-  }
-
-  /* 检查确认 */
-  if ((theMethod != httpIllegalMethod)
-      && (inMethodStr->Equal(sMethods[theMethod])))
-    return theMethod;
-
-  // Check for remaining methods (Only PUT method is left)
-  if (inMethodStr->Equal(sMethods[httpPutMethod]))
-    return httpPutMethod;
+  UInt32 theMethod = lookup<MethodTable>(inMethodStr);
 
+  // methods are case sensitive
+  if (theMethod != httpIllegalMethod && inMethodStr->Equal(sMethods[theMethod]))
+    return (HTTPMethod) theMethod;
   return httpIllegalMethod;
 }
 
 const StrPtrLen HTTPProtocol::sHeaders[] = {
-    StrPtrLen("Connection"),
-    StrPtrLen("Date"),
-    StrPtrLen("Authorization"),
-    StrPtrLen("If-Modified-Since"),
-    StrPtrLen("Server"),
-    StrPtrLen("WWW-Authenticate"),
-    StrPtrLen("Expires"),
-    StrPtrLen("Last-Modified"),
-
-    StrPtrLen("Cache-Control"),
-    StrPtrLen("Pragma"),
-    StrPtrLen("Trailer"),
-    StrPtrLen("Transfer-Encoding"),
-    StrPtrLen("Upgrade"),
-    StrPtrLen("Via"),
-    StrPtrLen("Warning"),
-
-    StrPtrLen("Accept"),
-    StrPtrLen("Accept-Charset"),
-    StrPtrLen("Accept-Encoding"),
-    StrPtrLen("Accept-Language"),
-    StrPtrLen("Expect"),
-    StrPtrLen("From"),
-    StrPtrLen("Host"),
-    StrPtrLen("If-Match"),
-    StrPtrLen("If-None-Match"),
-    StrPtrLen("If-Range"),
-    StrPtrLen("If-Unmodified-Since"),
-    StrPtrLen("Max-Forwards"),
-    StrPtrLen("Proxy-Authorization"),
-    StrPtrLen("Range"),
-    StrPtrLen("Referer"),
-    StrPtrLen("TE"),
-    StrPtrLen("User-Agent"),
-
-    StrPtrLen("Accept-Ranges"),
-    StrPtrLen("Age"),
-    StrPtrLen("ETag"),
-    StrPtrLen("Location"),
-    StrPtrLen("Proxy-Authenticate"),
-    StrPtrLen("Retry-After"),
-    StrPtrLen("Vary"),
-
-    StrPtrLen("Allow"),
-    StrPtrLen("Content-Encoding"),
-    StrPtrLen("Content-Language"),
-    StrPtrLen("Content-Length"),
-    StrPtrLen("Content-Location"),
-    StrPtrLen("Content-MD5"),
-    StrPtrLen("Content-Range"),
-    StrPtrLen("Content-Type"),
-
-    StrPtrLen("X-SessionCookie"),
-    StrPtrLen("X-Server-IP-Address"),
-
-    StrPtrLen("Access-Control-Allow-Origin"),
-
-    StrPtrLen("Cookie"),
-
+    HTTP_HEADER_NAMES(HTTP_NAME_AS_STRPTRLEN)
     StrPtrLen(" ,")
 };
 
 HTTPHeader HTTPProtocol::GetHeader(const StrPtrLen *inHeaderStr) {
-  if (inHeaderStr->Len == 0)
-    return httpIllegalHeader;
-
-  HTTPHeader theHeader = httpIllegalHeader;
-
-  //chances are this is one of our selected "VIP" headers. so check for this.
-  switch ((inHeaderStr->Ptr)[0]) {
-    case 'C':
-    case 'c': theHeader = httpConnectionHeader;
-      break;
-    case 'S':
-    case 's': theHeader = httpServerHeader;
-      break;
-    case 'D':
-    case 'd': theHeader = httpDateHeader;
-      break;
-    case 'A':
-    case 'a': theHeader = httpAuthorizationHeader;
-      break;
-    case 'W':
-    case 'w': theHeader = httpWWWAuthenticateHeader;
-      break;
-    case 'I':
-    case 'i': theHeader = httpIfModifiedSinceHeader;
-      break;
-    case 'E':
-    case 'e': theHeader = httpExpiresHeader;
-      break;
-    case 'L':
-    case 'l': theHeader = httpLastModifiedHeader;
-      break;
-      // Added this to optimize for HTTP tunnelling in the server (Not really a VIP header)
-    case 'X':
-    case 'x': theHeader = httpSessionCookieHeader;
-      break;
-    default: break;
-  }
+  UInt32 theHeader = lookup<HeaderTable>(inHeaderStr);
 
-  if ((theHeader != httpIllegalHeader) &&
-      (inHeaderStr->EqualIgnoreCase(sHeaders[theHeader].Ptr,
-                                    sHeaders[theHeader].Len)))
-    return theHeader;
-
-  //If this isn't one of our VIP headers, go through the remaining request headers, trying
-  //to find the right one.
-  for (SInt32 x = httpNumVIPHeaders; x < httpNumHeaders; x++)
-    if (inHeaderStr->EqualIgnoreCase(sHeaders[x].Ptr, sHeaders[x].Len))
-      return (HTTPHeader) x;
+  if (theHeader != httpIllegalHeader
+      && sHeaders[theHeader].Len == inHeaderStr->Len
+      && CharScan::EqualIgnoreCase(inHeaderStr->Ptr, sHeaders[theHeader].Ptr,
+                                   inHeaderStr->Len))
+    return (HTTPHeader) theHeader;
   return httpIllegalHeader;
 }
 
 const StrPtrLen HTTPProtocol::sStatusCodeStrings[] = {
-    StrPtrLen("Continue"),                      //kContinue
-    StrPtrLen("Switching Protocols"),           //kSwitchingProtocols
-    StrPtrLen("OK"),                            //kOK
-    StrPtrLen("Created"),                       //kCreated
-    StrPtrLen("Accepted"),                      //kAccepted
-    StrPtrLen("Non Authoritative Information"), //kNonAuthoritativeInformation
-    StrPtrLen("No Content"),                    //kNoContent
-    StrPtrLen("Reset Content"),                 //kResetContent
-    StrPtrLen("Partial Content"),               //kPartialContent
-    StrPtrLen("Multiple Choices"),              //kMultipleChoices
-    StrPtrLen("Moved Permanently"),             //kMovedPermanently
-    StrPtrLen("Found"),                         //kFound
-    StrPtrLen("See Other"),                     //kSeeOther
-    StrPtrLen("Not Modified"),                  //kNotModified
-    StrPtrLen("Use Proxy"),                     //kUseProxy
-    StrPtrLen("Temporary Redirect"),            //kTemporaryRedirect
-    StrPtrLen("Bad Request"),                   //kBadRequest
-    StrPtrLen("Unauthorized"),                  //kUnAuthorized
-    StrPtrLen("Payment Required"),              //kPaymentRequired
-    StrPtrLen("Forbidden"),                     //kForbidden
-    StrPtrLen("Not Found"),                     //kNotFound
-    StrPtrLen("Method Not Allowed"),            //kMethodNotAllowed
-    StrPtrLen("Not Acceptable"),                //kNotAcceptable
-    StrPtrLen("Proxy Authentication Required"), //kProxyAuthenticationRequired
-    StrPtrLen("Request Time-out"),              //kRequestTimeout
-    StrPtrLen("Conflict"),                      //kConflict
-    StrPtrLen("Gone"),                          //kGone
-    StrPtrLen("Length Required"),               //kLengthRequired
-    StrPtrLen("Precondition Failed"),           //kPreconditionFailed
-    StrPtrLen("Request Entity Too Large"),      //kRequestEntityTooLarge
-    StrPtrLen("Request-URI Too Large"),         //kRequestURITooLarge
-    StrPtrLen("Unsupported Media Type"),        //kUnsupportedMediaType
-    StrPtrLen("Request Range Not Satisfiable"), //kRequestRangeNotSatisfiable
-    StrPtrLen("Expectation Failed"),            //kExpectationFailed
-    StrPtrLen("Internal Server Error"),         //kInternalServerError
-    StrPtrLen("Not Implemented"),               //kNotImplemented
-    StrPtrLen("Bad Gateway"),                   //kBadGateway
-    StrPtrLen("Service Unavailable"),           //kServiceUnavailable
-    StrPtrLen("Gateway Timeout"),               //kGatewayTimeout
-    StrPtrLen("HTTP Version not supported")     //kHTTPVersionNotSupported
+    HTTP_STATUS_CODES(HTTP_STATUS_AS_REASON)
 };
 
 const SInt32 HTTPProtocol::sStatusCodes[] = {
-    100,            //kContinue
-    101,            //kSwitchingProtocols
-    200,            //kOK
-    201,            //kCreated
-    202,            //kAccepted
-    203,            //kNonAuthoritativeInformation
-    204,            //kNoContent
-    205,            //kResetContent
-    206,            //kPartialContent
-    300,            //kMultipleChoices
-    301,            //kMovedPermanently
-    302,            //kFound
-    303,            //kSeeOther
-    304,            //kNotModified
-    305,            //kUseProxy
-    307,            //kTemporaryRedirect
-    400,            //kBadRequest
-    401,            //kUnAuthorized
-    402,            //kPaymentRequired
-    403,            //kForbidden
-    404,            //kNotFound
-    405,            //kMethodNotAllowed
-    406,            //kNotAcceptable
-    407,            //kProxyAuthenticationRequired
-    408,            //kRequestTimeout
-    409,            //kConflict
-    410,            //kGone
-    411,            //kLengthRequired
-    412,            //kPreconditionFailed
-    413,            //kRequestEntityTooLarge
-    414,            //kRequestURITooLarge
-    415,            //kUnsupportedMediaType
-    416,            //kRequestRangeNotSatisfiable
-    417,            //kExpectationFailed
-    500,            //kInternalServerError
-    501,            //kNotImplemented
-    502,            //kBadGateway
-    503,            //kServiceUnavailable
-    504,            //kGatewayTimeout
-    505             //kHTTPVersionNotSupported
+    HTTP_STATUS_CODES(HTTP_STATUS_AS_CODE)
 };
 
 const StrPtrLen HTTPProtocol::sStatusCodeAsStrings[] = {
-    StrPtrLen("100"),               //kContinue
-    StrPtrLen("101"),               //kSwitchingProtocols
-    StrPtrLen("200"),               //kOK
-    StrPtrLen("201"),               //kCreated
-    StrPtrLen("202"),               //kAccepted
-    StrPtrLen("203"),               //kNonAuthoritativeInformation
-    StrPtrLen("204"),               //kNoContent
-    StrPtrLen("205"),               //kResetContent
-    StrPtrLen("206"),               //kPartialContent
-    StrPtrLen("300"),               //kMultipleChoices
-    StrPtrLen("301"),               //kMovedPermanently
-    StrPtrLen("302"),               //kFound
-    StrPtrLen("303"),               //kSeeOther
-    StrPtrLen("304"),               //kNotModified
-    StrPtrLen("305"),               //kUseProxy
-    StrPtrLen("307"),               //kTemporaryRedirect
-    StrPtrLen("400"),               //kBadRequest
-    StrPtrLen("401"),               //kUnAuthorized
-    StrPtrLen("402"),               //kPaymentRequired
-    StrPtrLen("403"),               //kForbidden
-    StrPtrLen("404"),               //kNotFound
-    StrPtrLen("405"),               //kMethodNotAllowed
-    StrPtrLen("406"),               //kNotAcceptable
-    StrPtrLen("407"),               //kProxyAuthenticationRequired
-    StrPtrLen("408"),               //kRequestTimeout
-    StrPtrLen("409"),               //kConflict
-    StrPtrLen("410"),               //kGone
-    StrPtrLen("411"),               //kLengthRequired
-    StrPtrLen("412"),               //kPreconditionFailed
-    StrPtrLen("413"),               //kRequestEntityTooLarge
-    StrPtrLen("414"),               //kRequestURITooLarge
-    StrPtrLen("415"),               //kUnsupportedMediaType
-    StrPtrLen("416"),               //kRequestRangeNotSatisfiable
-    StrPtrLen("417"),               //kExpectationFailed
-    StrPtrLen("500"),               //kInternalServerError
-    StrPtrLen("501"),               //kNotImplemented
-    StrPtrLen("502"),               //kBadGateway
-    StrPtrLen("503"),               //kServiceUnavailable
-    StrPtrLen("504"),               //kGatewayTimeout
-    StrPtrLen("505")                //kHTTPVersionNotSupported
+    HTTP_STATUS_CODES(HTTP_STATUS_AS_STRING)
+};
+
+// Complete status lines, so a response starts with one copy
+const StrPtrLen HTTPProtocol::sStatusLines[][httpNumStatusCodes] = {
+    {HTTP_STATUS_CODES(HTTP_STATUS_AS_LINE_09)},
+    {HTTP_STATUS_CODES(HTTP_STATUS_AS_LINE_10)},
+    {HTTP_STATUS_CODES(HTTP_STATUS_AS_LINE_11)}
 };
 
 const StrPtrLen HTTPProtocol::sVersionStrings[] = {
-    StrPtrLen("HTTP/0.9"),
-    StrPtrLen("HTTP/1.0"),
-    StrPtrLen("HTTP/1.1")
+    HTTP_VERSION_NAMES(HTTP_NAME_AS_STRPTRLEN)
 };
 
 HTTPVersion HTTPProtocol::GetVersion(StrPtrLen *versionStr) {
   if (versionStr->Len != 8)
     return httpIllegalVersion;
-  SInt32 limit = httpNumVersions;
-  for (SInt32 x = 0; x < limit; x++) {
-    if (versionStr->EqualIgnoreCase(sVersionStrings[x].Ptr,
-                                    sVersionStrings[x].Len))
-      return (HTTPVersion) x;
-  }
 
+  UInt32 theVersion = lookup<VersionTable>(versionStr);
+  if (theVersion != httpIllegalVersion
+      && CharScan::EqualIgnoreCase(versionStr->Ptr, sVersionStrings[theVersion].Ptr, 8))
+    return (HTTPVersion) theVersion;
   return httpIllegalVersion;
 }
 
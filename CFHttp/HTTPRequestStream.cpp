@@ -28,36 +28,461 @@
     Contains:   Implementation of HTTPRequestStream class.
 */
 
+#include <new>
 #include <CF/Net/Http/HTTPRequestStream.h>
-#include <CF/StringParser.h>
 #include <CF/Core/Time.h>
+#include <CF/CharScan.h>
 #include <CF/base64.h>
+#include <CF/Net/Socket/ConnectionGovernor.h>
 
 #define READ_DEBUGGING 0
 
 using namespace CF::Net;
 
+CF::BufferPool HTTPRequestStream::sBufferPool(kSegmentSizeInBytes);
+
+CF::BufferPool HTTPRequestStream::sIndexPool(sizeof(HTTPHeaderIndex));
+
+UInt32 HTTPRequestStream::sMaxSegments =
+    kDefaultMaxHeaderSize / HTTPRequestStream::kSegmentSizeInBytes;
+
+void HTTPRequestStream::SetMaxHeaderSize(UInt32 inMaxHeaderSize) {
+  UInt32 theNumSegments =
+      (inMaxHeaderSize + kSegmentSizeInBytes - 1) / kSegmentSizeInBytes;
+  if (theNumSegments < 1)
+    theNumSegments = 1;
+  if (theNumSegments > kMaxSegments)
+    theNumSegments = kMaxSegments;
+  sMaxSegments = theNumSegments;
+}
+
 HTTPRequestStream::HTTPRequestStream(TCPSocket *sock)
     : fSocket(sock),
       fRetreatBytes(0),
       fRetreatBytesRead(0),
+      fFirstSegment(nullptr),
+      fSegments(&fFirstSegment),
+      fNumSegments(0),
       fCurOffset(0),
       fEncodedBytesRemaining(0),
-      fRequest(fRequestBuffer, 0),
+      fDecodeBuffer(nullptr),
+      fLinearBuffer(nullptr),
+      fLinearBufferLen(0),
+      fIndex(nullptr),
+      fRequest(nullptr, 0),
       fRequestPtr(NULL),
       fDecode(false),
-      fPrintRTSP(false) {}
+      fPrintRTSP(false) {
+  this->resetScan();
+}
+
+HTTPRequestStream::~HTTPRequestStream() {
+  // We may have to delete this memory if it was allocated due to base64 decoding
+  delete[] fDecodeBuffer;
+  this->freeLinearBuffer();
+  this->freeSegmentsFrom(0);
+}
+
+void HTTPRequestStream::acquireBuffer() {
+  if (fNumSegments == 0)
+    this->addSegment();
+
+  // a base64 request keeps its own decoded buffer
+  if (fRequest.Ptr == nullptr)
+    fRequest.Ptr = fSegments[0];
+}
+
+void HTTPRequestStream::releaseBufferIfIdle() {
+  if (fNumSegments == 0)
+    return;
+
+  // anything buffered, a request being processed, or a decoded request
+  // still pointing into the stream keeps the buffer
+  if (fCurOffset > 0 || fRetreatBytes > 0 || fEncodedBytesRemaining > 0
+      || fRequestPtr != NULL || fDecodeBuffer != nullptr)
+    return;
+
+  this->freeLinearBuffer();
+  this->freeSegmentsFrom(0);
+  fRequest.Set(nullptr, 0);
+}
+
+bool HTTPRequestStream::addSegment() {
+  if (fNumSegments == sMaxSegments)
+    return false;
+
+  if (fNumSegments == 1) {
+    // the first one outgrew, the table comes from the heap now
+    fSegments = new char *[kMaxSegments];
+    fSegments[0] = fFirstSegment;
+  }
+
+  fSegments[fNumSegments++] = (char *) sBufferPool.Get();
+  ConnectionGovernor::AddMemory(kSegmentSizeInBytes);
+
+  if (fIndex == nullptr) {
+    fIndex = new(sIndexPool.Get()) HTTPHeaderIndex;
+    ConnectionGovernor::AddMemory(sizeof(HTTPHeaderIndex));
+  }
+  return true;
+}
+
+void HTTPRequestStream::freeSegmentsFrom(UInt32 inIndex) {
+  while (fNumSegments > inIndex) {
+    sBufferPool.Put(fSegments[--fNumSegments]);
+    ConnectionGovernor::RemoveMemory(kSegmentSizeInBytes);
+  }
+
+  if (fNumSegments <= 1 && fSegments != &fFirstSegment) {
+    fFirstSegment = fSegments[0];
+    delete[] fSegments;
+    fSegments = &fFirstSegment;
+  }
+  if (fNumSegments == 0) {
+    fFirstSegment = nullptr;
+    if (fIndex != nullptr) {
+      sIndexPool.Put(fIndex);
+      ConnectionGovernor::RemoveMemory(sizeof(HTTPHeaderIndex));
+      fIndex = nullptr;
+    }
+  }
+}
+
+char *HTTPRequestStream::getReadSpace(UInt32 *outLen) {
+  if (fDecode) {
+    // the encoded data and its decoding stay in one segment each
+    *outLen = (kSegmentSizeInBytes - fCurOffset) - 1;
+    return &fSegments[0][fCurOffset];
+  }
+
+  UInt32 theIndex = fCurOffset / kSegmentSizeInBytes;
+  if (theIndex == fNumSegments && !this->addSegment()) {
+    *outLen = 0;
+    return nullptr;
+  }
+
+  UInt32 theOffset = fCurOffset % kSegmentSizeInBytes;
+  *outLen = kSegmentSizeInBytes - theOffset;
+  return &fSegments[theIndex][theOffset];
+}
+
+char *HTTPRequestStream::getMessagePtr(UInt32 inOffset,
+                                       UInt32 *outContiguousLen) {
+  if (fDecodeBuffer != nullptr) {
+    *outContiguousLen = kSegmentSizeInBytes - inOffset;
+    return fDecodeBuffer + inOffset;
+  }
+
+  UInt32 theOffset = inOffset % kSegmentSizeInBytes;
+  *outContiguousLen = kSegmentSizeInBytes - theOffset;
+  return &fSegments[inOffset / kSegmentSizeInBytes][theOffset];
+}
+
+void HTTPRequestStream::copyMessage(UInt32 inOffset,
+                                    char *outBuffer,
+                                    UInt32 inLen) {
+  while (inLen > 0) {
+    UInt32 theLen = 0;
+    char *thePtr = this->getMessagePtr(inOffset, &theLen);
+    if (theLen > inLen)
+      theLen = inLen;
+    ::memcpy(outBuffer, thePtr, theLen);
+    outBuffer += theLen;
+    inOffset += theLen;
+    inLen -= theLen;
+  }
+}
+
+void HTTPRequestStream::moveToFront(UInt32 inOffset, UInt32 inLen) {
+  // Going up piece by piece never overwrites a byte not moved yet, the
+  // destination is always below the source.
+  UInt32 theDest = 0;
+  while (inLen > 0) {
+    UInt32 theSrcLen = 0, theDestLen = 0;
+    char *theSrc = this->getMessagePtr(inOffset, &theSrcLen);
+    char *theDst = this->getMessagePtr(theDest, &theDestLen);
+    UInt32 theLen = inLen;
+    if (theLen > theSrcLen)
+      theLen = theSrcLen;
+    if (theLen > theDestLen)
+      theLen = theDestLen;
+    ::memmove(theDst, theSrc, theLen);
+    theDest += theLen;
+    inOffset += theLen;
+    inLen -= theLen;
+  }
+}
+
+char *HTTPRequestStream::linearize(UInt32 inLen) {
+  if (fDecodeBuffer != nullptr)
+    return fDecodeBuffer;
+  if (inLen <= kSegmentSizeInBytes)
+    return fSegments[0];
+
+  fLinearBuffer = new char[inLen];
+  fLinearBufferLen = inLen;
+  ConnectionGovernor::AddMemory(fLinearBufferLen);
+  this->copyMessage(0, fLinearBuffer, inLen);
+  return fLinearBuffer;
+}
+
+void HTTPRequestStream::freeLinearBuffer() {
+  if (fLinearBuffer != nullptr) {
+    ConnectionGovernor::RemoveMemory(fLinearBufferLen);
+    delete[] fLinearBuffer;
+    fLinearBuffer = nullptr;
+    fLinearBufferLen = 0;
+  }
+}
+
+void HTTPRequestStream::resetScan() {
+  fScanOffset = 0;
+  fScanState = kScanInLine;
+  fFirstLineLen = 0;
+  fFirstLineHasSpace = false;
+  fFirstLineDone = false;
+  fLineStart = fEOLStart = 0;
+  fColon = fValueStart = HTTPHeaderIndex::kNoColon;
+  if (fIndex != nullptr)
+    fIndex->Reset();
+}
+
+void HTTPRequestStream::scanLineChar(char inChar, UInt32 inOffset) {
+  if (inChar == ':') {
+    if (fColon == HTTPHeaderIndex::kNoColon) {
+      fColon = inOffset;
+      fValueStart = inOffset + 1;
+    }
+  } else if (inChar == ' ' && inOffset == fColon + 1) {
+    fValueStart = inOffset + 1; // one space after the colon is not the value
+  }
+
+  if (!fFirstLineDone) {
+    fFirstLineLen++;
+    if (inChar == ' ')
+      fFirstLineHasSpace = true;
+  }
+}
+
+void HTTPRequestStream::endLine(UInt32 inNext) {
+  if (fIndex != nullptr)
+    fIndex->AddLine(fLineStart, fEOLStart, inNext, fColon, fValueStart);
+  fLineStart = inNext;
+  fColon = fValueStart = HTTPHeaderIndex::kNoColon;
+}
+
+bool HTTPRequestStream::isPasswordLine(UInt32 inNextOffset) {
+  // If this request is actually a ShoutCast password it will be in the
+  // form of "xxxxxx\r" where "xxxxx" is the password. If we get a 1st
+  // request line with no blanks, and nothing or not a blank line follows,
+  // we assume that this is the end of the request.
+  if (fFirstLineDone)
+    return false;
+  fFirstLineDone = true;
+
+  if (fFirstLineLen == 0 || fFirstLineHasSpace)
+    return false;
+  if (inNextOffset >= fRequest.Len)
+    return true;
+
+  UInt32 theLen = 0;
+  char theNext = *this->getMessagePtr(inNextOffset, &theLen);
+  return theNext != '\r' && theNext != '\n';
+}
+
+bool HTTPRequestStream::HasRetreatRequest() {
+  if (fDecode || fRetreatBytes == 0)
+    return false;
+
+  // a line with text, then a blank one. \r\n is one line end, a \r as the
+  // last byte may still become \r\n, so it doesn't end the header yet.
+  UInt32 theOffset = fRequest.Len + fRetreatBytesRead;
+  UInt32 theEnd = theOffset + fRetreatBytes;
+  bool inText = false;      // the line so far has text
+  bool afterText = false;   // a line with text just ended
+  char thePrev = '\0';
+  while (theOffset < theEnd) {
+    UInt32 theLen = 0;
+    char *thePtr = this->getMessagePtr(theOffset, &theLen);
+    if (theLen > theEnd - theOffset)
+      theLen = theEnd - theOffset;
+
+    for (UInt32 i = 0; i < theLen; i++) {
+      char theChar = thePtr[i];
+      if (theChar == '\n' && thePrev == '\r') {
+        // the \n of a \r\n, the line ended on the \r
+      } else if (theChar == '\r' || theChar == '\n') {
+        if (afterText && (theChar == '\n' || theOffset + i + 1 < theEnd))
+          return true;
+        afterText = inText;
+        inText = false;
+      } else {
+        inText = true;
+        afterText = false;
+      }
+      thePrev = theChar;
+    }
+    theOffset += theLen;
+  }
+  return false;
+}
+
+bool HTTPRequestStream::findEndOfHeader(UInt32 *outHeaderLen) {
+  // The legal end-of-header sequences are \r\r, \r\n\r\n, & \n\n (and the
+  // mixes of them). NOT \r\n\r! If the packets arrive just a certain way,
+  // we could see that combo and must wait for a final \n. Bytes are
+  // looked at once, the state carries over to the next read.
+  while (fScanOffset < fRequest.Len) {
+    UInt32 theLen = 0;
+    char *thePtr = this->getMessagePtr(fScanOffset, &theLen);
+    if (theLen > fRequest.Len - fScanOffset)
+      theLen = fRequest.Len - fScanOffset;
+
+    for (UInt32 i = 0; i < theLen; i++) {
+      // Inside a line only the EOL, the first colon and the space after it
+      // matter, and the spaces of the request line: jump to the next one
+      if (fScanState == kScanInLine && fScanOffset + i != fColon + 1) {
+        char *theNext = thePtr + i;
+        if (!fFirstLineDone)
+          theNext = CharScan::FindEOLOr(theNext, thePtr + theLen, ' ', ':');
+        else if (fColon == HTTPHeaderIndex::kNoColon)
+          theNext = CharScan::FindEOLOr(theNext, thePtr + theLen, ':', ':');
+        else
+          theNext = CharScan::FindEOL(theNext, thePtr + theLen);
+
+        auto theSkipped = static_cast<UInt32>(theNext - (thePtr + i));
+        if (!fFirstLineDone)
+          fFirstLineLen += theSkipped;
+        i += theSkipped;
+        if (i == theLen)
+          break;
+      }
+
+      UInt32 theOffset = fScanOffset + i;
+      char theChar = thePtr[i];
+      UInt32 theEnd = 0;    // header length, if it ends here
+
+      switch (fScanState) {
+        case kScanInLine:
+          if (theChar == '\r') {
+            fEOLStart = theOffset;
+            fScanState = kScanGotCR;
+          } else if (theChar == '\n') {
+            fEOLStart = theOffset;
+            this->endLine(theOffset + 1);
+            fScanState = kScanLineStartLF;
+            if (this->isPasswordLine(theOffset + 1))
+              theEnd = theOffset + 1;
+          } else {
+            this->scanLineChar(theChar, theOffset);
+          }
+          break;
+
+        case kScanGotCR:
+          if (theChar == '\n') {
+            this->endLine(theOffset + 1);
+            fScanState = kScanLineStartCRLF;
+            if (this->isPasswordLine(theOffset + 1))
+              theEnd = theOffset + 1;
+          } else if (theChar == '\r') {
+            this->endLine(theOffset);
+            theEnd = theOffset + 1;
+          } else {
+            this->endLine(theOffset);
+            fScanState = kScanInLine;
+            if (this->isPasswordLine(theOffset))
+              theEnd = theOffset;
+            else
+              this->scanLineChar(theChar, theOffset);
+          }
+          break;
+
+        case kScanLineStartLF:
+          if (theChar == '\n' || theChar == '\r') {
+            theEnd = theOffset + 1;
+          } else {
+            fScanState = kScanInLine;
+            this->scanLineChar(theChar, theOffset);
+          }
+          break;
+
+        case kScanLineStartCRLF:
+          if (theChar == '\n') {
+            theEnd = theOffset + 1;
+          } else if (theChar == '\r') {
+            fEOLStart = theOffset;
+            fScanState = kScanBlankCR;
+          } else {
+            fScanState = kScanInLine;
+            this->scanLineChar(theChar, theOffset);
+          }
+          break;
+
+        case kScanBlankCR:
+          // the \r was an empty line, which ends the header fields
+          if (theChar == '\n') {
+            theEnd = theOffset + 1;
+          } else if (theChar == '\r') {
+            this->endLine(theOffset);
+            fEOLStart = theOffset;
+            fScanState = kScanGotCR;
+          } else {
+            this->endLine(theOffset);
+            fScanState = kScanInLine;
+            this->scanLineChar(theChar, theOffset);
+          }
+          break;
+
+        default: break;
+      }
+
+      if (theEnd > 0) {
+        // a \r ending it takes the \n after it along, if already here
+        if (theEnd < fRequest.Len && theEnd == theOffset + 1 && theChar == '\r') {
+          UInt32 theNextLen = 0;
+          if (*this->getMessagePtr(theEnd, &theNextLen) == '\n')
+            theEnd++;
+        }
+        *outHeaderLen = theEnd;
+        return true;
+      }
+    }
+    fScanOffset += theLen;
+  }
+
+  // a first line ending with a lone \r, and nothing after it yet
+  if (fScanState == kScanGotCR && !fFirstLineDone && fFirstLineLen > 0
+      && !fFirstLineHasSpace) {
+    this->endLine(fRequest.Len);
+    fFirstLineDone = true;
+    *outHeaderLen = fRequest.Len;
+    return true;
+  }
+
+  return false;
+}
 
 void HTTPRequestStream::SnarfRetreat(HTTPRequestStream &fromRequest) {
   // Simplest thing to do is to just completely blow away everything in this current
   // stream, and replace it with the retreat bytes from the other stream.
   fRequestPtr = NULL;
-  Assert(fRetreatBytes < kRequestBufferSizeInBytes);
   fRetreatBytes = fromRequest.fRetreatBytes;
+  Assert(fRetreatBytes < kSegmentSizeInBytes);
+  if (fRetreatBytes >= kSegmentSizeInBytes)
+    fRetreatBytes = kSegmentSizeInBytes - 1; // decoded in one segment
   fEncodedBytesRemaining = fCurOffset = fRequest.Len = 0;
-  ::memcpy(&fRequestBuffer[0],
-           fromRequest.fRequest.Ptr + fromRequest.fRequest.Len,
-           fromRequest.fRetreatBytes);
+  this->freeLinearBuffer();
+  this->resetScan();
+  fRequest.Ptr = fDecodeBuffer != nullptr ? fDecodeBuffer
+                                          : (fNumSegments > 0 ? fSegments[0] : nullptr);
+  if (fRetreatBytes > 0) {
+    this->acquireBuffer();
+    fromRequest.copyMessage(fromRequest.fRequest.Len + fromRequest.fRetreatBytesRead,
+                            fSegments[0],
+                            fRetreatBytes);
+  } else {
+    this->releaseBufferIfIdle();
+  }
 }
 
 CF_Error HTTPRequestStream::ReadRequest() {
@@ -74,12 +499,11 @@ CF_Error HTTPRequestStream::ReadRequest() {
 
       // Take all the retreated leftover data and move it to the beginning of the buffer
       if ((fRetreatBytes > 0) && (fRequest.Len > 0))
-        ::memmove(fRequest.Ptr,
-                  fRequest.Ptr + fRequest.Len + fRetreatBytesRead,
-                  fRetreatBytes);
+        this->moveToFront(fRequest.Len + fRetreatBytesRead, fRetreatBytes);
+      this->freeLinearBuffer();
 
       // if we are decoding, we need to also move over the remaining encoded bytes
-      // to the right position in the fRequestBuffer
+      // to the right position in the fSegments[0]
       if (fEncodedBytesRemaining > 0) {
         //Assert(fEncodedBytesRemaining < 4);
 
@@ -88,7 +512,7 @@ CF_Error HTTPRequestStream::ReadRequest() {
         //  1) We need to find a place in the request buffer where we know we
         //     have enough space to store fEncodedBytesRemaining.
         //     fRetreatBytes + fEncodedBytesRemaining will always be less than
-        //     kRequestBufferSize because all this data must have been in the
+        //     kSegmentSizeInBytes because all this data must have been in the
         //     same request buffer, together, at one point.
         //  2) We need to make sure that there is always more data in the
         //     RequestBuffer than in the decoded request buffer, otherwise we
@@ -96,16 +520,27 @@ CF_Error HTTPRequestStream::ReadRequest() {
         //     encoded buffer, not the decoded buffer). Leaving fRetreatBytes
         //     as empty space in the request buffer ensures that this principle
         //     is maintained.
-        ::memmove(&fRequestBuffer[fRetreatBytes],
-                  &fRequestBuffer[fCurOffset - fEncodedBytesRemaining],
+        ::memmove(&fSegments[0][fRetreatBytes],
+                  &fSegments[0][fCurOffset - fEncodedBytesRemaining],
                   fEncodedBytesRemaining);
         fCurOffset = fRetreatBytes + fEncodedBytesRemaining;
-        Assert(fCurOffset < kRequestBufferSizeInBytes);
+        Assert(fCurOffset < kSegmentSizeInBytes);
       } else
         fCurOffset = fRetreatBytes;
 
+      // segments a long header needed go back to the pool
+      if (fDecodeBuffer == nullptr) {
+        this->freeSegmentsFrom(fCurOffset > kSegmentSizeInBytes
+                               ? (fCurOffset + kSegmentSizeInBytes - 1) / kSegmentSizeInBytes
+                               : 1);
+        fRequest.Ptr = fSegments[0];
+      } else {
+        fRequest.Ptr = fDecodeBuffer;
+      }
+
       newOffset = fRequest.Len = fRetreatBytes;
       fRetreatBytes = fRetreatBytesRead = 0;
+      this->resetScan();
     }
 
     // We don't have any new data, so try and get some
@@ -121,19 +556,33 @@ CF_Error HTTPRequestStream::ReadRequest() {
       } else {
         // We don't have any new data, get some from the Socket...
         // 注意我们的 Socket 端口是 non blocking
-        CF_Error sockErr = fSocket->Read(
-            &fRequestBuffer[fCurOffset],
-            (kRequestBufferSizeInBytes - fCurOffset) - 1,
-            &newOffset);
+        this->acquireBuffer();
+
+        UInt32 theSpace = 0;
+        char *theReadPtr = this->getReadSpace(&theSpace);
+        if (theSpace == 0) {
+          // header longer than we accept, hand up what fits in one segment
+          if (fRequest.Len > kSegmentSizeInBytes)
+            fRequest.Len = kSegmentSizeInBytes;
+          fRequestPtr = &fRequest;
+          return (CF_Error) E2BIG;
+        }
+
+        CF_Error sockErr = fSocket->Read(theReadPtr, theSpace, &newOffset);
         // assume the client is dead if we get an error back
 #if __WinSock__
         if (sockErr == WSAEWOULDBLOCK)
 #else
         if (sockErr == EAGAIN)
 #endif
+        {
+          // between requests nothing is left, the connection idles without a buffer
+          this->releaseBufferIfIdle();
           return CF_NoErr;
+        }
         if (sockErr != CF_NoErr) {
           Assert(!fSocket->IsConnected());
+          this->releaseBufferIfIdle();
           return sockErr;
         }
       }
@@ -142,7 +591,7 @@ CF_Error HTTPRequestStream::ReadRequest() {
         // If we need to decode this data, do it now.
         Assert(fCurOffset >= fEncodedBytesRemaining);
         CF_Error decodeErr = this->DecodeIncomingData(
-            &fRequestBuffer[fCurOffset - fEncodedBytesRemaining],
+            &fSegments[0][fCurOffset - fEncodedBytesRemaining],
             newOffset + fEncodedBytesRemaining);
         // If the above function returns an error, it is because we've
         // encountered some non-base64 data in the stream. We can process
@@ -151,23 +600,25 @@ CF_Error HTTPRequestStream::ReadRequest() {
         if (decodeErr == CF_NoErr) Assert(fEncodedBytesRemaining < 4);
       } else
         fRequest.Len += newOffset;
-      Assert(fRequest.Len < kRequestBufferSizeInBytes);
       fCurOffset += newOffset;
     }
     Assert(newOffset > 0);
 
     // See if this is an interleaved data packet
-    if ('$' == *(fRequest.Ptr)) {
+    UInt32 theContiguousLen = 0;
+    UInt8 *theStart = (UInt8 *) this->getMessagePtr(0, &theContiguousLen);
+    if ('$' == theStart[0]) {
       if (fRequest.Len < 4)
         continue;
-      UInt16 *dataLenP = (UInt16 *) fRequest.Ptr;
-      UInt32 interleavedPacketLen = ntohs(dataLenP[1]) + 4;
+      // the first segment holds at least these 4 bytes
+      UInt32 interleavedPacketLen = ((theStart[2] << 8) | theStart[3]) + 4;
       if (interleavedPacketLen > fRequest.Len)
         continue;
 
       // put back any data that is not part of the header
       fRetreatBytes += fRequest.Len - interleavedPacketLen;
       fRequest.Len = interleavedPacketLen;
+      fRequest.Ptr = this->linearize(interleavedPacketLen);
 
       fRequestPtr = &fRequest;
       fIsDataPacket = true;
@@ -175,93 +626,50 @@ CF_Error HTTPRequestStream::ReadRequest() {
     }
     fIsDataPacket = false;
 
-    if (fPrintRTSP) {
-      DateBuffer theDate;
-      DateTranslator::UpdateDateBuffer(&theDate,
-                                       0); // get the current GMT date and Time
-      s_printf("\n\n#C->S:\n#Time: ms=%"   _U32BITARG_   " date=%s\n",
-               (UInt32) Core::Time::StartTimeMilli_Int(),
-               theDate.GetDateBuffer());
-
-      if (fSocket != NULL) {
-        UInt16 serverPort = fSocket->GetLocalPort();
-        UInt16 clientPort = fSocket->GetRemotePort();
-        StrPtrLen *theLocalAddrStr = fSocket->GetLocalAddrStr();
-        StrPtrLen *theRemoteAddrStr = fSocket->GetRemoteAddrStr();
-        if (theLocalAddrStr != NULL) {
-          s_printf("#server: ip=");
-          theLocalAddrStr->PrintStr();
-          s_printf(" port=%u\n", serverPort);
-        } else {
-          s_printf("#server: ip=NULL port=%u\n", serverPort);
-        }
+    // weAreDone means we have gotten a full request
+    UInt32 theHeaderLen = 0;
+    if (this->findEndOfHeader(&theHeaderLen)) {
+      // put back any data that is not part of the header
+      fRetreatBytes += fRequest.Len - theHeaderLen;
+      fRequest.Len = theHeaderLen;
+      fRequest.Ptr = this->linearize(theHeaderLen);
+
+      if (fPrintRTSP) {
+        s_printf("\n\n#C->S:\n#Time: ms=%"   _U32BITARG_   " date=%s\n",
+                 (UInt32) Core::Time::StartTimeMilli_Int(),
+                 DateCache::Get());
+
+        if (fSocket != NULL) {
+          UInt16 serverPort = fSocket->GetLocalPort();
+          UInt16 clientPort = fSocket->GetRemotePort();
+          StrPtrLen *theLocalAddrStr = fSocket->GetLocalAddrStr();
+          StrPtrLen *theRemoteAddrStr = fSocket->GetRemoteAddrStr();
+          if (theLocalAddrStr != NULL) {
+            s_printf("#server: ip=");
+            theLocalAddrStr->PrintStr();
+            s_printf(" port=%u\n", serverPort);
+          } else {
+            s_printf("#server: ip=NULL port=%u\n", serverPort);
+          }
+
+          if (theRemoteAddrStr != NULL) {
+            s_printf("#client: ip=");
+            theRemoteAddrStr->PrintStr();
+            s_printf(" port=%u\n", clientPort);
+          } else {
+            s_printf("#client: ip=NULL port=%u\n", clientPort);
+          }
 
-        if (theRemoteAddrStr != NULL) {
-          s_printf("#client: ip=");
-          theRemoteAddrStr->PrintStr();
-          s_printf(" port=%u\n", clientPort);
-        } else {
-          s_printf("#client: ip=NULL port=%u\n", clientPort);
         }
 
+        StrPtrLen str(fRequest);
+        // print the request but stop on \n\r\n and add a \n afterwards.
+        str.PrintStrEOL("\n\r\n", "\n");
       }
 
-      StrPtrLen str(fRequest);
-      // print the request but stop on \n\r\n and add a \n afterwards.
-      str.PrintStrEOL("\n\r\n", "\n");
-    }
-
-    // use a StringParser object to search for a double EOL, which signifies
-    // the end of the header.
-    bool weAreDone = false;
-    StringParser headerParser(&fRequest);
-
-    UInt16 lcount = 0;
-    while (headerParser.GetThruEOL(NULL)) {
-      lcount++;
-      if (headerParser.ExpectEOL()) {
-        // The legal end-of-header sequences are \r\r, \r\n\r\n, & \n\n.
-        // NOT \r\n\r!
-        // If the packets arrive just a certain way, we could get here with
-        // the latter combo, and not wait for a final \n.
-        if ((headerParser.GetDataParsedLen() > 2) &&
-            (memcmp(headerParser.GetCurrentPosition() - 3, "\r\n\r", 3) == 0))
-          continue;
-        weAreDone = true;
-        break;
-      } else if (lcount == 1) {
-        // if this request is actually a ShoutCast password it will be
-        // in the form of "xxxxxx\r" where "xxxxx" is the password.
-        // If we get a 1st request line ending in \r with no blanks we will
-        // assume that this is the end of the request.
-        UInt16 flag = 0;
-        UInt16 i = 0;
-        for (i = 0; i < fRequest.Len; i++) {
-          if (fRequest.Ptr[i] == ' ')
-            flag++;
-        }
-        if (flag == 0) {
-          weAreDone = true;
-          break;
-        }
-      }
-    }
-
-    // weAreDone means we have gotten a full request
-    if (weAreDone) {
-      // put back any data that is not part of the header
-      fRequest.Len -= headerParser.GetDataRemaining();
-      fRetreatBytes += headerParser.GetDataRemaining();
-
       fRequestPtr = &fRequest;
       return CF_RequestArrived;
     }
-
-    // check for a full buffer
-    if (fCurOffset == kRequestBufferSizeInBytes - 1) {
-      fRequestPtr = &fRequest;
-      return (CF_Error) E2BIG;
-    }
   }
 }
 
@@ -278,11 +686,10 @@ CF_Error HTTPRequestStream::Read(void *ioBuffer,
     if (inBufLen < theLengthRead)
       theLengthRead = inBufLen;
 
-    ::memcpy(theIoBuffer,
-             fRequest.Ptr + fRequest.Len + fRetreatBytesRead,
-             theLengthRead);
+    this->copyMessage(fRequest.Len + fRetreatBytesRead,
+                      (char *) theIoBuffer,
+                      theLengthRead);
 
-    //
     // We should not update fRequest.Len even though we've read some of the retreat bytes.
     // fRequest.Len always refers to the length of the request header. Instead, we
     // have a separate variable, fRetreatBytesRead
@@ -320,8 +727,9 @@ CF_Error HTTPRequestStream::DecodeIncomingData(char *inSrcData,
                                                UInt32 inSrcDataLen) {
   Assert(fRetreatBytes == 0);
 
-  if (fRequest.Ptr == &fRequestBuffer[0]) {
-    fRequest.Ptr = new char[kRequestBufferSizeInBytes];
+  if (fDecodeBuffer == nullptr) {
+    fDecodeBuffer = new char[kSegmentSizeInBytes];
+    fRequest.Ptr = fDecodeBuffer;
     fRequest.Len = 0;
   }
 
@@ -364,7 +772,7 @@ CF_Error HTTPRequestStream::DecodeIncomingData(char *inSrcData,
   // Make sure to replace the sacred endChar
   inSrcData[bytesToDecode] = endChar;
 
-  Assert(fRequest.Len < kRequestBufferSizeInBytes);
+  Assert(fRequest.Len < kSegmentSizeInBytes);
   Assert(encodedBytesConsumed == bytesToDecode);
 
   return CF_NoErr;
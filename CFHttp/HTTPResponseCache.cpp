@@ -0,0 +1,546 @@
+/**
+ * @file HTTPResponseCache.cpp
+ *
+ * implements HTTPResponseCache class
+ */
+
+#include <atomic>
+#include <string.h>
+#include <CF/Core/Mutex.h>
+#include <CF/Core/Time.h>
+#include <CF/HashTable.h>
+#include <CF/Queue.h>
+#include <CF/Net/Http/HTTPResponseCache.h>
+
+using namespace CF;
+using namespace CF::Net;
+
+namespace {
+
+enum {
+  kTableSize = 512,       // UInt32, hash buckets of a shard
+  kFlightTableSize = 64,  // UInt32
+  kMaxETagLength = 24     // UInt32
+};
+
+/*
+ * A stored response. The cache holds a reference while the entry is in its
+ * shard, a flight while it has the entry as its result, and each response
+ * sending the body one more.
+ */
+struct Entry {
+  Entry()
+      : fHash(0),
+        fExpires(0),
+        fSize(0),
+        fRefCount(1),
+        fCached(false),
+        fStatus(httpOK),
+        fData(nullptr),
+        fETagLen(0),
+        fNextHashEntry(nullptr),
+        fLRUElem(this) {}
+
+  ~Entry() { delete[] fData; }
+
+  StrPtrLen fKey;
+  UInt32 fHash;
+  SInt64 fExpires;  // Core::Time::Milliseconds
+  UInt64 fSize;     // charged to the shard
+  std::atomic<UInt32> fRefCount;
+  bool fCached;  // in the shard; a result only given to waiters is not
+  HTTPStatusCode fStatus;
+
+  char *fData;         // key, header lines and body
+  StrPtrLen fHeaders;  // from AddResponseHeader, with the ETag
+  StrPtrLen fBody;
+  char fETag[kMaxETagLength];
+  UInt32 fETagLen;
+
+  Entry *fNextHashEntry;
+  QueueElem fLRUElem;
+};
+
+UInt32 hashKey(const StrPtrLen &inKey) {
+  UInt32 theHash = 2166136261U; // FNV-1a
+  for (UInt32 i = 0; i < inKey.Len; i++)
+    theHash = (theHash ^ (UInt8) inKey.Ptr[i]) * 16777619U;
+  return theHash;
+}
+
+void release(Entry *inEntry) {
+  if (--inEntry->fRefCount == 0)
+    delete inEntry;
+}
+
+/*
+ * A GET being answered by its leader. The identical requests arriving
+ * meanwhile wait here as suspended tasks, and get fResult once the leader is
+ * done. The flight is deleted when the last waiter has taken it.
+ */
+struct Flight {
+  Flight()
+      : fHash(0),
+        fLeader(nullptr),
+        fWaiters(nullptr),
+        fNumWaiters(0),
+        fMaxWaiters(0),
+        fDone(false),
+        fResult(nullptr),
+        fNextHashEntry(nullptr),
+        fElem(this) {}
+
+  ~Flight() {
+    if (fResult != nullptr)
+      release(fResult);
+    delete[] fKey.Ptr;
+    delete[] fWaiters;
+  }
+
+  void addWaiter(Thread::Task *inTask) {
+    for (UInt32 i = 0; i < fNumWaiters; i++)
+      if (fWaiters[i] == inTask)
+        return;
+    if (fNumWaiters == fMaxWaiters) {
+      fMaxWaiters = fMaxWaiters == 0 ? 8 : fMaxWaiters * 2;
+      auto **theWaiters = new Thread::Task *[fMaxWaiters];
+      if (fNumWaiters > 0)
+        ::memcpy(theWaiters, fWaiters, fNumWaiters * sizeof(Thread::Task *));
+      delete[] fWaiters;
+      fWaiters = theWaiters;
+    }
+    fWaiters[fNumWaiters++] = inTask;
+  }
+
+  bool removeWaiter(Thread::Task *inTask) {
+    for (UInt32 i = 0; i < fNumWaiters; i++) {
+      if (fWaiters[i] == inTask) {
+        fWaiters[i] = fWaiters[--fNumWaiters];
+        return true;
+      }
+    }
+    return false;
+  }
+
+  StrPtrLen fKey;  // owned
+  UInt32 fHash;
+  Thread::Task *fLeader;
+  Thread::Task **fWaiters;
+  UInt32 fNumWaiters;
+  UInt32 fMaxWaiters;
+  bool fDone;
+  Entry *fResult;  // nullptr: the waiters call the function themselves
+
+  Flight *fNextHashEntry;
+  QueueElem fElem;
+};
+
+template<class T>
+class ItemKey {
+ public:
+  ItemKey(StrPtrLen *inKey, UInt32 inHash) : fKey(inKey), fHash(inHash) {}
+  explicit ItemKey(T *inItem) : fKey(&inItem->fKey), fHash(inItem->fHash) {}
+
+  UInt32 GetHashKey() { return fHash; }
+
+  friend int operator==(const ItemKey &key1, const ItemKey &key2) {
+    return key1.fHash == key2.fHash && key1.fKey->Equal(*key2.fKey);
+  }
+
+ private:
+  StrPtrLen *fKey;
+  UInt32 fHash;
+};
+
+typedef ItemKey<Entry> EntryKey;
+typedef ItemKey<Flight> FlightKey;
+
+struct Shard {
+  Shard() : fTable(kTableSize), fBytes(0), fFlights(kFlightTableSize) {}
+
+  Core::Mutex fMutex;
+  HashTable<Entry, EntryKey> fTable;
+  Queue fLRU;  // least recently used at the head
+  UInt64 fBytes;
+  HashTable<Flight, FlightKey> fFlights;
+  Queue fFlightList;  // the same flights, for Cancel
+};
+
+Shard sShards[HTTPResponseCache::kNumShards];
+UInt64 sMaxBytes = HTTPResponseCache::kDefaultMaxBytes;
+
+// the table index uses the low bits, the shard the high ones
+Shard &shardOf(UInt32 inHash) {
+  return sShards[(inHash >> 24) % HTTPResponseCache::kNumShards];
+}
+
+UInt64 shardBudget() {
+  return sMaxBytes / HTTPResponseCache::kNumShards;
+}
+
+// out of the shard, without dropping the cache's reference. the lock is held.
+void uncache(Shard &inShard, Entry *inEntry) {
+  Assert(inEntry->fCached);
+  inShard.fTable.Remove(inEntry);
+  inShard.fLRU.Remove(&inEntry->fLRUElem);
+  inShard.fBytes -= inEntry->fSize;
+  inEntry->fCached = false;
+}
+
+// the leader is done, inResult (may be nullptr) goes to the waiters. the
+// lock is held.
+void land(Flight *inFlight, Entry *inResult) {
+  inFlight->fDone = true;
+  inFlight->fResult = inResult;
+  if (inResult != nullptr)
+    inResult->fRefCount++;
+  for (UInt32 i = 0; i < inFlight->fNumWaiters; i++)
+    inFlight->fWaiters[i]->Signal(Thread::Task::kUpdateEvent);
+}
+
+// out of the shard once every waiter has its result; the caller deletes it
+// after the lock is released. the lock is held.
+bool collect(Shard &inShard, Flight *inFlight) {
+  if (!inFlight->fDone || inFlight->fNumWaiters > 0)
+    return false;
+  inShard.fFlights.Remove(inFlight);
+  inShard.fFlightList.Remove(&inFlight->fElem);
+  return true;
+}
+
+// the path, the query and the policy's request headers
+bool makeKey(HTTPCachePolicy *inPolicy, HTTPPacket &request,
+             char *outBuffer, StrPtrLen *outKey) {
+  StringFormatter theKey(outBuffer, HTTPResponseCache::kMaxKeyLength);
+  theKey.Put(*request.GetRequestRelativeURI());
+  char const *theQuery = request.GetQueryString();
+  if (theQuery != nullptr) {
+    theKey.PutChar('?');
+    theKey.Put((char *) theQuery);
+  }
+  for (UInt32 i = 0; i < inPolicy->numVaryHeaders && i < 4; i++) {
+    theKey.PutChar('\n');
+    theKey.Put(*request.GetHeaderValue(inPolicy->varyHeaders[i]));
+  }
+
+  // a full buffer may have been truncated
+  if (theKey.GetSpaceLeft() <= 1)
+    return false;
+  outKey->Set(outBuffer, theKey.GetCurrentOffset());
+  return true;
+}
+
+// the value of an "ETag:" line in inLines
+bool findETag(const StrPtrLen &inLines, StrPtrLen *outETag) {
+  static StrPtrLen sETag((char *) "ETag:", 5);
+  StringParser theParser((StrPtrLen *) &inLines);
+  while (theParser.GetDataRemaining() > 0) {
+    StrPtrLen theLine;
+    theParser.GetThruEOL(&theLine);
+    if (theLine.Len > sETag.Len
+        && StrPtrLen(theLine.Ptr, sETag.Len).EqualIgnoreCase(sETag)) {
+      StringParser theValue(&theLine);
+      theValue.ConsumeLength(nullptr, sETag.Len);
+      theValue.ConsumeWhitespace();
+      outETag->Set(theValue.GetCurrentPosition(), theValue.GetDataRemaining());
+      outETag->TrimTrailingWhitespace();
+      return outETag->Len > 0;
+    }
+  }
+  return false;
+}
+
+// the response keeps its entry while the body is sent
+class CachedBody : public StrPtrLen {
+ public:
+  explicit CachedBody(Entry *inEntry) : StrPtrLen(inEntry->fBody), fEntry(inEntry) {}
+  ~CachedBody() override { release(fEntry); }
+
+ private:
+  Entry *fEntry;
+};
+
+// takes the caller's reference to inEntry
+void serve(Entry *inEntry, HTTPPacket &request, HTTPPacket &response) {
+  response.SetStatusCode(inEntry->fStatus);
+  response.AddResponseHeaderLines(inEntry->fHeaders);
+  if (inEntry->fETagLen > 0
+      && request.IfNoneMatch(StrPtrLen(inEntry->fETag, inEntry->fETagLen))) {
+    response.SetStatusCode(httpNotModified);
+    release(inEntry);
+  } else {
+    response.SetBody(new CachedBody(inEntry));
+  }
+}
+
+} // namespace
+
+void HTTPResponseCache::SetMaxBytes(UInt64 inMaxBytes) {
+  sMaxBytes = inMaxBytes;
+  if (sMaxBytes == 0)
+    Purge();
+}
+
+CF_Error HTTPResponseCache::Lookup(HTTPCachePolicy *inPolicy,
+                                   HTTPPacket &request, HTTPPacket &response,
+                                   Thread::Task *inTask) {
+  HTTPMethod theMethod = request.GetMethod();
+  if (theMethod != httpGetMethod && theMethod != httpHeadMethod)
+    return CF_ValueNotFound;
+
+  char theBuffer[kMaxKeyLength];
+  StrPtrLen theKey;
+  if (!makeKey(inPolicy, request, theBuffer, &theKey))
+    return CF_ValueNotFound;
+  UInt32 theHash = hashKey(theKey);
+  Shard &theShard = shardOf(theHash);
+
+  CF_Error theErr = CF_ValueNotFound;
+  Entry *theFound = nullptr;
+  Entry *theExpired = nullptr;
+  Flight *theCollected = nullptr;
+  {
+    Core::MutexLocker locker(&theShard.fMutex);
+    EntryKey theEntryKey(&theKey, theHash);
+    Entry *theEntry = sMaxBytes > 0 ? theShard.fTable.Map(&theEntryKey) : nullptr;
+    if (theEntry != nullptr && theEntry->fExpires <= Core::Time::Milliseconds()) {
+      uncache(theShard, theEntry);
+      theExpired = theEntry;
+      theEntry = nullptr;
+    }
+
+    if (theEntry != nullptr) {
+      theEntry->fRefCount++;
+      theShard.fLRU.Remove(&theEntry->fLRUElem);
+      theShard.fLRU.EnQueue(&theEntry->fLRUElem);
+      theFound = theEntry;
+    }
+
+    FlightKey theFlightKey(&theKey, theHash);
+    Flight *theFlight = theShard.fFlights.Map(&theFlightKey);
+    if (theFlight != nullptr && theFlight->fDone) {
+      // woken up, or just after the leader: its result is fresh either way
+      theFlight->removeWaiter(inTask);
+      if (theFound == nullptr && theFlight->fResult != nullptr) {
+        theFlight->fResult->fRefCount++;
+        theFound = theFlight->fResult;
+      }
+      if (collect(theShard, theFlight))
+        theCollected = theFlight;
+    } else if (theFound != nullptr) {
+      // a hit
+    } else if (theFlight == nullptr) {
+      // the first: it calls the function, the next ones wait for it
+      if (inTask != nullptr && theMethod == httpGetMethod) {
+        theFlight = new Flight();
+        theFlight->fKey.Set(theKey.GetAsCString(), theKey.Len);
+        theFlight->fHash = theHash;
+        theFlight->fLeader = inTask;
+        theShard.fFlights.Add(theFlight);
+        theShard.fFlightList.EnQueue(&theFlight->fElem);
+      }
+    } else if (inTask != nullptr && inTask != theFlight->fLeader) {
+      theFlight->addWaiter(inTask);
+      theErr = CF_WouldBlock;
+    }
+  }
+
+  if (theExpired != nullptr)
+    release(theExpired);
+  delete theCollected;
+
+  if (theFound != nullptr) {
+    serve(theFound, request, response);
+    return CF_NoErr;
+  }
+  return theErr;
+}
+
+void HTTPResponseCache::Store(HTTPCachePolicy *inPolicy,
+                              HTTPPacket &request, HTTPPacket &response,
+                              CF_Error inResult, Thread::Task *inTask) {
+  if (request.GetMethod() != httpGetMethod)
+    return;
+
+  char theBuffer[kMaxKeyLength];
+  StrPtrLen theKey;
+  if (!makeKey(inPolicy, request, theBuffer, &theKey))
+    return;
+  UInt32 theHash = hashKey(theKey);
+  Shard &theShard = shardOf(theHash);
+  FlightKey theFlightKey(&theKey, theHash);
+
+  bool theLeads = false;
+  if (inTask != nullptr) {
+    Core::MutexLocker locker(&theShard.fMutex);
+    Flight *theFlight = theShard.fFlights.Map(&theFlightKey);
+    theLeads = theFlight != nullptr && !theFlight->fDone && theFlight->fLeader == inTask;
+  }
+
+  // anything in memory can be given to the waiters, only a 200 is kept. A
+  // failure goes to them as the status the session answers it with.
+  bool theFailed = inResult != CF_NoErr;
+  bool theShareable = theFailed
+      || (response.GetFileBody() == nullptr && response.GetStreamBody() == nullptr);
+  bool theCacheable = !theFailed && theShareable && sMaxBytes > 0
+      && response.GetStatusCode() == httpOK;
+
+  StrPtrLen theEmpty;
+  StrPtrLen *theBody = response.GetBody() != nullptr && !theFailed
+                       ? response.GetBody() : &theEmpty;
+
+  // the function's own ETag, or a hash of the body
+  StrPtrLen theETag;
+  char theETagBuffer[kMaxETagLength];
+  if (theCacheable) {
+    if (findETag(response.GetAddedResponseHeaders(), &theETag)) {
+      if (theETag.Len > kMaxETagLength) {
+        theETag.Len = 0;
+        theCacheable = false;
+      }
+    } else {
+      UInt64 theBodyHash = 14695981039346656037ULL; // FNV-1a
+      for (UInt32 i = 0; i < theBody->Len; i++)
+        theBodyHash = (theBodyHash ^ (UInt8) theBody->Ptr[i]) * 1099511628211ULL;
+      s_sprintf(theETagBuffer, "\"%016" _64BITARG_ "x\"", theBodyHash);
+      theETag.Set(theETagBuffer, 18);
+      response.AddResponseHeader(httpETagHeader, theETag);
+    }
+  }
+  StrPtrLen theHeaders = theFailed ? theEmpty : response.GetAddedResponseHeaders();
+
+  UInt64 theSize = sizeof(Entry) + theKey.Len + theHeaders.Len + theBody->Len;
+  if (theSize > shardBudget() / 4)
+    theCacheable = false;
+
+  Entry *theEntry = nullptr;
+  if (theCacheable || (theShareable && theLeads)) {
+    theEntry = new Entry();
+    theEntry->fData = new char[theKey.Len + theHeaders.Len + theBody->Len];
+    char *thePut = theEntry->fData;
+    ::memcpy(thePut, theKey.Ptr, theKey.Len);
+    theEntry->fKey.Set(thePut, theKey.Len);
+    thePut += theKey.Len;
+    ::memcpy(thePut, theHeaders.Ptr, theHeaders.Len);
+    theEntry->fHeaders.Set(thePut, theHeaders.Len);
+    thePut += theHeaders.Len;
+    ::memcpy(thePut, theBody->Ptr, theBody->Len);
+    theEntry->fBody.Set(thePut, theBody->Len);
+    ::memcpy(theEntry->fETag, theETag.Ptr, theETag.Len);
+    theEntry->fETagLen = theETag.Len;
+    if (theFailed)
+      theEntry->fStatus = inResult == CF_FileNotFound ? httpNotFound : httpInternalServerError;
+    else
+      theEntry->fStatus = response.GetStatusCode();
+    theEntry->fHash = theHash;
+    theEntry->fExpires = Core::Time::Milliseconds() + inPolicy->ttlInMSecs;
+    theEntry->fSize = theSize;
+  }
+
+  // entries pushed out are deleted after the lock is released
+  Queue theEvicted;
+  Flight *theCollected = nullptr;
+  {
+    Core::MutexLocker locker(&theShard.fMutex);
+    if (theCacheable) {
+      EntryKey theEntryKey(theEntry);
+      Entry *theOld = theShard.fTable.Map(&theEntryKey);
+      if (theOld != nullptr) {
+        uncache(theShard, theOld);
+        theEvicted.EnQueue(&theOld->fLRUElem);
+      }
+
+      theShard.fTable.Add(theEntry);
+      theShard.fLRU.EnQueue(&theEntry->fLRUElem);
+      theShard.fBytes += theSize;
+      theEntry->fCached = true;
+      theEntry->fRefCount++;
+
+      while (theShard.fBytes > shardBudget()) {
+        auto *theLast = (Entry *) theShard.fLRU.GetHead()->GetEnclosingObject();
+        uncache(theShard, theLast);
+        theEvicted.EnQueue(&theLast->fLRUElem);
+      }
+    }
+
+    if (theLeads) {
+      Flight *theFlight = theShard.fFlights.Map(&theFlightKey);
+      if (theFlight != nullptr && !theFlight->fDone && theFlight->fLeader == inTask) {
+        land(theFlight, theEntry);
+        if (collect(theShard, theFlight))
+          theCollected = theFlight;
+      }
+    }
+  }
+
+  QueueElem *theElem;
+  while ((theElem = theEvicted.DeQueue()) != nullptr)
+    release((Entry *) theElem->GetEnclosingObject());
+  delete theCollected;
+  if (theEntry != nullptr)
+    release(theEntry);
+
+  if (theCacheable && request.IfNoneMatch(theETag))
+    response.SetStatusCode(httpNotModified);
+}
+
+void HTTPResponseCache::Cancel(Thread::Task *inTask) {
+  for (Shard &theShard : sShards) {
+    Queue theCollected;
+    {
+      Core::MutexLocker locker(&theShard.fMutex);
+      QueueIter theIter(&theShard.fFlightList);
+      while (!theIter.IsDone()) {
+        auto *theFlight = (Flight *) theIter.GetCurrent()->GetEnclosingObject();
+        theIter.Next();
+
+        theFlight->removeWaiter(inTask);
+        if (!theFlight->fDone && theFlight->fLeader == inTask)
+          land(theFlight, nullptr);
+        if (collect(theShard, theFlight))
+          theCollected.EnQueue(&theFlight->fElem);
+      }
+    }
+
+    QueueElem *theElem;
+    while ((theElem = theCollected.DeQueue()) != nullptr)
+      delete (Flight *) theElem->GetEnclosingObject();
+  }
+}
+
+void HTTPResponseCache::Purge() {
+  for (Shard &theShard : sShards) {
+    Queue theEvicted;
+    {
+      Core::MutexLocker locker(&theShard.fMutex);
+      QueueElem *theElem;
+      while ((theElem = theShard.fLRU.GetTail()) != nullptr) {
+        auto *theEntry = (Entry *) theElem->GetEnclosingObject();
+        uncache(theShard, theEntry);
+        theEvicted.EnQueue(theElem);
+      }
+    }
+
+    QueueElem *theElem;
+    while ((theElem = theEvicted.DeQueue()) != nullptr)
+      release((Entry *) theElem->GetEnclosingObject());
+  }
+}
+
+UInt32 HTTPResponseCache::GetNumEntries() {
+  UInt32 theNum = 0;
+  for (Shard &theShard : sShards) {
+    Core::MutexLocker locker(&theShard.fMutex);
+    theNum += theShard.fLRU.GetLength();
+  }
+  return theNum;
+}
+
+UInt64 HTTPResponseCache::GetNumBytes() {
+  UInt64 theBytes = 0;
+  for (Shard &theShard : sShards) {
+    Core::MutexLocker locker(&theShard.fMutex);
+    theBytes += theShard.fBytes;
+  }
+  return theBytes;
+}
@@ -30,18 +30,88 @@
 
 #include <CF/Net/Http/HTTPResponseStream.h>
 #include <CF/Core/Time.h>
+#include <CF/Net/Socket/ConnectionGovernor.h>
 
 using namespace CF::Net;
 
-CF_Error HTTPResponseStream::WriteV(iovec *inVec,
-                                      UInt32 inNumVectors,
-                                      UInt32 inTotalLength,
-                                      UInt32 *outLengthSent,
-                                      UInt32 inSendType) {
+CF::BufferPool HTTPResponseStream::sBufferPool(kOutputBufferSizeInBytes);
+
+bool HTTPResponseStream::BufferIsFull(char *inBuffer, UInt32 inBufferLen) {
+  if (inBuffer == nullptr) {
+    fPoolBuffer = (char *) sBufferPool.Get();
+    ConnectionGovernor::AddMemory(kOutputBufferSizeInBytes);
+
+    // not Set(), that would clear fBytesWritten
+    fStartPut = fCurrentPut = fPoolBuffer;
+    fEndPut = fPoolBuffer + kOutputBufferSizeInBytes;
+    return true;
+  }
+
+  // allocate a buffer twice as big as the old one, and copy over the contents
+  UInt32 theNewBufferSize = this->GetTotalBufferSize() * 2;
+  char *theNewBuffer = new char[theNewBufferSize];
+  ::memcpy(theNewBuffer, inBuffer, inBufferLen);
+
+  if (inBuffer == fPoolBuffer)
+    this->putPoolBuffer();
+  else
+    delete[] inBuffer;
+
+  fStartPut = theNewBuffer;
+  fCurrentPut = theNewBuffer + inBufferLen;
+  fEndPut = theNewBuffer + theNewBufferSize;
+  return true;
+}
+
+void HTTPResponseStream::releaseBuffer() {
+  if (fStartPut == nullptr)
+    return;
+
+  if (fStartPut == fPoolBuffer)
+    this->putPoolBuffer();
+  else
+    delete[] fStartPut;
+
+  // ResizeableStringFormatter deletes nothing once this is nullptr
+  fStartPut = fCurrentPut = fEndPut = nullptr;
+  fBytesSentInBuffer = 0;
+}
+
+void HTTPResponseStream::putPoolBuffer() {
+  if (fZeroCopyBuffer)
+    fSocket->ReleaseAfterSend(&sBufferPool, fPoolBuffer);
+  else
+    sBufferPool.Put(fPoolBuffer);
+  ConnectionGovernor::RemoveMemory(kOutputBufferSizeInBytes);
+  fPoolBuffer = nullptr;
+  fZeroCopyBuffer = false;
+}
+
+CF_Error HTTPResponseStream::WriteVZeroCopy(iovec *inVec,
+                                            UInt32 inNumVectors,
+                                            UInt32 inTotalLength,
+                                            StrPtrLen *inData) {
+  CF_Error theErr = this->writeV(inVec, inNumVectors, inTotalLength, nullptr,
+                                 kAlwaysBuffer, fSocket->IsZeroCopyEnabled());
+  // the part the Socket didn't take is in the buffer now
+  fSocket->ReleaseAfterSend(inData);
+  return theErr;
+}
+
+CF_Error HTTPResponseStream::writeV(iovec *inVec,
+                                    UInt32 inNumVectors,
+                                    UInt32 inTotalLength,
+                                    UInt32 *outLengthSent,
+                                    UInt32 inSendType,
+                                    bool inZeroCopy) {
   CF_Error theErr = CF_NoErr;
   UInt32 theLengthSent = 0;
   UInt32 amtInBuffer = this->GetCurrentOffset() - fBytesSentInBuffer;
 
+  // a grown buffer is deleted, not handed to the Socket, once sent
+  if (amtInBuffer > 0 && fStartPut != fPoolBuffer)
+    inZeroCopy = false;
+
   if (amtInBuffer > 0) {
 
     // There is some data in the output buffer. Make sure to send that
@@ -49,25 +119,17 @@ CF_Error HTTPResponseStream::WriteV(iovec *inVec,
 
     inVec[0].iov_base = this->GetBufPtr() + fBytesSentInBuffer;
     inVec[0].iov_len = amtInBuffer;
-    theErr = fSocket->WriteV(inVec, inNumVectors, &theLengthSent);
-
-    if (fPrintRTSP) {
-      DateBuffer theDate;
-      DateTranslator::UpdateDateBuffer(&theDate, 0); // get the current GMT date and Time
-
-      s_printf("\n#S->C:\n#Time: ms=%"   _U32BITARG_   " date=%s\n",
-               (UInt32) Core::Time::StartTimeMilli_Int(),
-               theDate.GetDateBuffer());
-      for (UInt32 i = 0; i < inNumVectors; i++) {
-        StrPtrLen str((char *) inVec[i].iov_base, (UInt32) inVec[i].iov_len);
-        str.PrintStrEOL();
-      }
+    if (inZeroCopy) {
+      theErr = fSocket->WriteVZeroCopy(inVec, inNumVectors, &theLengthSent);
+      if (theLengthSent > 0)
+        fZeroCopyBuffer = true;
+    } else {
+      theErr = fSocket->WriteV(inVec, inNumVectors, &theLengthSent);
     }
 
     if (theLengthSent >= amtInBuffer) {
       // We were able to send all the data in the buffer. Great. Flush it.
-      this->Reset();
-      fBytesSentInBuffer = 0;
+      this->releaseBuffer();
 
       // Make theLengthSent reflect the amount of data sent in the ioVec
       theLengthSent -= amtInBuffer;
@@ -81,7 +143,21 @@ CF_Error HTTPResponseStream::WriteV(iovec *inVec,
     }
     // theLengthSent now represents how much data in the ioVec was sent
   } else if (inNumVectors > 1) {
-    theErr = fSocket->WriteV(&inVec[1], inNumVectors - 1, &theLengthSent);
+    if (inZeroCopy)
+      theErr = fSocket->WriteVZeroCopy(&inVec[1], inNumVectors - 1, &theLengthSent);
+    else
+      theErr = fSocket->WriteV(&inVec[1], inNumVectors - 1, &theLengthSent);
+  }
+
+  if (fPrintRTSP) {
+
+    s_printf("\n#S->C:\n#Time: ms=%"   _U32BITARG_   " date=%s\n",
+             (UInt32) Core::Time::StartTimeMilli_Int(),
+             DateCache::Get());
+    for (UInt32 i = amtInBuffer > 0 ? 0 : 1; i < inNumVectors; i++) {
+      StrPtrLen str((char *) inVec[i].iov_base, (UInt32) inVec[i].iov_len);
+      str.PrintStrEOL();
+    }
   }
   // We are supposed to refresh the timeout if there is a successful write.
   if (theErr == CF_NoErr)
@@ -142,12 +218,10 @@ CF_Error HTTPResponseStream::Flush() {
   UInt32 amtInBuffer = this->GetCurrentOffset() - fBytesSentInBuffer;
   if (amtInBuffer > 0) {
     if (fPrintRTSP) {
-      DateBuffer theDate;
-      DateTranslator::UpdateDateBuffer(&theDate, 0); // get the current GMT date and Time
 
       s_printf("\n#S->C:\n#Time: ms=%"   _U32BITARG_   " date=%s\n",
                (UInt32) Core::Time::StartTimeMilli_Int(),
-               theDate.GetDateBuffer());
+               DateCache::Get());
       StrPtrLen str(this->GetBufPtr() + fBytesSentInBuffer, amtInBuffer);
       str.PrintStrEOL();
     }
@@ -163,8 +237,7 @@ CF_Error HTTPResponseStream::Flush() {
 
     if (theLengthSent == amtInBuffer) {
       // We were able to send all the data in the buffer. Great. Flush it.
-      this->Reset();
-      fBytesSentInBuffer = 0;
+      this->releaseBuffer();
     } else {
       // Not all the data was sent, so report an EAGAIN
       fBytesSentInBuffer += theLengthSent;
@@ -174,3 +247,41 @@ CF_Error HTTPResponseStream::Flush() {
   }
   return CF_NoErr;
 }
+
+CF_Error HTTPResponseStream::SendFileBody(HTTPFileBody *inBody) {
+  // the header is still in the buffer, it must go first
+  CF_Error theErr = this->Flush();
+  if (theErr != CF_NoErr)
+    return theErr;
+
+  UInt32 theLengthSent = 0;
+  theErr = inBody->Send(fSocket, &theLengthSent);
+
+  // Refresh the timeout if we were able to send any data
+  if (theLengthSent > 0)
+    fTimeoutTask->RefreshTimeout();
+
+  // never buffered, count it here so GetBytesWritten stays right
+  fBytesWritten += theLengthSent;
+
+  return theErr;
+}
+
+CF_Error HTTPResponseStream::SendStreamBody(HTTPStreamBody *inBody) {
+  // the header is still in the buffer, it must go first
+  CF_Error theErr = this->Flush();
+  if (theErr != CF_NoErr)
+    return theErr;
+
+  UInt32 theLengthSent = 0;
+  theErr = inBody->Send(fSocket, &theLengthSent);
+
+  // Refresh the timeout if we were able to send any data
+  if (theLengthSent > 0)
+    fTimeoutTask->RefreshTimeout();
+
+  // never buffered, count it here so GetBytesWritten stays right
+  fBytesWritten += theLengthSent;
+
+  return theErr;
+}
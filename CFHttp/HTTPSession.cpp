@@ -5,6 +5,8 @@
 
 #include <CF/CFEnv.h>
 #include <CF/Net/Http/HTTPSession.h>
+#include <CF/Net/Http/HTTPDeferred.h>
+#include <CF/Net/Socket/ConnectionGovernor.h>
 
 #if __FreeBSD__ || __hpux__
 #include <unistd.h>
@@ -15,13 +17,26 @@
 
 using namespace CF::Net;
 
+CF::BufferPool HTTPSession::sBodyBufferPool(kBodyChunkSizeInBytes);
+
 HTTPSession::HTTPSession()
     : HTTPSessionInterface(),
       fRequest(nullptr),
       fResponse(nullptr),
+      fRequestPacket(httpIllegalType),
+      fResponsePacket(httpResponseType),
       fReadMutex(),
+      fChargedBodyBytes(0),
+      fNumHeldResponses(0),
+      fWaitingForDispatch(false),
+      fBodyBufferSize(0),
+      fBodyBytesRead(0),
+      fZeroCopyWaits(0),
       fState(kReadingFirstRequest) {
   this->SetTaskName("HTTPSession");
+
+  ConnectionGovernor::AddSession();
+  ConnectionGovernor::AddMemory(sizeof(HTTPSession));
 }
 
 HTTPSession::~HTTPSession() {
@@ -33,6 +48,9 @@ HTTPSession::~HTTPSession() {
 
   fLiveSession = false; //used in Clean up request to remove the RTP session.
   this->CleanupRequestAndResponse();// Make sure that all our objects are deleted
+
+  ConnectionGovernor::RemoveMemory(sizeof(HTTPSession));
+  ConnectionGovernor::RemoveSession();
 }
 
 SInt64 HTTPSession::Run() {
@@ -47,6 +65,11 @@ SInt64 HTTPSession::Run() {
 
   if (events & Thread::Task::kTimeoutEvent) {
     /* Session超时,释放Session */
+    if (fWaitingForDispatch) {
+      // no kUpdateEvent may come after we are deleted
+      sDispatcher->Cancel(this);
+      fWaitingForDispatch = false;
+    }
     return -1;
   }
 
@@ -85,6 +108,11 @@ SInt64 HTTPSession::Run() {
         Core::MutexLocker readMutexLocker(&fReadMutex);
 
         if ((err = fInputStream.ReadRequest()) == CF_NoErr) {
+          // 没有完整的请求了，先发出攒下的流水线响应
+          if (fOutputStream.GetUnsentBytes() > 0) {
+            fState = kFlushingHeldResponses;
+            continue;
+          }
           fInputSocketP->RequestEvent(EV_RE);
           return 0;
         }
@@ -120,8 +148,11 @@ SInt64 HTTPSession::Run() {
 
         Assert(fRequest == nullptr);
         Assert(fResponse == nullptr);
-        fRequest = new HTTPPacket(fInputStream.GetRequestBuffer());
-        fResponse = new HTTPPacket(httpResponseType);
+        // 连接的两个 packet 每个请求重复使用，keep-alive 的请求不再分配内存
+        fRequestPacket.Reset(fInputStream.GetRequestBuffer(),
+                             fInputStream.GetHeaderIndex());
+        fRequest = &fRequestPacket;
+        fResponse = &fResponsePacket;
 
         /*
            在这里，我们已经读取了一个完整的 Request，并准备进行请求的处理，
@@ -133,8 +164,10 @@ SInt64 HTTPSession::Run() {
 
         fOutputStream.ResetBytesWritten();
 
+        // Header longer than HTTPRequestStream::GetMaxHeaderSize. The
+        // rest of it is still unread, so the connection is closed after.
         if (err == E2BIG) {
-          fResponse->SetStatusCode(httpInternalServerError);
+          fResponse->SetStatusCode(httpRequestHeaderFieldsTooLarge);
           fState = kSendingResponse;
           break;
         }
@@ -146,6 +179,15 @@ SInt64 HTTPSession::Run() {
           break;
         }
 
+        // Server is past its limits, shed this connection. The request is
+        // not parsed, so it isn't keep-alive and will be closed after the
+        // response is sent.
+        if (OverMaxConnections(0)) {
+          fResponse->SetStatusCode(httpServiceUnavailable);
+          fState = kSendingResponse;
+          break;
+        }
+
         Assert(err == CF_RequestArrived);
         fState = kFilteringRequest;
       }
@@ -170,6 +212,15 @@ SInt64 HTTPSession::Run() {
           return 0;
         }
 
+        /* 请求有误，或 body 没有读完: 回复错误，之后关闭连接 */
+        if (theErr != CF_NoErr) {
+          fRequest->SetRequestKeepAlive(false);
+          if (fResponse->GetStatusCode() == httpOK)
+            fResponse->SetStatusCode(httpBadRequest);
+          fState = kSendingResponse;
+          break;
+        }
+
         fState = kPreprocessingRequest;
         break;
       }
@@ -189,7 +240,64 @@ SInt64 HTTPSession::Run() {
       case kProcessingRequest: {
 
         // doDispatch
-        CF_Error theErr = sDispatcher->Dispatch(*fRequest, *fResponse);
+        CF_Error theErr = sDispatcher->Dispatch(*fRequest, *fResponse, this);
+        HTTPDeferred *theDeferred = fResponse->GetDeferred();
+        if (theErr == CF_WouldBlock && theDeferred != nullptr) {
+          // 响应由别的线程稍后完成: 不占用锁和线程，等它的 kUpdateEvent
+          fWaitingForDispatch = true;
+          fState = kWaitingForResponse;
+          fSessionMutex.Unlock();
+          fReadMutex.Unlock();
+          if (theDeferred->Park(this))
+            return 0;
+          continue; // already complete
+        }
+        if (theErr == CF_WouldBlock) {
+          // 相同的请求正在处理，挂起等待它的结果 (kUpdateEvent)，同样
+          // 不占用锁和线程
+          fWaitingForDispatch = true;
+          fState = kWaitingForFlight;
+          fSessionMutex.Unlock();
+          fReadMutex.Unlock();
+          return 0;
+        }
+        fWaitingForDispatch = false;
+
+        if (theErr == CF_FileNotFound) {
+          fResponse->SetStatusCode(httpNotFound);
+        } else if (theErr != CF_NoErr) {
+          fResponse->SetStatusCode(httpInternalServerError);
+        }
+
+        fState = kSendingResponse;
+        break;
+      }
+
+      case kWaitingForFlight: {
+        /* 相同的请求处理完了，重新持有锁，再 Dispatch 取它的结果 */
+        fReadMutex.Lock();
+        fSessionMutex.Lock();
+        fState = kProcessingRequest;
+        continue;
+      }
+
+      case kWaitingForResponse: {
+        /* 延迟的响应已完成，换上它，重新持有锁后发送 */
+        HTTPDeferred *theDeferred = fResponse->GetDeferred();
+        if (!theDeferred->IsComplete())
+          return 0;
+
+        fReadMutex.Lock();
+        fSessionMutex.Lock();
+
+        CF_Error theErr = theDeferred->GetResult();
+        HTTPPacket *theResponse = theDeferred->TakeResponse();
+        fResponse->Reset(); // lets go of theDeferred
+        fResponse = theResponse;
+
+        sDispatcher->Finish(*fRequest, *fResponse, theErr, this);
+        fWaitingForDispatch = false;
+
         if (theErr == CF_FileNotFound) {
           fResponse->SetStatusCode(httpNotFound);
         } else if (theErr != CF_NoErr) {
@@ -204,16 +312,29 @@ SInt64 HTTPSession::Run() {
         Assert(fRequest != nullptr);
         Assert(fResponse != nullptr);
 
-        /* 构造响应信息 */
+        /* 构造响应信息，并交给 fOutputStream */
         CF_Error theErr = SetupResponse();
-
-        if (fOutputStream.GetBytesWritten() == 0) {
-          fState = kCleaningUp;
+        if (theErr != CF_NoErr) {
+          // the client has disconnected
+          fLiveSession = false;
           break;
         }
 
-        /* 发送响应报文 */
-        err = fOutputStream.Flush();
+        fState = kFlushingResponse;
+      }
+
+      case kFlushingResponse: {
+        /* 发送响应报文，EAGAIN 后从这里继续 */
+        HTTPFileBody *fileBody = fResponse->GetFileBody();
+        HTTPStreamBody *streamBody = fResponse->GetStreamBody();
+        if (fileBody != nullptr)
+          err = fOutputStream.SendFileBody(fileBody);
+        else if (streamBody != nullptr)
+          err = fOutputStream.SendStreamBody(streamBody);
+        else if (fNumHeldResponses > 0)
+          err = CF_NoErr; // 下一个请求已经到达，与它的响应一起发送
+        else
+          err = fOutputStream.Flush();
 
         if (err == EAGAIN) {
           // If we get this error, we are currently flow-controlled and should
@@ -224,9 +345,18 @@ SInt64 HTTPSession::Run() {
           // We are holding mutexes, so we need to force
           // the same Thread to be used for next Run()
           return 0;
+        } else if (err == CF_WouldBlock) {
+          this->ForceSameThread();
+          // 文件 body 的源 (管道、fifo、socket) 暂时没有数据，Socket 是可写
+          // 的，等它没有用，过一会儿再试
+          if (fileBody != nullptr)
+            return kFileSourceWaitMsec;
+          // 流式 body 暂时没有数据，它准备好后用 kWriteEvent 唤醒我们
+          return 0;
         } else if (err != CF_NoErr) {
-          // Any other error means that the client has disconnected, right?
-          Assert(!this->IsLiveSession());
+          // Any other error means that the client has disconnected, or the
+          // file or stream body failed; the response is truncated either way.
+          fLiveSession = false;
           break;
         }
 
@@ -250,6 +380,20 @@ SInt64 HTTPSession::Run() {
         /* 一次请求的读取、处理、响应过程完整，等待下一次网络报文！ */
         this->CleanupRequestAndResponse();
         fState = kReadingRequest;
+        break;
+      }
+
+      case kFlushingHeldResponses: {
+        /* 流水线: 一次发送之前攒下的所有响应 */
+        err = fOutputStream.Flush();
+        if (err == EAGAIN) {
+          fSocket.RequestEvent(EV_WR);
+          return 0;
+        }
+
+        fNumHeldResponses = 0;
+        fState = kReadingRequest;
+        break;
       }
       default: break;
     }
@@ -258,6 +402,10 @@ SInt64 HTTPSession::Run() {
   /* 清空Session占用的所有资源 */
   this->CleanupRequestAndResponse();
 
+  /* zero-copy 发送的数据内核可能还在读，等它的完成通知再删除 Socket */
+  if (this->waitForZeroCopy())
+    return kZeroCopyWaitMsec;
+
   /* Session引用数为0，返回-1后，系统会将此Session删除 */
   if (fObjectHolders == 0)
     return -1;
@@ -272,7 +420,8 @@ SInt64 HTTPSession::Run() {
 CF_Error HTTPSession::SendHTTPPacket(CF::StrPtrLen *contentXML,
                                      bool connectionClose,
                                      bool decrement) {
-  HTTPPacket httpAck(&CFEnv::GetServerHeader());
+  HTTPPacket httpAck(httpResponseType);
+  httpAck.SetVersion(http11Version);
   httpAck.CreateResponseHeader();
   if (contentXML->Len)
     httpAck.AppendContentLengthHeader(contentXML->Len);
@@ -280,16 +429,9 @@ CF_Error HTTPSession::SendHTTPPacket(CF::StrPtrLen *contentXML,
   if (connectionClose)
     httpAck.AppendConnectionCloseHeader();
 
-  char respHeader[2048] = {0};
-  StrPtrLen *ackPtr = httpAck.GetCompleteHTTPHeader();
-  strncpy(respHeader, ackPtr->Ptr, ackPtr->Len);
-
   HTTPResponseStream *pOutputStream = GetOutputStream();
-  pOutputStream->Put(respHeader);
-  if (contentXML->Len > 0)
-    pOutputStream->Put(contentXML->Ptr, contentXML->Len);
-
-  if (pOutputStream->GetBytesWritten() != 0) {
+  (void) writeHeaderAndBody(httpAck.GetCompleteHTTPHeader(), contentXML);
+  if (pOutputStream->GetUnsentBytes() > 0) {
     pOutputStream->Flush();
   }
 
@@ -303,6 +445,27 @@ CF_Error HTTPSession::SendHTTPPacket(CF::StrPtrLen *contentXML,
   return CF_NoErr;
 }
 
+/*
+ * HTTP/1.1 流水线: 客户端不等响应就发来的请求在 fInputStream 里排队，
+ * 按顺序处理，它们的响应留在 fOutputStream 的缓冲区里，等没有完整的请求
+ * 可处理时一次发出，而不是每个响应一次 send。
+ *
+ * 只有下一个请求的 header 已经完整在缓冲区里才攒: 否则下一次 ReadRequest
+ * 要读 Socket，读到 EOF 或错误时 Socket 已断开，攒下的响应就发不出去了。
+ */
+bool HTTPSession::holdResponse() {
+  if (fRequest->IsRequestKeepAlive()
+      && fInputStream.HasRetreatRequest()
+      && fNumHeldResponses + 1 < sMaxPipelineDepth
+      && fOutputStream.GetUnsentBytes() < kMaxHeldBytes) {
+    fNumHeldResponses++;
+    return true;
+  }
+
+  fNumHeldResponses = 0;
+  return false;
+}
+
 /*
  * 解析请求报文
  */
@@ -312,8 +475,10 @@ CF_Error HTTPSession::SetupRequest() {
   /* 解析 head */
   if (fRequest->GetHTTPType() == httpIllegalType) {
     theErr = fRequest->Parse();
-    if (theErr != CF_NoErr)
+    if (theErr != CF_NoErr) {
+      fResponse->SetStatusCode(httpBadRequest);
       return CF_BadArgument;
+    }
   }
 
   /* 解析 body */
@@ -323,56 +488,108 @@ CF_Error HTTPSession::SetupRequest() {
   UInt32 content_length = theContentLenParser.ConsumeInteger(nullptr);
 
   if (content_length) {
-    s_printf("HTTPSession read content-length:%d \n", content_length);
-    // Check for the existence of 2 attributes in the request: a pointer to our buffer for
-    // the request body, and the current offset in that buffer. If these attributes exist,
-    // then we've already been here for this request. If they don't exist, add them.
-    UInt32 theBufferOffset = 0;
-    char *theRequestBody = nullptr;
-    StrPtrLen *requestBody = fRequest->GetBody();
-    if (requestBody != nullptr) {
-      theRequestBody = requestBody->Ptr;
-      theBufferOffset = requestBody->Len;
-    } else {
-      theRequestBody = new char[content_length + 1];
-      memset(theRequestBody, 0, content_length + 1);
-      requestBody = new StrPtrLenDel(theRequestBody, 0);
-      fRequest->SetBody(requestBody);
+    // First time here: does the route take the body as it arrives?
+    if (fRequest->GetBody() == nullptr && fRequest->GetBodySink() == nullptr) {
+      HTTPMapping *theMapping =
+          sDispatcher->Find(*fRequest->GetRequestRelativeURI(), fRequest);
+      if (theMapping != nullptr && theMapping->body != nullptr)
+        fRequest->SetBodySink(theMapping->body(*fRequest));
+
+      if (fRequest->GetBodySink() == nullptr
+          && sMaxBodySize > 0 && content_length > sMaxBodySize) {
+        fResponse->SetStatusCode(httpRequestEntityTooLarge);
+        return CF_RequestFailed;
+      }
     }
 
-    UInt32 theLen;
+    HTTPBodySink *theSink = fRequest->GetBodySink();
+    theErr = theSink != nullptr ? this->readBodyToSink(theSink, content_length)
+                                : this->readBody(content_length);
+    if (theErr != CF_NoErr)
+      return theErr;
+  }
+
+  s_printf("get complete http msg:%s QueryString:%s \n",
+           fRequest->GetRequestPath(),
+           fRequest->GetQueryString());
+
+  return CF_NoErr;
+}
 
-    // We have our buffer and offset. Read the data.
-    theErr = fInputStream.Read(theRequestBody + theBufferOffset,
-                               content_length - theBufferOffset,
-                               &theLen);
+CF_Error HTTPSession::readBody(UInt32 inContentLength) {
+  // The buffer grows with what has arrived, a Content-Length alone does not
+  // allocate it.
+  StrPtrLen *requestBody = fRequest->GetBody();
+  if (requestBody == nullptr) {
+    fBodyBufferSize = (inContentLength < kBodyChunkSizeInBytes
+                       ? inContentLength : (UInt32) kBodyChunkSizeInBytes) + 1;
+    chargeBodyMemory(fBodyBufferSize);
+    requestBody = new StrPtrLenDel(new char[fBodyBufferSize], 0);
+    fRequest->SetBody(requestBody);
+  }
+
+  while (requestBody->Len < inContentLength) {
+    if (requestBody->Len + 1 == fBodyBufferSize) {
+      UInt32 theNewSize = fBodyBufferSize * 2;
+      if (theNewSize > inContentLength + 1)
+        theNewSize = inContentLength + 1;
+      char *theNewBuffer = new char[theNewSize];
+      ::memcpy(theNewBuffer, requestBody->Ptr, requestBody->Len);
+      delete[] requestBody->Ptr;
+      requestBody->Ptr = theNewBuffer;
+      chargeBodyMemory(theNewSize - fBodyBufferSize);
+      fBodyBufferSize = theNewSize;
+    }
+
+    UInt32 theLen = 0;
+    CF_Error theErr = fInputStream.Read(requestBody->Ptr + requestBody->Len,
+                                        fBodyBufferSize - 1 - requestBody->Len,
+                                        &theLen);
     Assert(theErr != CF_BadArgument);
+    requestBody->Len += theLen;
 
-    if (theErr == CF_RequestFailed) {
-      // NEED TO RETURN HTTP ERROR RESPONSE
+    if (theErr == EAGAIN || theErr == CF_WouldBlock || (theErr == CF_NoErr && theLen == 0))
+      return CF_WouldBlock; // the rest hasn't arrived yet
+    if (theErr != CF_NoErr)
       return CF_RequestFailed;
-    }
+  }
 
-    // Update our offset in the buffer
-    requestBody->Len = theBufferOffset + theLen;
+  requestBody->Ptr[requestBody->Len] = '\0';
+  return CF_NoErr;
+}
 
-    s_printf("Add Len:%d \n", theLen);
-    if ((theErr == CF_WouldBlock) ||
-        (theLen < (content_length - theBufferOffset))) {
+CF_Error HTTPSession::readBodyToSink(HTTPBodySink *inSink, UInt32 inContentLength) {
+  // a pooled buffer only while bytes are moved, a slow upload holds none
+  while (fBodyBytesRead < inContentLength) {
+    UInt32 theLen = inContentLength - fBodyBytesRead;
+    if (theLen > kBodyChunkSizeInBytes)
+      theLen = kBodyChunkSizeInBytes;
 
-      // The entire content body hasn't arrived yet.
-      // Request a read event and wait for it.
+    char *theBuffer = (char *) sBodyBufferPool.Get();
+    CF_Error theErr = fInputStream.Read(theBuffer, theLen, &theLen);
+    Assert(theErr != CF_BadArgument);
 
-      return CF_WouldBlock;
+    CF_Error theSinkErr = CF_NoErr;
+    if (theLen > 0) {
+      fBodyBytesRead += theLen;
+      theSinkErr = inSink->Write(theBuffer, theLen);
     }
+    sBodyBufferPool.Put(theBuffer);
 
-    Assert(theErr == CF_NoErr);
+    if (theSinkErr != CF_NoErr) {
+      fResponse->SetStatusCode(httpInternalServerError);
+      return CF_RequestFailed;
+    }
+    if (theErr == EAGAIN || theErr == CF_WouldBlock || (theErr == CF_NoErr && theLen == 0))
+      return CF_WouldBlock;
+    if (theErr != CF_NoErr)
+      return CF_RequestFailed;
   }
 
-  s_printf("get complete http msg:%s QueryString:%s \n",
-           fRequest->GetRequestPath(),
-           fRequest->GetQueryString());
-
+  if (inSink->End() != CF_NoErr) {
+    fResponse->SetStatusCode(httpInternalServerError);
+    return CF_RequestFailed;
+  }
   return CF_NoErr;
 }
 
@@ -387,7 +604,29 @@ CF_Error HTTPSession::SetupResponse() {
   fResponse->CreateResponseHeader();
 
   StrPtrLen *respBody = fResponse->GetBody();
-  if (respBody != NULL && respBody->Len > 0)
+  HTTPFileBody *fileBody = fResponse->GetFileBody();
+  HTTPStreamBody *streamBody = fResponse->GetStreamBody();
+  HTTPStatusCode status = fResponse->GetStatusCode();
+  if (status <= httpSwitchingProtocols || status == httpNoContent
+      || status == httpNotModified) {
+    // these never have a body, nor a length
+    fResponse->SetFileBody(nullptr);
+    respBody = nullptr;
+    fileBody = nullptr;
+    streamBody = nullptr;
+  } else if (streamBody != nullptr) {
+    // length unknown: chunked, or until the connection closes for HTTP/1.0
+    streamBody->SetTask(this);
+    streamBody->SetChunked(fResponse->GetVersion() == http11Version);
+    if (streamBody->IsChunked()) {
+      static StrPtrLen sChunked("chunked");
+      fResponse->AppendResponseHeader(httpTransferEncodingHeader, &sChunked);
+    } else {
+      fRequest->SetRequestKeepAlive(false);
+    }
+  } else if (fileBody != nullptr)
+    fResponse->AppendContentLengthHeader(fileBody->GetLength());
+  else if (respBody != NULL && respBody->Len > 0)
     fResponse->AppendContentLengthHeader(respBody->Len);
   else
     fResponse->AppendContentLengthHeader((UInt32) 0);
@@ -396,35 +635,120 @@ CF_Error HTTPSession::SetupResponse() {
     fResponse->AppendConnectionCloseHeader();
   }
 
-  char respHeader[2048] = {0};
-  StrPtrLen *ackPtr = fResponse->GetCompleteHTTPHeader();
-  strncpy(respHeader, ackPtr->Ptr, ackPtr->Len);
+  StrPtrLen *respHeader = fResponse->GetCompleteHTTPHeader();
 
-  fOutputStream.Put(respHeader);
+  // HEAD: the header of a GET, the body is not sent
+  if (fRequest->GetMethod() == httpHeadMethod
+      && (respBody != nullptr || fileBody != nullptr || streamBody != nullptr)) {
+    fResponse->SetFileBody(nullptr);
+    respBody = nullptr;
+    fileBody = nullptr;
+    streamBody = nullptr;
+  }
 
-  // construct response body
-  if (respBody != NULL && respBody->Len > 0)
-    fOutputStream.Put(*respBody);
+  // the file or stream body is sent from kFlushingResponse, after the header
+  if (fileBody != nullptr || streamBody != nullptr) {
+    fOutputStream.Put(*respHeader);
+    return CF_NoErr;
+  }
 
-  return CF_NoErr;
+  // held for pipelining: copied, fResponse is gone before it is sent
+  if (this->holdResponse()) {
+    fOutputStream.Put(*respHeader);
+    if (respBody != nullptr && respBody->Len > 0)
+      fOutputStream.Put(*respBody);
+    return CF_NoErr;
+  }
+
+  // a big body of its own goes out from where it is
+  if (respBody != nullptr && sZeroCopyMinBytes > 0
+      && respBody->Len >= sZeroCopyMinBytes && fResponse->OwnsBody()) {
+    OS_Error theErr = fSocket.EnableZeroCopy();
+    if (theErr == OS_NoErr)
+      return writeHeaderAndBodyZeroCopy(respHeader, fResponse->GetAndSetBody(nullptr));
+    if (theErr == ENOTSUP)
+      sZeroCopyMinBytes = 0; // not in this kernel, don't ask again
+  }
+
+  return writeHeaderAndBody(respHeader, respBody);
+}
+
+/*
+ * 头部和 body 用一次 writev 直接从各自的内存发出（前面还有缓冲区里
+ * 等待发送的数据），只有 Socket 没有接收的部分才复制到 fOutputStream
+ * 的缓冲区，由 Flush 继续发送。
+ */
+CF_Error HTTPSession::writeHeaderAndBody(StrPtrLen *inHeader, StrPtrLen *inBody) {
+  iovec theVec[3];  // [0] is for the data already buffered in the stream
+  UInt32 theNumVectors = 1;
+  UInt32 theTotalLength = 0;
+
+  theVec[theNumVectors].iov_base = inHeader->Ptr;
+  theVec[theNumVectors].iov_len = inHeader->Len;
+  theTotalLength += inHeader->Len;
+  theNumVectors++;
+
+  if (inBody != nullptr && inBody->Len > 0) {
+    theVec[theNumVectors].iov_base = inBody->Ptr;
+    theVec[theNumVectors].iov_len = inBody->Len;
+    theTotalLength += inBody->Len;
+    theNumVectors++;
+  }
+
+  return fOutputStream.WriteV(theVec, theNumVectors, theTotalLength, nullptr,
+                              HTTPResponseStream::kAlwaysBuffer);
+}
+
+/*
+ * 头部复制到 fOutputStream 的缓冲区（它的内存下一个响应还要用），body
+ * 由内核直接从原处读取，读完后才删除。
+ */
+CF_Error HTTPSession::writeHeaderAndBodyZeroCopy(StrPtrLen *inHeader,
+                                                 StrPtrLen *inBody) {
+  fOutputStream.Put(*inHeader);
+
+  iovec theVec[2];  // [0] is for the data buffered in the stream
+  theVec[1].iov_base = inBody->Ptr;
+  theVec[1].iov_len = inBody->Len;
+  return fOutputStream.WriteVZeroCopy(theVec, 2, inBody->Len, inBody);
+}
+
+bool HTTPSession::waitForZeroCopy() {
+  // what is still buffered will not be sent, its buffer joins the pending
+  fOutputStream.Discard();
+  if (fSocket.GetNumZeroCopyPending() == 0)
+    return false;
+  // a peer that stopped reading never completes them
+  return fZeroCopyWaits++ < kMaxZeroCopyWaits;
 }
 
 void HTTPSession::CleanupRequestAndResponse() {
+  if (fWaitingForDispatch) {
+    sDispatcher->Cancel(this);
+    fWaitingForDispatch = false;
+  }
 
   if (fRequest != nullptr) {
     if (!fRequest->IsRequestKeepAlive())
       this->Signal(Thread::Task::kKillEvent);
 
-    // nullptr out any references to the current request
-    delete fRequest;
+    // nullptr out any references to the current request; the packets are
+    // kept for the next one, what they hold is deleted
+    fRequest->Reset(httpIllegalType);
     fRequest = nullptr;
   }
 
   if (fResponse != nullptr) {
-    delete fResponse;
+    if (fResponse == &fResponsePacket)
+      fResponse->Reset();
+    else
+      delete fResponse; // from an HTTPDeferred
     fResponse = nullptr;
   }
 
+  releaseBodyMemory();
+  fBodyBufferSize = fBodyBytesRead = 0;
+
   fSessionMutex.Unlock();
   fReadMutex.Unlock();
 
@@ -434,8 +758,26 @@ void HTTPSession::CleanupRequestAndResponse() {
 }
 
 bool HTTPSession::OverMaxConnections(UInt32 buffer) {
+  // The listener pauses at the limit, this is the hard stop for sessions
+  // that still got in (already queued in the backlog, or memory growth).
+  UInt32 maxSessions = ConnectionGovernor::GetMaxSessions();
+  if (maxSessions > 0 && ConnectionGovernor::GetNumSessions() > maxSessions + buffer)
+    return true;
+
+  UInt64 maxMemory = ConnectionGovernor::GetMaxMemoryBytes();
+  return maxMemory > 0 && ConnectionGovernor::GetMemoryBytes() > maxMemory;
+}
 
-  return false;
+void HTTPSession::chargeBodyMemory(UInt32 bytes) {
+  fChargedBodyBytes += bytes;
+  ConnectionGovernor::AddMemory(bytes);
+}
+
+void HTTPSession::releaseBodyMemory() {
+  if (fChargedBodyBytes > 0) {
+    ConnectionGovernor::RemoveMemory(fChargedBodyBytes);
+    fChargedBodyBytes = 0;
+  }
 }
 
 CF_Error HTTPSession::dumpRequestData() {
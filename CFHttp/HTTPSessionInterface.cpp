@@ -27,6 +27,8 @@
     Contains:   Implementation of HTTPSessionInterface object.
 */
 
+#include <CF/DateTranslator.h>
+#include <CF/Core/Time.h>
 #include <CF/Net/Http/HTTPProtocol.h>
 #include <CF/Net/Http/HTTPSessionInterface.h>
 
@@ -43,9 +45,54 @@ std::atomic_uint HTTPSessionInterface::sSessionIndexCounter{kFirstHTTPSessionID}
 
 HTTPDispatcher *HTTPSessionInterface::sDispatcher = nullptr;
 
+UInt32 HTTPSessionInterface::sMaxPipelineDepth = kDefaultMaxPipelineDepth;
+
+UInt32 HTTPSessionInterface::sMaxBodySize = kDefaultMaxBodySize;
+
+UInt32 HTTPSessionInterface::sZeroCopyMinBytes = 0;
+
+/*
+ * 每秒更新一次 DateCache，所有响应的 Date 头部都从那里复制，不再各自格式化。
+ */
+class HTTPDateTask : public Thread::Task {
+ public:
+  HTTPDateTask() : Task() { this->SetTaskName("HTTPDateTask"); }
+
+  SInt64 Run() override {
+    EventFlags events = this->GetEvents();
+    if (events & Task::kKillEvent)
+      return -1;
+
+    DateCache::Update();
+
+    // wake up just after the next second starts
+    struct timeval theTime;
+    Core::Time::GetTimeOfDay(&theTime);
+    return 1000 - theTime.tv_usec / 1000;
+  }
+};
+
+HTTPDateTask *HTTPSessionInterface::sDateTask = nullptr;
+
 void HTTPSessionInterface::Initialize(HTTPMapping *mapping) {
   sDispatcher = new HTTPDispatcher(mapping);
   Assert(sDispatcher != nullptr);
+
+  if (sDateTask == nullptr) {
+    DateCache::Update();
+    sDateTask = new HTTPDateTask();
+    sDateTask->Signal(Task::kStartEvent);
+  }
+}
+
+void HTTPSessionInterface::Release() {
+  delete sDispatcher;
+  sDispatcher = nullptr;
+
+  if (sDateTask != nullptr) {
+    sDateTask->Signal(Task::kKillEvent); // deletes itself
+    sDateTask = nullptr;
+  }
 }
 
 HTTPSessionInterface::HTTPSessionInterface()
@@ -73,6 +120,9 @@ HTTPSessionInterface::HTTPSessionInterface()
 }
 
 HTTPSessionInterface::~HTTPSessionInterface() {
+  // while fSocket is there, a zero-copy buffer is handed back through it
+  fOutputStream.Discard();
+
   // If the input Socket is != output Socket, the input Socket was created dynamically
   if (fInputSocketP != fOutputSocketP)
     delete fInputSocketP;
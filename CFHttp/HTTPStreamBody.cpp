@@ -0,0 +1,101 @@
+/**
+ * @file HTTPStreamBody.cpp
+ *
+ * implements HTTPStreamBody class
+ */
+
+#include <string.h>
+#include <CF/Net/Http/HTTPStreamBody.h>
+
+using namespace CF::Net;
+
+HTTPStreamBody::HTTPStreamBody()
+    : fBuffer(nullptr),
+      fSendPos(0),
+      fSendEnd(0),
+      fLength(0),
+      fChunked(true),
+      fEnded(false),
+      fDone(false),
+      fTask(nullptr) {}
+
+HTTPStreamBody::~HTTPStreamBody() {
+  delete[] fBuffer;
+}
+
+void HTTPStreamBody::Wakeup() {
+  if (fTask != nullptr)
+    fTask->Signal(Thread::Task::kWriteEvent);
+}
+
+CF_Error HTTPStreamBody::nextChunk() {
+  if (fBuffer == nullptr)
+    fBuffer = new char[kChunkBufferSize];
+
+  UInt32 theLen = 0;
+  CF_Error theErr = this->Read(fBuffer + kChunkHeaderSize, kMaxChunkSizeInBytes, &theLen);
+  if (theErr == EAGAIN)
+    return CF_WouldBlock;
+  if (theErr == CF_NoMoreData) {
+    fEnded = true;
+    theLen = 0;
+  } else if (theErr != CF_NoErr) {
+    return theErr;
+  }
+  Assert(theLen > 0 || fEnded);
+  Assert(theLen <= kMaxChunkSizeInBytes);
+  fLength += theLen;
+
+  fSendPos = kChunkHeaderSize;
+  fSendEnd = kChunkHeaderSize + theLen;
+  if (!fChunked)
+    return CF_NoErr;
+
+  // "<hex length>\r\n" just before the data, "\r\n" after it; the last
+  // chunk is "0\r\n\r\n"
+  fBuffer[--fSendPos] = '\n';
+  fBuffer[--fSendPos] = '\r';
+  UInt32 theDigits = theLen;
+  do {
+    fBuffer[--fSendPos] = "0123456789abcdef"[theDigits & 0xF];
+    theDigits >>= 4;
+  } while (theDigits != 0);
+  fBuffer[fSendEnd++] = '\r';
+  fBuffer[fSendEnd++] = '\n';
+  return CF_NoErr;
+}
+
+CF_Error HTTPStreamBody::Send(Socket *inSocket, UInt32 *outLengthSent) {
+  Assert(inSocket != nullptr);
+
+  UInt32 theTotalSent = 0;
+  CF_Error theErr = CF_NoErr;
+
+  while (!fDone) {
+    if (fSendPos == fSendEnd) {
+      if (fEnded) {
+        fDone = true;
+        break;
+      }
+      theErr = this->nextChunk();
+      if (theErr != CF_NoErr)
+        break;
+      continue;
+    }
+
+    UInt32 theLengthSent = 0;
+    theErr = inSocket->Send(fBuffer + fSendPos, fSendEnd - fSendPos, &theLengthSent);
+    fSendPos += theLengthSent;
+    theTotalSent += theLengthSent;
+
+    if (theErr == CF_NoErr && theLengthSent == 0)
+      theErr = EAGAIN; // nothing moved, wait for the Socket
+    if (theErr != CF_NoErr)
+      break;
+  }
+
+  if (outLengthSent != nullptr)
+    *outLengthSent = theTotalSent;
+
+  return theErr;
+}
@@ -0,0 +1,48 @@
+/**
+ * @file HTTPBodySink.h
+ *
+ * Where a request body goes while it arrives. A route that expects large
+ * bodies gives a body function in its HTTPMapping; the session calls it once
+ * the header is parsed, and if it returns a sink the body is handed to it
+ * piece by piece, from a pooled buffer, instead of being collected in
+ * request.GetBody(). The route's CGI function runs after End, with the sink
+ * still at request.GetBodySink().
+ */
+
+#ifndef __HTTP_BODY_SINK_H__
+#define __HTTP_BODY_SINK_H__
+
+#include <CF/CFDef.h>
+
+namespace CF {
+namespace Net {
+
+class HTTPBodySink {
+ public:
+
+  HTTPBodySink() = default;
+  virtual ~HTTPBodySink() = default;
+
+  /**
+   * @brief the next inLen bytes of the body.
+   *
+   * inData is only valid during the call. Called from the session's
+   * thread, in order.
+   *
+   * @return CF_NoErr, or an error to stop reading: the client gets a 500
+   *         and the connection is closed.
+   */
+  virtual CF_Error Write(char const *inData, UInt32 inLen) = 0;
+
+  /**
+   * @brief the whole body has been written.
+   *
+   * @return as Write
+   */
+  virtual CF_Error End() { return CF_NoErr; }
+};
+
+} // namespace Net
+} // namespace CF
+
+#endif // __HTTP_BODY_SINK_H__
@@ -8,6 +8,7 @@
 #include <CF/CFEnv.h>
 #include <CF/Net/Http/HTTPDef.h>
 #include <CF/Net/Http/HTTPListenerSocket.h>
+#include <CF/Net/Http/HTTPResponseCache.h>
 #include <CF/Net/Http/HTTPSessionInterface.h>
 #include <CF/Net/Socket/SocketUtils.h>
 
@@ -26,6 +27,14 @@ class HTTPConfigure {
     UInt32 numHttpListens;
     CF_NetAddr *httpListenAddrs = config->GetHttpListenAddr(&numHttpListens);
     if (numHttpListens > 0) {
+      ConnectionGovernor::SetLimits(config->GetHttpMaxConnections(),
+                                    config->GetHttpMaxQueuedTasks(),
+                                    config->GetHttpMaxMemoryUsage());
+      HTTPRequestStream::SetMaxHeaderSize(config->GetHttpMaxHeaderSize());
+      HTTPSessionInterface::SetMaxPipelineDepth(config->GetHttpMaxPipelineDepth());
+      HTTPSessionInterface::SetMaxBodySize(config->GetHttpMaxBodySize());
+      HTTPSessionInterface::SetZeroCopyMinBytes(config->GetHttpZeroCopyMinBytes());
+      HTTPResponseCache::SetMaxBytes(config->GetHttpResponseCacheSize());
       HTTPSessionInterface::Initialize(config->GetHttpMapping());
       for (UInt32 i = 0; i < numHttpListens; i++) {
         auto *httpSocket = new HTTPListenerSocket();
@@ -57,8 +66,8 @@ class HTTPConfigure {
 
   virtual HTTPMapping *GetHttpMapping() {
     static HTTPMapping defaultHttpMapping[] = {
-        {"/exit", (CF_CGIFunction) DefaultExitCGI},
-        {NULL, NULL}
+        {"/exit", (CF_CGIFunction) DefaultExitCGI, nullptr, nullptr},
+        {NULL, NULL, NULL, NULL}
     };
     return defaultHttpMapping;
   }
@@ -71,6 +80,47 @@ class HTTPConfigure {
     return defaultHttpAddrs;
   }
 
+  //
+  // Admission control, 0 means unlimited. When a limit is reached the
+  // listeners stop accepting until the load drops below 90% of it.
+
+  virtual UInt32 GetHttpMaxConnections() { return 0; }
+  virtual UInt32 GetHttpMaxQueuedTasks() { return 0; }
+  virtual UInt64 GetHttpMaxMemoryUsage() { return 0; }
+
+  //
+  // Longest request header accepted, a longer one gets 431. Buffers grow
+  // in CF_MAX_REQUEST_BUFFER_SIZE steps up to it.
+  virtual UInt32 GetHttpMaxHeaderSize() {
+    return HTTPRequestStream::kDefaultMaxHeaderSize;
+  }
+
+  //
+  // Pipelined requests answered before their responses are sent together,
+  // 1 sends each response on its own.
+  virtual UInt32 GetHttpMaxPipelineDepth() {
+    return HTTPSessionInterface::kDefaultMaxPipelineDepth;
+  }
+
+  //
+  // Longest request body buffered for a handler, a longer one gets 413.
+  // Routes with a body function (HTTPBodySink) are not limited. 0: no limit.
+  virtual UInt32 GetHttpMaxBodySize() {
+    return HTTPSessionInterface::kDefaultMaxBodySize;
+  }
+
+  //
+  // Response bodies at least this big are sent with MSG_ZEROCOPY (Linux),
+  // without the kernel copying them. 0: never.
+  virtual UInt32 GetHttpZeroCopyMinBytes() { return 0; }
+
+  //
+  // Memory for the responses of routes with an HTTPCachePolicy, 0 turns the
+  // cache off.
+  virtual UInt64 GetHttpResponseCacheSize() {
+    return HTTPResponseCache::kDefaultMaxBytes;
+  }
+
 };
 
 }
@@ -6,17 +6,35 @@
 #define __CF_HTTP_DEF_H__
 
 #include <CF/Net/Http/HTTPPacket.h>
+#include <CF/Net/Http/HTTPBodySink.h>
 
 #ifdef __cplusplus
 extern "C" {
 #endif
 
+// 填好 response 后返回; 或者 response.Defer() 之后返回 CF_WouldBlock，
+// 稍后由别的线程完成，见 HTTPDeferred
 typedef CF_Error (*CF_CGIFunction) (CF::Net::HTTPPacket &request,
                                     CF::Net::HTTPPacket &response);
 
+// 可选: 请求 body 到达时交给它返回的 sink，返回 nullptr 则照常缓存到
+// request.GetBody()
+typedef CF::Net::HTTPBodySink *(*CF_BodyFunction) (CF::Net::HTTPPacket &request);
+
+// 可选: 路由的 GET 响应在内存中缓存 ttlInMSecs，见 HTTPResponseCache。
+// 缓存的 key 是 path、query 和这里列出的请求头
+struct HTTPCachePolicy {
+  UInt32 ttlInMSecs;
+  UInt32 numVaryHeaders;
+  CF::Net::HTTPHeader varyHeaders[4];
+};
+typedef struct HTTPCachePolicy HTTPCachePolicy;
+
 struct HTTPMapping {
   char *path;
   CF_CGIFunction func;
+  CF_BodyFunction body; // nullptr: the body is read whole
+  HTTPCachePolicy *cache; // nullptr: not cached
 };
 typedef struct HTTPMapping HTTPMapping;
 
@@ -0,0 +1,97 @@
+/**
+ * @file HTTPDeferred.h
+ *
+ * Response of a CGI function that is answered later, from another thread:
+ * the function takes a handle from its response, hands it to whoever will
+ * produce the answer, and returns CF_WouldBlock.
+ *
+ *   static CF_Error Upstream(HTTPPacket &request, HTTPPacket &response) {
+ *     HTTPDeferred *theDeferred = response.Defer();
+ *     sJobs.Push(theDeferred);          // the worker fills
+ *     return CF_WouldBlock;             // theDeferred->GetResponse(), then
+ *   }                                   // calls theDeferred->Complete()
+ *
+ * Meanwhile the session holds no lock and no thread. Complete wakes it with
+ * a kUpdateEvent and it sends the handle's response in place of the one the
+ * function got.
+ *
+ * CF_WouldBlock without a Defer() is a bug of the function, and is answered
+ * 500.
+ *
+ * The handle is shared by the session and the producer, whichever lets go
+ * last deletes it. Complete must be called exactly once, also when the
+ * session went away (IsCancelled), and the handle is not used after it.
+ */
+
+#ifndef __HTTP_DEFERRED_H__
+#define __HTTP_DEFERRED_H__
+
+#include <CF/Core/Mutex.h>
+#include <CF/Thread/Task.h>
+#include <CF/Net/Http/HTTPPacket.h>
+
+namespace CF {
+namespace Net {
+
+class HTTPDeferred {
+ public:
+
+  /**
+   * @brief the response to fill, as a CGI function fills its own.
+   *
+   * Only the producer touches it until Complete.
+   */
+  HTTPPacket *GetResponse() { return fResponse; }
+
+  /**
+   * @brief the response is ready. Thread safe, releases the producer's hold.
+   *
+   * @param inResult - what a CGI function would return: CF_FileNotFound is
+   *                   answered 404, another error 500.
+   */
+  void Complete(CF_Error inResult = CF_NoErr);
+
+  // the session is gone (timed out or killed), nobody will see the response
+  bool IsCancelled();
+
+  //
+  // Used by the session
+
+  /**
+   * @brief inTask gets a kUpdateEvent on Complete.
+   *
+   * @return false when it is complete already, there is nothing to wait for
+   */
+  bool Park(Thread::Task *inTask);
+  bool IsComplete();
+  CF_Error GetResult() { return fResult; }
+
+  // the filled response, now owned by the caller
+  HTTPPacket *TakeResponse();
+
+  // the session lets go, no event is sent after this
+  void Detach();
+
+ private:
+
+  friend class HTTPPacket;
+
+  HTTPDeferred();
+  ~HTTPDeferred();
+
+  // with fMutex held; true if it was the last hold
+  bool release();
+
+  Core::Mutex fMutex;
+  HTTPPacket *fResponse;
+  Thread::Task *fTask;
+  CF_Error fResult;
+  UInt32 fRefCount;   // the session and the producer
+  bool fComplete;
+  bool fCancelled;
+};
+
+} // namespace Net
+} // namespace CF
+
+#endif // __HTTP_DEFERRED_H__
@@ -5,137 +5,101 @@
 #ifndef __HTTP_DISPATCHER_H__
 #define __HTTP_DISPATCHER_H__
 
+#include <CF/Thread/Task.h>
 #include <CF/Net/Http/HTTPDef.h>
 #include <CF/Net/Http/HTTPPacket.h>
 
+#define HTTPDISPATCHER_TESTING 0
+
 namespace CF {
 namespace Net {
 
-class HTTPPathMapper;
-
+/**
+ * Routes a request path to its CGI function.
+ *
+ * 四种类型的映射, in this order of precedence:
+ *  - exact:     "/live/list", or with parameters "/users/:id/posts", a
+ *               ":name" segment matches one path segment and is captured
+ *               (HTTPPacket::GetPathParam); static segments win over
+ *               parameters.
+ *  - wildcard:  "/live/\*", any path starting with "/live"; the longest
+ *               prefix wins.
+ *  - extension: "*.m3u8", any path ending with ".m3u8"; the longest wins.
+ *  - default:   "/", everything else.
+ *
+ * The mappings are put in two compressed radix trees when the dispatcher is
+ * built, one for the paths and one for the reversed extensions, so a lookup
+ * costs the length of the path, not the number of routes.
+ */
 class HTTPDispatcher {
  public:
 
-  HTTPDispatcher(HTTPMapping *mapping);
+  /**
+   * @param mapping - terminated by an entry with a null path or func; the
+   *                  first of two identical paths is kept.
+   */
+  explicit HTTPDispatcher(HTTPMapping *mapping);
 
-  virtual ~HTTPDispatcher() { delete[] fMappers; }
+  virtual ~HTTPDispatcher();
 
-  CF_Error Dispatch(HTTPPacket &request, HTTPPacket &response);
+  /**
+   * @param inTask - the session, for a route with an HTTPCachePolicy: while
+   *                 an identical request is answered, CF_WouldBlock is
+   *                 returned and inTask gets a kUpdateEvent to call again.
+   * @return also CF_WouldBlock when the function deferred its response
+   *         (response.GetDeferred()), call Finish with the completed one.
+   */
+  CF_Error Dispatch(HTTPPacket &request, HTTPPacket &response,
+                    Thread::Task *inTask = nullptr);
 
- private:
-  HTTPPathMapper **fMappers;
-  UInt32 fMapperNum;
-};
+  // the deferred response of request is complete
+  void Finish(HTTPPacket &request, HTTPPacket &response,
+              CF_Error inResult, Thread::Task *inTask = nullptr);
 
-class HTTPPathMapper {
- public:
-  // 四种类型的映射器
-  enum {
-    httpExactMapper = 0,
-    httpWildcardMapper = 1,
-    httpExtensionMapper = 2,
-    httpDefaultMapper = 4
-  };
+  // inTask, told to wait by Dispatch, is going away
+  void Cancel(Thread::Task *inTask);
 
-  static HTTPPathMapper *BuildPathMatcher(HTTPMapping &mapping);
+  /**
+   * @brief the function for inPath, nullptr if none.
+   *
+   * @param outParams - gets the captured path parameters, may be nullptr
+   */
+  CF_CGIFunction Route(const StrPtrLen &inPath, HTTPPacket *outParams);
 
-  static int ComparePriority(HTTPPathMapper *aMapper, HTTPPathMapper *bMapper);
+  // same, the whole mapping (with its body function)
+  HTTPMapping *Find(const StrPtrLen &inPath, HTTPPacket *outParams);
 
-  virtual ~HTTPPathMapper() = default;;
+  UInt32 GetNumRoutes() { return fNumRoutes; }
 
-  virtual UInt32 ItsType() = 0;
+#if HTTPDISPATCHER_TESTING
+  // lookup time with 10, 1k and 10k routes, against a linear scan
+  static bool Test();
+#endif
 
-  virtual bool Match(const StrPtrLen &path) = 0;
+ private:
 
-  CF_Error Mapping(HTTPPacket &request, HTTPPacket &response) {
-    return fFunc(request, response);
-  }
+  struct Node;
+  struct Search;
 
- protected:
-  HTTPPathMapper(HTTPMapping mapping) : fFunc(mapping.func) {}
+  bool addRoute(HTTPMapping &mapping);
+  // static bytes below inNode, splitting edges as needed
+  static Node *insert(Node *inNode, char const *inKey, UInt32 inLen);
+  // a ":name" segment below inNode, nullptr if it has another name
+  static Node *insertParam(Node *inNode, char const *inName, UInt32 inLen);
+  static bool find(Node *inNode, char *inPath, UInt32 inRemaining, Search *ioSearch);
+  HTTPMapping *findExtension(const StrPtrLen &inPath);
 
-  CF_CGIFunction fFunc;
+  Node *fRoot;        // exact and wildcard routes
+  Node *fSuffixRoot;  // extension routes, reversed
+  HTTPMapping *fDefault;
+  HTTPMapping *fMappings;  // copy of the table, the nodes point into it
+  UInt32 fNumRoutes;
 
   static StrPtrLen sAllSuffix;
   static StrPtrLen sTypePrefix;
   static StrPtrLen sRootPath;
 };
 
-class ExactPathMapper : public HTTPPathMapper {
- public:
-  ExactPathMapper(HTTPMapping mapping) : HTTPPathMapper(mapping) {
-    auto len = static_cast<UInt32>(strlen(mapping.path));
-    char *buffer = new char[len + 1];
-    memcpy(buffer, mapping.path, len);
-    buffer[len] = '\0';
-    pattern.Set(buffer, len);
-  }
-  ~ExactPathMapper() override { delete[] pattern.Ptr; }
-
-  UInt32 ItsType() override { return httpExactMapper; }
-
-  bool Match(const StrPtrLen &path) override { return pattern.Equal(path); }
-
- private:
-  StrPtrLen pattern;
-};
-
-class WildcardPathMapper : public HTTPPathMapper {
- public:
-  WildcardPathMapper(HTTPMapping mapping) : HTTPPathMapper(mapping) {
-    // xxxxx/*
-    auto len = static_cast<UInt32>(strlen(mapping.path) - 2);
-    char *buffer = new char[len + 1];
-    memcpy(buffer, mapping.path, len);
-    buffer[len] = '\0';
-    pattern.Set(buffer, len);
-  }
-  ~WildcardPathMapper() override { delete[] pattern.Ptr; }
-
-  UInt32 ItsType() override { return httpWildcardMapper; }
-
-  bool Match(const StrPtrLen &path) override {
-    if (path.Len < pattern.Len) return false;
-    StrPtrLen op(path.Ptr, pattern.Len);
-    return pattern.Equal(op);
-  }
- private:
-  StrPtrLen pattern;
-};
-
-class ExtensionPathMapper : public HTTPPathMapper {
- public:
-  ExtensionPathMapper(HTTPMapping mapping) : HTTPPathMapper(mapping) {
-    // *.ext
-    auto len = static_cast<UInt32>(strlen(mapping.path) - 1);
-    char *buffer = new char[len + 1];
-    memcpy(buffer, mapping.path + 1, len);
-    buffer[len] = '\0';
-    pattern.Set(buffer, len);
-  }
-  ~ExtensionPathMapper() override { delete[] pattern.Ptr; }
-
-  UInt32 ItsType() override { return httpExtensionMapper; }
-
-  bool Match(const StrPtrLen &path) override {
-    if (path.Len < pattern.Len) return false;
-    StrPtrLen op(path.Ptr + (path.Len - pattern.Len), pattern.Len);
-    return pattern.Equal(op);
-  }
- private:
-  StrPtrLen pattern;
-};
-
-class DefaultPathMapper : public HTTPPathMapper {
- public:
-  DefaultPathMapper(HTTPMapping mapping) : HTTPPathMapper(mapping) {}
-  ~DefaultPathMapper() override = default;
-
-  UInt32 ItsType() override { return httpDefaultMapper; }
-
-  bool Match(const StrPtrLen &path) override { return true; }
-};
-
 } // namespace Net
 } // namespace CF
 
@@ -0,0 +1,84 @@
+/**
+ * @file HTTPFileBody.h
+ *
+ * File-backed HTTP body. Instead of reading the file into a StrPtrLen and
+ * copying it through HTTPResponseStream, the data goes from the file to the
+ * Socket inside the kernel: sendfile(2) for regular files, splice(2) through
+ * a pipe for pipes/fifos/devices, and read + send where neither exists.
+ */
+
+#ifndef __HTTP_FILE_BODY_H__
+#define __HTTP_FILE_BODY_H__
+
+#include <CF/CFDef.h>
+#include <CF/FileSource.h>
+#include <CF/Net/Socket/Socket.h>
+
+namespace CF {
+namespace Net {
+
+class HTTPFileBody {
+ public:
+
+  /**
+   * @brief send inLength bytes of inSource, starting at inOffset.
+   *
+   * @note the FileSource is owned by this object. For non-regular sources
+   *       the length must be given, their size is unknown, and their fd is
+   *       made non-blocking.
+   */
+  HTTPFileBody(FileSource *inSource, UInt64 inOffset, UInt64 inLength);
+
+  /**
+   * @brief send the whole file at inPath.
+   */
+  explicit HTTPFileBody(char const *inPath);
+
+  virtual ~HTTPFileBody();
+
+  bool IsValid() const { return fSource != nullptr && fSource->IsValid(); }
+  FileSource *GetSource() { return fSource; }
+
+  UInt64 GetLength() const { return fLength; }
+  UInt64 GetRemaining() const { return fLength - fSent; }
+  bool IsDone() const { return fSent >= fLength; }
+
+  /**
+   * @brief send as much as the Socket accepts.
+   *
+   * @return CF_NoErr when the whole body is sent, EAGAIN when the Socket is
+   *         flow controlled (wait for kWriteEvent and call again),
+   *         CF_WouldBlock when a pipe, fifo or socket source has no data yet
+   *         (call again a little later), CF_NoMoreData when the source ended
+   *         early, or POSIX error code.
+   */
+  CF_Error Send(Socket *inSocket, UInt32 *outLengthSent);
+
+ private:
+
+  enum {
+    kMaxSendSizeInBytes = 1024 * 1024,  // UInt32, per system call
+    kCopyBufferSizeInBytes = 32 * 1024  // UInt32, for the read + send fallback
+  };
+
+  CF_Error sendByCopy(Socket *inSocket, UInt32 inLength, UInt32 *outLengthSent);
+
+  FileSource *fSource;
+  UInt64 fOffset;   // next file position to send
+  UInt64 fLength;
+  UInt64 fSent;
+
+  bool fUseCopy;    // sendfile/splice not available for this fd
+
+  int fPipe[2];     // splice pipe, for non-regular sources
+  UInt32 fPipeBytes;
+
+  char *fCopyBuffer;
+  UInt32 fCopyBufferLen;
+  UInt32 fCopyBufferPos;
+};
+
+} // namespace Net
+} // namespace CF
+
+#endif // __HTTP_FILE_BODY_H__
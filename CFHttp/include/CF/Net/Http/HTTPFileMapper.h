@@ -0,0 +1,65 @@
+/**
+ * @file HTTPFileMapper.h
+ *
+ * Static files for HTTPMapping. A directory is mapped under a URL prefix,
+ * and HTTPFileMapper::Serve is the CGI function of the prefix's wildcard
+ * route:
+ *
+ *   HTTPFileMapper::AddRoot("/static", "/var/www");
+ *   {"/static/\*", (CF_CGIFunction) HTTPFileMapper::Serve, nullptr, nullptr}
+ *
+ * GET and HEAD are answered with Last-Modified and ETag, 304 for a matching
+ * If-None-Match or If-Modified-Since, and 206 for a single "bytes" Range
+ * (If-Range honoured). The data goes out through HTTPFileBody, by sendfile.
+ *
+ * Open files and their stat results are kept in a bounded LRU cache shared
+ * by all sessions, so a hot file costs no open/fstat. An entry is checked
+ * with stat once it is older than the revalidate interval and replaced when
+ * the file changed; a file being sent keeps its fd until the send ends.
+ */
+
+#ifndef __HTTP_FILE_MAPPER_H__
+#define __HTTP_FILE_MAPPER_H__
+
+#include <CF/Net/Http/HTTPPacket.h>
+
+namespace CF {
+namespace Net {
+
+class HTTPFileMapper {
+ public:
+
+  enum {
+    kMaxRoots = 16,                           // UInt32
+    kDefaultMaxCachedFiles = 1024,            // UInt32
+    kDefaultRevalidateIntervalInMSecs = 1000  // UInt32
+  };
+
+  /**
+   * @brief serve the files under inDirectory for the paths under inURLPrefix.
+   *
+   * The longest matching prefix wins. Call before the server starts.
+   *
+   * @return false when kMaxRoots are mapped
+   */
+  static bool AddRoot(char const *inURLPrefix, char const *inDirectory);
+
+  // the CGI function
+  static CF_Error Serve(HTTPPacket &request, HTTPPacket &response);
+
+  // open files kept, 0 to open every file for each request
+  static void SetMaxCachedFiles(UInt32 inMaxFiles);
+  // how long a cached stat is trusted
+  static void SetRevalidateInterval(UInt32 inMilliseconds);
+
+  // forget inPath (a file system path), or every file
+  static void Invalidate(char const *inPath);
+  static void InvalidateAll();
+
+  static UInt32 GetNumCachedFiles();
+};
+
+} // namespace Net
+} // namespace CF
+
+#endif // __HTTP_FILE_MAPPER_H__
@@ -0,0 +1,127 @@
+/**
+ * @file HTTPHeaderIndex.h
+ *
+ * Where the request line and the header fields of a request are, as offsets
+ * from the start of the header. HTTPRequestStream fills it in while it looks
+ * for the end of the header, every byte once, and HTTPPacket::Parse reads
+ * the fields from it instead of tokenizing the header again.
+ */
+
+#ifndef __HTTP_HEADER_INDEX_H__
+#define __HTTP_HEADER_INDEX_H__
+
+#include <CF/CFDef.h>
+
+namespace CF {
+namespace Net {
+
+class HTTPHeaderIndex {
+ public:
+
+  enum {
+    kMaxFields = 64,        // UInt32, more and HTTPPacket parses the text
+    kNoColon = 0xFFFFFFFF   // UInt32
+  };
+
+  struct Field {
+    UInt32 fNameOffset;
+    UInt32 fNameLen;
+    UInt32 fValueOffset;
+    UInt32 fValueLen;
+  };
+
+  HTTPHeaderIndex() { this->Reset(); }
+
+  void Reset() {
+    fRequestLineOffset = fRequestLineLen = fHeadersOffset = 0;
+    fNumFields = 0;
+    fHasRequestLine = fMalformed = fOverflow = fDone = false;
+  }
+
+  /**
+   * @brief can HTTPPacket use it?
+   *
+   * Not when there was no request line or more fields than kMaxFields.
+   */
+  bool IsUsable() { return fHasRequestLine && !fOverflow; }
+
+  // a header line without a colon
+  bool IsMalformed() { return fMalformed; }
+
+  UInt32 GetRequestLineOffset() { return fRequestLineOffset; }
+  UInt32 GetRequestLineLen() { return fRequestLineLen; }
+  // first byte after the request line and its EOL
+  UInt32 GetHeadersOffset() { return fHeadersOffset; }
+
+  UInt32 GetNumFields() { return fNumFields; }
+  Field *GetField(UInt32 inIndex) { return &fFields[inIndex]; }
+
+  /**
+   * @brief one line of the header, called by the scanner at its EOL.
+   *
+   * @param inStart      - first byte of the line
+   * @param inEnd        - first byte of its EOL
+   * @param inNext       - first byte of the next line
+   * @param inColon      - first ':' in the line, or kNoColon
+   * @param inValueStart - value start, after the colon and one space
+   */
+  void AddLine(UInt32 inStart, UInt32 inEnd, UInt32 inNext,
+               UInt32 inColon, UInt32 inValueStart) {
+    if (fDone)
+      return;
+
+    // empty lines before the request line are skipped
+    if (!fHasRequestLine) {
+      if (inEnd > inStart) {
+        fRequestLineOffset = inStart;
+        fRequestLineLen = inEnd - inStart;
+        fHeadersOffset = inNext;
+        fHasRequestLine = true;
+      }
+      return;
+    }
+
+    // a blank line ends the fields
+    if (inEnd == inStart) {
+      fDone = true;
+      return;
+    }
+
+    if (inColon == kNoColon) {
+      fMalformed = fDone = true;
+      return;
+    }
+
+    if (fNumFields == kMaxFields) {
+      fOverflow = fDone = true;
+      return;
+    }
+
+    Field *theField = &fFields[fNumFields++];
+    theField->fNameOffset = inStart;
+    theField->fNameLen = inColon - inStart;
+    if (inValueStart > inEnd)
+      inValueStart = inEnd;
+    theField->fValueOffset = inValueStart;
+    theField->fValueLen = inEnd - inValueStart;
+  }
+
+ private:
+
+  UInt32 fRequestLineOffset;
+  UInt32 fRequestLineLen;
+  UInt32 fHeadersOffset;
+
+  Field fFields[kMaxFields];
+  UInt32 fNumFields;
+
+  bool fHasRequestLine;
+  bool fMalformed;
+  bool fOverflow;
+  bool fDone;
+};
+
+} // namespace Net
+} // namespace CF
+
+#endif // __HTTP_HEADER_INDEX_H__
@@ -21,7 +21,7 @@ class HTTPListenerSocket : public TCPListenerSocket {
   Thread::Task *GetSessionTask(TCPSocket **outSocket) override;
 
   //check whether the Listener should be idling
-  bool OverMaxConnections(UInt32 buffer);
+  bool OverMaxConnections(UInt32 buffer) override;
 
 };
 
@@ -26,14 +26,23 @@
 #define __HTTP_PACKET_H__
 
 #include <CF/CFDef.h>
+#include <CF/Arena.h>
 #include <CF/StringParser.h>
 #include <CF/ResizeableStringFormatter.h>
 #include <CF/Net/Http/HTTPProtocol.h>
+#include <CF/Net/Http/HTTPHeaderIndex.h>
 #include <CF/Net/Http/QueryParamList.h>
 
+#define HTTPPACKET_TESTING 0
+
 namespace CF {
 namespace Net {
 
+class HTTPFileBody;
+class HTTPStreamBody;
+class HTTPBodySink;
+class HTTPDeferred;
+
 class HTTPPacket {
  public:
 
@@ -41,8 +50,10 @@ class HTTPPacket {
    * @brief construct object for parse http packet header.
    *
    * @param packetPtr - http packet data
+   * @param index     - where its lines are, from HTTPRequestStream; Parse
+   *                    then reads the fields from it. Not owned.
    */
-  HTTPPacket(StrPtrLen *packetPtr);
+  HTTPPacket(StrPtrLen *packetPtr, HTTPHeaderIndex *index = nullptr);
 
   /**
    * @brief construct object for build http packet
@@ -54,6 +65,16 @@ class HTTPPacket {
   // Destructor
   virtual ~HTTPPacket();
 
+  /**
+   * @brief the packet as constructed, to be used for the next message.
+   *
+   * The bodies, the sink and the deferred handle are deleted; the header
+   * buffers and the arena keep their memory, so that a packet reused for
+   * each request of a connection does not allocate.
+   */
+  void Reset(HTTPType httpType = httpResponseType);
+  void Reset(StrPtrLen *packetPtr, HTTPHeaderIndex *index = nullptr);
+
   HTTPType GetHTTPType() { return fHTTPType; }
 
   /**
@@ -73,6 +94,7 @@ class HTTPPacket {
   HTTPVersion GetVersion() { return fVersion; }
   HTTPStatusCode GetStatusCode() { return fStatusCode; }
   bool IsRequestKeepAlive() { return fRequestKeepAlive; }
+  void SetRequestKeepAlive(bool inKeepAlive) { fRequestKeepAlive = inKeepAlive; }
 
   StrPtrLen *GetRequestLine() { return &fRequestLine; }
   StrPtrLen *GetRequestAbsoluteURI() { return &fAbsoluteURI; }
@@ -82,12 +104,31 @@ class HTTPPacket {
   char *GetRequestPath() { return fRequestPath; }
   char *GetQueryString() { return fQueryString; }
 
+  // the decoded value of the first inParam in the query string (the name
+  // is case insensitive), nullptr if there is none
   char const *GetQueryValues(char *inParam);
 
   // If header field exists in the request, it will be found in the dictionary
   // and the value returned. Otherwise, NULL is returned.
   StrPtrLen *GetHeaderValue(HTTPHeader inHeader);
 
+  //
+  // Path parameters, captured by HTTPDispatcher for routes like
+  // "/users/:id". The values point into the request, the names into the
+  // dispatcher.
+
+  enum { kMaxPathParams = 8 }; // UInt32
+
+  UInt32 GetNumPathParams() { return fNumPathParams; }
+  StrPtrLen *GetPathParamName(UInt32 inIndex) { return &fPathParamNames[inIndex]; }
+  StrPtrLen *GetPathParam(UInt32 inIndex) { return &fPathParamValues[inIndex]; }
+  // nullptr if the route has no such parameter
+  StrPtrLen *GetPathParam(char const *inName);
+
+  // false when kMaxPathParams are set
+  bool AddPathParam(const StrPtrLen &inName, const StrPtrLen &inValue);
+  void ClearPathParams() { fNumPathParams = 0; }
+
   // Creates a header
   bool CreateResponseHeader();
   bool CreateRequestHeader();
@@ -95,6 +136,18 @@ class HTTPPacket {
   void SetVersion(HTTPVersion version) { fVersion = version; }
   void SetStatusCode(HTTPStatusCode statusCode) { fStatusCode = statusCode; }
 
+  /**
+   * @brief a header field for the response, from a CGI function.
+   *
+   * The value is copied. The session builds the header after the function
+   * returns, these fields go after the ones it always sends.
+   */
+  void AddResponseHeader(HTTPHeader inHeader, const StrPtrLen &inValue);
+  // complete header lines, each ending in CRLF
+  void AddResponseHeaderLines(const StrPtrLen &inLines);
+  // what AddResponseHeader has added so far, as header lines
+  StrPtrLen GetAddedResponseHeaders();
+
   // To append response header fields as appropriate
   void AppendResponseHeader(HTTPHeader inHeader, StrPtrLen *inValue) const;
   void AppendDateAndExpiresFields() const;
@@ -120,15 +173,76 @@ class HTTPPacket {
    *       需要使用 StrPtrLenDel
    */
   void SetBody(StrPtrLen *body) {
-    delete fHTTPBody;
+    if (fHTTPBody != &fBodyRef)
+      delete fHTTPBody;
     fHTTPBody = body;
   }
 
+  /**
+   * @brief a body that is not owned: static data, or from Allocate.
+   *
+   * Allocates nothing. GetBody returns a StrPtrLen of the packet then, don't
+   * delete it.
+   */
+  void SetBody(char *inData, UInt32 inLen) {
+    SetBody(nullptr);
+    fBodyRef.Set(inData, inLen);
+    fHTTPBody = &fBodyRef;
+  }
+
+  // the body is a StrPtrLen of its own, SetBody(StrPtrLen *)
+  bool OwnsBody() { return fHTTPBody != nullptr && fHTTPBody != &fBodyRef; }
+
+  // memory until the packet is reset or deleted, e.g. for SetBody(char *, UInt32)
+  char *Allocate(UInt32 inLen) { return (char *) fArena.Allocate(inLen); }
+
+  /**
+   * @brief file-backed body, sent by sendfile/splice instead of being copied
+   *
+   * @note the body object is owned by the Packet. A packet has either a
+   *       StrPtrLen body or a file body, SetFileBody clears the other.
+   */
+  HTTPFileBody *GetFileBody() { return fHTTPFileBody; }
+  void SetFileBody(HTTPFileBody *body);
+
+  /**
+   * @brief body produced while it is sent, in chunks
+   *
+   * @note owned by the Packet, like the file body; setting one body kind
+   *       clears the others.
+   */
+  HTTPStreamBody *GetStreamBody() { return fHTTPStreamBody; }
+  void SetStreamBody(HTTPStreamBody *body);
+
+  /**
+   * @brief where the request body went, see HTTPBodySink
+   *
+   * @note owned by the Packet
+   */
+  HTTPBodySink *GetBodySink() { return fBodySink; }
+  void SetBodySink(HTTPBodySink *sink);
+
+  /**
+   * @brief answer later: the CGI function returns CF_WouldBlock and the
+   *        handle's response is sent when it is completed, see HTTPDeferred
+   *
+   * @note the same handle for each call. The packet holds it until deleted.
+   */
+  HTTPDeferred *Defer();
+  HTTPDeferred *GetDeferred() { return fDeferred; }
+
   //
   // Other Utils
 
   // Parse if-modified-since header
   time_t ParseIfModSinceHeader();
+  // the If-None-Match header lists inETag, or is "*". Weak tags match.
+  bool IfNoneMatch(const StrPtrLen &inETag);
+
+#if HTTPPACKET_TESTING
+  // heap allocations of a keep-alive request, new packets against Reset
+  static bool Test();
+#endif
 
  private:
   enum { kMinHeaderSizeInBytes = 512 };
@@ -140,9 +254,14 @@ class HTTPPacket {
   CF_Error parseRequestLine(StringParser *parser);
   // Parses the URI to get absolute and relative URIs, the host name and the file path
   CF_Error parseURI(StringParser *parser);
+  // fQueryString into fQueryParams, on the first GetQueryValues
+  void parseQuery();
   // Parses the headers and adds them into a dictionary
   // Also calls SetKeepAlive with the Connection header field's value if it exists
   CF_Error parseHeaders(StringParser *parser);
+  // Parse from fHeaderIndex, only the request line is tokenized
+  CF_Error parseIndexed();
+  void setHeaderValue(StrPtrLen *inKeyWord, StrPtrLen *inValue);
 
   // Sets fRequestKeepAlive
   void setKeepAlive(StrPtrLen *keepAliveValue);
@@ -165,13 +284,27 @@ class HTTPPacket {
   //
   // Private members
 
+  struct QueryParam {
+    char *fName;
+    char *fValue;
+  };
+
   // Complete request and response headers
   StrPtrLen fPacketHeader; // for parse
+  HTTPHeaderIndex *fHeaderIndex; // for parse, may be nullptr
   ResizeableStringFormatter *fHTTPHeaderFormatter; // for construct
-  StrPtrLen *fHTTPHeader; // for construct. it really is StrPtrLenDel
+  ResizeableStringFormatter *fExtraHeaders; // from AddResponseHeader
+  // for construct: the formatter's current buffer, which moves off
+  // fHTTPHeaderBuffer to the heap if the header outgrows it
+  mutable StrPtrLen fHTTPHeader;
+  char fHTTPHeaderBuffer[kMinHeaderSizeInBytes];
 
   // request and repose body
   StrPtrLen *fHTTPBody;
+  HTTPFileBody *fHTTPFileBody;
+  HTTPStreamBody *fHTTPStreamBody;
+  HTTPBodySink *fBodySink;
+  HTTPDeferred *fDeferred;
 
   HTTPType fHTTPType;
 
@@ -194,7 +327,18 @@ class HTTPPacket {
   char *fRequestPath; // Also contains the query string
   char *fQueryString;
 
-  QueryParamList *fQueryValues;
+  QueryParam *fQueryParams;
+  UInt32 fNumQueryParams;
+  bool fQueryParsed;
+
+  // fRequestPath, fQueryString and fQueryParams live here, and what the
+  // CGI function takes with Allocate
+  Arena fArena;
+  StrPtrLen fBodyRef;  // the body of SetBody(char *, UInt32)
+
+  StrPtrLen fPathParamNames[kMaxPathParams];
+  StrPtrLen fPathParamValues[kMaxPathParams];
+  UInt32 fNumPathParams;
 
   bool fRequestKeepAlive;  // Keep-alive information in the client request
   StrPtrLen fFieldValues[httpNumHeaders]; // Array of header field values parsed from the request
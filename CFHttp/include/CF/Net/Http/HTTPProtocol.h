@@ -184,15 +184,16 @@ typedef enum {
   httpUnsupportedMediaType = 31,         //415
   httpRequestRangeNotSatisfiable = 32,   //416
   httpExpectationFailed = 33,            //417
+  httpRequestHeaderFieldsTooLarge = 34,  //431
 
-  httpInternalServerError = 34,          //500
-  httpNotImplemented = 35,               //501
-  httpBadGateway = 36,                   //502
-  httpServiceUnavailable = 37,           //503
-  httpGatewayTimeout = 38,               //504
-  httpHTTPVersionNotSupported = 39,      //505
+  httpInternalServerError = 35,          //500
+  httpNotImplemented = 36,               //501
+  httpBadGateway = 37,                   //502
+  httpServiceUnavailable = 38,           //503
+  httpGatewayTimeout = 39,               //504
+  httpHTTPVersionNotSupported = 40,      //505
 
-  httpNumStatusCodes = 40
+  httpNumStatusCodes = 41
 } HTTPStatusCode;
 
 class HTTPProtocol {
@@ -210,6 +211,10 @@ class HTTPProtocol {
   static SInt32 GetStatusCode(HTTPStatusCode inStat) { return sStatusCodes[inStat]; }
   static const StrPtrLen &GetStatusCodeAsString(HTTPStatusCode inStat) { return sStatusCodeAsStrings[inStat]; }
   static HTTPStatusCode GetStatusCodeEnum(SInt32 inCode);
+  // "HTTP/1.1 200 OK\r\n", for HTTP/1.1 if the version is not known
+  static const StrPtrLen &GetStatusLine(HTTPStatusCode inStat, HTTPVersion inVersion) {
+    return sStatusLines[inVersion < httpNumVersions ? inVersion : http11Version][inStat];
+  }
 
   // Versions
   static HTTPVersion GetVersion(StrPtrLen *versionStr);
@@ -226,6 +231,7 @@ class HTTPProtocol {
   static const StrPtrLen sStatusCodeAsStrings[];
   static const SInt32 sStatusCodes[];
   static const StrPtrLen sVersionStrings[];
+  static const StrPtrLen sStatusLines[][httpNumStatusCodes];
 
   static const StrPtrLen sStreamTypes[];
 };
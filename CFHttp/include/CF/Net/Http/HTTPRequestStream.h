@@ -30,6 +30,14 @@
                 (do this by calling ReadRequest). It handles HTTP pipelining (request
                 headers are produced serially even if multiple headers arrive simultaneously),
                 & RTSP request data.
+
+                The header is read into a chain of pooled segments: one for
+                the usual small request, more as a long one (cookies, tokens)
+                keeps coming, up to GetMaxHeaderSize. The end of the header is
+                looked for in the new bytes only, and a header that ends up in
+                more than one segment is copied once into a contiguous buffer
+                when it is complete. The same pass records where the request
+                line and each header field are, see HTTPHeaderIndex.
 */
 
 #ifndef __HTTP_REQUEST_STREAM_H__
@@ -38,7 +46,9 @@
 
 //INCLUDES
 #include <CF/CFDef.h>
+#include <CF/BufferPool.h>
 #include <CF/Net/Socket/TCPSocket.h>
+#include <CF/Net/Http/HTTPHeaderIndex.h>
 
 namespace CF {
 namespace Net {
@@ -50,11 +60,7 @@ class HTTPRequestStream {
 
   explicit HTTPRequestStream(TCPSocket *sock);
 
-  // We may have to delete this memory if it was allocated due to base64 decoding
-  ~HTTPRequestStream() {
-    if (fRequest.Ptr != &fRequestBuffer[0])
-      delete[] fRequest.Ptr;
-  }
+  ~HTTPRequestStream();
 
   /**
    * @brief ReadRequest - read request header
@@ -68,7 +74,7 @@ class HTTPRequestStream {
    * @return CF_RequestArrived - full request has arrived
    * @return CF_RequestFailed  - if the client has disconnected
    * @return CF_OutOfState
-   * @return E2BIG             - ran out of buffer space
+   * @return E2BIG             - header longer than GetMaxHeaderSize
    * @return EINVAL            - if we are base64 decoding and the stream is corrupt
    */
   CF_Error ReadRequest();
@@ -102,38 +108,141 @@ class HTTPRequestStream {
    */
   StrPtrLen *GetRequestBuffer() { return fRequestPtr; }
 
+  /**
+   * Offsets of the request line and header fields in GetRequestBuffer(),
+   * valid until the next ReadRequest. NULL for a data packet.
+   */
+  HTTPHeaderIndex *GetHeaderIndex() {
+    return (fRequestPtr != NULL && !fIsDataPacket) ? fIndex : NULL;
+  }
+
   bool IsDataPacket() { return fIsDataPacket; }
 
+  /**
+   * Bytes that arrived after the current request and its body read so far,
+   * the start of the next pipelined request.
+   */
+  UInt32 GetRetreatBytes() { return fRetreatBytes; }
+
+  /**
+   * @brief is the header of the next request complete in the retreat bytes?
+   *
+   * Then the next ReadRequest hands it up without reading the Socket.
+   * Answers false when unsure, and for base64 decoded streams.
+   */
+  bool HasRetreatRequest();
+
   void ShowRTSP(bool enable) { fPrintRTSP = enable; }
 
   void SnarfRetreat(HTTPRequestStream &fromRequest);
 
- private:
+  /**
+   * @brief is a pool buffer held?
+   *
+   * The request buffer is borrowed from a BufferPool when data arrives, and
+   * given back as soon as the stream holds nothing, so an idle keep-alive
+   * connection costs no buffer memory.
+   */
+  bool HasBuffer() { return fNumSegments > 0; }
+  UInt32 GetNumSegments() { return fNumSegments; }
+
+  /**
+   * @brief longest request header accepted, for all streams.
+   *
+   * Rounded up to whole segments, within [kSegmentSizeInBytes,
+   * kMaxSegments * kSegmentSizeInBytes]. Default kDefaultMaxHeaderSize.
+   */
+  static void SetMaxHeaderSize(UInt32 inMaxHeaderSize);
+  static UInt32 GetMaxHeaderSize() { return sMaxSegments * kSegmentSizeInBytes; }
 
   //CONSTANTS:
   enum {
-    kRequestBufferSizeInBytes = CF_MAX_REQUEST_BUFFER_SIZE        //UInt32
+    kSegmentSizeInBytes = CF_MAX_REQUEST_BUFFER_SIZE,   //UInt32
+    kMaxSegments = 64,                                  //UInt32
+    kDefaultMaxHeaderSize = 32 * 1024                   //UInt32
   };
 
-  // Base64 decodes into fRequest.Ptr, updates fRequest.Len, and returns the amount
+ private:
+
+  // Where the end-of-header scan is, between two reads
+  enum {
+    kScanInLine = 0,          // inside a line
+    kScanGotCR = 1,           // line ended by \r, maybe \r\n
+    kScanLineStartLF = 2,     // after a \n
+    kScanLineStartCRLF = 3,   // after a \r\n
+    kScanBlankCR = 4          // after \r\n\r, a \n ends the header
+  };
+
+  // Base64 decodes into fDecodeBuffer, updates fRequest.Len, and returns the amount
   // of data left undecoded in inSrcData
   CF_Error DecodeIncomingData(char *inSrcData, UInt32 inSrcDataLen);
 
+  void acquireBuffer();
+  // gives the buffers back if nothing in them is still needed
+  void releaseBufferIfIdle();
+
+  //
+  // The message (fRequest.Len bytes, then retreat bytes) lives in the
+  // segments, or in fDecodeBuffer when base64 decoding
+
+  // free space to read into, a new segment if the last is full; 0 at the cap
+  char *getReadSpace(UInt32 *outLen);
+  bool addSegment();
+  void freeSegmentsFrom(UInt32 inIndex);
+  char *getMessagePtr(UInt32 inOffset, UInt32 *outContiguousLen);
+  void copyMessage(UInt32 inOffset, char *outBuffer, UInt32 inLen);
+  // moves the bytes at inOffset to the start, before the next request
+  void moveToFront(UInt32 inOffset, UInt32 inLen);
+  // the first inLen bytes in one piece
+  char *linearize(UInt32 inLen);
+  void freeLinearBuffer();
+
+  void resetScan();
+  // looks for the end of the header in bytes not scanned yet
+  bool findEndOfHeader(UInt32 *outHeaderLen);
+  void scanLineChar(char inChar, UInt32 inOffset);
+  // a line is over, inNext is where the next one starts
+  void endLine(UInt32 inNext);
+  // the ShoutCast password check, once the first line is over
+  bool isPasswordLine(UInt32 inNextOffset);
+
   TCPSocket *fSocket;
   UInt32 fRetreatBytes;
   UInt32 fRetreatBytesRead; // Used by Read() when it is reading RetreatBytes
 
-  char fRequestBuffer[kRequestBufferSizeInBytes];
-  UInt32 fCurOffset; // tracks how much valid data is in the above buffer
+  // from sBufferPool while data is in flight; fSegments is &fFirstSegment
+  // until a second segment is needed
+  char *fFirstSegment;
+  char **fSegments;
+  UInt32 fNumSegments;
+  UInt32 fCurOffset; // tracks how much valid data is in the segments
   UInt32
       fEncodedBytesRemaining; // If we are decoding, tracks how many encoded bytes are in the buffer
-
+  char *fDecodeBuffer;  // base64 decoded request
+  char *fLinearBuffer;  // a complete header that spanned segments
+  UInt32 fLinearBufferLen;
+
+  UInt32 fScanOffset;
+  UInt32 fScanState;
+  UInt32 fLineStart;
+  UInt32 fEOLStart;
+  UInt32 fColon;          // first ':' of the line, or kNoColon
+  UInt32 fValueStart;
+  HTTPHeaderIndex *fIndex;  // from sIndexPool, with the first segment
+  UInt32 fFirstLineLen;   // until the first EOL
+  bool fFirstLineHasSpace;
+  bool fFirstLineDone;
+
+  // while reading, fRequest.Len counts all bytes of the message so far
   StrPtrLen fRequest;
   StrPtrLen *fRequestPtr;    // pointer to a request header
   bool fDecode;        // should we base 64 decode?
   bool fIsDataPacket;  // is this a data packet? Like for a record?
   bool fPrintRTSP;     // debugging printfs
 
+  static BufferPool sBufferPool;
+  static BufferPool sIndexPool;
+  static UInt32 sMaxSegments;
 };
 
 } // namespace Net
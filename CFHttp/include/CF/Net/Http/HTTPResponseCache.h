@@ -0,0 +1,93 @@
+/**
+ * @file HTTPResponseCache.h
+ *
+ * GET responses of the routes that have an HTTPCachePolicy, kept in memory
+ * for the policy's TTL. HTTPDispatcher looks here before it calls the
+ * route's CGI function, and stores what the function answered:
+ *
+ *   static HTTPCachePolicy sListCache = {5000, 1, {httpAcceptLanguageHeader}};
+ *   {"/live/list", (CF_CGIFunction) LiveList, nullptr, &sListCache}
+ *
+ * Only a 200 whose body is in memory (HTTPPacket::SetBody) is stored, with
+ * the fields from AddResponseHeader. It gets an ETag unless the function set
+ * one, and a request whose If-None-Match has it is answered 304. HEAD is
+ * answered from the GET entry. A hit sends the stored header lines and body
+ * from the entry's memory, nothing is copied.
+ *
+ * The entries are spread over kNumShards tables by their key's hash, each
+ * with its own lock, LRU list and share of the byte budget. An entry leaves
+ * when it is found expired, when its shard is over budget, or by Purge.
+ *
+ * Misses are coalesced: while the first GET for a key runs the function,
+ * the identical requests that arrive are suspended (Lookup returns
+ * CF_WouldBlock), not blocked. When the function returns, they are woken
+ * with a kUpdateEvent and Lookup gives them the same response, even one that
+ * is not cached (not a 200, too big, or the 404/500 of a failed function).
+ * Only a file or stream body can't be shared: each of them then calls the
+ * function itself.
+ */
+
+#ifndef __HTTP_RESPONSE_CACHE_H__
+#define __HTTP_RESPONSE_CACHE_H__
+
+#include <CF/Thread/Task.h>
+#include <CF/Net/Http/HTTPDef.h>
+
+namespace CF {
+namespace Net {
+
+class HTTPResponseCache {
+ public:
+
+  enum {
+    kNumShards = 16,                     // UInt32
+    kMaxKeyLength = 1024,                // UInt32, longer requests are not cached
+    kDefaultMaxBytes = 64 * 1024 * 1024  // UInt32
+  };
+
+  // all entries together, 0 turns the cache off
+  static void SetMaxBytes(UInt64 inMaxBytes);
+
+  /**
+   * @brief answer request from the cache.
+   *
+   * @param inTask - the session; with it, a miss makes it the leader of the
+   *                 key, or one of the waiters if there is a leader already
+   * @return CF_NoErr on a hit, response is complete; CF_WouldBlock: inTask
+   *         gets a kUpdateEvent when the leader is done, and calls again;
+   *         CF_ValueNotFound: call the function, then Store.
+   */
+  static CF_Error Lookup(HTTPCachePolicy *inPolicy,
+                         HTTPPacket &request, HTTPPacket &response,
+                         Thread::Task *inTask = nullptr);
+
+  /**
+   * @brief keep response, if it can be kept, and give it to the waiters.
+   *
+   * Adds the ETag to response, and makes it a 304 for a matching
+   * If-None-Match.
+   *
+   * @param inResult - what the function returned
+   */
+  static void Store(HTTPCachePolicy *inPolicy,
+                    HTTPPacket &request, HTTPPacket &response,
+                    CF_Error inResult, Thread::Task *inTask = nullptr);
+
+  /**
+   * @brief inTask is going away.
+   *
+   * It stops waiting, and if it was a leader its waiters are woken to call
+   * the function themselves. No kUpdateEvent is sent to inTask after this.
+   */
+  static void Cancel(Thread::Task *inTask);
+
+  static void Purge();
+
+  static UInt32 GetNumEntries();
+  static UInt64 GetNumBytes();
+};
+
+} // namespace Net
+} // namespace CF
+
+#endif // __HTTP_RESPONSE_CACHE_H__
@@ -30,15 +30,20 @@
                 controlled data in different ways.
 
                 It is derived from StringFormatter, which it uses as an output
-                stream buffer. The buffer may grow infinitely.
+                stream buffer. The buffer may grow infinitely. It is borrowed
+                from a BufferPool on the first Put and given back once
+                everything in it has been sent.
 */
 
 #ifndef __HTTP_RESPONSE_STREAM_H__
 #define __HTTP_RESPONSE_STREAM_H__
 
 #include <CF/CFDef.h>
+#include <CF/BufferPool.h>
 #include <CF/ResizeableStringFormatter.h>
 #include <CF/Net/Socket/TCPSocket.h>
+#include <CF/Net/Http/HTTPFileBody.h>
+#include <CF/Net/Http/HTTPStreamBody.h>
 #include <CF/Thread/TimeoutTask.h>
 
 namespace CF {
@@ -51,13 +56,15 @@ class HTTPResponseStream : public ResizeableStringFormatter {
   // It also refreshes the timeout whenever there is a successful write
   // on the Socket.
   HTTPResponseStream(TCPSocket *inSocket, Thread::TimeoutTask *inTimeoutTask)
-      : ResizeableStringFormatter(fOutputBuf, kOutputBufferSizeInBytes),
+      : ResizeableStringFormatter(nullptr, 0),
+        fPoolBuffer(nullptr),
         fSocket(inSocket),
         fBytesSentInBuffer(0),
         fTimeoutTask(inTimeoutTask),
+        fZeroCopyBuffer(false),
         fPrintRTSP(false) {}
 
-  virtual ~HTTPResponseStream() {}
+  ~HTTPResponseStream() override { this->releaseBuffer(); }
 
   // WriteV
   //
@@ -83,30 +90,73 @@ class HTTPResponseStream : public ResizeableStringFormatter {
   };
 
   CF_Error WriteV(iovec *inVec, UInt32 inNumVectors, UInt32 inTotalLength,
-                  UInt32 *outLengthSent, UInt32 inSendType);
+                  UInt32 *outLengthSent, UInt32 inSendType) {
+    return this->writeV(inVec, inNumVectors, inTotalLength, outLengthSent,
+                        inSendType, false);
+  }
+
+  // WriteVZeroCopy
+  //
+  // WriteV with kAlwaysBuffer, for a big body: inVec[1..] point into inData,
+  // which the stream owns from now on. When the Socket has zero-copy on
+  // (Socket::EnableZeroCopy), the data goes out with MSG_ZEROCOPY and
+  // inData is deleted once the kernel is done with it, otherwise right
+  // away. What the Socket doesn't take is copied to the buffer as usual.
+  CF_Error WriteVZeroCopy(iovec *inVec, UInt32 inNumVectors,
+                          UInt32 inTotalLength, StrPtrLen *inData);
 
   // Flushes any buffered data to the Socket. If all data could be sent,
   // this returns QTSS_NoErr, otherwise, it returns EWOULDBLOCK
   CF_Error Flush();
 
+  // Flushes any buffered data, then sends the file body straight from the
+  // file to the Socket. Returns QTSS_NoErr when everything is sent,
+  // otherwise EWOULDBLOCK; call again on the next write event.
+  CF_Error SendFileBody(HTTPFileBody *inBody);
+
+  // Same for a body produced while it is sent. Also returns CF_WouldBlock
+  // when the body has nothing to send yet, it wakes the task when it has.
+  CF_Error SendStreamBody(HTTPStreamBody *inBody);
+
+  // Drops whatever is still buffered. Call it while the Socket is still
+  // there, the buffer may be waiting for a zero-copy completion.
+  void Discard() { this->releaseBuffer(); }
+
   void ShowRTSP(bool enable) { fPrintRTSP = enable; }
 
+  bool HasBuffer() { return fStartPut != nullptr; }
+
+  // Put but not sent yet
+  UInt32 GetUnsentBytes() { return this->GetCurrentOffset() - fBytesSentInBuffer; }
+
  private:
 
   enum {
     kOutputBufferSizeInBytes = CF_MAX_REQUEST_BUFFER_SIZE  //UInt32
   };
 
-  //The default buffer size is allocated inline as part of the object. Because this size
-  //is good enough for 99.9% of all requests, we avoid the dynamic memory allocation in most
-  //cases. But if the response is too big for this buffer, the BufferIsFull function will
-  //allocate a larger buffer.
-  char fOutputBuf[kOutputBufferSizeInBytes];
+  // The first Put takes a buffer from sBufferPool. Because this size is good
+  // enough for 99.9% of all requests, we avoid the dynamic memory allocation
+  // in most cases. But if the response is too big for this buffer, it is
+  // replaced by a larger one from the heap.
+  bool BufferIsFull(char *inBuffer, UInt32 inBufferLen) override;
+
+  CF_Error writeV(iovec *inVec, UInt32 inNumVectors, UInt32 inTotalLength,
+                  UInt32 *outLengthSent, UInt32 inSendType, bool inZeroCopy);
+
+  // called when all buffered data is sent, an idle stream holds no buffer
+  void releaseBuffer();
+  void putPoolBuffer();
+
+  char *fPoolBuffer;    // the pool buffer in use, nullptr if none or grown
   TCPSocket *fSocket;
   UInt32 fBytesSentInBuffer;
   Thread::TimeoutTask *fTimeoutTask;
+  bool fZeroCopyBuffer; // the kernel may still read fPoolBuffer
   bool fPrintRTSP;     // debugging printfs
 
+  static BufferPool sBufferPool;
+
   friend class HTTPRequestInterface;
 };
 
@@ -30,9 +30,45 @@ class HTTPSession : public HTTPSessionInterface {
 
   CF_Error dumpRequestData();
 
-  HTTPPacket *fRequest;
-  HTTPPacket *fResponse;
+  // the body of fRequest, into a buffer grown as it arrives or to its sink
+  CF_Error readBody(UInt32 inContentLength);
+  CF_Error readBodyToSink(HTTPBodySink *inSink, UInt32 inContentLength);
+
+  // keep the response in fOutputStream, to send it with the next ones?
+  bool holdResponse();
+  // header and body in one gather write, the unsent rest is buffered
+  CF_Error writeHeaderAndBody(StrPtrLen *inHeader, StrPtrLen *inBody);
+  // same with MSG_ZEROCOPY, inBody is taken over
+  CF_Error writeHeaderAndBodyZeroCopy(StrPtrLen *inHeader, StrPtrLen *inBody);
+  // the session ends, may the Socket go?
+  bool waitForZeroCopy();
+
+  // memory charged to ConnectionGovernor for the current request body
+  void chargeBodyMemory(UInt32 bytes);
+  void releaseBodyMemory();
+
+  HTTPPacket *fRequest;       // fRequestPacket while there is a request
+  HTTPPacket *fResponse;      // fResponsePacket, or a deferred response
+  HTTPPacket fRequestPacket;
+  HTTPPacket fResponsePacket;
   Core::Mutex fReadMutex;
+  UInt32 fChargedBodyBytes;
+  UInt32 fNumHeldResponses;   // answered, waiting in fOutputStream
+  bool fWaitingForDispatch;   // Dispatch said CF_WouldBlock, or deferred
+  UInt32 fBodyBufferSize;     // of fRequest->GetBody()
+  UInt32 fBodyBytesRead;      // given to fRequest->GetBodySink()
+  UInt32 fZeroCopyWaits;
+
+  enum {
+    kMaxHeldBytes = 64 * 1024,      // UInt32, held responses send at this size
+    kBodyChunkSizeInBytes = 32 * 1024, // UInt32, most a sink gets at once
+    kZeroCopyWaitMsec = 10,         // UInt32
+    kFileSourceWaitMsec = 10,       // UInt32, a file body's source is empty
+    kMaxZeroCopyWaits = 100         // UInt32, then the Socket leaks the rest
+  };
+
+  // borrowed for each read of a streamed body
+  static BufferPool sBodyBufferPool;
 
   enum {
     kReadingRequest = 0,
@@ -42,7 +78,11 @@ class HTTPSession : public HTTPSessionInterface {
     kSendingResponse = 4,
     kCleaningUp = 5,
     kReadingFirstRequest = 6,
-    kHaveCompleteMessage = 7
+    kHaveCompleteMessage = 7,
+    kFlushingResponse = 8,
+    kFlushingHeldResponses = 9,
+    kWaitingForResponse = 10,     // for an HTTPDeferred, holding no mutex
+    kWaitingForFlight = 11        // for the same request in flight, no mutex
   } fState;
 };
 
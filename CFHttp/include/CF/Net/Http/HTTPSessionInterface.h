@@ -17,6 +17,8 @@
 namespace CF {
 namespace Net {
 
+class HTTPDateTask;
+
 class HTTPSessionInterface : public Thread::Task {
  public:
 
@@ -27,10 +29,39 @@ class HTTPSessionInterface : public Thread::Task {
    */
   static void Initialize(HTTPMapping *mapping);
 
-  static void Release() {
-    delete sDispatcher;
-    sDispatcher = nullptr;
+  static void Release();
+
+  /**
+   * @brief how many pipelined requests are answered before a send.
+   *
+   * When the next request of a keep-alive connection has already arrived,
+   * the response waits in the output buffer and goes out with the ones
+   * after it, in one send. 1 sends every response on its own.
+   */
+  static void SetMaxPipelineDepth(UInt32 inDepth) {
+    sMaxPipelineDepth = inDepth > 0 ? inDepth : 1;
   }
+  static UInt32 GetMaxPipelineDepth() { return sMaxPipelineDepth; }
+
+  /**
+   * @brief longest request body collected in request.GetBody(), 0 for no
+   *        limit. A longer one gets 413, unless its route streams the body
+   *        to an HTTPBodySink.
+   */
+  static void SetMaxBodySize(UInt32 inMaxBodySize) { sMaxBodySize = inMaxBodySize; }
+  static UInt32 GetMaxBodySize() { return sMaxBodySize; }
+
+  /**
+   * @brief response bodies of at least this many bytes are sent with
+   *        MSG_ZEROCOPY, 0 (the default) never.
+   *
+   * The kernel reads the body where it is instead of copying it, which
+   * pays off from some tens of KB. Only bodies the response owns qualify
+   * (SetBody(StrPtrLen *), cached responses), they are deleted once the
+   * kernel is done with them.
+   */
+  static void SetZeroCopyMinBytes(UInt32 inMinBytes) { sZeroCopyMinBytes = inMinBytes; }
+  static UInt32 GetZeroCopyMinBytes() { return sZeroCopyMinBytes; }
 
   HTTPSessionInterface();
   virtual ~HTTPSessionInterface();
@@ -74,7 +105,9 @@ class HTTPSessionInterface : public Thread::Task {
 
   enum {
     kMaxUserNameLen = 32,
-    kMaxUserPasswordLen = 32
+    kMaxUserPasswordLen = 32,
+    kDefaultMaxPipelineDepth = 16,          // UInt32
+    kDefaultMaxBodySize = 16 * 1024 * 1024  // UInt32
   };
 
  protected:
@@ -84,9 +117,6 @@ class HTTPSessionInterface : public Thread::Task {
 
   //Each http session has a unique number that identifies it.
 
-  char fUserNameBuf[kMaxUserNameLen];
-  char fUserPasswordBuf[kMaxUserPasswordLen];
-
   Thread::TimeoutTask fTimeoutTask; // allows the session to be timed out
 
   HTTPRequestStream fInputStream;
@@ -119,6 +149,10 @@ class HTTPSessionInterface : public Thread::Task {
   static std::atomic_uint sSessionIndexCounter;
 
   static HTTPDispatcher *sDispatcher;
+  static HTTPDateTask *sDateTask;
+  static UInt32 sMaxPipelineDepth;
+  static UInt32 sMaxBodySize;
+  static UInt32 sZeroCopyMinBytes;
 
   // Dictionary support Param retrieval function
   static void *SetupParams(HTTPSessionInterface *inSession, UInt32 *outLen);
@@ -0,0 +1,102 @@
+/**
+ * @file HTTPStreamBody.h
+ *
+ * Response body produced while it is sent. A handler sets a subclass on the
+ * response instead of a complete StrPtrLen; the session asks it for the next
+ * piece each time the Socket has taken the previous one, and sends it as a
+ * chunk of a "Transfer-Encoding: chunked" body (HTTP/1.0: as is, and the
+ * connection is closed at the end). One chunk is buffered at a time,
+ * whatever the length of the body.
+ */
+
+#ifndef __HTTP_STREAM_BODY_H__
+#define __HTTP_STREAM_BODY_H__
+
+#include <CF/CFDef.h>
+#include <CF/Net/Socket/Socket.h>
+#include <CF/Thread/Task.h>
+
+namespace CF {
+namespace Net {
+
+class HTTPStreamBody {
+ public:
+
+  enum {
+    kMaxChunkSizeInBytes = 16 * 1024  // UInt32, most Read is asked for
+  };
+
+  HTTPStreamBody();
+  virtual ~HTTPStreamBody();
+
+  /**
+   * @brief the next piece of the body, implemented by the handler.
+   *
+   * Called from the session's thread, only when everything returned before
+   * has been sent.
+   *
+   * @param ioBuffer    - kMaxChunkSizeInBytes bytes to fill
+   * @param inBufferLen - size of ioBuffer
+   * @param outLen      - bytes put in ioBuffer, more than 0 with CF_NoErr
+   * @return CF_NoErr, CF_NoMoreData at the end of the body, EAGAIN when
+   *         nothing is ready yet (call Wakeup once it is), or another error
+   *         to abort the response.
+   */
+  virtual CF_Error Read(char *ioBuffer, UInt32 inBufferLen, UInt32 *outLen) = 0;
+
+  /**
+   * @brief more data is ready after Read returned EAGAIN.
+   *
+   * Thread safe. A subclass fed by another thread must stop it calling this
+   * before the body is deleted.
+   */
+  void Wakeup();
+
+  // bytes of the body returned by Read so far, without the chunk framing
+  UInt64 GetLength() const { return fLength; }
+  bool IsDone() const { return fDone; }
+
+  //
+  // Used by the session
+
+  void SetChunked(bool inChunked) { fChunked = inChunked; }
+  bool IsChunked() const { return fChunked; }
+  void SetTask(Thread::Task *inTask) { fTask = inTask; }
+
+  /**
+   * @brief send as much as the Socket accepts and Read returns.
+   *
+   * @return CF_NoErr when the whole body (and the last chunk) is sent,
+   *         EAGAIN when the Socket is flow controlled (wait for kWriteEvent
+   *         and call again), CF_WouldBlock when Read has nothing yet (the
+   *         task gets a kWriteEvent from Wakeup), or the error that ended
+   *         it.
+   */
+  CF_Error Send(Socket *inSocket, UInt32 *outLengthSent);
+
+ private:
+
+  enum {
+    kChunkHeaderSize = 10,  // UInt32, up to 8 hex digits and CRLF
+    kChunkBufferSize = kChunkHeaderSize + kMaxChunkSizeInBytes + 2  // UInt32
+  };
+
+  // frames the next piece in fBuffer, or the last chunk at the end
+  CF_Error nextChunk();
+
+  char *fBuffer;      // chunk header space, data, CRLF
+  UInt32 fSendPos;
+  UInt32 fSendEnd;
+
+  UInt64 fLength;
+  bool fChunked;
+  bool fEnded;        // Read returned CF_NoMoreData
+  bool fDone;         // and everything is sent
+
+  Thread::Task *fTask;
+};
+
+} // namespace Net
+} // namespace CF
+
+#endif // __HTTP_STREAM_BODY_H__
@@ -73,16 +73,18 @@ class QueryParamList {
   char const *DoFindCGIValueForParam(char *name);
   void PrintAll(char *idString);
 
+  // in place '+' to space and %hex decoding, of a name or a value
+  static void DecodeArg(char *ioCodedPtr);
+
  protected:
   void BulidList(StrPtrLen *querySPL);
-  void DecodeArg(char *ioCodedPtr);
 
   enum {
     // escaping states
     kLastWasText, kPctEscape, kRcvHexDigitOne
   };
 
-  bool IsHex(char c);
+  static bool IsHex(char c);
 
   PLDoubleLinkedList<QueryParamListElement> *fNameValueQueryParamList;
 
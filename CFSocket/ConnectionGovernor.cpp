@@ -0,0 +1,104 @@
+/**
+ * @file ConnectionGovernor.cpp
+ *
+ * implements ConnectionGovernor class
+ */
+
+#include <CF/Net/Socket/ConnectionGovernor.h>
+#include <CF/Thread/Task.h>
+
+#if !__WinSock__
+
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+#endif
+
+using namespace CF::Net;
+
+std::atomic<UInt32> ConnectionGovernor::sNumSessions{0};
+std::atomic<UInt64> ConnectionGovernor::sMemoryBytes{0};
+std::atomic<UInt32> ConnectionGovernor::sNumShed{0};
+std::atomic_bool ConnectionGovernor::sOverloaded{false};
+
+UInt32 ConnectionGovernor::sMaxSessions = 0;
+UInt32 ConnectionGovernor::sMaxQueuedTasks = 0;
+UInt64 ConnectionGovernor::sMaxMemoryBytes = 0;
+
+int ConnectionGovernor::sReserveFD = -1;
+
+void ConnectionGovernor::SetLimits(UInt32 maxSessions,
+                                   UInt32 maxQueuedTasks,
+                                   UInt64 maxMemoryBytes) {
+  sMaxSessions = maxSessions;
+  sMaxQueuedTasks = maxQueuedTasks;
+  sMaxMemoryBytes = maxMemoryBytes;
+}
+
+bool ConnectionGovernor::IsOverloaded(UInt32 buffer) {
+  UInt64 sessions = (UInt64) sNumSessions + buffer;
+  UInt64 memory = sMemoryBytes;
+  UInt64 queued = 0;
+  if (sMaxQueuedTasks > 0)
+    queued = Thread::TaskThreadPool::GetNumQueuedTasks();
+
+  bool overHigh = (sMaxSessions > 0 && sessions >= sMaxSessions)
+      || (sMaxQueuedTasks > 0 && queued >= sMaxQueuedTasks)
+      || (sMaxMemoryBytes > 0 && memory >= sMaxMemoryBytes);
+
+  if (overHigh) {
+    sOverloaded = true;
+    return true;
+  }
+
+  if (sOverloaded) {
+    // hysteresis: keep pausing until everything drops below the low watermark
+    bool underLow =
+        (sessions * 100 < (UInt64) sMaxSessions * kLowWatermarkPercent || sMaxSessions == 0)
+            && (queued * 100 < (UInt64) sMaxQueuedTasks * kLowWatermarkPercent || sMaxQueuedTasks == 0)
+            && (memory < sMaxMemoryBytes / 100 * kLowWatermarkPercent || sMaxMemoryBytes == 0);
+    if (!underLow)
+      return true;
+    sOverloaded = false;
+  }
+
+  return false;
+}
+
+void ConnectionGovernor::OpenReserveFD() {
+#if !__WinSock__
+  if (sReserveFD == -1)
+    sReserveFD = ::open("/dev/null", O_RDONLY);
+#endif
+}
+
+void ConnectionGovernor::CloseReserveFD() {
+#if !__WinSock__
+  if (sReserveFD != -1) {
+    ::close(sReserveFD);
+    sReserveFD = -1;
+  }
+#endif
+}
+
+bool ConnectionGovernor::ShedConnection(int listenFD) {
+#if !__WinSock__
+  if (sReserveFD == -1)
+    return false;
+
+  // give back the spare descriptor, take the connection and say goodbye
+  CloseReserveFD();
+  int osSocket = ::accept(listenFD, nullptr, nullptr);
+  if (osSocket != -1) {
+    ::close(osSocket);
+    ++sNumShed;
+  }
+  OpenReserveFD();
+
+  return osSocket != -1;
+#else
+  return false;
+#endif
+}
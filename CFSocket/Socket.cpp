@@ -34,6 +34,7 @@
 
 #include <CF/Net/Socket/Socket.h>
 #include <CF/Net/Socket/SocketUtils.h>
+#include <CF/CFDef.h>
 
 #if !__WinSock__
 
@@ -45,6 +46,27 @@
 
 #endif
 
+#if __linux__
+
+#include <fcntl.h>
+#include <sys/sendfile.h>
+#include <linux/errqueue.h>
+
+#ifndef SO_ZEROCOPY
+#define SO_ZEROCOPY 60
+#endif
+#ifndef MSG_ZEROCOPY
+#define MSG_ZEROCOPY 0x4000000
+#endif
+#ifndef SO_EE_ORIGIN_ZEROCOPY
+#define SO_EE_ORIGIN_ZEROCOPY 5
+#endif
+#ifndef SO_EE_CODE_ZEROCOPY_COPIED
+#define SO_EE_CODE_ZEROCOPY_COPIED 1
+#endif
+
+#endif
+
 #ifdef USE_NETLOG
 #include <netlog.h>
 #else
@@ -59,12 +81,48 @@ using namespace CF::Net;
 
 EventThread *Socket::sEventThread = nullptr;
 
+/**
+ * Zero-copy bookkeeping. The kernel numbers every successful MSG_ZEROCOPY
+ * send, starting at 0, and reports completed ranges [lo, hi] on the error
+ * queue. TCP completes them in order, so one counter of completed sends is
+ * enough: a buffer can go back to its pool when every send issued before
+ * its release has completed.
+ */
+struct Socket::ZeroCopyState {
+  struct Release {
+    Release(BufferPool *inPool, void *inBuffer, StrPtrLen *inData, UInt32 inSeq)
+        : fElem(this), fPool(inPool), fBuffer(inBuffer), fData(inData), fSeq(inSeq) {}
+    // the kernel is done with it
+    void Done() {
+      if (fPool != nullptr)
+        fPool->Put(fBuffer);
+      delete fData;
+    }
+    QueueElem fElem;
+    BufferPool *fPool;
+    void *fBuffer;
+    StrPtrLen *fData; // or this, deleted
+    UInt32 fSeq;    // sends issued when released
+  };
+
+  ZeroCopyState() : fNextSeq(0), fCompleted(0), fNumCopied(0) {}
+
+  bool IsCompleted(UInt32 inSeq) { return (SInt32) (fCompleted - inSeq) >= 0; }
+
+  Core::Mutex fMutex;
+  UInt32 fNextSeq;      // id of the next zero-copy send
+  UInt32 fCompleted;    // number of sends the kernel is done with
+  UInt32 fNumCopied;    // completions where the kernel copied anyway
+  Queue fPending;       // Release, oldest first
+};
+
 Socket::Socket(CF::Thread::Task *inNotifyTask, UInt32 inSocketType)
     : EventContext(EventContext::kInvalidFileDesc, sEventThread),
       fState(inSocketType),
       fLocalAddrStrPtr(nullptr),
       fLocalDNSStrPtr(nullptr),
-      fPortStr(fPortBuffer, kPortBufSizeInBytes) {
+      fPortStr(fPortBuffer, kPortBufSizeInBytes),
+      fZeroCopy(nullptr) {
   fLocalAddr.sin_addr.s_addr = 0;
   fLocalAddr.sin_port = 0;
 
@@ -386,3 +444,310 @@ OS_Error Socket::Read(void *buffer, const UInt32 length, UInt32 *outRecvLenP) {
   *outRecvLenP = (UInt32) theRecvLen;
   return OS_NoErr;
 }
+
+OS_Error Socket::SendFile(int inFileDesc, UInt64 *ioOffset,
+                          const UInt32 inLength, UInt32 *outLengthSent) {
+  Assert(ioOffset != nullptr);
+  Assert(outLengthSent != nullptr);
+
+  *outLengthSent = 0;
+  if (!(fState & kConnected))
+    return (OS_Error) ENOTCONN;
+
+#if __linux__
+  off_t theOffset = (off_t) *ioOffset;
+  ssize_t err;
+  do {
+    err = ::sendfile(fFileDesc, inFileDesc, &theOffset, inLength);
+  } while ((err == -1) && (Core::Thread::GetErrno() == EINTR));
+
+  if (err == -1) {
+    int theErr = Core::Thread::GetErrno();
+    if ((theErr != EAGAIN) && (theErr != EINVAL) && (theErr != ENOSYS)
+        && (this->IsConnected()))
+      fState ^= kConnected;//turn off connected state flag
+    // EINVAL / ENOSYS: the fd can't be used with sendfile, let caller fallback
+    if ((theErr == EINVAL) || (theErr == ENOSYS))
+      return (OS_Error) ENOTSUP;
+    return (OS_Error) theErr;
+  }
+
+  *ioOffset = (UInt64) theOffset;
+  *outLengthSent = (UInt32) err;
+  return OS_NoErr;
+#else
+  return (OS_Error) ENOTSUP;
+#endif
+}
+
+OS_Error Socket::Splice(int inFileDesc, int ioPipe[2], UInt32 *ioPipeBytes,
+                        const UInt32 inLength, UInt32 *outLengthSent) {
+  Assert(ioPipeBytes != nullptr);
+  Assert(outLengthSent != nullptr);
+
+  *outLengthSent = 0;
+  if (!(fState & kConnected))
+    return (OS_Error) ENOTCONN;
+
+#if __linux__
+  // fill the pipe from the source, only when it has been drained
+  bool sourceEOF = false;
+  if (*ioPipeBytes == 0 && inLength > 0) {
+    ssize_t theLen;
+    do {
+      theLen = ::splice(inFileDesc, nullptr, ioPipe[1], nullptr, inLength,
+                        SPLICE_F_MOVE | SPLICE_F_NONBLOCK);
+    } while ((theLen == -1) && (Core::Thread::GetErrno() == EINTR));
+
+    if (theLen == -1) {
+      int theErr = Core::Thread::GetErrno();
+      // EINVAL / ENOSYS: the source can't be spliced, let caller fallback;
+      // the pipe is empty, nothing is lost
+      if ((theErr == EINVAL) || (theErr == ENOSYS))
+        return (OS_Error) ENOTSUP;
+      // the source has no data yet, not our Socket being full
+      if (theErr == EAGAIN)
+        return (OS_Error) CF_WouldBlock;
+      return (OS_Error) theErr;
+    }
+    if (theLen == 0)
+      sourceEOF = true;
+    *ioPipeBytes = (UInt32) theLen;
+  }
+
+  // drain the pipe to the Socket
+  if (*ioPipeBytes > 0) {
+    ssize_t theLen;
+    do {
+      theLen = ::splice(ioPipe[0], nullptr, fFileDesc, nullptr, *ioPipeBytes,
+                        SPLICE_F_MOVE | SPLICE_F_NONBLOCK | SPLICE_F_MORE);
+    } while ((theLen == -1) && (Core::Thread::GetErrno() == EINTR));
+
+    if (theLen == -1) {
+      int theErr = Core::Thread::GetErrno();
+      if ((theErr != EAGAIN) && (this->IsConnected()))
+        fState ^= kConnected;//turn off connected state flag
+      return (OS_Error) theErr;
+    }
+
+    *ioPipeBytes -= (UInt32) theLen;
+    *outLengthSent = (UInt32) theLen;
+  }
+
+  return sourceEOF ? (OS_Error) CF_NoMoreData : OS_NoErr;
+#else
+  return (OS_Error) ENOTSUP;
+#endif
+}
+
+Socket::~Socket() {
+  if (fZeroCopy == nullptr)
+    return;
+
+  // fd is still open here, EventContext closes it after us
+  this->drainZeroCopyCompletions();
+  UInt32 numLeaked = fZeroCopy->fPending.GetLength();
+  WarnV(numLeaked == 0, "Socket destroyed with zero-copy sends in flight, "
+                        "leaking their buffers");
+  while (QueueElem *elem = fZeroCopy->fPending.DeQueue())
+    delete (ZeroCopyState::Release *) elem->GetEnclosingObject();
+
+  delete fZeroCopy;
+}
+
+void Socket::ProcessEvent(int eventBits) {
+  // completions arrive as EPOLLERR, which is reported like a read event
+  if (fZeroCopy != nullptr)
+    this->drainZeroCopyCompletions();
+
+  EventContext::ProcessEvent(eventBits);
+}
+
+OS_Error Socket::EnableZeroCopy() {
+#if __linux__
+  if (fZeroCopy != nullptr)
+    return OS_NoErr;
+
+  int one = 1;
+  int err = ::setsockopt(fFileDesc, SOL_SOCKET, SO_ZEROCOPY,
+                         (char *) &one, sizeof(int));
+  if (err != 0) {
+    int theErr = Core::Thread::GetErrno();
+    return (OS_Error) ((theErr == ENOPROTOOPT) ? ENOTSUP : theErr);
+  }
+
+  fZeroCopy = new ZeroCopyState();
+  return OS_NoErr;
+#else
+  return (OS_Error) ENOTSUP;
+#endif
+}
+
+OS_Error Socket::SendZeroCopy(char const *inData, const UInt32 inLength,
+                              UInt32 *outLengthSent) {
+  if (fZeroCopy == nullptr)
+    return this->Send(inData, inLength, outLengthSent);
+
+#if __linux__
+  Assert(inData != nullptr);
+
+  if (!(fState & kConnected))
+    return (OS_Error) ENOTCONN;
+
+  Core::MutexLocker locker(&fZeroCopy->fMutex);
+
+  int flags = MSG_ZEROCOPY;
+  long err;
+  do {
+    err = ::send(fFileDesc, inData, inLength, flags);
+    // out of optmem for the notifications, this one goes the copy way
+    if ((err == -1) && (Core::Thread::GetErrno() == ENOBUFS) && (flags != 0)) {
+      flags = 0;
+      continue;
+    }
+  } while ((err == -1) && (Core::Thread::GetErrno() == EINTR));
+
+  if (err == -1) {
+    int theErr = Core::Thread::GetErrno();
+    if ((theErr != EAGAIN) && (this->IsConnected()))
+      fState ^= kConnected;//turn off connected state flag
+    return (OS_Error) theErr;
+  }
+
+  if (flags != 0)
+    fZeroCopy->fNextSeq++;
+
+  *outLengthSent = static_cast<UInt32>(err);
+  return OS_NoErr;
+#else
+  return this->Send(inData, inLength, outLengthSent);
+#endif
+}
+
+OS_Error Socket::WriteVZeroCopy(const struct iovec *iov, const UInt32 numVecs,
+                                UInt32 *outLengthSent) {
+  if (fZeroCopy == nullptr)
+    return this->WriteV(iov, numVecs, outLengthSent);
+
+#if __linux__
+  Assert(iov != nullptr);
+
+  if (!(fState & kConnected))
+    return (OS_Error) ENOTCONN;
+
+  struct msghdr msg;
+  ::memset(&msg, 0, sizeof(msg));
+  msg.msg_iov = (struct iovec *) iov;
+  msg.msg_iovlen = numVecs;
+
+  Core::MutexLocker locker(&fZeroCopy->fMutex);
+
+  int flags = MSG_ZEROCOPY;
+  long err;
+  do {
+    err = ::sendmsg(fFileDesc, &msg, flags);
+    // out of optmem for the notifications, this one goes the copy way
+    if ((err == -1) && (Core::Thread::GetErrno() == ENOBUFS) && (flags != 0)) {
+      flags = 0;
+      continue;
+    }
+  } while ((err == -1) && (Core::Thread::GetErrno() == EINTR));
+
+  if (err == -1) {
+    int theErr = Core::Thread::GetErrno();
+    if ((theErr != EAGAIN) && (this->IsConnected()))
+      fState ^= kConnected;//turn off connected state flag
+    return (OS_Error) theErr;
+  }
+
+  if (flags != 0)
+    fZeroCopy->fNextSeq++;
+
+  if (outLengthSent != nullptr)
+    *outLengthSent = static_cast<UInt32>(err);
+  return OS_NoErr;
+#else
+  return this->WriteV(iov, numVecs, outLengthSent);
+#endif
+}
+
+void Socket::ReleaseAfterSend(BufferPool *inPool, void *inBuffer) {
+  Assert(inPool != nullptr);
+  this->releaseAfterSend(inPool, inBuffer, nullptr);
+}
+
+void Socket::ReleaseAfterSend(StrPtrLen *inData) {
+  this->releaseAfterSend(nullptr, nullptr, inData);
+}
+
+void Socket::releaseAfterSend(BufferPool *inPool, void *inBuffer,
+                              StrPtrLen *inData) {
+  ZeroCopyState::Release theRelease(inPool, inBuffer, inData, 0);
+
+  if (fZeroCopy != nullptr) {
+    this->drainZeroCopyCompletions();
+
+    Core::MutexLocker locker(&fZeroCopy->fMutex);
+    if (!fZeroCopy->IsCompleted(fZeroCopy->fNextSeq)) {
+      auto *thePending = new ZeroCopyState::Release(inPool, inBuffer, inData,
+                                                    fZeroCopy->fNextSeq);
+      fZeroCopy->fPending.EnQueue(&thePending->fElem);
+      return;
+    }
+  }
+
+  theRelease.Done();
+}
+
+UInt32 Socket::GetNumZeroCopyPending() {
+  if (fZeroCopy == nullptr)
+    return 0;
+
+  this->drainZeroCopyCompletions();
+  Core::MutexLocker locker(&fZeroCopy->fMutex);
+  return fZeroCopy->fPending.GetLength();
+}
+
+void Socket::drainZeroCopyCompletions() {
+#if __linux__
+  Core::MutexLocker locker(&fZeroCopy->fMutex);
+
+  while (true) {
+    char control[CMSG_SPACE(sizeof(struct sock_extended_err)) + 64];
+    struct msghdr msg;
+    ::memset(&msg, 0, sizeof(msg));
+    msg.msg_control = control;
+    msg.msg_controllen = sizeof(control);
+
+    long err;
+    do {
+      err = ::recvmsg(fFileDesc, &msg, MSG_ERRQUEUE | MSG_DONTWAIT);
+    } while ((err == -1) && (Core::Thread::GetErrno() == EINTR));
+    if (err == -1)
+      break; // EAGAIN: nothing more in the error queue
+
+    for (struct cmsghdr *cm = CMSG_FIRSTHDR(&msg); cm != nullptr;
+         cm = CMSG_NXTHDR(&msg, cm)) {
+      auto *serr = (struct sock_extended_err *) CMSG_DATA(cm);
+      if (serr->ee_errno != 0 || serr->ee_origin != SO_EE_ORIGIN_ZEROCOPY)
+        continue;
+
+      // sends [ee_info, ee_data] are done
+      UInt32 completed = serr->ee_data + 1;
+      if ((SInt32) (completed - fZeroCopy->fCompleted) > 0)
+        fZeroCopy->fCompleted = completed;
+      if (serr->ee_code & SO_EE_CODE_ZEROCOPY_COPIED)
+        fZeroCopy->fNumCopied++;
+    }
+  }
+
+  while (QueueElem *elem = fZeroCopy->fPending.GetHead()) {
+    auto *theRelease = (ZeroCopyState::Release *) elem->GetEnclosingObject();
+    if (!fZeroCopy->IsCompleted(theRelease->fSeq))
+      break;
+    fZeroCopy->fPending.DeQueue();
+    theRelease->Done();
+    delete theRelease;
+  }
+#endif
+}
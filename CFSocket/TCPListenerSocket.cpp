@@ -83,6 +83,9 @@ OS_Error TCPListenerSocket::Initialize(UInt32 addr, UInt16 port) {
       AssertV(err == 0, Core::Thread::GetErrno());
       if (err != 0) break;
 
+      // keep a spare descriptor around for EMFILE, see ProcessEvent
+      ConnectionGovernor::OpenReserveFD();
+
     } while (false);
   }
 
@@ -135,12 +138,19 @@ void TCPListenerSocket::ProcessEvent(int /*eventBits*/) {
     // test acceptError = EINTR;
     // test acceptError = ENOENT;
     if (acceptError == EMFILE || acceptError == ENFILE) {
-      // if these error gets returned, we're out of file descriptors, the server
-      // is going to be failing on sockets, logs, qtgroups and qtuser auth file
-      // accesses and movie files. The server is not functional.
-      s_printf("Out of File Descriptors. Set max connections lower and check"
-               " for competing usage from other processes. Exiting.");
-      exit(EXIT_FAILURE);
+      // if these error gets returned, we're out of file descriptors. The
+      // pending connection would keep the listener readable forever, so
+      // spend the reserve descriptor to accept and drop it, then stop
+      // listening for a while.
+      if (!fOutOfDescriptors)
+        s_printf("Out of File Descriptors. Set max connections lower and check"
+                 " for competing usage from other processes. Shedding.\n");
+      fOutOfDescriptors = true;
+      ConnectionGovernor::ShedConnection(fFileDesc);
+
+      this->RequestEvent(EV_RM); // 屏蔽事件，暂停服务
+      this->SetIdleTimer(kTimeBetweenAcceptsInMsec);
+      return;
     } else {
       char errStr[256];
       errStr[sizeof(errStr) - 1] = 0;
@@ -161,9 +171,12 @@ void TCPListenerSocket::ProcessEvent(int /*eventBits*/) {
 //        theSocket->fState &= ~kConnected; // turn off connected state
 //
 //      return;
+      return;
     }
   }
 
+  fOutOfDescriptors = false;
+
   theTask = this->GetSessionTask(&theSocket);
   if (theTask == nullptr) { //this should be a disconnect. do an ioctl call?
     close(osSocket);
@@ -210,8 +223,6 @@ void TCPListenerSocket::ProcessEvent(int /*eventBits*/) {
     //s_printf("TCPListenerSocket normal speed\n");
     //this->RequestEvent(EV_RE);
   }
-
-  fOutOfDescriptors = false; // always false for now we don't properly handle this elsewhere in the code
 }
 
 SInt64 TCPListenerSocket::Run() {
@@ -224,10 +235,16 @@ SInt64 TCPListenerSocket::Run() {
   if (events & Thread::Task::kKillEvent)
     return -1;
 
-  // This function will get called when we have run out of file descriptors.
-  // All we need to do is check the listen Queue to see if the situation has
-  // cleared up.
-  (void) this->GetEvents();
+  // This function will get called when we have run out of file descriptors,
+  // or when the server was overloaded. If the situation has not cleared up,
+  // keep the listener paused and check again later; the kernel listen queue
+  // holds the pending clients meanwhile.
+  if (this->OverMaxConnections(0)) {
+    this->SetIdleTimer(kTimeBetweenAcceptsInMsec);
+    return 0;
+  }
+
+  this->RunNormal();
   this->RequestEvent(EV_RE);
   this->ProcessEvent(Thread::Task::kReadEvent);
   return 0;
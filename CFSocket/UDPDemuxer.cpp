@@ -30,34 +30,422 @@
 */
 
 #include <CF/Net/Socket/UDPDemuxer.h>
+#include <CF/Core/Thread.h>
+
+#if UDPDEMUXER_TESTING
+#include <CF/Core/Time.h>
+#endif
 
 using namespace CF::Net;
 
+UDPDemuxer::Table::Table(UInt32 inNumBuckets)
+    : fMask(inNumBuckets - 1),
+      fBuckets(new std::atomic<Entry *>[inNumBuckets]) {
+  Assert((inNumBuckets & fMask) == 0);
+  for (UInt32 i = 0; i < inNumBuckets; i++)
+    fBuckets[i].store(nullptr, std::memory_order_relaxed);
+}
+
+UDPDemuxer::Table::~Table() {
+  for (UInt32 i = 0; i <= fMask; i++) {
+    Entry *theEntry = fBuckets[i].load(std::memory_order_relaxed);
+    while (theEntry != nullptr) {
+      Entry *theNext = theEntry->fNext.load(std::memory_order_relaxed);
+      delete theEntry;
+      theEntry = theNext;
+    }
+  }
+  delete[] fBuckets;
+}
+
+UDPDemuxer::UDPDemuxer()
+    : fSnapshot(new Snapshot{new Table(kInitialNumBuckets), nullptr}),
+      fEpoch(0),
+      fNumTasks(0),
+      fMigratePos(0),
+      fRetiredHead(nullptr),
+      fRetiredTail(nullptr),
+      fMutex() {
+  for (auto &theSlot : fReaders) {
+    theSlot.fCount[0] = 0;
+    theSlot.fCount[1] = 0;
+  }
+}
+
+UDPDemuxer::~UDPDemuxer() {
+  while (fRetiredHead != nullptr) {
+    Retired *theRetired = fRetiredHead;
+    fRetiredHead = theRetired->fNext;
+    delete theRetired->fEntries[0];
+    delete theRetired->fEntries[1];
+    delete theRetired->fTable;
+    delete theRetired->fSnapshot;
+    delete theRetired->fTask;
+    delete theRetired;
+  }
+
+  Snapshot *theSnapshot = fSnapshot.load();
+  delete theSnapshot->fTable;
+  delete theSnapshot->fOldTable;
+  delete theSnapshot;
+}
+
+UInt32 UDPDemuxer::GetNumBuckets() {
+  ReadLock theLock(this);
+  return fSnapshot.load()->fTable->fMask + 1;
+}
+
+UInt32 UDPDemuxer::readerSlot() {
+  static std::atomic<UInt32> sNextSlot(0);
+  static thread_local UInt32 sSlot = sNextSlot++ % kNumReaderSlots;
+  return sSlot;
+}
+
+UInt32 UDPDemuxer::enterRead(UInt32 inSlot) {
+  std::atomic<UInt32> *theCount = fReaders[inSlot].fCount;
+  while (true) {
+    UInt32 theEpoch = fEpoch.load();
+    theCount[theEpoch & 1]++;
+    // a writer flipped the epoch before seeing us, count in the new one
+    if (fEpoch.load() == theEpoch)
+      return theEpoch;
+    theCount[theEpoch & 1]--;
+  }
+}
+
+bool UDPDemuxer::hasReaders(UInt32 inEpoch) {
+  for (auto &theSlot : fReaders) {
+    if (theSlot.fCount[inEpoch & 1].load() != 0)
+      return true;
+  }
+  return false;
+}
+
+UDPDemuxer::Retired *UDPDemuxer::retire() {
+  auto *theRetired = new Retired();
+  theRetired->fEpoch = fEpoch.load();
+  if (fRetiredTail != nullptr)
+    fRetiredTail->fNext = theRetired;
+  else
+    fRetiredHead = theRetired;
+  fRetiredTail = theRetired;
+  return theRetired;
+}
+
+void UDPDemuxer::reclaim(bool inAdvance) {
+  // lookups count in the slot of the epoch they began in. The epoch only
+  // moves on once the slot it hands to new lookups is empty, so when the
+  // slot of the previous epoch is empty too, no lookup older than the
+  // current epoch is left, and whatever was unlinked before it can go.
+  UInt32 theEpoch = fEpoch.load();
+  if (this->hasReaders(theEpoch - 1))
+    return;
+
+  while (fRetiredHead != nullptr && fRetiredHead->fEpoch != theEpoch) {
+    Retired *theRetired = fRetiredHead;
+    fRetiredHead = theRetired->fNext;
+    delete theRetired->fEntries[0];
+    delete theRetired->fEntries[1];
+    delete theRetired->fTable;
+    delete theRetired->fSnapshot;
+    delete theRetired->fTask;
+    delete theRetired;
+  }
+  if (fRetiredHead == nullptr)
+    fRetiredTail = nullptr;
+
+  // starts the grace period of what this epoch retired
+  if (inAdvance || fRetiredHead != nullptr)
+    fEpoch++;
+}
+
+void UDPDemuxer::Synchronize() {
+  UInt32 theTarget;
+  {
+    Core::MutexLocker locker(&fMutex);
+    theTarget = fEpoch.load() + 2;
+  }
+
+  // two flips: the second needs the slot of the lookups present now empty
+  while (true) {
+    {
+      Core::MutexLocker locker(&fMutex);
+      if ((SInt32) (fEpoch.load() - theTarget) >= 0)
+        return;
+      this->reclaim(true);
+    }
+    Core::Thread::ThreadYield();
+  }
+}
+
+UDPDemuxer::Entry *UDPDemuxer::find(Table *inTable, UInt32 inHashValue,
+                                    UInt32 inRemoteAddr, UInt16 inRemotePort) {
+  Entry *theEntry =
+      inTable->fBuckets[inHashValue & inTable->fMask].load(std::memory_order_acquire);
+  for (; theEntry != nullptr;
+         theEntry = theEntry->fNext.load(std::memory_order_acquire)) {
+    if ((theEntry->fHashValue == inHashValue) &&
+        (theEntry->fRemoteAddr == inRemoteAddr) &&
+        (theEntry->fRemotePort == inRemotePort))
+      return theEntry;
+  }
+  return nullptr;
+}
+
+void UDPDemuxer::link(Table *inTable, UDPDemuxerTask *inTaskP) {
+  std::atomic<Entry *> &theBucket =
+      inTable->fBuckets[inTaskP->fHashValue & inTable->fMask];
+  auto *theEntry = new Entry;
+  theEntry->fTask = inTaskP;
+  theEntry->fHashValue = inTaskP->fHashValue;
+  theEntry->fRemoteAddr = inTaskP->fRemoteAddr;
+  theEntry->fRemotePort = inTaskP->fRemotePort;
+  theEntry->fNext.store(theBucket.load(std::memory_order_relaxed),
+                        std::memory_order_relaxed);
+  // publishes the initialized entry
+  theBucket.store(theEntry, std::memory_order_release);
+}
+
+UDPDemuxer::Entry *UDPDemuxer::unlink(Table *inTable, UDPDemuxerTask *inTaskP) {
+  std::atomic<Entry *> *thePrev =
+      &inTable->fBuckets[inTaskP->fHashValue & inTable->fMask];
+  for (Entry *theEntry = thePrev->load(std::memory_order_relaxed);
+       theEntry != nullptr;
+       thePrev = &theEntry->fNext,
+           theEntry = thePrev->load(std::memory_order_relaxed)) {
+    if (theEntry->fTask == inTaskP) {
+      // lookups standing on theEntry still find the rest of the chain
+      thePrev->store(theEntry->fNext.load(std::memory_order_relaxed),
+                     std::memory_order_release);
+      return theEntry;
+    }
+  }
+  return nullptr;
+}
+
+void UDPDemuxer::grow() {
+  Snapshot *theSnapshot = fSnapshot.load();
+  Assert(theSnapshot->fOldTable == nullptr);
+
+  auto *theTable = new Table((theSnapshot->fTable->fMask + 1) * 2);
+  fSnapshot.store(new Snapshot{theTable, theSnapshot->fTable});
+  fMigratePos = 0;
+
+  this->retire()->fSnapshot = theSnapshot;
+}
+
+void UDPDemuxer::migrate(UInt32 inNumBuckets) {
+  Snapshot *theSnapshot = fSnapshot.load();
+  Table *theOld = theSnapshot->fOldTable;
+  if (theOld == nullptr)
+    return;
+
+  // copies only, the old chains stay intact for lookups still walking them
+  for (; inNumBuckets > 0 && fMigratePos <= theOld->fMask;
+         inNumBuckets--, fMigratePos++) {
+    Entry *theEntry = theOld->fBuckets[fMigratePos].load(std::memory_order_relaxed);
+    for (; theEntry != nullptr;
+           theEntry = theEntry->fNext.load(std::memory_order_relaxed))
+      link(theSnapshot->fTable, theEntry->fTask);
+  }
+
+  if (fMigratePos > theOld->fMask) {
+    fSnapshot.store(new Snapshot{theSnapshot->fTable, nullptr});
+    Retired *theRetired = this->retire();
+    theRetired->fTable = theOld;
+    theRetired->fSnapshot = theSnapshot;
+  }
+}
+
+UDPDemuxerTask *UDPDemuxer::lookup(UInt32 inRemoteAddr, UInt16 inRemotePort) {
+  UInt32 theHashValue =
+      UDPDemuxerUtils::ComputeHashValue(inRemoteAddr, inRemotePort);
+
+  Snapshot *theSnapshot = fSnapshot.load(std::memory_order_relaxed);
+  Entry *theEntry = find(theSnapshot->fTable, theHashValue,
+                         inRemoteAddr, inRemotePort);
+  if (theEntry == nullptr && theSnapshot->fOldTable != nullptr)
+    theEntry = find(theSnapshot->fOldTable, theHashValue,
+                    inRemoteAddr, inRemotePort);
+  return (theEntry != nullptr) ? theEntry->fTask : nullptr;
+}
+
 OS_Error UDPDemuxer::RegisterTask(UInt32 inRemoteAddr, UInt16 inRemotePort,
                                   UDPDemuxerTask *inTaskP) {
   Assert(nullptr != inTaskP);
   Core::MutexLocker locker(&fMutex);
-  if (this->GetTask(inRemoteAddr, inRemotePort) != nullptr)
+  if (this->lookup(inRemoteAddr, inRemotePort) != nullptr)
     return (OS_Error) EPERM;
   inTaskP->set(inRemoteAddr, inRemotePort);
-  fHashTable.Add(inTaskP);
+
+  Snapshot *theSnapshot = fSnapshot.load();
+  link(theSnapshot->fTable, inTaskP);
+  fNumTasks++;
+
+  if (theSnapshot->fOldTable != nullptr)
+    this->migrate(kMigrateBucketsPerWrite);
+  else if (fNumTasks > (theSnapshot->fTable->fMask + 1) * kMaxLoadFactor)
+    this->grow();
+
+  this->reclaim(false);
   return OS_NoErr;
 }
 
 OS_Error UDPDemuxer::UnregisterTask(UInt32 inRemoteAddr, UInt16 inRemotePort,
                                     UDPDemuxerTask *inTaskP) {
+  OS_Error theErr = this->unregister(inRemoteAddr, inRemotePort, inTaskP, false);
+  if (theErr == OS_NoErr)
+    this->Synchronize();
+  return theErr;
+}
+
+OS_Error UDPDemuxer::UnregisterAndDeleteTask(UInt32 inRemoteAddr,
+                                             UInt16 inRemotePort,
+                                             UDPDemuxerTask *inTaskP) {
+  return this->unregister(inRemoteAddr, inRemotePort, inTaskP, true);
+}
+
+OS_Error UDPDemuxer::unregister(UInt32 inRemoteAddr, UInt16 inRemotePort,
+                                UDPDemuxerTask *inTaskP, bool inDeleteTask) {
   Core::MutexLocker locker(&fMutex);
   //remove by executing a lookup based on key information
-  UDPDemuxerTask *theTask = this->GetTask(inRemoteAddr, inRemotePort);
-
-  if ((nullptr != theTask) && (theTask == inTaskP)) {
-    fHashTable.Remove(theTask);
-    return OS_NoErr;
-  } else
+  UDPDemuxerTask *theTask = this->lookup(inRemoteAddr, inRemotePort);
+  if ((nullptr == theTask) || (theTask != inTaskP))
     return (OS_Error) EPERM;
+
+  // the task may sit in both tables while they are being merged
+  Snapshot *theSnapshot = fSnapshot.load();
+  Retired *theRetired = this->retire();
+  theRetired->fEntries[0] = unlink(theSnapshot->fTable, theTask);
+  if (theSnapshot->fOldTable != nullptr)
+    theRetired->fEntries[1] = unlink(theSnapshot->fOldTable, theTask);
+  if (inDeleteTask)
+    theRetired->fTask = theTask;
+  fNumTasks--;
+
+  this->migrate(kMigrateBucketsPerWrite);
+  this->reclaim(false);
+  return OS_NoErr;
+}
+
+UDPDemuxerTask *UDPDemuxer::GetTask(const ReadLock &inLock,
+                                    UInt32 inRemoteAddr, UInt16 inRemotePort) {
+  Assert(inLock.fDemuxer == this);
+  UInt32 theHashValue =
+      UDPDemuxerUtils::ComputeHashValue(inRemoteAddr, inRemotePort);
+
+  Snapshot *theSnapshot = fSnapshot.load(std::memory_order_acquire);
+  Entry *theEntry = find(theSnapshot->fTable, theHashValue,
+                         inRemoteAddr, inRemotePort);
+  if (theEntry == nullptr && theSnapshot->fOldTable != nullptr)
+    theEntry = find(theSnapshot->fOldTable, theHashValue,
+                    inRemoteAddr, inRemotePort);
+  return (theEntry != nullptr) ? theEntry->fTask : nullptr;
+}
+
+#if UDPDEMUXER_TESTING
+namespace {
+
+class LookupThread : public CF::Core::Thread {
+ public:
+  LookupThread(UDPDemuxer *inDemuxer, UInt32 inNumKeys, bool inLocked)
+      : fDemuxer(inDemuxer), fNumKeys(inNumKeys), fLocked(inLocked),
+        fNumLookups(0), fNumMisses(0) {}
+
+  void Entry() override {
+    UInt32 theSeed = (UInt32) (PointerSizedInt) this;
+    while (!this->IsStopRequested()) {
+      for (int i = 0; i < 1024; i++) {
+        theSeed = theSeed * 1103515245 + 12345;
+        UInt32 theIndex = (theSeed >> 8) % fNumKeys;
+        UDPDemuxerTask *theTask;
+        if (fLocked) {
+          // what every lookup paid before
+          CF::Core::MutexLocker locker(fDemuxer->GetMutex());
+          UDPDemuxer::ReadLock theLock(fDemuxer);
+          theTask = fDemuxer->GetTask(theLock, 0x0A000000 + theIndex, 5000);
+        } else {
+          UDPDemuxer::ReadLock theLock(fDemuxer);
+          theTask = fDemuxer->GetTask(theLock, 0x0A000000 + theIndex, 5000);
+        }
+        if (theTask == nullptr) fNumMisses++;
+      }
+      fNumLookups += 1024;
+    }
+  }
+
+  UDPDemuxer *fDemuxer;
+  UInt32 fNumKeys;
+  bool fLocked;
+  UInt64 fNumLookups;
+  UInt64 fNumMisses;
+};
+
 }
 
-UDPDemuxerTask *UDPDemuxer::GetTask(UInt32 inRemoteAddr, UInt16 inRemotePort) {
-  UDPDemuxerKey theKey(inRemoteAddr, inRemotePort);
-  return fHashTable.Map(&theKey);
+bool UDPDemuxer::Test() {
+  enum {
+    kNumKeys = 200000,      // stable peers, past the 100k mark
+    kNumChurnKeys = 1000,   // peers coming and going during lookups
+    kNumReaders = 4,
+    kRunMsec = 2000
+  };
+
+  bool theResult = true;
+  for (int locked = 1; locked >= 0; locked--) {
+    UDPDemuxer theDemuxer;
+    auto *theTasks = new UDPDemuxerTask[kNumKeys];
+    auto **theChurn = new UDPDemuxerTask *[kNumChurnKeys];
+
+    SInt64 theStart = Core::Time::Milliseconds();
+    for (UInt32 i = 0; i < kNumKeys; i++)
+      theDemuxer.RegisterTask(0x0A000000 + i, 5000, &theTasks[i]);
+    SInt64 theRegisterMsec = Core::Time::Milliseconds() - theStart;
+
+    LookupThread *theReaders[kNumReaders];
+    for (auto &theReader : theReaders) {
+      theReader = new LookupThread(&theDemuxer, kNumKeys, locked != 0);
+      theReader->Start();
+    }
+
+    UInt64 theNumChurn = 0;
+    theStart = Core::Time::Milliseconds();
+    while (Core::Time::Milliseconds() - theStart < kRunMsec) {
+      for (UInt32 i = 0; i < kNumChurnKeys; i++) {
+        theChurn[i] = new UDPDemuxerTask();
+        theDemuxer.RegisterTask(0x0B000000 + i, 6000, theChurn[i]);
+      }
+      for (UInt32 i = 0; i < kNumChurnKeys; i++)
+        theDemuxer.UnregisterAndDeleteTask(0x0B000000 + i, 6000, theChurn[i]);
+      theNumChurn += 2 * kNumChurnKeys;
+    }
+    SInt64 theMsec = Core::Time::Milliseconds() - theStart;
+
+    UInt64 theNumLookups = 0, theNumMisses = 0;
+    for (auto &theReader : theReaders) {
+      theReader->StopAndWaitForThread();
+      theNumLookups += theReader->fNumLookups;
+      theNumMisses += theReader->fNumMisses;
+      delete theReader;
+    }
+    if (theNumMisses != 0)
+      theResult = false;
+
+    s_printf("UDPDemuxer::Test %s: %" _U32BITARG_ " tasks registered in %"
+             _S64BITARG_ "ms (%" _U32BITARG_ " buckets), %" _S64BITARG_
+             " lookups/s on %d threads, %" _S64BITARG_ " churn ops/s, %"
+             _S64BITARG_ " misses\n",
+             locked ? "locked lookups" : "lock-free lookups",
+             (UInt32) kNumKeys, theRegisterMsec, theDemuxer.GetNumBuckets(),
+             (SInt64) (theNumLookups * 1000 / theMsec), (int) kNumReaders,
+             (SInt64) (theNumChurn * 1000 / theMsec), (SInt64) theNumMisses);
+
+    for (UInt32 i = 0; i < kNumKeys; i++)
+      theDemuxer.UnregisterTask(0x0A000000 + i, 5000, &theTasks[i]);
+    delete[] theTasks;
+    delete[] theChurn;
+  }
+
+  return theResult;
 }
+#endif
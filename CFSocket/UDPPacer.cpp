@@ -0,0 +1,426 @@
+/**
+ * @file UDPPacer.cpp
+ *
+ * implements UDPPacedFlow and UDPPacer classes
+ */
+
+#include <CF/Net/Socket/UDPPacer.h>
+#include <CF/Core/Time.h>
+
+#if !__Win32__
+#include <time.h>
+#include <unistd.h>
+#endif
+
+using namespace CF::Net;
+
+static const UInt64 kNanosPerSec = 1000000000ULL;
+static const UInt64 kNanosPerUsec = 1000ULL;
+
+UDPPacedFlow::UDPPacedFlow(UInt32 inRemoteAddr, UInt16 inRemotePort)
+    : fRemoteAddr(inRemoteAddr),
+      fRemotePort(inRemotePort),
+      fBytesPerSec(0),
+      fBurstBytes(0),
+      fBurst(0),
+      fTokens(0),
+      fLastRefill(0),
+      fNextTxTime(0),
+      fQueueHead(0),
+      fNumQueued(0),
+      fNumInBatch(0),
+      fNumPacketsSent(0),
+      fNumBytesSent(0),
+      fNumPacketsRefused(0),
+      fElem(this) {}
+
+UDPPacedFlow::~UDPPacedFlow() {
+  while (fNumQueued > 0)
+    this->dequeue();
+}
+
+void UDPPacedFlow::setRate(UInt64 inBitsPerSec, UInt32 inBurstBytes,
+                           UInt32 inMaxBurstUsec, UInt64 inNow) {
+  this->refill(inNow);
+  fBytesPerSec = inBitsPerSec / 8;
+  if (fBytesPerSec == 0)
+    fBytesPerSec = 1;
+  fBurstBytes = inBurstBytes;
+
+  UInt64 theBurst = inBurstBytes;
+  if (inMaxBurstUsec > 0) {
+    UInt64 theMax = fBytesPerSec * inMaxBurstUsec / (kNanosPerSec / kNanosPerUsec);
+    if (theMax == 0)
+      theMax = 1;
+    if (theBurst > theMax)
+      theBurst = theMax;
+  }
+  fBurst = (SInt64) theBurst * (SInt64) kNanosPerSec;
+  if (fTokens > fBurst)
+    fTokens = fBurst;
+  fLastRefill = inNow;
+}
+
+void UDPPacedFlow::refill(UInt64 inNow) {
+  if (inNow <= fLastRefill)
+    return;
+  UInt64 theElapsed = inNow - fLastRefill;
+  if (theElapsed > kNanosPerSec)
+    theElapsed = kNanosPerSec; // a full second fills any sane burst
+  fTokens += (SInt64) (theElapsed * fBytesPerSec);
+  if (fTokens > fBurst)
+    fTokens = fBurst;
+  fLastRefill = inNow;
+}
+
+void UDPPacedFlow::dequeue() {
+  Assert(fNumQueued > 0);
+  fQueue[fQueueHead]->Release();
+  fQueueHead = (fQueueHead + 1) % kMaxQueuedPackets;
+  fNumQueued--;
+}
+
+UDPPacer::UDPPacer(UDPSocket *inSocket, BufferPool *inPool)
+    : fSocket(inSocket),
+      fPool(inPool),
+      fUseTxTime(false),
+      fMaxBurstUsec(kDefaultMaxBurstUsec),
+      fIdle(false) {
+  Assert(fSocket != nullptr);
+}
+
+UDPPacer::~UDPPacer() {
+  {
+    Core::MutexLocker locker(&fMutex);
+    this->SendStopRequest();
+    fCond.Signal();
+  }
+  this->StopAndWaitForThread();
+
+  while (fFlows.GetLength() > 0)
+    delete (UDPPacedFlow *) fFlows.DeQueue()->GetEnclosingObject();
+}
+
+UInt64 UDPPacer::NowNanos() {
+#if __Win32__
+  return (UInt64) Core::Time::Microseconds() * kNanosPerUsec;
+#else
+  struct timespec theTime;
+  ::clock_gettime(CLOCK_MONOTONIC, &theTime);
+  return (UInt64) theTime.tv_sec * kNanosPerSec + (UInt64) theTime.tv_nsec;
+#endif
+}
+
+OS_Error UDPPacer::UseTxTime() {
+  OS_Error theErr = fSocket->EnableTxTime();
+  if (theErr == OS_NoErr) {
+    Core::MutexLocker locker(&fMutex);
+    fUseTxTime = true;
+  }
+  return theErr;
+}
+
+void UDPPacer::SetMaxBurst(UInt32 inUsec) {
+  Core::MutexLocker locker(&fMutex);
+  fMaxBurstUsec = inUsec;
+  UInt64 theNow = NowNanos();
+  for (QueueIter theIter(&fFlows); !theIter.IsDone(); theIter.Next()) {
+    auto *theFlow = (UDPPacedFlow *) theIter.GetCurrent()->GetEnclosingObject();
+    theFlow->setRate(theFlow->fBytesPerSec * 8, theFlow->fBurstBytes,
+                     fMaxBurstUsec, theNow);
+  }
+}
+
+UDPPacedFlow *UDPPacer::AddFlow(UInt32 inRemoteAddr, UInt16 inRemotePort,
+                                UInt64 inBitsPerSec, UInt32 inBurstBytes) {
+  auto *theFlow = new UDPPacedFlow(inRemoteAddr, inRemotePort);
+  UInt64 theNow = NowNanos();
+  theFlow->fLastRefill = theNow;
+
+  Core::MutexLocker locker(&fMutex);
+  theFlow->setRate(inBitsPerSec, inBurstBytes, fMaxBurstUsec, theNow);
+  theFlow->fTokens = theFlow->fBurst; // may start with a burst
+  fFlows.EnQueue(&theFlow->fElem);
+  return theFlow;
+}
+
+void UDPPacer::SetFlowRate(UDPPacedFlow *inFlow, UInt64 inBitsPerSec,
+                           UInt32 inBurstBytes) {
+  Core::MutexLocker locker(&fMutex);
+  inFlow->setRate(inBitsPerSec, inBurstBytes, fMaxBurstUsec, NowNanos());
+}
+
+void UDPPacer::RemoveFlow(UDPPacedFlow *inFlow) {
+  Core::MutexLocker locker(&fMutex);
+  fFlows.Remove(&inFlow->fElem);
+  delete inFlow;
+}
+
+OS_Error UDPPacer::Send(UDPPacedFlow *inFlow, RelayPacket *inPacket) {
+  Core::MutexLocker locker(&fMutex);
+  if (inFlow->fNumQueued == UDPPacedFlow::kMaxQueuedPackets) {
+    inFlow->fNumPacketsRefused++;
+    return EAGAIN;
+  }
+
+  inPacket->AddRef();
+  UInt32 theIndex = (inFlow->fQueueHead + inFlow->fNumQueued)
+      % UDPPacedFlow::kMaxQueuedPackets;
+  inFlow->fQueue[theIndex] = inPacket;
+  inFlow->fNumQueued++;
+
+  if (fIdle)
+    fCond.Signal();
+  return OS_NoErr;
+}
+
+OS_Error UDPPacer::Send(UDPPacedFlow *inFlow, void *inData, UInt32 inLength) {
+  Assert(fPool != nullptr);
+  RelayPacket *thePacket = RelayPacket::Create(fPool);
+  if (thePacket == nullptr || inLength > thePacket->GetCapacity()) {
+    if (thePacket != nullptr)
+      thePacket->Release();
+    return EMSGSIZE;
+  }
+
+  ::memcpy(thePacket->GetData(), inData, inLength);
+  thePacket->SetLength(inLength);
+  OS_Error theErr = this->Send(inFlow, thePacket);
+  thePacket->Release();
+  return theErr;
+}
+
+void UDPPacer::Entry() {
+  Core::MutexLocker locker(&fMutex);
+  while (!this->IsStopRequested()) {
+    UInt64 theNow = NowNanos();
+    UInt64 theNext = this->sendDue(theNow);
+
+    if (theNext == 0) {
+      fIdle = true;
+      fCond.Wait(&fMutex, kIdleWaitMsec);
+      fIdle = false;
+      continue;
+    }
+
+    // new packets are picked up on the next tick at the latest
+    if (theNext > theNow + kMaxSleepUsec * kNanosPerUsec)
+      theNext = theNow + kMaxSleepUsec * kNanosPerUsec;
+
+    fMutex.Unlock();
+#if __linux__
+    struct timespec theWake;
+    theWake.tv_sec = (time_t) (theNext / kNanosPerSec);
+    theWake.tv_nsec = (long) (theNext % kNanosPerSec);
+    while (::clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &theWake, nullptr) == EINTR);
+#else
+    Core::Thread::Sleep(1);
+#endif
+    fMutex.Lock();
+  }
+}
+
+UInt64 UDPPacer::sendDue(UInt64 inNow) {
+  UDPPacket thePackets[UDPPacketBatch::kMaxPackets];
+  UDPPacedFlow *theOwners[UDPPacketBatch::kMaxPackets];
+  UInt32 theCount = 0;
+  UInt64 theNext = 0;
+  UInt64 theSlack = kSlackUsec * kNanosPerUsec;
+  UInt64 theHorizon = kTxTimeHorizonUsec * kNanosPerUsec;
+
+  for (QueueIter theIter(&fFlows); !theIter.IsDone(); theIter.Next()) {
+    auto *theFlow = (UDPPacedFlow *) theIter.GetCurrent()->GetEnclosingObject();
+    theFlow->refill(inNow);
+
+    while (theFlow->fNumInBatch < theFlow->fNumQueued) {
+      RelayPacket *thePacket = theFlow->peek(theFlow->fNumInBatch);
+      SInt64 theCost = (SInt64) thePacket->GetLength() * (SInt64) kNanosPerSec;
+      // a full bucket lets a packet larger than the burst go
+      SInt64 theNeed = theCost < theFlow->fBurst ? theCost : theFlow->fBurst;
+      UInt64 theTxTime = 0;
+      UInt64 theWait = 0;
+
+      if (fUseTxTime) {
+        // virtual departure clock, the qdisc does the waiting
+        theTxTime = theFlow->fNextTxTime > inNow ? theFlow->fNextTxTime : inNow;
+        if (theTxTime > inNow + theHorizon)
+          theWait = theTxTime - theHorizon - inNow;
+      } else if (theNeed > theFlow->fTokens + (SInt64) (theSlack * theFlow->fBytesPerSec)) {
+        theWait = (UInt64) (theNeed - theFlow->fTokens) / theFlow->fBytesPerSec;
+      }
+
+      if (theWait > 0) {
+        if (theNext == 0 || inNow + theWait < theNext)
+          theNext = inNow + theWait;
+        break;
+      }
+
+      if (fUseTxTime)
+        theFlow->fNextTxTime = theTxTime + (UInt64) theCost / theFlow->fBytesPerSec;
+      else
+        theFlow->fTokens -= theCost; // below 0 by the slack, or the borrowed tokens
+
+      UDPPacket &theOut = thePackets[theCount];
+      theOut.fBuffer = thePacket->GetData();
+      theOut.fBufferLen = thePacket->GetCapacity();
+      theOut.fLength = thePacket->GetLength();
+      theOut.fRemoteAddr = theFlow->fRemoteAddr;
+      theOut.fRemotePort = theFlow->fRemotePort;
+      theOut.fSegmentSize = 0;
+      theOut.fTxTime = theTxTime;
+      theOwners[theCount] = theFlow;
+      theFlow->fNumInBatch++;
+
+      if (++theCount == UDPPacketBatch::kMaxPackets) {
+        if (this->sendBatch(thePackets, theOwners, theCount) < theCount)
+          return inNow + kMaxSleepUsec * kNanosPerUsec; // socket full, retry later
+        theCount = 0;
+      }
+    }
+  }
+
+  if (theCount > 0 && this->sendBatch(thePackets, theOwners, theCount) < theCount)
+    return inNow + kMaxSleepUsec * kNanosPerUsec;
+
+  return theNext;
+}
+
+UInt32 UDPPacer::sendBatch(UDPPacket *inPackets, UDPPacedFlow **inOwners,
+                           UInt32 inCount) {
+  UInt32 theNumSent = 0;
+  OS_Error theErr = fSocket->SendMany(inPackets, inCount, &theNumSent);
+  if (theErr != OS_NoErr && theErr != EAGAIN && theErr != ENOBUFS) {
+    // the destination refuses, lose this packet rather than the flow
+    theNumSent = 1;
+  }
+
+  for (UInt32 i = 0; i < theNumSent; i++) {
+    inOwners[i]->fNumPacketsSent++;
+    inOwners[i]->fNumBytesSent += inPackets[i].fLength;
+    inOwners[i]->fNumInBatch--;
+    inOwners[i]->dequeue();
+  }
+
+  // give back what the unsent packets took, they stay queued
+  for (UInt32 i = theNumSent; i < inCount; i++) {
+    UDPPacedFlow *theFlow = inOwners[i];
+    SInt64 theCost = (SInt64) inPackets[i].fLength * (SInt64) kNanosPerSec;
+    if (theFlow->fNumInBatch == 0)
+      continue; // already rewound
+    if (fUseTxTime) {
+      // the flow's first unsent packet is its earliest one
+      theFlow->fNextTxTime = inPackets[i].fTxTime;
+      theFlow->fNumInBatch = 0;
+    } else {
+      theFlow->fTokens += theCost;
+      theFlow->fNumInBatch--;
+    }
+  }
+  return theNumSent;
+}
+
+#if UDPPACER_TESTING
+bool UDPPacer::Test() {
+  enum {
+    kNumFlows = 20,
+    kBitsPerSec = 8 * 1000 * 1000,  // 1MB/s each
+    kPacketSize = 1000,
+    kFrameSize = 40,                // packets per frame, 40ms at the rate
+    kNumFrames = 25
+  };
+
+  // the second pass is as good as unpaced, for comparison
+  const UInt64 theRates[] = {kBitsPerSec, 100ULL * 1000 * 1000 * 1000};
+  for (UInt64 theRate : theRates) {
+    UDPSocket theOutput(nullptr, Socket::kNonBlockingSocketType);
+    UDPSocket theSink(nullptr, Socket::kNonBlockingSocketType);
+    if (theOutput.Open() != OS_NoErr || theSink.Open() != OS_NoErr)
+      return false;
+    theOutput.Bind(INADDR_LOOPBACK, 0);
+    theSink.Bind(INADDR_LOOPBACK, 0);
+    theOutput.SetSocketBufSize(16 * 1024 * 1024);
+    theSink.SetSocketRcvBufSize(16 * 1024 * 1024);
+
+    // arrival times stamped by the kernel, our polling doesn't matter
+    int theOn = 1;
+    ::setsockopt(theSink.GetSocketFD(), SOL_SOCKET, SO_TIMESTAMPNS, &theOn, sizeof(theOn));
+
+    struct sockaddr_in theAddr;
+    socklen_t theLen = sizeof(theAddr);
+    ::getsockname(theSink.GetSocketFD(), (sockaddr *) &theAddr, &theLen);
+    UInt16 theSinkPort = ntohs(theAddr.sin_port);
+
+    BufferPool thePool(2048);
+    UDPPacer thePacer(&theOutput, &thePool);
+    UDPPacedFlow *theFlows[kNumFlows];
+    for (auto &theFlow : theFlows)
+      theFlow = thePacer.AddFlow(INADDR_LOOPBACK, theSinkPort, theRate, 2 * kPacketSize);
+    thePacer.Start();
+
+    char theData[kPacketSize];
+    ::memset(theData, 'p', sizeof(theData));
+
+    // busiest millisecond, seen from the receiver
+    UInt32 theBuckets[kNumFrames * 40 + 100];
+    ::memset(theBuckets, 0, sizeof(theBuckets));
+    UInt64 theNumRecv = 0;
+    UInt64 theFirst = 0;
+    auto theDrain = [&]() {
+      while (true) {
+        char theRecvBuf[2048];
+        UInt64 theCtrl[64];
+        struct iovec theVec = {theRecvBuf, sizeof(theRecvBuf)};
+        struct msghdr theMsg;
+        ::memset(&theMsg, 0, sizeof(theMsg));
+        theMsg.msg_iov = &theVec;
+        theMsg.msg_iovlen = 1;
+        theMsg.msg_control = theCtrl;
+        theMsg.msg_controllen = sizeof(theCtrl);
+        if (::recvmsg(theSink.GetSocketFD(), &theMsg, MSG_DONTWAIT) < 0)
+          return;
+
+        struct cmsghdr *theCmsg = CMSG_FIRSTHDR(&theMsg);
+        if (theCmsg == nullptr || theCmsg->cmsg_type != SO_TIMESTAMPNS)
+          continue;
+        struct timespec theStamp;
+        ::memcpy(&theStamp, CMSG_DATA(theCmsg), sizeof(theStamp));
+        UInt64 theUsec = (UInt64) theStamp.tv_sec * 1000000 + theStamp.tv_nsec / 1000;
+        if (theFirst == 0)
+          theFirst = theUsec;
+        UInt64 theBucket = (theUsec - theFirst) / 1000;
+        if (theBucket < sizeof(theBuckets) / sizeof(theBuckets[0]))
+          theBuckets[theBucket]++;
+        theNumRecv++;
+      }
+    };
+
+    UInt64 theStart = NowNanos();
+    for (UInt32 theFrame = 0; theFrame <= kNumFrames; theFrame++) {
+      // every frame is queued at once
+      for (auto &theFlow : theFlows)
+        for (UInt32 i = 0; i < kFrameSize && theFrame < kNumFrames; i++)
+          thePacer.Send(theFlow, theData, kPacketSize);
+      UInt64 theFrameEnd = theStart + (theFrame + 1) * 40 * 1000 * kNanosPerUsec;
+      while (NowNanos() < theFrameEnd) {
+        theDrain();
+        ::usleep(200);
+      }
+    }
+    theDrain();
+
+    UInt32 theMaxPerMsec = 0;
+    for (UInt32 theCount : theBuckets)
+      if (theCount > theMaxPerMsec) theMaxPerMsec = theCount;
+    UInt64 theMsec = (NowNanos() - theStart) / 1000000;
+
+    s_printf("UDPPacer::Test: %d flows at %" _S64BITARG_ " bit/s, %" _S64BITARG_
+             " packets in %" _S64BITARG_ "ms (%" _S64BITARG_ " kbit/s), "
+             "busiest millisecond %" _U32BITARG_ " packets (%d when smooth)\n",
+             (int) kNumFlows, (SInt64) theRate, (SInt64) theNumRecv,
+             (SInt64) theMsec, (SInt64) (theNumRecv * kPacketSize * 8 / theMsec),
+             theMaxPerMsec, (int) (kNumFlows * kBitsPerSec / 8 / kPacketSize / 1000));
+  }
+
+  return true;
+}
+#endif
@@ -0,0 +1,315 @@
+/**
+ * @file UDPRelay.cpp
+ *
+ * implements RelayPacket, UDPRelaySubscriber and UDPRelay classes
+ */
+
+#include <new>
+#include <CF/Net/Socket/UDPRelay.h>
+
+#if UDPRELAY_TESTING
+#include <CF/Core/Time.h>
+#endif
+
+using namespace CF::Net;
+
+RelayPacket *RelayPacket::Create(BufferPool *inPool) {
+  Assert(inPool != nullptr);
+  if (inPool->GetBufferSize() <= sizeof(RelayPacket))
+    return nullptr;
+
+  void *theBuffer = inPool->Get();
+  return new(theBuffer) RelayPacket(inPool,
+                                    inPool->GetBufferSize() - sizeof(RelayPacket));
+}
+
+void RelayPacket::Release() {
+  Assert(fRefCount > 0);
+  if (--fRefCount == 0)
+    fPool->Put(this); // trivially destructible, the buffer is all there is
+}
+
+UDPRelaySubscriber::UDPRelaySubscriber(UInt32 inRemoteAddr, UInt16 inRemotePort)
+    : fRemoteAddr(inRemoteAddr),
+      fRemotePort(inRemotePort),
+      fQueueHead(0),
+      fNumQueued(0),
+      fNumPacketsSent(0),
+      fNumBytesSent(0),
+      fNumPacketsDropped(0),
+      fNumSendErrors(0),
+      fNumBackpressured(0),
+      fElem(this) {}
+
+UDPRelaySubscriber::~UDPRelaySubscriber() {
+  while (fNumQueued > 0)
+    this->dequeue();
+}
+
+void UDPRelaySubscriber::enqueue(RelayPacket *inPacket) {
+  if (fNumQueued == kMaxQueuedPackets) {
+    // late media is useless, make room by losing the oldest
+    this->dequeue();
+    fNumPacketsDropped++;
+  }
+  inPacket->AddRef();
+  fQueue[(fQueueHead + fNumQueued) % kMaxQueuedPackets] = inPacket;
+  fNumQueued++;
+}
+
+void UDPRelaySubscriber::dequeue() {
+  Assert(fNumQueued > 0);
+  fQueue[fQueueHead]->Release();
+  fQueueHead = (fQueueHead + 1) % kMaxQueuedPackets;
+  fNumQueued--;
+}
+
+UDPRelay::UDPRelay(UDPSocket *inSendSocket, BufferPool *inPool)
+    : fSendSocket(inSendSocket),
+      fPool(inPool),
+      fNumSpare(0),
+      fNumPacketsReceived(0) {
+  Assert(fSendSocket != nullptr);
+  Assert(fPool != nullptr);
+}
+
+UDPRelay::~UDPRelay() {
+  while (fSubscribers.GetLength() > 0) {
+    QueueElem *theElem = fSubscribers.DeQueue();
+    delete (UDPRelaySubscriber *) theElem->GetEnclosingObject();
+  }
+  for (UInt32 i = 0; i < fNumSpare; i++)
+    fSpare[i]->Release();
+}
+
+UDPRelaySubscriber *UDPRelay::AddSubscriber(UInt32 inRemoteAddr,
+                                            UInt16 inRemotePort) {
+  Core::MutexLocker locker(&fMutex);
+  auto *theSubscriber = new UDPRelaySubscriber(inRemoteAddr, inRemotePort);
+  fSubscribers.EnQueue(&theSubscriber->fElem);
+  return theSubscriber;
+}
+
+void UDPRelay::RemoveSubscriber(UDPRelaySubscriber *inSubscriber) {
+  Core::MutexLocker locker(&fMutex);
+  fSubscribers.Remove(&inSubscriber->fElem);
+  delete inSubscriber;
+}
+
+void UDPRelay::Push(RelayPacket *inPacket) {
+  Core::MutexLocker locker(&fMutex);
+  for (QueueIter theIter(&fSubscribers); !theIter.IsDone(); theIter.Next()) {
+    auto *theSubscriber =
+        (UDPRelaySubscriber *) theIter.GetCurrent()->GetEnclosingObject();
+    theSubscriber->enqueue(inPacket);
+  }
+}
+
+OS_Error UDPRelay::RelayFrom(UDPSocket *inSocket, UInt32 *outNumPackets) {
+  Assert(inSocket != nullptr);
+
+  UInt32 theTotal = 0;
+  UDPPacket thePackets[UDPPacketBatch::kMaxPackets];
+
+  while (true) {
+    while (fNumSpare < UDPPacketBatch::kMaxPackets) {
+      RelayPacket *thePacket = RelayPacket::Create(fPool);
+      if (thePacket == nullptr)
+        return ENOBUFS;
+      fSpare[fNumSpare++] = thePacket;
+    }
+
+    for (UInt32 i = 0; i < fNumSpare; i++) {
+      thePackets[i].fBuffer = fSpare[i]->GetData();
+      thePackets[i].fBufferLen = fSpare[i]->GetCapacity();
+    }
+
+    UInt32 theNumRecv = 0;
+    if (inSocket->RecvMany(thePackets, fNumSpare, &theNumRecv) != OS_NoErr)
+      break;
+
+    {
+      Core::MutexLocker locker(&fMutex);
+      for (UInt32 i = 0; i < theNumRecv; i++) {
+        fSpare[i]->SetLength(thePackets[i].fLength);
+        this->Push(fSpare[i]);
+        // the subscribers hold it now, or nobody and it's back in the pool
+        fSpare[i]->Release();
+      }
+    }
+
+    // keep the unused buffers at the front for the next round
+    fNumSpare -= theNumRecv;
+    for (UInt32 i = 0; i < fNumSpare; i++)
+      fSpare[i] = fSpare[i + theNumRecv];
+
+    theTotal += theNumRecv;
+    fNumPacketsReceived += theNumRecv;
+
+    // send as we go, the subscriber queues are short
+    if (this->Flush() != OS_NoErr || theNumRecv < UDPPacketBatch::kMaxPackets)
+      break;
+  }
+
+  if (outNumPackets != nullptr)
+    *outNumPackets = theTotal;
+
+  Core::MutexLocker locker(&fMutex);
+  return this->flush();
+}
+
+OS_Error UDPRelay::Flush() {
+  Core::MutexLocker locker(&fMutex);
+  return this->flush();
+}
+
+OS_Error UDPRelay::flush() {
+  UDPPacket thePackets[UDPPacketBatch::kMaxPackets];
+  UDPRelaySubscriber *theOwners[UDPPacketBatch::kMaxPackets];
+
+  // start with somebody else each time, for fairness under backpressure
+  if (fSubscribers.GetLength() > 1)
+    fSubscribers.EnQueue(fSubscribers.DeQueue());
+
+  while (true) {
+    // one batch: queued packets of each subscriber, in order
+    UInt32 theCount = 0;
+    for (QueueIter theIter(&fSubscribers);
+         !theIter.IsDone() && theCount < UDPPacketBatch::kMaxPackets;
+         theIter.Next()) {
+      auto *theSubscriber =
+          (UDPRelaySubscriber *) theIter.GetCurrent()->GetEnclosingObject();
+      for (UInt32 i = 0; i < theSubscriber->fNumQueued &&
+          theCount < UDPPacketBatch::kMaxPackets; i++, theCount++) {
+        RelayPacket *thePacket = theSubscriber->peek(i);
+        UDPPacket &theOut = thePackets[theCount];
+        theOut.fBuffer = thePacket->GetData();
+        theOut.fBufferLen = thePacket->GetCapacity();
+        theOut.fLength = thePacket->GetLength();
+        theOut.fRemoteAddr = theSubscriber->fRemoteAddr;
+        theOut.fRemotePort = theSubscriber->fRemotePort;
+        theOut.fSegmentSize = 0;
+        theOut.fTxTime = 0;
+        theOwners[theCount] = theSubscriber;
+      }
+    }
+
+    if (theCount == 0)
+      return OS_NoErr;
+
+    UInt32 theNumSent = 0;
+    OS_Error theErr = fSendSocket->SendMany(thePackets, theCount, &theNumSent);
+
+    for (UInt32 i = 0; i < theNumSent; i++) {
+      theOwners[i]->fNumPacketsSent++;
+      theOwners[i]->fNumBytesSent += thePackets[i].fLength;
+      theOwners[i]->dequeue();
+    }
+
+    if (theErr == EAGAIN || theErr == ENOBUFS ||
+        (theErr == OS_NoErr && theNumSent < theCount)) {
+      // the send socket is full, everyone still queued waits for kWriteEvent
+      for (QueueIter theIter(&fSubscribers); !theIter.IsDone(); theIter.Next()) {
+        auto *theSubscriber =
+            (UDPRelaySubscriber *) theIter.GetCurrent()->GetEnclosingObject();
+        if (theSubscriber->fNumQueued > 0)
+          theSubscriber->fNumBackpressured++;
+      }
+      return EAGAIN;
+    }
+
+    if (theErr != OS_NoErr) {
+      // this destination refuses (ICMP unreachable, ...), don't stall the rest
+      theOwners[theNumSent]->fNumSendErrors++;
+      theOwners[theNumSent]->dequeue();
+    }
+  }
+}
+
+#if UDPRELAY_TESTING
+bool UDPRelay::Test() {
+  enum {
+    kNumSubscribers = 50,
+    kNumPackets = 20000,
+    kPacketSize = 1200
+  };
+
+  UDPSocket theSource(nullptr, Socket::kNonBlockingSocketType);
+  UDPSocket theInput(nullptr, Socket::kNonBlockingSocketType);
+  UDPSocket theOutput(nullptr, Socket::kNonBlockingSocketType);
+  UDPSocket theSink(nullptr, Socket::kNonBlockingSocketType);
+  if (theSource.Open() != OS_NoErr || theInput.Open() != OS_NoErr ||
+      theOutput.Open() != OS_NoErr || theSink.Open() != OS_NoErr)
+    return false;
+  theSource.Bind(INADDR_LOOPBACK, 0);
+  theInput.Bind(INADDR_LOOPBACK, 0);
+  theOutput.Bind(INADDR_LOOPBACK, 0);
+  theSink.Bind(INADDR_LOOPBACK, 0);
+  theInput.SetSocketRcvBufSize(4 * 1024 * 1024);
+  theSink.SetSocketRcvBufSize(16 * 1024 * 1024);
+
+  struct sockaddr_in theAddr;
+  socklen_t theLen = sizeof(theAddr);
+  ::getsockname(theInput.GetSocketFD(), (sockaddr *) &theAddr, &theLen);
+  UInt16 theInputPort = ntohs(theAddr.sin_port);
+  theLen = sizeof(theAddr);
+  ::getsockname(theSink.GetSocketFD(), (sockaddr *) &theAddr, &theLen);
+  UInt16 theSinkPort = ntohs(theAddr.sin_port);
+
+  BufferPool thePool(2048);
+  UDPRelay theRelay(&theOutput, &thePool);
+  // every subscriber is the same sink, the relay can't tell
+  for (UInt32 i = 0; i < kNumSubscribers; i++)
+    theRelay.AddSubscriber(INADDR_LOOPBACK, theSinkPort);
+
+  char theData[kPacketSize];
+  ::memset(theData, 'r', sizeof(theData));
+  char theSinkBuf[2048];
+
+  UInt64 theNumSunk = 0;
+  SInt64 theStart = Core::Time::Milliseconds();
+  for (UInt32 theNumSent = 0; theNumSent < kNumPackets;) {
+    for (int j = 0; j < 32 && theNumSent < kNumPackets; j++)
+      if (theSource.SendTo(INADDR_LOOPBACK, theInputPort, theData,
+                           kPacketSize) == OS_NoErr)
+        theNumSent++;
+
+    theRelay.RelayFrom(&theInput, nullptr);
+
+    UInt32 theRecvAddr, theRecvLen;
+    UInt16 theRecvPort;
+    while (theSink.RecvFrom(&theRecvAddr, &theRecvPort, theSinkBuf,
+                            sizeof(theSinkBuf), &theRecvLen) == OS_NoErr)
+      theNumSunk++;
+  }
+  while (theRelay.Flush() == EAGAIN) {
+    UInt32 theRecvAddr, theRecvLen;
+    UInt16 theRecvPort;
+    while (theSink.RecvFrom(&theRecvAddr, &theRecvPort, theSinkBuf,
+                            sizeof(theSinkBuf), &theRecvLen) == OS_NoErr)
+      theNumSunk++;
+  }
+  SInt64 theMsec = Core::Time::Milliseconds() - theStart;
+  if (theMsec == 0) theMsec = 1;
+
+  UInt64 theSent = 0, theDropped = 0, theBackpressured = 0;
+  for (QueueIter theIter(&theRelay.fSubscribers); !theIter.IsDone(); theIter.Next()) {
+    auto *theSubscriber =
+        (UDPRelaySubscriber *) theIter.GetCurrent()->GetEnclosingObject();
+    theSent += theSubscriber->GetNumPacketsSent();
+    theDropped += theSubscriber->GetNumPacketsDropped();
+    theBackpressured += theSubscriber->GetNumBackpressured();
+  }
+
+  s_printf("UDPRelay::Test: %" _S64BITARG_ " in, %" _S64BITARG_ " out to %d"
+           " subscribers (%" _S64BITARG_ " pps out), %" _S64BITARG_
+           " dropped, %" _S64BITARG_ " backpressured, %" _S64BITARG_
+           " seen by sink, %" _U32BITARG_ " pool buffers\n",
+           (SInt64) theRelay.GetNumPacketsReceived(), (SInt64) theSent,
+           (int) kNumSubscribers, (SInt64) (theSent * 1000 / theMsec),
+           (SInt64) theDropped, (SInt64) theBackpressured,
+           (SInt64) theNumSunk, thePool.GetTotalNumBuffers());
+
+  return theSent + theDropped == theRelay.GetNumPacketsReceived() * kNumSubscribers;
+}
+#endif
@@ -39,6 +39,27 @@
 #include <CF/Net/Socket/SocketUtils.h>
 #endif
 
+#if __linux__
+#include <netinet/in.h>
+#include <netinet/udp.h>
+
+#ifndef SOL_UDP
+#define SOL_UDP 17
+#endif
+#ifndef UDP_SEGMENT
+#define UDP_SEGMENT 103
+#endif
+#ifndef UDP_GRO
+#define UDP_GRO 104
+#endif
+#ifndef SO_TXTIME
+#define SO_TXTIME 61
+#define SCM_TXTIME SO_TXTIME
+#endif
+
+#include <linux/net_tstamp.h>
+#endif
+
 #if NEED_SOCKETBITS
 #if __GLIBC__ >= 2
 #include <bits/socket.h>
@@ -52,6 +73,10 @@
 #include <netlog.h>
 #endif
 
+#if UDPSOCKET_TESTING
+#include <CF/Core/Time.h>
+#endif
+
 using namespace CF::Net;
 
 UDPSocket::UDPSocket(CF::Thread::Task *inTask, UInt32 inSocketType)
@@ -121,6 +146,336 @@ UDPSocket::RecvFrom(UInt32 *outRemoteAddr, UInt16 *outRemotePort,
   return OS_NoErr;
 }
 
+UDPPacketBatch::UDPPacketBatch(BufferPool *inPool, UInt32 inNumPackets)
+    : fPool(inPool),
+      fCapacity(inNumPackets > (UInt32) kMaxPackets ? (UInt32) kMaxPackets
+                                                   : inNumPackets),
+      fNumPackets(0) {
+  Assert(fPool != nullptr);
+  ::memset(fPackets, 0, sizeof(fPackets));
+  for (UInt32 i = 0; i < fCapacity; i++) {
+    fPackets[i].fBuffer = fPool->Get();
+    fPackets[i].fBufferLen = fPool->GetBufferSize();
+  }
+}
+
+UDPPacketBatch::~UDPPacketBatch() {
+  for (UInt32 i = 0; i < fCapacity; i++)
+    fPool->Put(fPackets[i].fBuffer);
+}
+
+OS_Error UDPSocket::RecvMany(UDPPacketBatch *ioBatch) {
+  UInt32 theNumRecv = 0;
+  OS_Error theErr = this->RecvMany(ioBatch->GetPackets(),
+                                   ioBatch->GetCapacity(), &theNumRecv);
+  ioBatch->SetNumPackets(theNumRecv);
+  return theErr;
+}
+
+OS_Error UDPSocket::SendMany(UDPPacketBatch *inBatch, UInt32 *outNumSent) {
+  return this->SendMany(inBatch->GetPackets(), inBatch->GetNumPackets(),
+                        outNumSent);
+}
+
+OS_Error UDPSocket::RecvMany(UDPPacket *ioPackets, UInt32 inNumPackets,
+                             UInt32 *outNumRecv) {
+  Assert(ioPackets != nullptr);
+  Assert(outNumRecv != nullptr);
+
+  *outNumRecv = 0;
+
+#if __linux__
+  struct mmsghdr theMsgs[UDPPacketBatch::kMaxPackets];
+  struct iovec theVecs[UDPPacketBatch::kMaxPackets];
+  struct sockaddr_in theAddrs[UDPPacketBatch::kMaxPackets];
+  // room for the UDP_GRO segment size of each message
+  UInt64 theCtrl[UDPPacketBatch::kMaxPackets][CMSG_SPACE(sizeof(int)) / sizeof(UInt64) + 1];
+  bool wantsGRO = this->IsGROEnabled();
+
+  while (*outNumRecv < inNumPackets) {
+    UDPPacket *thePackets = ioPackets + *outNumRecv;
+    UInt32 theCount = inNumPackets - *outNumRecv;
+    if (theCount > UDPPacketBatch::kMaxPackets)
+      theCount = UDPPacketBatch::kMaxPackets;
+
+    ::memset(theMsgs, 0, sizeof(struct mmsghdr) * theCount);
+    for (UInt32 i = 0; i < theCount; i++) {
+      theVecs[i].iov_base = thePackets[i].fBuffer;
+      theVecs[i].iov_len = thePackets[i].fBufferLen;
+      theMsgs[i].msg_hdr.msg_iov = &theVecs[i];
+      theMsgs[i].msg_hdr.msg_iovlen = 1;
+      theMsgs[i].msg_hdr.msg_name = &theAddrs[i];
+      theMsgs[i].msg_hdr.msg_namelen = sizeof(struct sockaddr_in);
+      if (wantsGRO) {
+        theMsgs[i].msg_hdr.msg_control = theCtrl[i];
+        theMsgs[i].msg_hdr.msg_controllen = sizeof(theCtrl[i]);
+      }
+    }
+
+    int theNum;
+    do {
+      theNum = ::recvmmsg(fFileDesc, theMsgs, theCount, MSG_DONTWAIT, nullptr);
+    } while ((theNum == -1) && (Core::Thread::GetErrno() == EINTR));
+
+    if (theNum == -1) {
+      if (*outNumRecv > 0)
+        break;
+      return (OS_Error) Core::Thread::GetErrno();
+    }
+
+    for (int i = 0; i < theNum; i++) {
+      thePackets[i].fLength = theMsgs[i].msg_len;
+      thePackets[i].fRemoteAddr = ntohl(theAddrs[i].sin_addr.s_addr);
+      thePackets[i].fRemotePort = ntohs(theAddrs[i].sin_port);
+      thePackets[i].fSegmentSize = 0;
+      if (!wantsGRO)
+        continue;
+
+      struct msghdr *theHdr = &theMsgs[i].msg_hdr;
+      for (struct cmsghdr *theCmsg = CMSG_FIRSTHDR(theHdr); theCmsg != nullptr;
+           theCmsg = CMSG_NXTHDR(theHdr, theCmsg)) {
+        if (theCmsg->cmsg_level == SOL_UDP && theCmsg->cmsg_type == UDP_GRO) {
+          int theSegSize = 0;
+          ::memcpy(&theSegSize, CMSG_DATA(theCmsg), sizeof(theSegSize));
+          // a single datagram may be reported with its own length
+          if (theSegSize > 0 && (UInt32) theSegSize < thePackets[i].fLength)
+            thePackets[i].fSegmentSize = (UInt16) theSegSize;
+        }
+      }
+    }
+    *outNumRecv += theNum;
+
+    if ((UInt32) theNum < theCount)
+      break; // drained
+  }
+  return OS_NoErr;
+#else
+  // one datagram per call where recvmmsg is missing
+  for (; *outNumRecv < inNumPackets; (*outNumRecv)++) {
+    UDPPacket &thePacket = ioPackets[*outNumRecv];
+    OS_Error theErr = this->RecvFrom(&thePacket.fRemoteAddr,
+                                     &thePacket.fRemotePort,
+                                     thePacket.fBuffer, thePacket.fBufferLen,
+                                     &thePacket.fLength);
+    thePacket.fSegmentSize = 0;
+    if (theErr != OS_NoErr)
+      return (*outNumRecv > 0) ? OS_NoErr : theErr;
+  }
+  return OS_NoErr;
+#endif
+}
+
+OS_Error UDPSocket::SendMany(UDPPacket *inPackets, UInt32 inNumPackets,
+                             UInt32 *outNumSent) {
+  Assert(inPackets != nullptr);
+
+  UInt32 theNumSent = 0;
+  OS_Error theErr = OS_NoErr;
+
+#if __linux__
+  struct mmsghdr theMsgs[UDPPacketBatch::kMaxPackets];
+  struct iovec theVecs[UDPPacketBatch::kMaxPackets];
+  struct sockaddr_in theAddrs[UDPPacketBatch::kMaxPackets];
+  UInt64 theCtrl[UDPPacketBatch::kMaxPackets]
+                [(CMSG_SPACE(sizeof(UInt16)) + CMSG_SPACE(sizeof(UInt64))) / sizeof(UInt64) + 1];
+  bool wantsTxTime = this->IsTxTimeEnabled();
+
+  while (theNumSent < inNumPackets) {
+    UDPPacket *thePackets = inPackets + theNumSent;
+    UInt32 theCount = inNumPackets - theNumSent;
+    if (theCount > UDPPacketBatch::kMaxPackets)
+      theCount = UDPPacketBatch::kMaxPackets;
+
+    // a segmented packet the kernel can't take goes out on its own
+    if (thePackets[0].GetNumSegments() > 1 && !this->canSendSegmented(thePackets[0])) {
+      theErr = this->sendSegmentsOneByOne(thePackets[0]);
+      if (theErr != OS_NoErr)
+        break;
+      theNumSent++;
+      continue;
+    }
+    for (UInt32 i = 1; i < theCount; i++) {
+      if (thePackets[i].GetNumSegments() > 1 && !this->canSendSegmented(thePackets[i])) {
+        theCount = i;
+        break;
+      }
+    }
+
+    ::memset(theMsgs, 0, sizeof(struct mmsghdr) * theCount);
+    for (UInt32 i = 0; i < theCount; i++) {
+      ::memset(&theAddrs[i], 0, sizeof(struct sockaddr_in));
+      theAddrs[i].sin_family = AF_INET;
+      theAddrs[i].sin_port = htons(thePackets[i].fRemotePort);
+      theAddrs[i].sin_addr.s_addr = htonl(thePackets[i].fRemoteAddr);
+      theVecs[i].iov_base = thePackets[i].fBuffer;
+      theVecs[i].iov_len = thePackets[i].fLength;
+      theMsgs[i].msg_hdr.msg_iov = &theVecs[i];
+      theMsgs[i].msg_hdr.msg_iovlen = 1;
+      theMsgs[i].msg_hdr.msg_name = &theAddrs[i];
+      theMsgs[i].msg_hdr.msg_namelen = sizeof(struct sockaddr_in);
+
+      bool hasSegments = thePackets[i].GetNumSegments() > 1;
+      bool hasTxTime = wantsTxTime && thePackets[i].fTxTime != 0;
+      if (!hasSegments && !hasTxTime)
+        continue;
+
+      struct msghdr *theHdr = &theMsgs[i].msg_hdr;
+      ::memset(theCtrl[i], 0, sizeof(theCtrl[i]));
+      theHdr->msg_control = theCtrl[i];
+      theHdr->msg_controllen = (hasSegments ? CMSG_SPACE(sizeof(UInt16)) : 0)
+          + (hasTxTime ? CMSG_SPACE(sizeof(UInt64)) : 0);
+      struct cmsghdr *theCmsg = CMSG_FIRSTHDR(theHdr);
+      if (hasSegments) {
+        theCmsg->cmsg_level = SOL_UDP;
+        theCmsg->cmsg_type = UDP_SEGMENT;
+        theCmsg->cmsg_len = CMSG_LEN(sizeof(UInt16));
+        ::memcpy(CMSG_DATA(theCmsg), &thePackets[i].fSegmentSize, sizeof(UInt16));
+        theCmsg = CMSG_NXTHDR(theHdr, theCmsg);
+      }
+      if (hasTxTime) {
+        theCmsg->cmsg_level = SOL_SOCKET;
+        theCmsg->cmsg_type = SCM_TXTIME;
+        theCmsg->cmsg_len = CMSG_LEN(sizeof(UInt64));
+        ::memcpy(CMSG_DATA(theCmsg), &thePackets[i].fTxTime, sizeof(UInt64));
+      }
+    }
+
+    int theNum;
+    do {
+      theNum = ::sendmmsg(fFileDesc, theMsgs, theCount, 0);
+    } while ((theNum == -1) && (Core::Thread::GetErrno() == EINTR));
+
+    if (theNum == -1) {
+      theErr = (OS_Error) Core::Thread::GetErrno();
+      // EIO: the device has no checksum offload, segment in user space
+      if (theErr == EIO && thePackets[0].GetNumSegments() > 1) {
+        fState &= ~kGSOEnabled;
+        theErr = OS_NoErr;
+        continue;
+      }
+      break;
+    }
+
+    theNumSent += theNum;
+    if ((UInt32) theNum < theCount)
+      break; // Socket buffer is full
+  }
+#else
+  for (; theNumSent < inNumPackets; theNumSent++) {
+    UDPPacket &thePacket = inPackets[theNumSent];
+    if (thePacket.GetNumSegments() > 1)
+      theErr = this->sendSegmentsOneByOne(thePacket);
+    else
+      theErr = this->SendTo(thePacket.fRemoteAddr, thePacket.fRemotePort,
+                            thePacket.fBuffer, thePacket.fLength);
+    if (theErr != OS_NoErr)
+      break;
+  }
+#endif
+
+  if (outNumSent != nullptr)
+    *outNumSent = theNumSent;
+
+  return (theNumSent > 0) ? OS_NoErr : theErr;
+}
+
+OS_Error UDPSocket::EnableGSO() {
+#if __linux__
+  // UDP_SEGMENT is per send, just ask whether the kernel knows about it;
+  // older kernels would silently send one oversized datagram instead
+  int theSegSize = 0;
+  socklen_t theLen = sizeof(theSegSize);
+  if (::getsockopt(fFileDesc, SOL_UDP, UDP_SEGMENT, &theSegSize, &theLen) == -1)
+    return ENOTSUP;
+  fState |= kGSOEnabled;
+  return OS_NoErr;
+#else
+  return ENOTSUP;
+#endif
+}
+
+OS_Error UDPSocket::EnableGRO() {
+#if __linux__
+  int theOn = 1;
+  if (::setsockopt(fFileDesc, SOL_UDP, UDP_GRO, &theOn, sizeof(theOn)) == -1)
+    return ENOTSUP;
+  fState |= kGROEnabled;
+  return OS_NoErr;
+#else
+  return ENOTSUP;
+#endif
+}
+
+OS_Error UDPSocket::EnableTxTime() {
+#if __linux__
+  struct sock_txtime theConfig;
+  ::memset(&theConfig, 0, sizeof(theConfig));
+  theConfig.clockid = CLOCK_MONOTONIC;
+  if (::setsockopt(fFileDesc, SOL_SOCKET, SO_TXTIME, &theConfig, sizeof(theConfig)) == -1)
+    return ENOTSUP;
+  fState |= kTxTimeEnabled;
+  return OS_NoErr;
+#else
+  return ENOTSUP;
+#endif
+}
+
+bool UDPSocket::canSendSegmented(const UDPPacket &inPacket) {
+  return this->IsGSOEnabled()
+      && inPacket.GetNumSegments() <= kMaxSegments
+      && inPacket.fLength <= kMaxSegmentedLength;
+}
+
+OS_Error UDPSocket::SendSegmented(UInt32 inRemoteAddr, UInt16 inRemotePort,
+                                  void *inBuffer, UInt32 inLength,
+                                  UInt16 inSegmentSize) {
+  UDPPacket thePacket = {inBuffer, inLength, inLength,
+                         inRemoteAddr, inRemotePort, inSegmentSize, 0};
+  UInt32 theNumSent = 0;
+  OS_Error theErr = this->SendMany(&thePacket, 1, &theNumSent);
+  if (theErr == OS_NoErr && theNumSent == 0)
+    theErr = EAGAIN;
+  return theErr;
+}
+
+OS_Error UDPSocket::sendSegmentsOneByOne(const UDPPacket &inPacket) {
+  UDPPacket theSegments[UDPPacketBatch::kMaxPackets];
+  UInt32 theNumSegments = inPacket.GetNumSegments();
+  UInt32 theTotalSent = 0;
+
+  for (UInt32 theIndex = 0; theIndex < theNumSegments;) {
+    UInt32 theCount = 0;
+    for (; theCount < UDPPacketBatch::kMaxPackets && theIndex < theNumSegments;
+           theCount++, theIndex++) {
+      StrPtrLen theSegment;
+      inPacket.GetSegment(theIndex, &theSegment);
+      theSegments[theCount] = {theSegment.Ptr, theSegment.Len, theSegment.Len,
+                               inPacket.fRemoteAddr, inPacket.fRemotePort, 0,
+                               inPacket.fTxTime};
+    }
+
+    UInt32 theNumSent = 0;
+    OS_Error theErr = this->SendMany(theSegments, theCount, &theNumSent);
+    if (theErr != OS_NoErr)
+      return theTotalSent > 0 ? OS_NoErr : theErr;
+    theTotalSent += theNumSent;
+    // UDP may drop, it may not reorder what is already queued: a short
+    // write loses the tail of this packet, as one big datagram would.
+    // Once a segment is out the packet is sent, a retry would repeat it.
+    if (theNumSent < theCount)
+      return theTotalSent > 0 ? OS_NoErr : EAGAIN;
+  }
+  return OS_NoErr;
+}
+
+UDPDemuxerTask *UDPSocket::DemuxPacket(const UDPDemuxer::ReadLock &inLock,
+                                       const UDPPacket &inPacket) {
+  if (fDemuxer == nullptr)
+    return nullptr;
+  // GRO merges only datagrams of one flow, one lookup covers all segments
+  return fDemuxer->GetTask(inLock, inPacket.fRemoteAddr, inPacket.fRemotePort);
+}
+
 OS_Error UDPSocket::JoinMulticast(UInt32 inRemoteAddr) {
   struct ip_mreq theMulti;
   UInt32 localAddr = fLocalAddr.sin_addr.s_addr; // Already in network byte order
@@ -176,3 +531,83 @@ OS_Error UDPSocket::LeaveMulticast(UInt32 inRemoteAddr) {
   else
     return OS_NoErr;
 }
+
+#if UDPSOCKET_TESTING
+bool UDPSocket::Test() {
+  enum { kNumPackets = 1000000, kPacketSize = 200 };
+
+  UDPSocket theSender(nullptr, Socket::kNonBlockingSocketType);
+  UDPSocket theReceiver(nullptr, Socket::kNonBlockingSocketType);
+  if (theSender.Open() != OS_NoErr || theReceiver.Open() != OS_NoErr)
+    return false;
+  theSender.Bind(INADDR_LOOPBACK, 0);
+  theReceiver.Bind(INADDR_LOOPBACK, 0);
+  theReceiver.SetSocketRcvBufSize(8 * 1024 * 1024);
+
+  // bound addresses are only known to the kernel
+  struct sockaddr_in theAddr;
+  socklen_t theLen = sizeof(theAddr);
+  ::getsockname(theReceiver.GetSocketFD(), (sockaddr *) &theAddr, &theLen);
+  UInt16 thePort = ntohs(theAddr.sin_port);
+
+  BufferPool thePool(2048);
+  char theData[kPacketSize];
+  ::memset(theData, 'x', sizeof(theData));
+
+  for (int batched = 0; batched < 2; batched++) {
+    UInt32 theNumSent = 0, theNumRecv = 0;
+    SInt64 theStart = Core::Time::Milliseconds();
+    UDPPacketBatch theSendBatch(&thePool);
+    UDPPacketBatch theRecvBatch(&thePool);
+    for (UInt32 i = 0; i < theSendBatch.GetCapacity(); i++) {
+      UDPPacket &thePacket = theSendBatch.GetPacket(i);
+      ::memcpy(thePacket.fBuffer, theData, kPacketSize);
+      thePacket.fLength = kPacketSize;
+      thePacket.fRemoteAddr = INADDR_LOOPBACK;
+      thePacket.fRemotePort = thePort;
+    }
+    theSendBatch.SetNumPackets(theSendBatch.GetCapacity());
+
+    while (theNumSent < kNumPackets) {
+      // keep at most a few batches in flight, so nothing gets dropped
+      for (int j = 0; j < 8 && theNumSent < kNumPackets; j++) {
+        if (batched) {
+          UInt32 theNum = 0;
+          theSender.SendMany(&theSendBatch, &theNum);
+          theNumSent += theNum;
+        } else {
+          for (UInt32 k = 0; k < UDPPacketBatch::kMaxPackets; k++)
+            if (theSender.SendTo(INADDR_LOOPBACK, thePort, theData,
+                                 kPacketSize) == OS_NoErr)
+              theNumSent++;
+        }
+      }
+
+      while (true) {
+        if (batched) {
+          if (theReceiver.RecvMany(&theRecvBatch) != OS_NoErr) break;
+          theNumRecv += theRecvBatch.GetNumPackets();
+        } else {
+          UInt32 theAddr32, theRecvLen;
+          UInt16 thePort16;
+          if (theReceiver.RecvFrom(&theAddr32, &thePort16,
+                                   theRecvBatch.GetPacket(0).fBuffer,
+                                   2048, &theRecvLen) != OS_NoErr)
+            break;
+          theNumRecv++;
+        }
+      }
+    }
+
+    SInt64 theMsec = Core::Time::Milliseconds() - theStart;
+    if (theMsec == 0) theMsec = 1;
+    s_printf("UDPSocket::Test %s: sent %" _U32BITARG_ " recv %" _U32BITARG_
+             " in %" _S64BITARG_ "ms, %" _S64BITARG_ " pps\n",
+             batched ? "SendMany/RecvMany" : "SendTo/RecvFrom",
+             theNumSent, theNumRecv, theMsec,
+             (SInt64) theNumRecv * 1000 / theMsec);
+  }
+
+  return true;
+}
+#endif
@@ -34,6 +34,95 @@
 
 using namespace CF::Net;
 
+UDPSocketPool::PortBitmap::PortBitmap() : fCursor(0) {
+  ::memset(fUsed, 0, sizeof(fUsed));
+  ::memset(fBlocked, 0, sizeof(fBlocked));
+  // the bits past the last pair are never free
+  for (UInt32 theSlot = kNumPairs; theSlot < kNumWords * 64; theSlot++)
+    fUsed[theSlot / 64] |= (UInt64) 1 << (theSlot % 64);
+}
+
+bool UDPSocketPool::PortBitmap::getSlot(UInt16 inPort, UInt32 *outSlot) {
+  if (inPort < kLowestUDPPort || ((inPort - kLowestUDPPort) & 1) != 0)
+    return false;
+  *outSlot = (UInt32) (inPort - kLowestUDPPort) / 2;
+  return *outSlot < kNumPairs;
+}
+
+UInt16 UDPSocketPool::PortBitmap::scan() {
+  for (UInt32 i = 0; i < kNumWords; i++) {
+    UInt32 theWord = (fCursor + i) % kNumWords;
+    UInt64 theFree = ~(fUsed[theWord] | fBlocked[theWord]);
+    if (theFree == 0)
+      continue;
+
+    UInt32 theSlot = theWord * 64 + (UInt32) __builtin_ctzll(theFree);
+    fUsed[theWord] |= (UInt64) 1 << (theSlot % 64);
+    fCursor = theWord;
+    return (UInt16) (kLowestUDPPort + theSlot * 2);
+  }
+  return 0;
+}
+
+UInt16 UDPSocketPool::PortBitmap::Allocate() {
+  UInt16 thePort = this->scan();
+  if (thePort == 0) {
+    // other processes may have let go of their ports by now
+    ::memset(fBlocked, 0, sizeof(fBlocked));
+    thePort = this->scan();
+  }
+  return thePort;
+}
+
+void UDPSocketPool::PortBitmap::Free(UInt16 inPort) {
+  UInt32 theSlot;
+  if (getSlot(inPort, &theSlot))
+    fUsed[theSlot / 64] &= ~((UInt64) 1 << (theSlot % 64));
+}
+
+void UDPSocketPool::PortBitmap::SetUsed(UInt16 inPort) {
+  UInt32 theSlot;
+  if (getSlot(inPort, &theSlot))
+    fUsed[theSlot / 64] |= (UInt64) 1 << (theSlot % 64);
+}
+
+void UDPSocketPool::PortBitmap::SetBlocked(UInt16 inPort) {
+  UInt32 theSlot;
+  if (getSlot(inPort, &theSlot))
+    fBlocked[theSlot / 64] |= (UInt64) 1 << (theSlot % 64);
+}
+
+UDPSocketPool::~UDPSocketPool() {
+  for (auto &theLocalAddr : fLocalAddrs)
+    delete theLocalAddr.second;
+}
+
+UDPSocketPool::LocalAddr *UDPSocketPool::getLocalAddr(UInt32 inAddr) {
+  LocalAddr *&theLocalAddr = fLocalAddrs[inAddr];
+  if (theLocalAddr == nullptr)
+    theLocalAddr = new LocalAddr;
+  return theLocalAddr;
+}
+
+bool UDPSocketPool::canShare(UDPSocketPair *inPair,
+                             UInt32 inSrcIPAddr, UInt16 inSrcPort) {
+  // check to make sure this source IP & port is not already in the demuxer.
+  UDPDemuxer *theDemuxer = inPair->fSocketB->GetDemuxer();
+  return (theDemuxer == nullptr) ||
+      ((!theDemuxer->AddrInMap(0, 0)) &&
+          (!theDemuxer->AddrInMap(inSrcIPAddr, inSrcPort)));
+}
+
+void UDPSocketPool::addPair(UDPSocketPair *inPair, UInt32 inAddr, UInt16 inPort) {
+  LocalAddr *theLocalAddr = this->getLocalAddr(inAddr);
+  inPair->fLocalAddr = inAddr;
+  inPair->fLocalPort = inPort;
+  theLocalAddr->fPorts.SetUsed(inPort);
+  theLocalAddr->fPairsByPort[inPort] = inPair;
+  theLocalAddr->fShareable.EnQueue(&inPair->fShareElem);
+  fUDPQueue.EnQueue(&inPair->fElem);
+}
+
 /**
  * 获取 UDPSocket Pair
  * @param inIPAddr  local ip
@@ -48,23 +137,35 @@ UDPSocketPair *UDPSocketPool::GetUDPSocketPair(UInt32 inIPAddr, UInt16 inPort, U
      *   a) on the right IP address,
      *   b) doesn't have this source IP & port in the demuxer already,
      * we can return this pair */
-    for (QueueIter qIter(&fUDPQueue); !qIter.IsDone(); qIter.Next()) {
-      auto theElem = (UDPSocketPair *) qIter.GetCurrent()->GetEnclosingObject();
-      if ((theElem->fSocketA->GetLocalAddr() == inIPAddr) &&
-          ((inPort == 0) || (theElem->fSocketA->GetLocalPort() == inPort))) {
-        // check to make sure this source IP & port is not already in the demuxer.
-        // If not, we can return this Socket pair.
-        if ((theElem->fSocketB->GetDemuxer() == nullptr) ||
-            ((!theElem->fSocketB->GetDemuxer()->AddrInMap(0, 0)) &&
-                (!theElem->fSocketB->GetDemuxer()->AddrInMap(inSrcIPAddr, inSrcPort)))) {
-          theElem->fRefCount++;
-          return theElem;
-        }
+    LocalAddr *theLocalAddr = this->getLocalAddr(inIPAddr);
 
+    if (inPort != 0) {
+      auto theIter = theLocalAddr->fPairsByPort.find(inPort);
+      if (theIter != theLocalAddr->fPairsByPort.end()) {
         // If port is specified, there is NO WAY a Socket pair can exist that matches
         // the criteria (because caller wants a specific ip & port combination)
-        if (inPort != 0)
+        if (!this->canShare(theIter->second, inSrcIPAddr, inSrcPort))
           return nullptr;
+        theIter->second->fRefCount++;
+        return theIter->second;
+      }
+    } else {
+      for (QueueIter qIter(&theLocalAddr->fShareable); !qIter.IsDone();) {
+        QueueElem *theQElem = qIter.GetCurrent();
+        qIter.Next();
+
+        auto theElem = (UDPSocketPair *) theQElem->GetEnclosingObject();
+        UDPDemuxer *theDemuxer = theElem->fSocketB->GetDemuxer();
+        if (theDemuxer != nullptr && theDemuxer->AddrInMap(0, 0)) {
+          // taken whole, don't look at it again until it is released
+          theQElem->Remove();
+          continue;
+        }
+
+        if (this->canShare(theElem, inSrcIPAddr, inSrcPort)) {
+          theElem->fRefCount++;
+          return theElem;
+        }
       }
     }
   }
@@ -77,65 +178,78 @@ UDPSocketPair *UDPSocketPool::GetUDPSocketPair(UInt32 inIPAddr, UInt16 inPort, U
 void UDPSocketPool::ReleaseUDPSocketPair(UDPSocketPair *inPair) {
   Core::MutexLocker locker(&fMutex);
   inPair->fRefCount--;
+  LocalAddr *theLocalAddr = this->getLocalAddr(inPair->fLocalAddr);
   if (inPair->fRefCount == 0) {
     fUDPQueue.Remove(&inPair->fElem);
+    inPair->fShareElem.Remove();
+    theLocalAddr->fPairsByPort.erase(inPair->fLocalPort);
+    theLocalAddr->fPorts.Free(inPair->fLocalPort);
     this->DestructUDPSocketPair(inPair);
+  } else if (!inPair->fShareElem.IsMemberOfAnyQueue()) {
+    // its wildcard user may be gone, give it another chance
+    theLocalAddr->fShareable.EnQueue(&inPair->fShareElem);
   }
 }
 
 UDPSocketPair *UDPSocketPool::CreateUDPSocketPair(UInt32 inAddr, UInt16 inPort) {
   // try to find an open pair of ports to bind these suckers tooo
   Core::MutexLocker locker(&fMutex);
-  UDPSocketPair *thePair = nullptr;
-  UInt16 socketAPort = kLowestUDPPort;
-  UInt16 socketBPort;
+  LocalAddr *theLocalAddr = this->getLocalAddr(inAddr);
 
   // If port is 0, then the caller doesn't care what port # we bind this Socket to.
   // Otherwise, ONLY attempt to bind this Socket to the specified port
-  if (inPort != 0) socketAPort = inPort;
-
-  while (socketAPort < kHighestUDPPort) {
-    socketBPort = static_cast<UInt16>(socketAPort + 1);  // make Socket pairs adjacent to one another
+  for (UInt32 theTries = 0; theTries < (kHighestUDPPort - kLowestUDPPort + 1) / 2; theTries++) {
+    UInt16 socketAPort = inPort;
+    if (inPort == 0) {
+      socketAPort = theLocalAddr->fPorts.Allocate();
+      if (socketAPort == 0)
+        return nullptr; // every pair is in use
+    } else if (inPort == kHighestUDPPort ||
+        theLocalAddr->fPairsByPort.count(inPort) != 0) {
+      return nullptr;
+    }
+    auto socketBPort = static_cast<UInt16>(socketAPort + 1);  // make Socket pairs adjacent to one another
 
-    thePair = ConstructUDPSocketPair();  // 创建一个 udp Socket pair
+    UDPSocketPair *thePair = ConstructUDPSocketPair();  // 创建一个 udp Socket pair
     Assert(thePair != nullptr);
 
     // check construct udp socket pair fail
-    if (thePair == nullptr) return nullptr;
+    if (thePair == nullptr) {
+      if (inPort == 0) theLocalAddr->fPorts.Free(socketAPort);
+      return nullptr;
+    }
 
     // 创建数据报 Socket 端口
-    if (thePair->fSocketA->Open() != OS_NoErr || thePair->fSocketB->Open() != OS_NoErr) break;
+    if (thePair->fSocketA->Open() != OS_NoErr || thePair->fSocketB->Open() != OS_NoErr) {
+      if (inPort == 0) theLocalAddr->fPorts.Free(socketAPort);
+      this->DestructUDPSocketPair(thePair);
+      return nullptr;
+    }
 
     // Set Socket options on these new sockets. 主要是设置 Socket buf size
     this->SetUDPSocketOptions(thePair);
 
     // 在两个 Socket 端口上执行 bind 操作,两个 port 相差 1.
     OS_Error theErr = thePair->fSocketA->Bind(inAddr, socketAPort);
-    if (theErr == OS_NoErr) {
-      //s_printf("fSocketA->Bind ok on port%u\n", socketAPort);
+    if (theErr == OS_NoErr)
       theErr = thePair->fSocketB->Bind(inAddr, socketBPort);
-      if (theErr == OS_NoErr) {
-        //s_printf("fSocketB->Bind ok on port%u\n", socketBPort);
-        fUDPQueue.EnQueue(&thePair->fElem);
-        thePair->fRefCount++;
 
-        return thePair;
-      }
-      //else s_printf("fSocketB->Bind failed on port%u\n", socketBPort);
+    if (theErr == OS_NoErr) {
+      this->addPair(thePair, inAddr, socketAPort);
+      thePair->fRefCount++;
+      return thePair;
     }
-    //else s_printf("fSocketA->Bind failed on port%u\n", socketAPort);
 
-    // If we are looking to bind to a specific port set, and we couldn't then just break here.
-    if (inPort != 0) break;
+    this->DestructUDPSocketPair(thePair); //a bind failure
 
-    socketAPort += 2; //try a higher port pair
+    // If we are looking to bind to a specific port set, and we couldn't then just break here.
+    if (inPort != 0)
+      return nullptr;
 
-    this->DestructUDPSocketPair(thePair); //a bind failure
-    thePair = nullptr;
+    // somebody else has it, try the next free pair
+    theLocalAddr->fPorts.Free(socketAPort);
+    theLocalAddr->fPorts.SetBlocked(socketAPort);
   }
 
-  // if we couldn't find a pair of sockets, make sure to clean up our mess
-  if (thePair != nullptr) this->DestructUDPSocketPair(thePair);
-
   return nullptr;
 }
@@ -98,6 +98,13 @@ int select_modwatch0(struct eventreq *req, int which, bool isAdd) {
     do {
       ret = epoll_ctl(gEpollFD, EPOLL_CTL_MOD, req->er_handle, &ev);
     } while (ret == -1 && Thread::GetErrno() == EINTR);
+
+    // the fd was removed by EV_RM (e.g. a paused listener), add it back
+    if (ret == -1 && Thread::GetErrno() == ENOENT) {
+      do {
+        ret = epoll_ctl(gEpollFD, EPOLL_CTL_ADD, req->er_handle, &ev);
+      } while (ret == -1 && Thread::GetErrno() == EINTR);
+    }
   }
 
   if (ret == 0) {
@@ -152,14 +159,14 @@ int select_waitevent(struct eventreq *req, void *onlyForMOSX) {
   int eventPos = epoll_waitevent();
   if (eventPos >= 0) {
     req->er_handle = gEpollEvents[eventPos].data.fd;
-    if (gEpollEvents[eventPos].events == EPOLLIN ||
-        gEpollEvents[eventPos].events == EPOLLHUP ||
-        gEpollEvents[eventPos].events == EPOLLERR) {
-      if (gEpollEvents[eventPos].events != EPOLLIN) {
-        DEBUG_LOG(0, "active non-in event=%u\n", gEpollEvents[eventPos].events);
+    uint32_t events = gEpollEvents[eventPos].events;
+    // 可能同时有多个位，如 EPOLLIN | EPOLLERR (zero-copy 完成通知)
+    if (events & (EPOLLIN | EPOLLHUP | EPOLLERR)) {
+      if (events != EPOLLIN) {
+        DEBUG_LOG(0, "active non-in event=%u\n", events);
       }
       req->er_eventbits = EV_RE;  // we only support read event
-    } else if (gEpollEvents[eventPos].events == EPOLLOUT) {
+    } else if (events & EPOLLOUT) {
       req->er_eventbits = EV_WR;
     }
     SpinLocker locker1(&sMapLock);
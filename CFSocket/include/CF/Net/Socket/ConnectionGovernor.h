@@ -0,0 +1,100 @@
+/**
+ * @file ConnectionGovernor.h
+ *
+ * Process-wide admission control for listener sockets.
+ *
+ * The governor keeps track of live sessions, tasks waiting in the task
+ * threads and memory charged by sessions. Listeners consult it before
+ * accepting new connections, and stop reading the listen queue while the
+ * server is overloaded (EV_RM + IdleTimer), so the kernel backlog absorbs
+ * the burst instead of us.
+ *
+ * It also keeps one reserve file descriptor. When accept fails with
+ * EMFILE/ENFILE, the reserve is released to accept the pending connection
+ * and close it at once, which drains the listen queue instead of spinning
+ * on a readable listener (or exiting the process).
+ */
+
+#ifndef __CONNECTION_GOVERNOR_H__
+#define __CONNECTION_GOVERNOR_H__
+
+#include <atomic>
+#include <CF/Types.h>
+
+namespace CF {
+namespace Net {
+
+class ConnectionGovernor {
+ public:
+
+  /**
+   * @brief set the high watermarks, 0 means unlimited.
+   *
+   * Accepting resumes when all counters drop below the low watermark, which
+   * is kLowWatermarkPercent of the high one, to avoid flapping.
+   */
+  static void SetLimits(UInt32 maxSessions,
+                        UInt32 maxQueuedTasks,
+                        UInt64 maxMemoryBytes);
+
+  static UInt32 GetMaxSessions() { return sMaxSessions; }
+  static UInt32 GetMaxQueuedTasks() { return sMaxQueuedTasks; }
+  static UInt64 GetMaxMemoryBytes() { return sMaxMemoryBytes; }
+
+  //
+  // Session accounting, called by session objects
+
+  static void AddSession() { ++sNumSessions; }
+  static void RemoveSession() { --sNumSessions; }
+  static void AddMemory(UInt64 bytes) { sMemoryBytes += bytes; }
+  static void RemoveMemory(UInt64 bytes) { sMemoryBytes -= bytes; }
+
+  static UInt32 GetNumSessions() { return sNumSessions; }
+  static UInt64 GetMemoryBytes() { return sMemoryBytes; }
+  static UInt32 GetNumShedConnections() { return sNumShed; }
+
+  /**
+   * @brief check whether listeners should stop accepting.
+   *
+   * @param buffer - number of sessions to keep in reserve below the limit.
+   */
+  static bool IsOverloaded(UInt32 buffer);
+
+  //
+  // Reserve fd, to survive EMFILE / ENFILE
+
+  static void OpenReserveFD();
+  static void CloseReserveFD();
+
+  /**
+   * @brief accept the pending connection on listenFD and drop it.
+   *
+   * Uses the reserve descriptor to make room. Returns true when a connection
+   * was shed.
+   */
+  static bool ShedConnection(int listenFD);
+
+ private:
+
+  enum {
+    kLowWatermarkPercent = 90 // UInt32
+  };
+
+  ConnectionGovernor() = default;
+
+  static std::atomic<UInt32> sNumSessions;
+  static std::atomic<UInt64> sMemoryBytes;
+  static std::atomic<UInt32> sNumShed;
+  static std::atomic_bool sOverloaded;
+
+  static UInt32 sMaxSessions;
+  static UInt32 sMaxQueuedTasks;
+  static UInt64 sMaxMemoryBytes;
+
+  static int sReserveFD;
+};
+
+} // namespace Net
+} // namespace CF
+
+#endif // __CONNECTION_GOVERNOR_H__
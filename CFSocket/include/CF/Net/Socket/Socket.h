@@ -35,6 +35,7 @@
 #define __SOCKET_H__
 
 #include <CF/Net/Socket/EventContext.h>
+#include <CF/BufferPool.h>
 
 #if !__WinSock__
 
@@ -139,6 +140,79 @@ class Socket : public EventContext {
    */
   OS_Error WriteV(const struct iovec *iov, UInt32 numVecs, UInt32 *outLengthSent);
 
+  /**
+   * SendFile - sends inLength bytes of a regular file starting at *ioOffset,
+   * without copying them through user space (sendfile(2)).
+   *
+   * *ioOffset is advanced by the amount sent.
+   * @return CF_NoErr, EAGAIN, ENOTSUP (no sendfile on this platform), or
+   *         POSIX error code.
+   */
+  OS_Error SendFile(int inFileDesc, UInt64 *ioOffset, UInt32 inLength,
+                    UInt32 *outLengthSent);
+
+  /**
+   * Splice - moves data from a non-seekable fd (pipe, fifo, device) to the
+   * Socket through the caller's pipe (splice(2)).
+   *
+   * ioPipe[2] is a pipe owned by the caller, *ioPipeBytes is the amount of
+   * data still sitting in it and must be kept across calls.
+   * @return CF_NoErr, EAGAIN (the Socket is flow controlled), CF_WouldBlock
+   *         (the source has no data yet), CF_NoMoreData (source EOF),
+   *         ENOTSUP (no splice on this platform, or for this source), or
+   *         POSIX error code.
+   */
+  OS_Error Splice(int inFileDesc, int ioPipe[2], UInt32 *ioPipeBytes,
+                  UInt32 inLength, UInt32 *outLengthSent);
+
+  //
+  // Zero-copy send (MSG_ZEROCOPY). Opt-in, only worth it for big payloads:
+  // the kernel pins the user pages instead of copying them, and reports on
+  // the Socket error queue when it is done with them. Until then the data
+  // must not be touched, so buffers come from a BufferPool and are handed
+  // back with ReleaseAfterSend.
+
+  /**
+   * EnableZeroCopy - sets SO_ZEROCOPY on the Socket.
+   * @return CF_NoErr, ENOTSUP (platform / kernel without it), or POSIX error.
+   */
+  OS_Error EnableZeroCopy();
+
+  bool IsZeroCopyEnabled() { return fZeroCopy != nullptr; }
+
+  /**
+   * SendZeroCopy - same as Send, but with MSG_ZEROCOPY when enabled. inData
+   * must stay untouched until released through ReleaseAfterSend.
+   */
+  OS_Error SendZeroCopy(char const *inData, UInt32 inLength,
+                        UInt32 *outLengthSent);
+
+  /**
+   * WriteVZeroCopy - same as WriteV, but with MSG_ZEROCOPY when enabled.
+   * Every buffer of iov must stay untouched until released through
+   * ReleaseAfterSend.
+   */
+  OS_Error WriteVZeroCopy(const struct iovec *iov, UInt32 numVecs,
+                          UInt32 *outLengthSent);
+
+  /**
+   * ReleaseAfterSend - call when done sending from inBuffer. It is Put back
+   * to inPool once the kernel completed every zero-copy send issued so far,
+   * right away if there is none pending.
+   */
+  void ReleaseAfterSend(BufferPool *inPool, void *inBuffer);
+
+  // same for data that is not from a BufferPool: inData is deleted then, a
+  // StrPtrLenDel with its Ptr
+  void ReleaseAfterSend(StrPtrLen *inData);
+
+  /**
+   * number of buffers still waiting for a completion. Owners should wait for
+   * this to drop to 0 before closing: buffers still pending at destruction
+   * can't be reused safely and are leaked.
+   */
+  UInt32 GetNumZeroCopyPending();
+
   // You can query for the Socket's state
 
   bool IsConnected() { return (bool) (fState & kConnected); }
@@ -171,7 +245,10 @@ class Socket : public EventContext {
 
   Socket(Thread::Task *inNotifyTask, UInt32 inSocketType);
 
-  ~Socket() override = default;
+  ~Socket() override;
+
+  // drains zero-copy completions before signalling the Task
+  void ProcessEvent(int eventBits) override;
 
   /**
    * @return returns QTSS_NoErr, or appropriate posix error
@@ -200,6 +277,13 @@ class Socket : public EventContext {
   char fPortBuffer[kPortBufSizeInBytes];
   StrPtrLen fPortStr;
 
+  struct ZeroCopyState;
+  ZeroCopyState *fZeroCopy;
+
+  // reads the error queue and releases the completed buffers
+  void drainZeroCopyCompletions();
+  void releaseAfterSend(BufferPool *inPool, void *inBuffer, StrPtrLen *inData);
+
   // State flags. Be careful when changing these values, as subclasses add
   // their own
   enum {
@@ -37,6 +37,7 @@
 #define __TCP_LISTENER_SOCKET_H__
 
 #include <CF/Net/Socket/TCPSocket.h>
+#include <CF/Net/Socket/ConnectionGovernor.h>
 #include <CF/Thread/IdleTask.h>
 
 namespace CF {
@@ -77,6 +78,11 @@ class TCPListenerSocket : public TCPSocket, public Thread::IdleTask {
   //derived object must implement a way of getting tasks & sockets to this object
   virtual Thread::Task *GetSessionTask(TCPSocket **outSocket) = 0;
 
+  //check whether the Listener should be idling, default asks the governor
+  virtual bool OverMaxConnections(UInt32 buffer) {
+    return ConnectionGovernor::IsOverloaded(buffer);
+  }
+
   SInt64 Run() override;
 
  private:
@@ -35,36 +35,43 @@
 #ifndef __UDPDEMUXER_H__
 #define __UDPDEMUXER_H__
 
+#include <atomic>
 #include <CF/StrPtrLen.h>
-#include <CF/HashTable.h>
 #include <CF/Core/Mutex.h>
 
+#define UDPDEMUXER_TESTING 0
+
 namespace CF {
 namespace Net {
 
 class Task;
-class UDPDemuxerKey;
 
 //IMPLEMENTATION ONLY:
-//HASH TABLE CLASSES USED ONLY IN IMPLEMENTATION
 
 class UDPDemuxerUtils {
  private:
 
+  // 64 bit finalizer of MurmurHash3 over addr:port, every input bit reaches
+  // the low bits used as the bucket index
   static UInt32 ComputeHashValue(UInt32 inRemoteAddr, UInt16 inRemotePort) {
-    return ((inRemoteAddr << 16) + inRemotePort);
+    UInt64 theKey = ((UInt64) inRemoteAddr << 16) | inRemotePort;
+    theKey ^= theKey >> 33;
+    theKey *= 0xff51afd7ed558ccdULL;
+    theKey ^= theKey >> 33;
+    theKey *= 0xc4ceb9fe1a85ec53ULL;
+    theKey ^= theKey >> 33;
+    return (UInt32) theKey;
   }
 
   friend class UDPDemuxerTask;
-  friend class UDPDemuxerKey;
+  friend class UDPDemuxer;
 };
 
 class UDPDemuxerTask {
  public:
 
   UDPDemuxerTask()
-      : fRemoteAddr(0), fRemotePort(0),
-        fHashValue(0), fNextHashEntry(nullptr) {}
+      : fRemoteAddr(0), fRemotePort(0), fHashValue(0) {}
   virtual ~UDPDemuxerTask() = default;
 
   UInt32 GetRemoteAddr() { return fRemoteAddr; }
@@ -84,59 +91,53 @@ class UDPDemuxerTask {
   //precomputed for performance
   UInt32 fHashValue;
 
-  UDPDemuxerTask *fNextHashEntry;
-
-  friend class UDPDemuxerKey;
-  friend class UDPDemuxer;
-  friend class HashTable<UDPDemuxerTask, UDPDemuxerKey>;
-};
-
-class UDPDemuxerKey {
- private:
-
-  //CONSTRUCTOR / DESTRUCTOR:
-  UDPDemuxerKey(UInt32 inRemoteAddr, UInt16 inRemotePort)
-      : fRemoteAddr(inRemoteAddr), fRemotePort(inRemotePort) {
-    fHashValue = UDPDemuxerUtils::ComputeHashValue(inRemoteAddr, inRemotePort);
-  }
-
-  ~UDPDemuxerKey() {}
-
- private:
-
-  //PRIVATE ACCESSORS:
-  UInt32 GetHashKey() { return fHashValue; }
-
-  //these functions are only used by the hash table itself. This constructor
-  //will break the "Set" functions.
-  UDPDemuxerKey(UDPDemuxerTask *elem) : fRemoteAddr(elem->fRemoteAddr),
-                                        fRemotePort(elem->fRemotePort),
-                                        fHashValue(elem->fHashValue) {}
-
-  friend int operator==(const UDPDemuxerKey &key1, const UDPDemuxerKey &key2) {
-    if ((key1.fRemoteAddr == key2.fRemoteAddr) &&
-        (key1.fRemotePort == key2.fRemotePort))
-      return true;
-    return false;
-  }
-
-  //data:
-  UInt32 fRemoteAddr;
-  UInt16 fRemotePort;
-  UInt32 fHashValue;
-
-  friend class HashTable<UDPDemuxerTask, UDPDemuxerKey>;
   friend class UDPDemuxer;
 };
 
-//CLASSES USED ONLY IN IMPLEMENTATION
-typedef HashTable<UDPDemuxerTask, UDPDemuxerKey> UDPDemuxerHashTable;
-
+/**
+ * @brief maps remote addr:port to the UDPDemuxerTask receiving its packets.
+ *
+ * Lookups take no lock (RCU style): the table is reached through one atomic
+ * pointer, writers serialize on the Mutex and link new entries with release
+ * stores. What a write unlinks goes on a retire list, tagged with the
+ * current epoch, and is freed by a later write once every lookup that might
+ * still see it has finished. No write waits for the lookups.
+ *
+ * Lookups count themselves in per-thread slots, one cache line each, so
+ * they don't bounce a shared counter between cores.
+ *
+ * The table grows when the load passes kMaxLoadFactor. The bigger table is
+ * published at once and filled from the old one kMigrateBucketsPerWrite
+ * buckets at a time on the following writes, lookups search both while
+ * this goes on. No single Register pays for rehashing 100k peers.
+ */
 class UDPDemuxer {
  public:
 
-  UDPDemuxer() : fHashTable(kMaxHashTableSize), fMutex() {}
-  ~UDPDemuxer() = default;
+  UDPDemuxer();
+  ~UDPDemuxer();
+
+  /**
+   * @brief read-side critical section.
+   *
+   * A task returned by GetTask may only be used while the ReadLock it was
+   * found under is alive. Keep it short, and don't Synchronize while
+   * holding one, that would wait forever.
+   */
+  class ReadLock {
+   public:
+    explicit ReadLock(UDPDemuxer *inDemuxer)
+        : fDemuxer(inDemuxer), fSlot(readerSlot()),
+          fEpoch(inDemuxer->enterRead(fSlot)) {}
+    ~ReadLock() { fDemuxer->exitRead(fSlot, fEpoch); }
+
+   private:
+    UDPDemuxer *fDemuxer;
+    UInt32 fSlot;
+    UInt32 fEpoch;
+
+    friend class UDPDemuxer;
+  };
 
   //These functions grab the Mutex and are therefore premptive safe
 
@@ -144,27 +145,138 @@ class UDPDemuxer {
   // with this address combination
   OS_Error RegisterTask(UInt32 inRemoteAddr, UInt16 inRemotePort, UDPDemuxerTask *inTaskP);
 
-  // Return values: OS_NoErr, or EPERM if this task / address combination
-  // is not registered
+  /**
+   * @brief new lookups don't find the task any more.
+   *
+   * Returns once the lookups that might still use the task are done, the
+   * caller may delete it then. Waits without fMutex, other writes go on.
+   * Not to be called with a ReadLock held.
+   *
+   * @return OS_NoErr, or EPERM if this task / address combination is not
+   *         registered.
+   */
   OS_Error UnregisterTask(UInt32 inRemoteAddr, UInt16 inRemotePort, UDPDemuxerTask *inTaskP);
 
-  //Assumes that parent has grabbed the Mutex!
-  UDPDemuxerTask *GetTask(UInt32 inRemoteAddr, UInt16 inRemotePort);
+  /**
+   * @brief same, without waiting: the demuxer deletes the task on a later
+   * write, once no lookup can see it.
+   *
+   * @return OS_NoErr, or EPERM (the task is not deleted then).
+   */
+  OS_Error UnregisterAndDeleteTask(UInt32 inRemoteAddr, UInt16 inRemotePort,
+                                   UDPDemuxerTask *inTaskP);
+
+  // Returns when every ReadLock alive on the call has ended. Blocks only
+  // the caller, other writes go on meanwhile.
+  void Synchronize();
+
+  // Lock free, the task is valid while inLock is alive
+  UDPDemuxerTask *GetTask(const ReadLock &inLock,
+                          UInt32 inRemoteAddr, UInt16 inRemotePort);
 
   bool AddrInMap(UInt32 inRemoteAddr, UInt16 inRemotePort) {
-    return (this->GetTask(inRemoteAddr, inRemotePort) != nullptr);
+    ReadLock theLock(this);
+    return (this->GetTask(theLock, inRemoteAddr, inRemotePort) != nullptr);
   }
 
+  // serializes writers, lookups don't need it
   Core::Mutex *GetMutex() { return &fMutex; }
-  UDPDemuxerHashTable *GetHashTable() { return &fHashTable; }
+
+  UInt32 GetNumTasks() { return fNumTasks; }
+  UInt32 GetNumBuckets();
+
+#if UDPDEMUXER_TESTING
+  static bool Test();
+#endif
 
  private:
 
   enum {
-    kMaxHashTableSize = 2747//is this prime? it should be... //UInt32
+    kInitialNumBuckets = 4096,      // UInt32, power of 2
+    kMaxLoadFactor = 2,             // UInt32, tasks per bucket
+    kMigrateBucketsPerWrite = 16,   // UInt32
+    kNumReaderSlots = 32,           // UInt32, threads share them beyond
+    kCacheLineSize = 64             // UInt32
+  };
+
+  // the key is copied, a lookup walking past an entry never touches its task
+  struct Entry {
+    UDPDemuxerTask *fTask;
+    UInt32 fHashValue;
+    UInt32 fRemoteAddr;
+    UInt16 fRemotePort;
+    std::atomic<Entry *> fNext;
+  };
+
+  struct Table {
+    explicit Table(UInt32 inNumBuckets);
+    ~Table();
+
+    UInt32 fMask;
+    std::atomic<Entry *> *fBuckets;
+  };
+
+  // what lookups see: the current table, and the one being drained into it
+  struct Snapshot {
+    Table *fTable;
+    Table *fOldTable;
+  };
+
+  // what one write unlinked, freed when no lookup can see it any more
+  struct Retired {
+    Retired *fNext;
+    UInt32 fEpoch;            // fEpoch when it was unlinked
+    Entry *fEntries[2];
+    Table *fTable;
+    Snapshot *fSnapshot;
+    UDPDemuxerTask *fTask;
+  };
+
+  // lookups in progress of each epoch parity. Padded to two cache lines:
+  // the demuxer is only as aligned as new makes it, yet no two slots'
+  // counters share a line.
+  struct ReaderSlot {
+    std::atomic<UInt32> fCount[2];
+    char fPad[2 * kCacheLineSize - 2 * sizeof(std::atomic<UInt32>)];
   };
-  UDPDemuxerHashTable fHashTable;
-  Core::Mutex fMutex;//this data structure is shared!
+
+  static Entry *find(Table *inTable, UInt32 inHashValue,
+                     UInt32 inRemoteAddr, UInt16 inRemotePort);
+  static Entry *unlink(Table *inTable, UDPDemuxerTask *inTaskP);
+  static void link(Table *inTable, UDPDemuxerTask *inTaskP);
+
+  // lookup for writers, fMutex keeps what it finds alive
+  UDPDemuxerTask *lookup(UInt32 inRemoteAddr, UInt16 inRemotePort);
+
+  static UInt32 readerSlot();
+  UInt32 enterRead(UInt32 inSlot);
+  void exitRead(UInt32 inSlot, UInt32 inEpoch) {
+    fReaders[inSlot].fCount[inEpoch & 1]--;
+  }
+  bool hasReaders(UInt32 inEpoch);
+
+  // unlinks inTaskP, with inDeleteTask it is deleted once unseen
+  OS_Error unregister(UInt32 inRemoteAddr, UInt16 inRemotePort,
+                      UDPDemuxerTask *inTaskP, bool inDeleteTask);
+
+  // with fMutex held
+  Retired *retire();
+  void reclaim(bool inAdvance);
+
+  void grow();
+  void migrate(UInt32 inNumBuckets);
+
+  std::atomic<Snapshot *> fSnapshot;
+
+  std::atomic<UInt32> fEpoch;
+  ReaderSlot fReaders[kNumReaderSlots];
+
+  // writer side
+  std::atomic<UInt32> fNumTasks;
+  UInt32 fMigratePos;   // next bucket of fOldTable to copy
+  Retired *fRetiredHead;  // oldest first
+  Retired *fRetiredTail;
+  Core::Mutex fMutex;
 };
 
 } // namespace Net
@@ -0,0 +1,182 @@
+/**
+ * @file UDPPacer.h
+ *
+ * Paced UDP output. Each flow has a token bucket (rate + burst); one pacer
+ * thread wakes on a CLOCK_MONOTONIC timer with microsecond precision,
+ * collects whatever every flow may send by then and hands it to the kernel
+ * in sendmmsg batches. A frame queued at once leaves spread over its
+ * frame interval instead of as a line-rate burst.
+ *
+ * Task timers are not used: they have millisecond resolution and a 10ms
+ * floor (see TaskThread::WaitForTask), far too coarse for pacing.
+ *
+ * With UseTxTime, packets are given a departure time (SO_TXTIME) up to
+ * kTxTimeHorizonUsec ahead and the fq / etf qdisc releases them, so the
+ * thread only wakes once per horizon.
+ */
+
+#ifndef __UDP_PACER_H__
+#define __UDP_PACER_H__
+
+#include <CF/BufferPool.h>
+#include <CF/Queue.h>
+#include <CF/Core/Cond.h>
+#include <CF/Core/Mutex.h>
+#include <CF/Core/Thread.h>
+#include <CF/Net/Socket/UDPSocket.h>
+#include <CF/Net/Socket/UDPRelay.h>
+
+#define UDPPACER_TESTING 0
+
+namespace CF {
+namespace Net {
+
+class UDPPacedFlow {
+ public:
+
+  UInt32 GetRemoteAddr() { return fRemoteAddr; }
+  UInt16 GetRemotePort() { return fRemotePort; }
+  UInt64 GetBitsPerSec() { return fBytesPerSec * 8; }
+
+  UInt64 GetNumPacketsSent() { return fNumPacketsSent; }
+  UInt64 GetNumBytesSent() { return fNumBytesSent; }
+  // Send calls refused because the queue was full
+  UInt64 GetNumPacketsRefused() { return fNumPacketsRefused; }
+  UInt32 GetNumQueued() { return fNumQueued; }
+
+ private:
+
+  enum {
+    kMaxQueuedPackets = 1024  // UInt32
+  };
+
+  UDPPacedFlow(UInt32 inRemoteAddr, UInt16 inRemotePort);
+  ~UDPPacedFlow();
+
+  void setRate(UInt64 inBitsPerSec, UInt32 inBurstBytes, UInt32 inMaxBurstUsec,
+               UInt64 inNow);
+  void refill(UInt64 inNow);
+
+  RelayPacket *peek(UInt32 inIndex) {
+    return fQueue[(fQueueHead + inIndex) % kMaxQueuedPackets];
+  }
+  void dequeue();
+
+  UInt32 fRemoteAddr;
+  UInt16 fRemotePort;
+
+  // token bucket, in bytes * 10^9 so that refills are exact in nanoseconds
+  UInt64 fBytesPerSec;
+  UInt32 fBurstBytes;   // as asked, fBurst may be less (SetMaxBurst)
+  SInt64 fBurst;
+  SInt64 fTokens;
+  UInt64 fLastRefill;
+
+  // SO_TXTIME mode: when the next packet may leave
+  UInt64 fNextTxTime;
+
+  RelayPacket *fQueue[kMaxQueuedPackets];
+  UInt32 fQueueHead;
+  UInt32 fNumQueued;
+  UInt32 fNumInBatch;   // queued packets already in the batch being built
+
+  UInt64 fNumPacketsSent;
+  UInt64 fNumBytesSent;
+  UInt64 fNumPacketsRefused;
+
+  QueueElem fElem;
+
+  friend class UDPPacer;
+};
+
+class UDPPacer : public Core::Thread {
+ public:
+
+  /**
+   * @param inSocket - socket the flows are sent from, non-blocking;
+   *                   not owned.
+   * @param inPool   - buffers for Send calls that copy, not owned.
+   *
+   * Call Start() to run the pacer thread.
+   */
+  UDPPacer(UDPSocket *inSocket, BufferPool *inPool);
+  ~UDPPacer() override;
+
+  /**
+   * @brief departure times go to the kernel through SO_TXTIME.
+   *
+   * @return ENOTSUP if the socket can't, the pacer keeps its own timer.
+   */
+  OS_Error UseTxTime();
+
+  /**
+   * @brief cap every flow's burst at what its rate sends in inUsec.
+   *
+   * A burst only builds up while a flow has nothing queued, and 20 flows
+   * that all start on a full bucket leave together. The default,
+   * kDefaultMaxBurstUsec, is one tick, so no flow sends more in a tick
+   * than it does when smooth. 0 leaves the bursts as the flows ask.
+   *
+   * A flow whose capped burst is smaller than a packet still sends it
+   * from a full bucket, and waits for the tokens it borrowed.
+   */
+  void SetMaxBurst(UInt32 inUsec);
+
+  //
+  // Flows, thread safe
+
+  UDPPacedFlow *AddFlow(UInt32 inRemoteAddr, UInt16 inRemotePort,
+                        UInt64 inBitsPerSec, UInt32 inBurstBytes);
+  void SetFlowRate(UDPPacedFlow *inFlow, UInt64 inBitsPerSec, UInt32 inBurstBytes);
+  // Drops what is still queued
+  void RemoveFlow(UDPPacedFlow *inFlow);
+
+  /**
+   * @brief queue a packet on inFlow.
+   *
+   * The shared packet gets a reference, the data one is copied.
+   *
+   * @return OS_NoErr, or EAGAIN when the flow has kMaxQueuedPackets
+   *         waiting (the producer is faster than the rate).
+   */
+  OS_Error Send(UDPPacedFlow *inFlow, RelayPacket *inPacket);
+  OS_Error Send(UDPPacedFlow *inFlow, void *inData, UInt32 inLength);
+
+  void Entry() override;
+
+  // CLOCK_MONOTONIC, what SO_TXTIME wants
+  static UInt64 NowNanos();
+
+#if UDPPACER_TESTING
+  static bool Test();
+#endif
+
+ private:
+
+  enum {
+    kSlackUsec = 200,             // UInt32, may leave this much early, to batch
+    kMaxSleepUsec = 1000,         // UInt32, while packets wait
+    kIdleWaitMsec = 100,          // UInt32, while nothing is queued
+    kTxTimeHorizonUsec = 5000,    // UInt32
+    kDefaultMaxBurstUsec = kMaxSleepUsec  // UInt32, one tick
+  };
+
+  // send what is due, return when to look again (0: nothing queued)
+  UInt64 sendDue(UInt64 inNow);
+  UInt32 sendBatch(UDPPacket *inPackets, UDPPacedFlow **inOwners, UInt32 inCount);
+
+  UDPSocket *fSocket;
+  BufferPool *fPool;
+  bool fUseTxTime;
+  UInt32 fMaxBurstUsec;
+
+  Queue fFlows;
+  Core::Mutex fMutex;
+  Core::Cond fCond;   // signaled when an idle pacer gets work
+  bool fIdle;
+};
+
+} // namespace Net
+} // namespace CF
+
+#endif // __UDP_PACER_H__
@@ -0,0 +1,182 @@
+/**
+ * @file UDPRelay.h
+ *
+ * One incoming UDP stream (unicast, or a multicast group joined on the
+ * receive socket) fanned out to a set of subscribers.
+ *
+ * Received datagrams land in RelayPackets, BufferPool buffers with a
+ * reference count, and every subscriber queues a reference instead of a
+ * copy. Flush sends the queues with sendmmsg (UDPSocket::SendMany). When
+ * the send socket is full the rest stays queued, and a subscriber whose
+ * queue overflows drops its oldest packets, so one slow peer never holds
+ * back the others or grows memory.
+ */
+
+#ifndef __UDP_RELAY_H__
+#define __UDP_RELAY_H__
+
+#include <atomic>
+#include <CF/BufferPool.h>
+#include <CF/Queue.h>
+#include <CF/Core/Mutex.h>
+#include <CF/Net/Socket/UDPSocket.h>
+
+#define UDPRELAY_TESTING 0
+
+namespace CF {
+namespace Net {
+
+/**
+ * @brief a datagram shared by many subscribers.
+ *
+ * Lives at the front of its own BufferPool buffer, the payload follows.
+ * The buffer goes back to the pool with the last Release.
+ */
+class RelayPacket {
+ public:
+
+  // Returns nullptr if pool buffers are too small to hold any payload
+  static RelayPacket *Create(BufferPool *inPool);
+
+  void AddRef() { ++fRefCount; }
+  void Release();
+
+  char *GetData() { return reinterpret_cast<char *>(this + 1); }
+  UInt32 GetCapacity() { return fCapacity; }
+  UInt32 GetLength() { return fLength; }
+  void SetLength(UInt32 inLength) { fLength = inLength; }
+
+ private:
+
+  RelayPacket(BufferPool *inPool, UInt32 inCapacity)
+      : fRefCount(1), fPool(inPool), fCapacity(inCapacity), fLength(0) {}
+
+  std::atomic<UInt32> fRefCount;
+  BufferPool *fPool;
+  UInt32 fCapacity;
+  UInt32 fLength;
+};
+
+class UDPRelaySubscriber {
+ public:
+
+  UInt32 GetRemoteAddr() { return fRemoteAddr; }
+  UInt16 GetRemotePort() { return fRemotePort; }
+
+  //
+  // Accounting
+
+  UInt64 GetNumPacketsSent() { return fNumPacketsSent; }
+  UInt64 GetNumBytesSent() { return fNumBytesSent; }
+  // oldest packets thrown away because the queue was full
+  UInt64 GetNumPacketsDropped() { return fNumPacketsDropped; }
+  // sends refused by the kernel for this destination (ICMP errors, ...)
+  UInt64 GetNumSendErrors() { return fNumSendErrors; }
+  // flushes that ended with packets still queued for this subscriber
+  UInt64 GetNumBackpressured() { return fNumBackpressured; }
+  UInt32 GetNumQueued() { return fNumQueued; }
+
+ private:
+
+  enum {
+    kMaxQueuedPackets = 256 // UInt32
+  };
+
+  UDPRelaySubscriber(UInt32 inRemoteAddr, UInt16 inRemotePort);
+  ~UDPRelaySubscriber();
+
+  void enqueue(RelayPacket *inPacket);
+  RelayPacket *peek(UInt32 inIndex) {
+    return fQueue[(fQueueHead + inIndex) % kMaxQueuedPackets];
+  }
+  void dequeue();
+
+  UInt32 fRemoteAddr;
+  UInt16 fRemotePort;
+
+  // ring of shared packets waiting to be sent
+  RelayPacket *fQueue[kMaxQueuedPackets];
+  UInt32 fQueueHead;
+  UInt32 fNumQueued;
+
+  UInt64 fNumPacketsSent;
+  UInt64 fNumBytesSent;
+  UInt64 fNumPacketsDropped;
+  UInt64 fNumSendErrors;
+  UInt64 fNumBackpressured;
+
+  QueueElem fElem;
+
+  friend class UDPRelay;
+};
+
+class UDPRelay {
+ public:
+
+  /**
+   * @param inSendSocket - socket all subscribers are sent from, preferably
+   *                       non-blocking; not owned.
+   * @param inPool       - buffers for received packets, not owned.
+   */
+  UDPRelay(UDPSocket *inSendSocket, BufferPool *inPool);
+  ~UDPRelay();
+
+  //
+  // Subscriber set, thread safe
+
+  UDPRelaySubscriber *AddSubscriber(UInt32 inRemoteAddr, UInt16 inRemotePort);
+  void RemoveSubscriber(UDPRelaySubscriber *inSubscriber);
+  UInt32 GetNumSubscribers() { return fSubscribers.GetLength(); }
+
+  /**
+   * @brief read everything inSocket has and relay it.
+   *
+   * Call on kReadEvent of the receive socket.
+   *
+   * @return OS_NoErr, or EAGAIN when packets are left queued: request
+   *         EV_WR on the send socket and call Flush on kWriteEvent.
+   */
+  OS_Error RelayFrom(UDPSocket *inSocket, UInt32 *outNumPackets);
+
+  /**
+   * @brief queue inPacket for every subscriber, without sending.
+   *
+   * Adds one reference per subscriber, the caller keeps its own.
+   */
+  void Push(RelayPacket *inPacket);
+
+  /**
+   * @brief send what the subscribers have queued.
+   *
+   * @return OS_NoErr when every queue is empty, EAGAIN when the send
+   *         socket is flow controlled.
+   */
+  OS_Error Flush();
+
+  UInt64 GetNumPacketsReceived() { return fNumPacketsReceived; }
+
+#if UDPRELAY_TESTING
+  static bool Test();
+#endif
+
+ private:
+
+  OS_Error flush();
+
+  UDPSocket *fSendSocket;
+  BufferPool *fPool;
+
+  Queue fSubscribers;
+  Core::Mutex fMutex;
+
+  // receive buffers not filled by the last RelayFrom, kept for the next
+  RelayPacket *fSpare[UDPPacketBatch::kMaxPackets];
+  UInt32 fNumSpare;
+
+  UInt64 fNumPacketsReceived;
+};
+
+} // namespace Net
+} // namespace CF
+
+#endif // __UDP_RELAY_H__
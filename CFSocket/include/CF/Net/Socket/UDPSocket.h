@@ -45,9 +45,74 @@
 
 #endif
 
+#define UDPSOCKET_TESTING 0
+
 namespace CF {
 namespace Net {
 
+/**
+ * @brief one datagram of a RecvMany / SendMany batch
+ */
+struct UDPPacket {
+  void *fBuffer;
+  UInt32 fBufferLen;    // capacity of fBuffer
+  UInt32 fLength;       // bytes of payload
+  UInt32 fRemoteAddr;   // host order, source on receive, destination on send
+  UInt16 fRemotePort;   // host order
+
+  // GSO / GRO: when not 0, fBuffer holds several datagrams of fSegmentSize
+  // bytes back to back (the last one may be shorter), all from / to the
+  // same peer. 0 means one datagram.
+  UInt16 fSegmentSize;
+
+  // SO_TXTIME departure time, CLOCK_MONOTONIC nanoseconds, 0 means now.
+  // Only looked at once EnableTxTime succeeded.
+  UInt64 fTxTime;
+
+  UInt32 GetNumSegments() const {
+    if (fSegmentSize == 0 || fLength <= fSegmentSize) return 1;
+    return (fLength + fSegmentSize - 1) / fSegmentSize;
+  }
+
+  void GetSegment(UInt32 index, StrPtrLen *outSegment) const {
+    UInt32 theSize = (fSegmentSize == 0) ? fLength : fSegmentSize;
+    UInt32 theOffset = index * theSize;
+    UInt32 theLen = (fLength - theOffset < theSize) ? fLength - theOffset : theSize;
+    outSegment->Set((char *) fBuffer + theOffset, theLen);
+  }
+};
+
+/**
+ * @brief a batch of UDPPacket whose buffers come from a BufferPool
+ *
+ * Buffers are taken from the pool on construction and given back on
+ * destruction, so a receive loop can keep one batch and reuse it for every
+ * RecvMany call.
+ */
+class UDPPacketBatch {
+ public:
+  enum {
+    kMaxPackets = 64  // UInt32
+  };
+
+  UDPPacketBatch(BufferPool *inPool, UInt32 inNumPackets = kMaxPackets);
+  ~UDPPacketBatch();
+
+  UDPPacket *GetPackets() { return fPackets; }
+  UDPPacket &GetPacket(UInt32 index) { return fPackets[index]; }
+  UInt32 GetCapacity() { return fCapacity; }
+
+  // number of packets received into / to be sent from this batch
+  UInt32 GetNumPackets() { return fNumPackets; }
+  void SetNumPackets(UInt32 inNum) { fNumPackets = inNum; }
+
+ private:
+  BufferPool *fPool;
+  UDPPacket fPackets[kMaxPackets];
+  UInt32 fCapacity;
+  UInt32 fNumPackets;
+};
+
 /*
  * Socket 的继承类,Socket 是 EventContext 的继承类。注意在 Socket 的构建函数里,调用了
  * EventContext 的 SetTask 函数,将传入的 intask 参数付给 EventContext 的 fTask 成员。
@@ -83,6 +148,75 @@ class UDPSocket : public Socket {
   OS_Error RecvFrom(UInt32 *outRemoteAddr, UInt16 *outRemotePort,
                     void *ioBuffer, UInt32 inBufLen, UInt32 *outRecvLen);
 
+  /**
+   * RecvMany - receives up to inNumPackets datagrams with one system call
+   * (recvmmsg), each into its packet's buffer, with its own source address.
+   *
+   * @return OS_NoErr if at least one packet was received, EAGAIN if none
+   *         was waiting, or POSIX error code.
+   */
+  OS_Error RecvMany(UDPPacket *ioPackets, UInt32 inNumPackets,
+                    UInt32 *outNumRecv);
+  OS_Error RecvMany(UDPPacketBatch *ioBatch);
+
+  /**
+   * SendMany - sends inNumPackets datagrams, each to its own destination,
+   * with one system call (sendmmsg).
+   *
+   * A segmented packet the kernel can't take in one send goes out one
+   * segment at a time. It counts as sent once its first segment is out:
+   * the segments the Socket buffer has no room for are lost, as the tail
+   * of a datagram would be, and a retry would only send the head twice.
+   *
+   * @return OS_NoErr if at least one packet was sent, *outNumSent may be
+   *         less than inNumPackets when the Socket buffer is full.
+   */
+  OS_Error SendMany(UDPPacket *inPackets, UInt32 inNumPackets,
+                    UInt32 *outNumSent);
+  OS_Error SendMany(UDPPacketBatch *inBatch, UInt32 *outNumSent);
+
+  //
+  // UDP segmentation offload (Linux UDP_SEGMENT / UDP_GRO).
+  //
+  // GSO: a packet with fSegmentSize set is handed to the kernel as one
+  // buffer and leaves as fLength / fSegmentSize datagrams. Without kernel
+  // support (or with it disabled) the segments are sent with sendmmsg.
+  //
+  // GRO: the kernel merges datagrams of one flow, RecvMany fills
+  // fSegmentSize. Buffers should be 64K to hold a merged packet. GRO only
+  // merges datagrams from the same peer, so one demuxer lookup per packet
+  // (DemuxPacket) routes every segment in it.
+
+  enum {
+    kMaxSegments = 64,                // UInt32, kernel UDP_MAX_SEGMENTS
+    kMaxSegmentedLength = 65000       // UInt32, payload of one GSO send
+  };
+
+  // Return ENOTSUP when the kernel doesn't know the option
+  OS_Error EnableGSO();
+  OS_Error EnableGRO();
+  bool IsGSOEnabled() { return (fState & kGSOEnabled) != 0; }
+  bool IsGROEnabled() { return (fState & kGROEnabled) != 0; }
+
+  // Lets SendMany hand fTxTime to the kernel (SO_TXTIME). Packets are
+  // held until then only by the fq or etf qdisc, other qdiscs send at once.
+  OS_Error EnableTxTime();
+  bool IsTxTimeEnabled() { return (fState & kTxTimeEnabled) != 0; }
+
+  OS_Error SendSegmented(UInt32 inRemoteAddr, UInt16 inRemotePort,
+                         void *inBuffer, UInt32 inLength,
+                         UInt16 inSegmentSize);
+
+  // Finds the task registered in the demuxer for the packet's peer, lock
+  // free. The task is valid while inLock (taken on GetDemuxer()) is alive.
+  UDPDemuxerTask *DemuxPacket(const UDPDemuxer::ReadLock &inLock,
+                              const UDPPacket &inPacket);
+
+#if UDPSOCKET_TESTING
+  // packets-per-second of RecvFrom/SendTo vs RecvMany/SendMany on loopback
+  static bool Test();
+#endif
+
   //A UDP Socket may or may not have a demuxer associated with it. The demuxer
   //is a data structure so the Socket can associate incoming data with the proper
   //task to process that data (based on source IP addr & port)
@@ -90,6 +224,17 @@ class UDPSocket : public Socket {
 
  private:
 
+  enum {
+    kGSOEnabled = 0x0200U,  // UInt32
+    kGROEnabled = 0x0400U,  // UInt32
+    kTxTimeEnabled = 0x0800U  // UInt32
+  };
+
+  bool canSendSegmented(const UDPPacket &inPacket);
+
+  // sends each segment as its own datagram, OS_NoErr once one went out
+  OS_Error sendSegmentsOneByOne(const UDPPacket &inPacket);
+
   UDPDemuxer *fDemuxer;
   struct sockaddr_in fMsgAddr;
 };
@@ -32,6 +32,7 @@
 #ifndef __UDPSOCKETPOOL_H__
 #define __UDPSOCKETPOOL_H__
 
+#include <unordered_map>
 #include <CF/Net/Socket/UDPDemuxer.h>
 #include <CF/Net/Socket/UDPSocket.h>
 #include <CF/Core/Mutex.h>
@@ -46,7 +47,7 @@ class UDPSocketPool {
  public:
 
   UDPSocketPool() : fMutex() {}
-  virtual ~UDPSocketPool() = default;
+  virtual ~UDPSocketPool();
 
   //Skanky access to member data
   Core::Mutex *GetMutex() { return &fMutex; }
@@ -85,7 +86,55 @@ class UDPSocketPool {
     kHighestUDPPort = 65535 //UInt16
   };
 
+  /**
+   * @brief free port pairs of one local address.
+   *
+   * One bit per even port from kLowestUDPPort, set while we own the pair
+   * or while someone else holds one of its ports (bind failed). Allocate
+   * scans 64 pairs per word from where the last one was found.
+   */
+  class PortBitmap {
+   public:
+    PortBitmap();
+
+    // Return the first port of a free pair, or 0 if all are taken
+    UInt16 Allocate();
+    void Free(UInt16 inPort);
+    void SetUsed(UInt16 inPort);
+    // Bind failed, skip the pair until we run out of ports
+    void SetBlocked(UInt16 inPort);
+
+   private:
+
+    enum {
+      kNumPairs = (kHighestUDPPort - kLowestUDPPort + 1) / 2,  // UInt32
+      kNumWords = (kNumPairs + 63) / 64                        // UInt32
+    };
+
+    static bool getSlot(UInt16 inPort, UInt32 *outSlot);
+    UInt16 scan();
+
+    UInt64 fUsed[kNumWords];
+    UInt64 fBlocked[kNumWords];
+    UInt32 fCursor;   // word to start the next scan at
+  };
+
+  // every pair bound on one local address
+  struct LocalAddr {
+    PortBitmap fPorts;
+    std::unordered_map<UInt16, UDPSocketPair *> fPairsByPort;
+
+    // pairs whose demuxer may take another source. Pairs found with the
+    // wildcard (0, 0) registered leave it until they are released again.
+    Queue fShareable;
+  };
+
+  LocalAddr *getLocalAddr(UInt32 inAddr);
+  bool canShare(UDPSocketPair *inPair, UInt32 inSrcIPAddr, UInt16 inSrcPort);
+  void addPair(UDPSocketPair *inPair, UInt32 inAddr, UInt16 inPort);
+
   Queue fUDPQueue;
+  std::unordered_map<UInt32, LocalAddr *> fLocalAddrs;
   Core::Mutex fMutex;
 };
 
@@ -93,8 +142,10 @@ class UDPSocketPair {
  public:
 
   UDPSocketPair(UDPSocket *inSocketA, UDPSocket *inSocketB)
-      : fSocketA(inSocketA), fSocketB(inSocketB), fRefCount(0), fElem() {
+      : fSocketA(inSocketA), fSocketB(inSocketB), fRefCount(0), fElem(),
+        fLocalAddr(0), fLocalPort(0), fShareElem() {
     fElem.SetEnclosingObject(this);
+    fShareElem.SetEnclosingObject(this);
   }
   ~UDPSocketPair() = default;
 
@@ -108,6 +159,11 @@ class UDPSocketPair {
   UInt32 fRefCount;
   QueueElem fElem;
 
+  // where the pool keeps it
+  UInt32 fLocalAddr;
+  UInt16 fLocalPort;
+  QueueElem fShareElem;
+
   friend class UDPSocketPool;
 };
 
@@ -481,6 +481,13 @@ TaskThread *TaskThreadPool::GetThread(UInt32 index) {
   return sTaskThreadArray[index];
 }
 
+UInt32 TaskThreadPool::GetNumQueuedTasks() {
+  UInt32 numQueued = 0;
+  for (UInt32 x = 0; x < sNumTaskThreads; x++)
+    numQueued += sTaskThreadArray[x]->fTaskQueue.GetQueue()->GetLength();
+  return numQueued;
+}
+
 void TaskThreadPool::RemoveThreads() {
   // Tell all the threads to stop
   for (UInt32 x = 0; x < sNumTaskThreads; x++)
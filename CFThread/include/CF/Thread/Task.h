@@ -247,6 +247,14 @@ class TaskThreadPool {
 
   static UInt32 GetNumThreads() { return sNumTaskThreads; }
 
+  /**
+   * @brief number of tasks waiting in all task thread queues
+   *
+   * Lengths are read without taking the queue locks, so the result is only
+   * an estimate. It is meant for load checks, not for exact accounting.
+   */
+  static UInt32 GetNumQueuedTasks();
+
  private:
   TaskThreadPool() = default;
 
@@ -15,9 +15,9 @@ class MyConfig : public CFConfigure, public Net::HTTPConfigure {
 
   HTTPMapping *GetHttpMapping() override {
     static HTTPMapping defaultHttpMapping[] = {
-        {"/exit", (CF_CGIFunction) DefaultExitCGI},
-        {"/", (CF_CGIFunction) DefaultCGI},
-        {NULL, NULL}
+        {"/exit", (CF_CGIFunction) DefaultExitCGI, nullptr, nullptr},
+        {"/", (CF_CGIFunction) DefaultCGI, nullptr, nullptr},
+        {NULL, NULL, NULL, NULL}
     };
     return defaultHttpMapping;
   }